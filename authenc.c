@@ -41,8 +41,11 @@
 #include <crypto/cryptodev.h>
 #include <crypto/scatterwalk.h>
 #include <linux/scatterlist.h>
+#include <asm/unaligned.h>
 #include "cryptodev_int.h"
 #include "zc.h"
+#include "stats.h"
+#include "cryptodev_trace.h"
 #include "util.h"
 #include "cryptlib.h"
 #include "version.h"
@@ -56,6 +59,7 @@ static int get_userbuf_tls(struct csession *ses, struct kernel_crypt_auth_op *kc
 {
 	int pagecount = 0;
 	struct crypt_auth_op *caop = &kcaop->caop;
+	struct zc_pages *zc = &ses->scratch->zc;
 	int rc;
 
 	if (caop->dst == NULL)
@@ -74,21 +78,56 @@ static int get_userbuf_tls(struct csession *ses, struct kernel_crypt_auth_op *kc
 
 	pagecount = PAGECOUNT(caop->dst, kcaop->dst_len);
 
-	ses->used_pages = pagecount;
-	ses->readonly_pages = 0;
+	zc->used_pages = pagecount;
+	zc->readonly_pages = 0;
 
-	rc = adjust_sg_array(ses, pagecount);
+	rc = adjust_sg_array(zc, pagecount);
 	if (rc)
 		return rc;
 
 	rc = __get_userbuf(caop->dst, kcaop->dst_len, 1, pagecount,
-	                   ses->pages, ses->sg, kcaop->task, kcaop->mm);
+	                   zc->pages, zc->sg, kcaop->task, kcaop->mm);
 	if (unlikely(rc)) {
 		derr(1, "failed to get user pages for data input");
 		return -EINVAL;
 	}
 
-	(*dst_sg) = ses->sg;
+	(*dst_sg) = zc->sg;
+
+	return 0;
+}
+
+
+/* Makes caop->auth_src available as scatterlist, in the pages of
+ * ses->scratch->aad_zc, for associated data too large to be copied.
+ */
+static int get_userbuf_aad(struct csession *ses, struct kernel_crypt_auth_op *kcaop,
+			struct scatterlist **auth_sg)
+{
+	struct crypt_auth_op *caop = &kcaop->caop;
+	struct zc_pages *zc = &ses->scratch->aad_zc;
+	int pagecount, rc;
+
+	pagecount = PAGECOUNT(caop->auth_src, caop->auth_len);
+
+	if (zc->array_size == 0)
+		rc = zc_pages_init(zc, pagecount);
+	else if (zc->array_size < pagecount)
+		rc = adjust_sg_array(zc, pagecount);
+	else
+		rc = 0;
+	if (unlikely(rc))
+		return rc;
+
+	rc = __get_userbuf(caop->auth_src, caop->auth_len, 0, pagecount,
+			   zc->pages, zc->sg, kcaop->task, kcaop->mm);
+	if (unlikely(rc)) {
+		derr(1, "failed to get user pages for auth data");
+		return rc;
+	}
+
+	zc->used_pages = zc->readonly_pages = pagecount;
+	*auth_sg = zc->sg;
 
 	return 0;
 }
@@ -108,6 +147,7 @@ static int get_userbuf_srtp(struct csession *ses, struct kernel_crypt_auth_op *k
 	int pagecount, diff;
 	int auth_pagecount = 0;
 	struct crypt_auth_op *caop = &kcaop->caop;
+	struct zc_pages *zc = &ses->scratch->zc;
 	int rc;
 
 	if (caop->dst == NULL && caop->auth_src == NULL) {
@@ -141,30 +181,30 @@ static int get_userbuf_srtp(struct csession *ses, struct kernel_crypt_auth_op *k
 
 	pagecount = auth_pagecount;
 
-	rc = adjust_sg_array(ses, pagecount*2); /* double pages to have pages for dst(=auth_src) */
+	rc = adjust_sg_array(zc, pagecount*2); /* double pages to have pages for dst(=auth_src) */
 	if (rc) {
 		derr(1, "cannot adjust sg array");
 		return rc;
 	}
 
 	rc = __get_userbuf(caop->auth_src, caop->auth_len, 1, auth_pagecount,
-			   ses->pages, ses->sg, kcaop->task, kcaop->mm);
+			   zc->pages, zc->sg, kcaop->task, kcaop->mm);
 	if (unlikely(rc)) {
 		derr(1, "failed to get user pages for data input");
 		return -EINVAL;
 	}
 
-	ses->used_pages = pagecount;
-	ses->readonly_pages = 0;
+	zc->used_pages = pagecount;
+	zc->readonly_pages = 0;
 
-	(*auth_sg) = ses->sg;
+	(*auth_sg) = zc->sg;
 
-	(*dst_sg) = ses->sg + auth_pagecount;
+	(*dst_sg) = zc->sg + auth_pagecount;
 	sg_init_table(*dst_sg, auth_pagecount);
-	sg_copy(ses->sg, (*dst_sg), caop->auth_len);
+	sg_copy(zc->sg, (*dst_sg), caop->auth_len);
 	(*dst_sg) = sg_advance(*dst_sg, diff);
 	if (*dst_sg == NULL) {
-		release_user_pages(ses);
+		release_user_pages(zc);
 		derr(1, "failed to get enough pages for auth data");
 		return -EINVAL;
 	}
@@ -208,24 +248,17 @@ static int cryptodev_get_dst_len(struct crypt_auth_op *caop, struct csession *se
 	return dst_len;
 }
 
-static int fill_kcaop_from_caop(struct kernel_crypt_auth_op *kcaop, struct fcrypt *fcr)
+/* Fill in kcaop from its caop, for an already looked up (and locked) session */
+int __fill_kcaop_from_caop(struct kernel_crypt_auth_op *kcaop,
+			struct csession *ses_ptr)
 {
 	struct crypt_auth_op *caop = &kcaop->caop;
-	struct csession *ses_ptr;
 	int ret;
 
-	/* this also enters ses_ptr->sem */
-	ses_ptr = crypto_get_session_by_sid(fcr, caop->ses);
-	if (unlikely(!ses_ptr)) {
-		derr(1, "invalid session ID=0x%08X", caop->ses);
-		return -EINVAL;
-	}
-
 	if (caop->flags & COP_FLAG_AEAD_TLS_TYPE || caop->flags & COP_FLAG_AEAD_SRTP_TYPE) {
 		if (caop->src != caop->dst) {
 			derr(1, "Non-inplace encryption and decryption is not efficient and not implemented");
-			ret = -EINVAL;
-			goto out_unlock;
+			return -EINVAL;
 		}
 	}
 
@@ -234,34 +267,71 @@ static int fill_kcaop_from_caop(struct kernel_crypt_auth_op *kcaop, struct fcryp
 
 	kcaop->ivlen = caop->iv ? ses_ptr->cdata.ivsize : 0;
 	kcaop->dst_len = cryptodev_get_dst_len(caop, ses_ptr);
+	kcaop->iov = NULL;
 	kcaop->task = current;
 	kcaop->mm = current->mm;
 
-	if (caop->iv) {
+	kcaop->region[0] = kcaop->region[1] = 0;
+	if (caop->flags & COP_FLAG_REGION) {
+		kcaop->region_ptr[0] = caop->src;
+		kcaop->region_ptr[1] = caop->dst;
+		ret = crypto_region_resolve(ses_ptr->fcr, kcaop->mm, &caop->src,
+				caop->len, &kcaop->region[0]);
+		if (likely(!ret))
+			ret = crypto_region_resolve(ses_ptr->fcr, kcaop->mm,
+					&caop->dst, kcaop->dst_len,
+					&kcaop->region[1]);
+		if (unlikely(ret))
+			return ret;
+	}
+
+	if (ses_ptr->iv_mode) {
+		/* caop->iv is only written with the IV used */
+		kcaop->ivlen = ses_ptr->cdata.ivsize;
+		crypto_session_next_iv(ses_ptr, kcaop->iv, caop->len);
+	} else if (caop->iv) {
 		ret = copy_from_user(kcaop->iv, caop->iv, kcaop->ivlen);
 		if (unlikely(ret)) {
 			derr(1, "error copying IV (%d bytes), copy_from_user returned %d for address %p",
 					kcaop->ivlen, ret, caop->iv);
-			ret = -EFAULT;
-			goto out_unlock;
+			return -EFAULT;
 		}
 	}
 
-	ret = 0;
+	return 0;
+}
+
+int fill_kcaop_from_caop(struct kernel_crypt_auth_op *kcaop, struct fcrypt *fcr)
+{
+	struct crypt_auth_op *caop = &kcaop->caop;
+	struct csession *ses_ptr;
+	int ret;
+
+	/* this also enters ses_ptr->sem */
+	ses_ptr = crypto_get_session_by_sid(fcr, caop->ses);
+	if (unlikely(!ses_ptr)) {
+		derr(1, "invalid session ID=0x%08X", caop->ses);
+		return -EINVAL;
+	}
+
+	ret = __fill_kcaop_from_caop(kcaop, ses_ptr);
 
-out_unlock:
 	crypto_put_session(ses_ptr);
 	return ret;
-
 }
 
-static int fill_caop_from_kcaop(struct kernel_crypt_auth_op *kcaop, struct fcrypt *fcr)
+int fill_caop_from_kcaop(struct kernel_crypt_auth_op *kcaop, struct fcrypt *fcr)
 {
 	int ret;
 
 	kcaop->caop.len = kcaop->dst_len;
+	if (kcaop->caop.flags & COP_FLAG_REGION) {
+		kcaop->caop.src = kcaop->region_ptr[0];
+		kcaop->caop.dst = kcaop->region_ptr[1];
+	}
 
-	if (kcaop->ivlen && kcaop->caop.flags & COP_FLAG_WRITE_IV) {
+	if (kcaop->ivlen && kcaop->caop.iv &&
+	    kcaop->caop.flags & COP_FLAG_WRITE_IV) {
 		ret = copy_to_user(kcaop->caop.iv,
 				kcaop->iv, kcaop->ivlen);
 		if (unlikely(ret)) {
@@ -350,11 +420,13 @@ static int verify_tls_record_pad(struct scatterlist *dst_sg, int len, int block_
 
 /* Authenticate and encrypt the TLS way (also perform padding).
  * During decryption it verifies the pad and tag and returns -EBADMSG on error.
+ * If aad_len is not NULL, the length of the plaintext is written there
+ * (big endian) before the auth data are hashed.
  */
 static int
 tls_auth_n_crypt(struct csession *ses_ptr, struct kernel_crypt_auth_op *kcaop,
 		 struct scatterlist *auth_sg, uint32_t auth_len,
-		 struct scatterlist *dst_sg, uint32_t len)
+		 struct scatterlist *dst_sg, uint32_t len, uint8_t *aad_len)
 {
 	int ret, fail = 0;
 	struct crypt_auth_op *caop = &kcaop->caop;
@@ -365,6 +437,8 @@ tls_auth_n_crypt(struct csession *ses_ptr, struct kernel_crypt_auth_op *kcaop,
 	 */
 	if (caop->op == COP_ENCRYPT) {
 		if (ses_ptr->hdata.init != 0) {
+			if (aad_len)
+				put_unaligned_be16(len, aad_len);
 			if (auth_len > 0) {
 				ret = cryptodev_hash_update(&ses_ptr->hdata,
 								auth_sg, auth_len);
@@ -436,6 +510,8 @@ tls_auth_n_crypt(struct csession *ses_ptr, struct kernel_crypt_auth_op *kcaop,
 			read_tls_hash(dst_sg, len, vhash, caop->tag_len);
 			len -= caop->tag_len;
 
+			if (aad_len)
+				put_unaligned_be16(len, aad_len);
 			if (auth_len > 0) {
 				ret = cryptodev_hash_update(&ses_ptr->hdata,
 								auth_sg, auth_len);
@@ -460,7 +536,7 @@ tls_auth_n_crypt(struct csession *ses_ptr, struct kernel_crypt_auth_op *kcaop,
 				return ret;
 			}
 
-			if (memcmp(vhash, hash_output, caop->tag_len) != 0 || fail != 0) {
+			if (crypto_memneq(vhash, hash_output, caop->tag_len) || fail != 0) {
 				derr(2, "MAC verification failed (tag_len: %d)", caop->tag_len);
 				return -EBADMSG;
 			}
@@ -470,6 +546,59 @@ tls_auth_n_crypt(struct csession *ses_ptr, struct kernel_crypt_auth_op *kcaop,
 	return 0;
 }
 
+/* The same as tls_auth_n_crypt(), in a single pass of the session's
+ * tls10 AEAD. The transform pads, and verifies the pad and the tag.
+ */
+static int
+tls_aead_n_crypt(struct csession *ses_ptr, struct kernel_crypt_auth_op *kcaop,
+		 struct scatterlist *auth_sg, uint32_t auth_len,
+		 struct scatterlist *dst_sg, uint32_t len)
+{
+	struct cipher_data *tls = &ses_ptr->tls;
+	struct crypt_auth_op *caop = &kcaop->caop;
+	uint8_t pad_size;
+	int ret;
+
+	if (unlikely(caop->tag_len > cryptodev_cipher_get_tag_size(tls))) {
+		derr(0, "Illegal tag length: %d", caop->tag_len);
+		return -EINVAL;
+	}
+	cryptodev_cipher_set_tag_size(tls, caop->tag_len);
+
+	cryptodev_cipher_set_iv(tls, kcaop->iv, tls->ivsize);
+	cryptodev_cipher_auth(tls, auth_sg, auth_len);
+
+	if (caop->op == COP_ENCRYPT) {
+		ret = cryptodev_cipher_encrypt(tls, dst_sg, dst_sg, len);
+		if (unlikely(ret)) {
+			derr(0, "cryptodev_cipher_encrypt: %d", ret);
+			return ret;
+		}
+	} else {
+		if (unlikely(len < caop->tag_len + 1)) {
+			derr(1, "Illegal record length: %u", len);
+			return -EINVAL;
+		}
+
+		ret = cryptodev_cipher_decrypt(tls, dst_sg, dst_sg, len);
+		if (unlikely(ret)) {
+			derr(2, "cryptodev_cipher_decrypt: %d", ret);
+			return ret;
+		}
+
+		scatterwalk_map_and_copy(&pad_size, dst_sg, len - 1, 1, 0);
+		if (unlikely(pad_size + 1 + caop->tag_len > len))
+			return -EBADMSG;
+		kcaop->dst_len = len - pad_size - 1 - caop->tag_len;
+	}
+
+	/* the next record continues from the IV of the cipher */
+	cryptodev_cipher_get_iv(tls, kcaop->iv, tls->ivsize);
+	cryptodev_cipher_set_iv(&ses_ptr->cdata, kcaop->iv,
+				ses_ptr->cdata.ivsize);
+	return 0;
+}
+
 /* Authenticate and encrypt the SRTP way. During decryption
  * it verifies the tag and returns -EBADMSG on error.
  */
@@ -538,7 +667,7 @@ srtp_auth_n_crypt(struct csession *ses_ptr, struct kernel_crypt_auth_op *kcaop,
 				return ret;
 			}
 
-			if (memcmp(vhash, hash_output, caop->tag_len) != 0 || fail != 0) {
+			if (crypto_memneq(vhash, hash_output, caop->tag_len) || fail != 0) {
 				derr(2, "MAC verification failed");
 				return -EBADMSG;
 			}
@@ -615,6 +744,7 @@ __crypto_auth_run_zc(struct csession *ses_ptr, struct kernel_crypt_auth_op *kcao
 {
 	struct scatterlist *dst_sg, *auth_sg, *src_sg;
 	struct crypt_auth_op *caop = &kcaop->caop;
+	struct zc_pages *zc = &ses_ptr->scratch->zc;
 	int ret = 0;
 
 	if (caop->flags & COP_FLAG_AEAD_SRTP_TYPE) {
@@ -634,33 +764,24 @@ __crypto_auth_run_zc(struct csession *ses_ptr, struct kernel_crypt_auth_op *kcao
 		ret = srtp_auth_n_crypt(ses_ptr, kcaop, auth_sg, caop->auth_len,
 			   dst_sg, caop->len);
 
-		release_user_pages(ses_ptr);
+		release_user_pages(zc);
 	} else { /* TLS and normal cases. Here auth data are usually small
-	          * so we just copy them to a free page, instead of trying
-	          * to map them.
+	          * so we just copy them to the session, and only map
+	          * them when they are not.
 	          */
-		unsigned char *auth_buf = NULL;
 		struct scatterlist tmp;
 
-		if (unlikely(caop->auth_len > PAGE_SIZE)) {
-			derr(1, "auth data len is excessive.");
-			return -EINVAL;
-		}
-
-		auth_buf = (char *)__get_free_page(GFP_KERNEL);
-		if (unlikely(!auth_buf)) {
-			derr(1, "unable to get a free page.");
-			return -ENOMEM;
-		}
-
-		if (caop->auth_src && caop->auth_len > 0) {
-			if (unlikely(copy_from_user(auth_buf, caop->auth_src, caop->auth_len))) {
+		if (caop->auth_src && caop->auth_len > sizeof(ses_ptr->aad)) {
+			ret = get_userbuf_aad(ses_ptr, kcaop, &auth_sg);
+			if (unlikely(ret))
+				return ret;
+		} else if (caop->auth_src && caop->auth_len > 0) {
+			if (unlikely(copy_from_user(ses_ptr->aad, caop->auth_src, caop->auth_len))) {
 				derr(1, "unable to copy auth data from userspace.");
-				ret = -EFAULT;
-				goto free_auth_buf;
+				return -EFAULT;
 			}
 
-			sg_init_one(&tmp, auth_buf, caop->auth_len);
+			sg_init_one(&tmp, ses_ptr->aad, caop->auth_len);
 			auth_sg = &tmp;
 		} else {
 			auth_sg = NULL;
@@ -670,44 +791,56 @@ __crypto_auth_run_zc(struct csession *ses_ptr, struct kernel_crypt_auth_op *kcao
 			ret = get_userbuf_tls(ses_ptr, kcaop, &dst_sg);
 			if (unlikely(ret)) {
 				derr(1, "get_userbuf_tls(): Error getting user pages.");
-				goto free_auth_buf;
+				goto release_aad;
 			}
 
-			ret = tls_auth_n_crypt(ses_ptr, kcaop, auth_sg, caop->auth_len,
-				   dst_sg, caop->len);
+			if (ses_ptr->tls.init)
+				ret = tls_aead_n_crypt(ses_ptr, kcaop, auth_sg,
+						caop->auth_len, dst_sg, caop->len);
+			else
+				ret = tls_auth_n_crypt(ses_ptr, kcaop, auth_sg,
+						caop->auth_len, dst_sg, caop->len,
+						NULL);
 		} else {
 			if (unlikely(ses_ptr->cdata.init == 0 ||
 			             (ses_ptr->cdata.stream == 0 &&
 				      ses_ptr->cdata.aead == 0))) {
 				derr(0, "Only stream and AEAD ciphers are allowed for authenc");
 				ret = -EINVAL;
-				goto free_auth_buf;
+				goto release_aad;
 			}
 
-			ret = get_userbuf(ses_ptr, caop->src, caop->len, caop->dst, kcaop->dst_len,
-					  kcaop->task, kcaop->mm, &src_sg, &dst_sg);
+			if (kcaop->iov)
+				ret = get_userbuf_iov(zc, kcaop->iov,
+						caop->len, kcaop->dst_len,
+						kcaop->task, kcaop->mm,
+						&src_sg, &dst_sg);
+			else
+				ret = get_userbuf(zc, ses_ptr->fcr, kcaop->region, caop->src, caop->len, caop->dst, kcaop->dst_len,
+						  kcaop->task, kcaop->mm, &src_sg, &dst_sg);
 			if (unlikely(ret)) {
 				derr(1, "get_userbuf(): Error getting user pages.");
-				goto free_auth_buf;
+				goto release_aad;
 			}
 
 			ret = auth_n_crypt(ses_ptr, kcaop, auth_sg, caop->auth_len,
 					   src_sg, dst_sg, caop->len);
 		}
 
-		release_user_pages(ses_ptr);
+		release_user_pages(zc);
 
-free_auth_buf:
-		free_page((unsigned long)auth_buf);
+release_aad:
+		release_user_pages(&ses_ptr->scratch->aad_zc);
 	}
 
 	return ret;
 }
 
 
-int crypto_auth_run(struct fcrypt *fcr, struct kernel_crypt_auth_op *kcaop)
+/* Run kcaop on an already looked up (and locked) session */
+int __crypto_auth_run(struct csession *ses_ptr,
+			struct kernel_crypt_auth_op *kcaop)
 {
-	struct csession *ses_ptr;
 	struct crypt_auth_op *caop = &kcaop->caop;
 	int ret;
 
@@ -716,17 +849,9 @@ int crypto_auth_run(struct fcrypt *fcr, struct kernel_crypt_auth_op *kcaop)
 		return -EINVAL;
 	}
 
-	/* this also enters ses_ptr->sem */
-	ses_ptr = crypto_get_session_by_sid(fcr, caop->ses);
-	if (unlikely(!ses_ptr)) {
-		derr(1, "invalid session ID=0x%08X", caop->ses);
-		return -EINVAL;
-	}
-
 	if (unlikely(ses_ptr->cdata.init == 0)) {
 		derr(1, "cipher context not initialized");
-		ret = -EINVAL;
-		goto out_unlock;
+		return -EINVAL;
 	}
 
 	/* If we have a hash/mac handle reset its state */
@@ -734,25 +859,509 @@ int crypto_auth_run(struct fcrypt *fcr, struct kernel_crypt_auth_op *kcaop)
 		ret = cryptodev_hash_reset(&ses_ptr->hdata);
 		if (unlikely(ret)) {
 			derr(1, "error in cryptodev_hash_reset()");
-			goto out_unlock;
+			return ret;
 		}
 	}
 
+	/* kcaop->ivlen stays zero, the IV is not passed back */
+	if (kcaop->ivlen == 0)
+		crypto_session_get_iv(ses_ptr, kcaop->iv);
 	cryptodev_cipher_set_iv(&ses_ptr->cdata, kcaop->iv,
-				min(ses_ptr->cdata.ivsize, kcaop->ivlen));
+				ses_ptr->cdata.ivsize);
+
+	cryptodev_stat_inc(ses_ptr->fcr, CRYPTODEV_STAT_OPS);
+	cryptodev_stat_add(ses_ptr->fcr, CRYPTODEV_STAT_BYTES, caop->len);
+	cryptodev_stat_inc(ses_ptr->fcr, CRYPTODEV_STAT_ZC);
 
+	ses_ptr->scratch = zc_get_scratch(ses_ptr->fcr);
+	if (unlikely(!ses_ptr->scratch))
+		return -ENOMEM;
 	ret = __crypto_auth_run_zc(ses_ptr, kcaop);
+	zc_put_scratch(ses_ptr->fcr, ses_ptr->scratch);
+	ses_ptr->scratch = NULL;
 	if (unlikely(ret)) {
 		derr(1, "error in __crypto_auth_run_zc()");
-		goto out_unlock;
+		return ret;
 	}
 
-	ret = 0;
+	/* a generated IV is passed back as it was used */
+	if (!ses_ptr->iv_mode) {
+		cryptodev_cipher_get_iv(&ses_ptr->cdata, kcaop->iv,
+					ses_ptr->cdata.ivsize);
+		crypto_session_set_iv(ses_ptr, kcaop->iv);
+	}
+
+	return 0;
+}
+
+int crypto_auth_run(struct fcrypt *fcr, struct kernel_crypt_auth_op *kcaop)
+{
+	struct csession *ses_ptr;
+	struct crypt_auth_op *caop = &kcaop->caop;
+	ktime_t start = ktime_get();
+	int ret;
 
+	/* this also enters ses_ptr->sem */
+	ses_ptr = crypto_get_session_by_sid(fcr, caop->ses);
+	if (unlikely(!ses_ptr)) {
+		derr(1, "invalid session ID=0x%08X", caop->ses);
+		return -EINVAL;
+	}
+
+	trace_cryptodev_op_start(ses_ptr, caop->op, caop->len, 0);
+	ret = __crypto_auth_run(ses_ptr, kcaop);
+	trace_cryptodev_op_done(ses_ptr, caop->op, caop->len, ret);
+
+	cryptodev_stat_latency(ses_ptr->stat_alg, start);
+	crypto_put_session(ses_ptr);
+	return ret;
+}
+
+/* The associated data of a TLS record: seq, type, version, length */
+#define TLS_AAD_SIZE 13
+
+/* Run one record of a CIOCTLSMULTI, pinned at dst_sg. kcaop has the
+ * operation and the IV, and is left with the length of the result. */
+static int tls_multi_record(struct csession *ses_ptr,
+		struct kernel_crypt_auth_op *kcaop,
+		struct crypt_tls_multi_op *tmo, uint64_t seq,
+		struct scatterlist *dst_sg, uint32_t len)
+{
+	struct scatterlist aad_sg;
+	uint8_t *aad = ses_ptr->aad;
+	int ret;
+
+	if (ses_ptr->hdata.init != 0) {
+		ret = cryptodev_hash_reset(&ses_ptr->hdata);
+		if (unlikely(ret)) {
+			derr(1, "error in cryptodev_hash_reset()");
+			return ret;
+		}
+	}
+	cryptodev_cipher_set_iv(&ses_ptr->cdata, kcaop->iv,
+				ses_ptr->cdata.ivsize);
+
+	put_unaligned_be64(seq, aad);
+	aad[8] = tmo->type;
+	put_unaligned_be16(tmo->version, aad + 9);
+	sg_init_one(&aad_sg, aad, TLS_AAD_SIZE);
+
+	/* The tls10 AEAD takes the associated data before it decrypts,
+	 * so it only encrypts here: the length of a record to decrypt is
+	 * known once its padding and tag are taken off. */
+	if (ses_ptr->tls.init && kcaop->caop.op == COP_ENCRYPT) {
+		put_unaligned_be16(len, aad + 11);
+		ret = tls_aead_n_crypt(ses_ptr, kcaop, &aad_sg, TLS_AAD_SIZE,
+				dst_sg, len);
+		if (likely(!ret))
+			kcaop->dst_len = cryptodev_get_dst_len(&kcaop->caop,
+							       ses_ptr);
+		return ret;
+	}
+
+	ret = tls_auth_n_crypt(ses_ptr, kcaop, &aad_sg, TLS_AAD_SIZE,
+			dst_sg, len, aad + 11);
 	cryptodev_cipher_get_iv(&ses_ptr->cdata, kcaop->iv,
-				min(ses_ptr->cdata.ivsize, kcaop->ivlen));
+				ses_ptr->cdata.ivsize);
+	return ret;
+}
+
+/* Run CIOCTLSMULTI. The session is entered once, and the records are
+ * pinned together in the pages of a single scratch. */
+int crypto_tls_run_multi(struct fcrypt *fcr, struct crypt_tls_multi_op *tmo,
+		const struct user_abi *abi)
+{
+	struct kernel_crypt_auth_op kcaop;
+	struct crypt_tls_record *recs;
+	struct scatterlist **sgs;
+	struct csession *ses_ptr;
+	struct zc_scratch *scratch;
+	struct zc_pages *zc;
+	unsigned int i, pagecount, total = 0;
+	uint64_t bytes = 0;
+	int ret;
+
+	if (unlikely(tmo->count == 0 || tmo->count > CRYPTODEV_MAX_MULTI_OPS ||
+		     (tmo->flags & ~COP_FLAG_WRITE_IV) || tmo->__reserved ||
+		     (tmo->op != COP_ENCRYPT && tmo->op != COP_DECRYPT))) {
+		ddebug(1, "invalid TLS multi op (count=%u, flags=0x%x)",
+				tmo->count, tmo->flags);
+		return -EINVAL;
+	}
+
+	recs = kmalloc_array(tmo->count, sizeof(*recs), GFP_KERNEL);
+	sgs = kmalloc_array(tmo->count, sizeof(*sgs), GFP_KERNEL);
+	if (unlikely(!recs || !sgs)) {
+		ret = -ENOMEM;
+		goto out_free;
+	}
+
+	if (unlikely(abi->records_from_user(recs, tmo->records, tmo->count))) {
+		ret = -EFAULT;
+		goto out_free;
+	}
+
+	/* this also enters ses_ptr->sem */
+	ses_ptr = crypto_get_session_by_sid(fcr, tmo->ses);
+	if (unlikely(!ses_ptr)) {
+		derr(1, "invalid session ID=0x%08X", tmo->ses);
+		ret = -EINVAL;
+		goto out_free;
+	}
+
+	if (unlikely(ses_ptr->cdata.init == 0 || ses_ptr->cdata.aead != 0)) {
+		ddebug(1, "CIOCTLSMULTI needs a cipher and mac session");
+		ret = -EINVAL;
+		goto out_put;
+	}
+
+	memset(&kcaop, 0, sizeof(kcaop));
+	kcaop.caop.ses = tmo->ses;
+	kcaop.caop.op = tmo->op;
+	kcaop.caop.flags = COP_FLAG_AEAD_TLS_TYPE;
+	kcaop.caop.tag_len = cryptodev_get_tag_len(ses_ptr);
+	kcaop.task = current;
+	kcaop.mm = current->mm;
+
+	if (tmo->iv) {
+		if (unlikely(copy_from_user(kcaop.iv, tmo->iv,
+					    ses_ptr->cdata.ivsize))) {
+			ret = -EFAULT;
+			goto out_put;
+		}
+	} else {
+		crypto_session_get_iv(ses_ptr, kcaop.iv);
+	}
+
+	/* the length each record needs, as a CIOCAUTHCRYPT would pin */
+	for (i = 0; i < tmo->count; i++) {
+		kcaop.caop.len = recs[i].len;
+		kcaop.dst_len = cryptodev_get_dst_len(&kcaop.caop, ses_ptr);
+		if (unlikely(!recs[i].buf || recs[i].len == 0)) {
+			ret = -EINVAL;
+			goto out_put;
+		}
+		total += PAGECOUNT(recs[i].buf, kcaop.dst_len);
+	}
+
+	scratch = zc_get_scratch(fcr);
+	if (unlikely(!scratch)) {
+		ret = -ENOMEM;
+		goto out_put;
+	}
+	zc = &scratch->zc;
+
+	if (zc->array_size < total) {
+		ret = adjust_sg_array(zc, total);
+		if (unlikely(ret))
+			goto out_scratch;
+	}
+
+	zc->used_pages = zc->readonly_pages = 0;
+	for (i = 0; i < tmo->count; i++) {
+		kcaop.caop.len = recs[i].len;
+		kcaop.dst_len = cryptodev_get_dst_len(&kcaop.caop, ses_ptr);
+		pagecount = PAGECOUNT(recs[i].buf, kcaop.dst_len);
+
+		sgs[i] = zc->sg + zc->used_pages;
+		ret = __get_userbuf(recs[i].buf, kcaop.dst_len, 1, pagecount,
+				zc->pages + zc->used_pages, sgs[i],
+				current, current->mm);
+		if (unlikely(ret)) {
+			derr(1, "failed to get user pages of TLS record %u", i);
+			goto out_release;
+		}
+		zc->used_pages += pagecount;
+	}
+
+	for (i = 0; i < tmo->count; i++) {
+		kcaop.caop.len = recs[i].len;
+		if (ses_ptr->iv_mode)
+			crypto_session_next_iv(ses_ptr, kcaop.iv, recs[i].len);
+
+		recs[i].status = tls_multi_record(ses_ptr, &kcaop, tmo,
+				tmo->seq + i, sgs[i], recs[i].len);
+		if (likely(!recs[i].status)) {
+			bytes += recs[i].len;
+			recs[i].len = kcaop.dst_len;
+		}
+	}
+
+	/* the next operation of the session carries on from the last record */
+	if (!ses_ptr->iv_mode)
+		crypto_session_set_iv(ses_ptr, kcaop.iv);
+
+	cryptodev_stat_add(fcr, CRYPTODEV_STAT_OPS, tmo->count);
+	cryptodev_stat_add(fcr, CRYPTODEV_STAT_BYTES, bytes);
+	cryptodev_stat_add(fcr, CRYPTODEV_STAT_ZC, tmo->count);
+
+	ret = 0;
+	if (tmo->iv && (tmo->flags & COP_FLAG_WRITE_IV) &&
+	    unlikely(copy_to_user(tmo->iv, kcaop.iv, ses_ptr->cdata.ivsize)))
+		ret = -EFAULT;
+	if (unlikely(abi->records_to_user(tmo->records, recs, tmo->count)))
+		ret = -EFAULT;
+
+out_release:
+	release_user_pages(zc);
+out_scratch:
+	zc_put_scratch(fcr, scratch);
+out_put:
+	crypto_put_session(ses_ptr);
+out_free:
+	kfree(sgs);
+	kfree(recs);
+	return ret;
+}
+
+/* the fixed part of an RTP header */
+#define RTP_HEADER_SIZE 12
+
+/* The rollover counter of the packet with sequence number seq, as
+ * guessed from the highest one so far (RFC 3711, 3.3.1) */
+static uint32_t srtp_guess_roc(const struct srtp_state *srtp, uint16_t seq)
+{
+	if (!srtp->started)
+		return srtp->roc;
+
+	if (srtp->s_l < 0x8000) {
+		if (seq > srtp->s_l && seq - srtp->s_l > 0x8000)
+			return srtp->roc - 1;
+	} else if (srtp->s_l - 0x8000 > seq) {
+		return srtp->roc + 1;
+	}
+	return srtp->roc;
+}
+
+static void srtp_update(struct srtp_state *srtp, uint32_t roc, uint16_t seq)
+{
+	if (!srtp->started || roc == srtp->roc + 1 ||
+	    (roc == srtp->roc && seq > srtp->s_l)) {
+		srtp->roc = roc;
+		srtp->s_l = seq;
+		srtp->started = 1;
+	}
+}
+
+/* Run one packet of a CIOCSRTPMULTI, pinned at sg (with a copy of the
+ * entries at copy_sg), and set its length and rollover counter */
+static int srtp_multi_packet(struct csession *ses_ptr, int op,
+		unsigned int tag_len, struct crypt_srtp_packet *pkt,
+		struct scatterlist *sg, struct scatterlist *copy_sg)
+{
+	struct srtp_state *srtp = ses_ptr->srtp;
+	struct scatterlist *payload_sg, roc_sg;
+	uint8_t hdr[RTP_HEADER_SIZE];
+	uint8_t iv[EALG_MAX_BLOCK_LEN];
+	uint8_t vhash[AALG_MAX_RESULT_LEN];
+	uint8_t hash_output[AALG_MAX_RESULT_LEN];
+	uint32_t len = pkt->len, roc, ssrc;
+	uint64_t index;
+	uint16_t seq;
+	int i, ret;
+
+	if (op == COP_DECRYPT) {
+		if (unlikely(len < pkt->hdr_len + tag_len))
+			return -EINVAL;
+		len -= tag_len;
+	}
 
-out_unlock:
+	scatterwalk_map_and_copy(hdr, sg, 0, RTP_HEADER_SIZE, 0);
+	seq = get_unaligned_be16(hdr + 2);
+	ssrc = get_unaligned_be32(hdr + 8);
+	roc = srtp_guess_roc(srtp, seq);
+
+	/* IV = salt * 2^16 ^ SSRC * 2^64 ^ index * 2^16 */
+	memcpy(iv, srtp->salt, sizeof(iv));
+	put_unaligned_be32(get_unaligned_be32(iv + 4) ^ ssrc, iv + 4);
+	index = ((uint64_t)roc << 16) | seq;
+	for (i = 13; i >= 8; i--, index >>= 8)
+		iv[i] ^= index & 0xff;
+	cryptodev_cipher_set_iv(&ses_ptr->cdata, iv, ses_ptr->cdata.ivsize);
+
+	/* the payload, after the header */
+	ret = sg_copy(sg, copy_sg, len);
+	if (unlikely(ret))
+		return ret;
+	payload_sg = sg_advance(copy_sg, pkt->hdr_len);
+
+	/* the tag is over the packet and the rollover counter */
+	put_unaligned_be32(roc, ses_ptr->aad);
+	sg_init_one(&roc_sg, ses_ptr->aad, sizeof(roc));
+
+	ret = cryptodev_hash_reset(&ses_ptr->hdata);
+	if (unlikely(ret))
+		return ret;
+
+	if (op == COP_ENCRYPT && payload_sg) {
+		ret = cryptodev_cipher_encrypt(&ses_ptr->cdata, payload_sg,
+				payload_sg, len - pkt->hdr_len);
+		if (unlikely(ret)) {
+			derr(0, "cryptodev_cipher_encrypt: %d", ret);
+			return ret;
+		}
+	}
+
+	ret = cryptodev_hash_update(&ses_ptr->hdata, sg, len);
+	if (likely(!ret))
+		ret = cryptodev_hash_update(&ses_ptr->hdata, &roc_sg,
+					    sizeof(roc));
+	if (likely(!ret))
+		ret = cryptodev_hash_final(&ses_ptr->hdata, hash_output);
+	if (unlikely(ret)) {
+		derr(0, "SRTP hash: %d", ret);
+		return ret;
+	}
+
+	if (op == COP_ENCRYPT) {
+		copy_tls_hash(sg, len, hash_output, tag_len);
+		pkt->len = len + tag_len;
+	} else {
+		read_tls_hash(sg, len + tag_len, vhash, tag_len);
+		if (crypto_memneq(vhash, hash_output, tag_len)) {
+			derr(2, "MAC verification failed");
+			return -EBADMSG;
+		}
+
+		if (payload_sg) {
+			ret = cryptodev_cipher_decrypt(&ses_ptr->cdata,
+					payload_sg, payload_sg,
+					len - pkt->hdr_len);
+			if (unlikely(ret)) {
+				derr(0, "cryptodev_cipher_decrypt: %d", ret);
+				return ret;
+			}
+		}
+		pkt->len = len;
+	}
+
+	srtp_update(srtp, roc, seq);
+	pkt->roc = roc;
+	return 0;
+}
+
+/* Run CIOCSRTPMULTI, as crypto_tls_run_multi() does the records */
+int crypto_srtp_run_multi(struct fcrypt *fcr, struct crypt_srtp_multi_op *smo,
+		const struct user_abi *abi)
+{
+	struct crypt_srtp_packet *pkts;
+	struct scatterlist **sgs;
+	struct csession *ses_ptr;
+	struct zc_scratch *scratch;
+	struct zc_pages *zc;
+	unsigned int i, pagecount, buflen, tag_len, total = 0;
+	uint64_t bytes = 0;
+	int ret;
+
+	if (unlikely(smo->count == 0 || smo->count > CRYPTODEV_MAX_MULTI_OPS ||
+		     smo->flags ||
+		     (smo->op != COP_ENCRYPT && smo->op != COP_DECRYPT))) {
+		ddebug(1, "invalid SRTP multi op (count=%u, flags=0x%x)",
+				smo->count, smo->flags);
+		return -EINVAL;
+	}
+
+	pkts = kmalloc_array(smo->count, sizeof(*pkts), GFP_KERNEL);
+	sgs = kmalloc_array(smo->count, sizeof(*sgs), GFP_KERNEL);
+	if (unlikely(!pkts || !sgs)) {
+		ret = -ENOMEM;
+		goto out_free;
+	}
+
+	if (unlikely(abi->packets_from_user(pkts, smo->packets, smo->count))) {
+		ret = -EFAULT;
+		goto out_free;
+	}
+
+	/* this also enters ses_ptr->sem */
+	ses_ptr = crypto_get_session_by_sid(fcr, smo->ses);
+	if (unlikely(!ses_ptr)) {
+		derr(1, "invalid session ID=0x%08X", smo->ses);
+		ret = -EINVAL;
+		goto out_free;
+	}
+
+	if (unlikely(!ses_ptr->srtp)) {
+		ddebug(1, "CIOCSRTPMULTI needs an SOP_FLAG_SRTP session");
+		ret = -EINVAL;
+		goto out_put;
+	}
+
+	tag_len = smo->tag_len ? smo->tag_len : ses_ptr->hdata.digestsize;
+	if (unlikely(tag_len > ses_ptr->hdata.digestsize)) {
+		derr(1, "Illegal tag len size");
+		ret = -EINVAL;
+		goto out_put;
+	}
+
+	for (i = 0; i < smo->count; i++) {
+		if (unlikely(!pkts[i].buf || pkts[i].__reserved ||
+			     pkts[i].hdr_len < RTP_HEADER_SIZE ||
+			     pkts[i].len < pkts[i].hdr_len)) {
+			ret = -EINVAL;
+			goto out_put;
+		}
+		buflen = pkts[i].len + (smo->op == COP_ENCRYPT ? tag_len : 0);
+		total += PAGECOUNT(pkts[i].buf, buflen);
+	}
+
+	scratch = zc_get_scratch(fcr);
+	if (unlikely(!scratch)) {
+		ret = -ENOMEM;
+		goto out_put;
+	}
+	zc = &scratch->zc;
+
+	/* as in get_userbuf_srtp(), the second half of the entries is for
+	 * copies that start at the payload */
+	if (zc->array_size < 2 * total) {
+		ret = adjust_sg_array(zc, 2 * total);
+		if (unlikely(ret))
+			goto out_scratch;
+	}
+
+	zc->used_pages = zc->readonly_pages = 0;
+	for (i = 0; i < smo->count; i++) {
+		buflen = pkts[i].len + (smo->op == COP_ENCRYPT ? tag_len : 0);
+		pagecount = PAGECOUNT(pkts[i].buf, buflen);
+
+		sgs[i] = zc->sg + zc->used_pages;
+		ret = __get_userbuf(pkts[i].buf, buflen, 1, pagecount,
+				zc->pages + zc->used_pages, sgs[i],
+				current, current->mm);
+		if (unlikely(ret)) {
+			derr(1, "failed to get user pages of SRTP packet %u", i);
+			goto out_release;
+		}
+		zc->used_pages += pagecount;
+	}
+
+	for (i = 0; i < smo->count; i++) {
+		unsigned int offset = sgs[i] - zc->sg;
+
+		sg_init_table(zc->sg + total + offset,
+			      PAGECOUNT(pkts[i].buf, pkts[i].len));
+		bytes += pkts[i].len;
+		pkts[i].status = srtp_multi_packet(ses_ptr, smo->op, tag_len,
+				&pkts[i], sgs[i], zc->sg + total + offset);
+	}
+
+	cryptodev_stat_add(fcr, CRYPTODEV_STAT_OPS, smo->count);
+	cryptodev_stat_add(fcr, CRYPTODEV_STAT_BYTES, bytes);
+	cryptodev_stat_add(fcr, CRYPTODEV_STAT_ZC, smo->count);
+
+	ret = 0;
+	if (unlikely(abi->packets_to_user(smo->packets, pkts, smo->count)))
+		ret = -EFAULT;
+
+out_release:
+	release_user_pages(zc);
+out_scratch:
+	zc_put_scratch(fcr, scratch);
+out_put:
 	crypto_put_session(ses_ptr);
+out_free:
+	kfree(sgs);
+	kfree(pkts);
 	return ret;
 }
@@ -0,0 +1,53 @@
+#ifndef CIPHERAPI_H
+# define CIPHERAPI_H
+
+/* Block ciphers go through the names below, which are those of
+ * ablkcipher. The module is tied to the kernels that still have
+ * aead_request_set_assoc() and the task/mm form of get_user_pages()
+ * anyway, which are gone well before skcipher replaced ablkcipher in
+ * 4.8, so there is no skcipher mapping to keep in step. */
+#include <linux/crypto.h>
+
+typedef struct crypto_ablkcipher cryptodev_crypto_blkcipher_t;
+typedef struct ablkcipher_request cryptodev_blkcipher_request_t;
+
+#define cryptodev_crypto_alloc_blkcipher crypto_alloc_ablkcipher
+#define cryptodev_crypto_free_blkcipher crypto_free_ablkcipher
+#define cryptodev_crypto_blkcipher_blocksize crypto_ablkcipher_blocksize
+#define cryptodev_crypto_blkcipher_ivsize crypto_ablkcipher_ivsize
+#define cryptodev_crypto_blkcipher_alignmask crypto_ablkcipher_alignmask
+#define cryptodev_crypto_blkcipher_reqsize crypto_ablkcipher_reqsize
+#define cryptodev_crypto_blkcipher_setkey crypto_ablkcipher_setkey
+#define cryptodev_crypto_blkcipher_tfm crypto_ablkcipher_tfm
+#define cryptodev_crypto_blkcipher_clear_flags crypto_ablkcipher_clear_flags
+
+#define cryptodev_blkcipher_request_alloc ablkcipher_request_alloc
+#define cryptodev_blkcipher_request_free ablkcipher_request_free
+#define cryptodev_blkcipher_request_set_tfm ablkcipher_request_set_tfm
+#define cryptodev_blkcipher_request_set_callback ablkcipher_request_set_callback
+#define cryptodev_blkcipher_request_set_crypt ablkcipher_request_set_crypt
+#define cryptodev_crypto_blkcipher_encrypt crypto_ablkcipher_encrypt
+#define cryptodev_crypto_blkcipher_decrypt crypto_ablkcipher_decrypt
+
+/* The key sizes the algorithm takes; 0 for max_keysize if unknown */
+static inline void
+cryptodev_crypto_blkcipher_keysizes(cryptodev_crypto_blkcipher_t *tfm,
+				    unsigned int *min, unsigned int *max)
+{
+	struct ablkcipher_alg *alg = crypto_ablkcipher_alg(tfm);
+
+	*min = alg ? alg->min_keysize : 0;
+	*max = alg ? alg->max_keysize : 0;
+}
+
+/* Synchronous transforms have requests of at most this size put on the
+ * stack of the caller, as with SKCIPHER_REQUEST_ON_STACK(); bigger ones
+ * use the request of the session. */
+#define CRYPTODEV_MAX_STACK_REQSIZE 384
+
+#define CRYPTODEV_REQUEST_ON_STACK(name, type) \
+	char __##name##_desc[sizeof(type) + CRYPTODEV_MAX_STACK_REQSIZE] \
+		CRYPTO_MINALIGN_ATTR; \
+	type *name = (void *)__##name##_desc
+
+#endif
@@ -0,0 +1,257 @@
+/*
+ * Driver for /dev/crypto device (aka CryptoDev)
+ *
+ * This file is part of linux cryptodev.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+
+#include <linux/crypto.h>
+#include <linux/ktime.h>
+#include <linux/list.h>
+#include <linux/module.h>
+#include <linux/mutex.h>
+#include <linux/scatterlist.h>
+#include <linux/slab.h>
+#include <crypto/hash.h>
+#include <crypto/cryptodev.h>
+#include "cryptodev_int.h"
+#include "cryptlib.h"
+#include "crossover.h"
+
+/* Offload engines take longer than the CPU to set up an operation, and
+ * less time for each byte. SOP_FLAG_DRIVER_AUTO sessions thus run their
+ * small operations on a synchronous implementation, up to the crossover
+ * of their pair of drivers. That is found by timing both on the sizes
+ * of crossover_sizes, each the best of CROSSOVER_RUNS operations: it is
+ * the largest size up to which the synchronous one is never slower, or
+ * UINT_MAX if it is faster on all of them.
+ *
+ * Crossovers are timed by the first session of each pair of drivers,
+ * and again by CIOCCALIBRATE. They are kept until the module is
+ * unloaded, and shown in /sys/module/cryptodev/parameters/crossovers.
+ */
+
+#define CROSSOVER_RUNS 4
+#define CROSSOVER_MAX 64
+
+static const unsigned int crossover_sizes[CROSSOVER_SIZES] = {
+	64, 256, 1024, 4096, 16384
+};
+
+static LIST_HEAD(crossovers);
+static unsigned int nr_crossovers;
+static DEFINE_MUTEX(crossover_lock);
+
+static bool cryptodev_autotune = 1;
+module_param(cryptodev_autotune, bool, 0644);
+MODULE_PARM_DESC(cryptodev_autotune,
+	"time the drivers of SOP_FLAG_DRIVER_AUTO sessions for where each "
+	"is faster, instead of using cryptodev_sync_threshold");
+
+static void crossover_name(char *name, size_t size, struct cipher_data *cdata,
+			struct hash_data *hdata)
+{
+	snprintf(name, size, "%s%s%s",
+		cdata->init ?
+		crypto_tfm_alg_driver_name(cryptodev_cipher_tfm(cdata)) : "",
+		cdata->init && hdata->init ? "+" : "",
+		hdata->init ?
+		crypto_tfm_alg_driver_name(crypto_ahash_tfm(hdata->async.s)) : "");
+}
+
+/* The best time of len bytes on cdata and hdata, U64_MAX on errors */
+static u64 crossover_time(struct cipher_data *cdata, struct hash_data *hdata,
+			struct scatterlist *sg, unsigned int len, uint8_t *digest)
+{
+	u64 ns, best = U64_MAX;
+	ktime_t start;
+	int i;
+
+	for (i = 0; i < CROSSOVER_RUNS; i++) {
+		start = ktime_get();
+		if (cdata->init &&
+		    unlikely(cryptodev_cipher_encrypt(cdata, sg, sg, len)))
+			return U64_MAX;
+		if (hdata->init &&
+		    unlikely(cryptodev_hash_digest(hdata, sg, len, digest)))
+			return U64_MAX;
+		ns = ktime_to_ns(ktime_sub(ktime_get(), start));
+		best = min(best, ns);
+	}
+	return best;
+}
+
+/* Time the transforms of ses_ptr into x, on requests of their own so
+ * that the operations of the session are not disturbed. x is left
+ * alone on failure. */
+static int crossover_measure(struct cryptodev_crossover *x,
+			struct csession *ses_ptr)
+{
+	struct cipher_data cdata, sync_cdata;
+	struct hash_data hdata, sync_hdata;
+	struct scatterlist sg;
+	uint8_t digest[AALG_MAX_RESULT_LEN];
+	u64 async_ns[CROSSOVER_SIZES], sync_ns[CROSSOVER_SIZES];
+	unsigned int i, bytes;
+	void *buf;
+	int ret;
+
+	buf = kzalloc(crossover_sizes[CROSSOVER_SIZES - 1], GFP_KERNEL);
+	if (unlikely(!buf))
+		return -ENOMEM;
+
+	memset(&hdata, 0, sizeof(hdata));
+	memset(&sync_hdata, 0, sizeof(sync_hdata));
+	memset(&sync_cdata, 0, sizeof(sync_cdata));
+	ret = cryptodev_cipher_clone(&cdata, &ses_ptr->cdata);
+	if (likely(!ret))
+		ret = cryptodev_cipher_clone(&sync_cdata, &ses_ptr->sync_cdata);
+	if (likely(!ret))
+		ret = cryptodev_hash_clone(&hdata, &ses_ptr->hdata);
+	if (likely(!ret))
+		ret = cryptodev_hash_clone(&sync_hdata, &ses_ptr->sync_hdata);
+	if (unlikely(ret))
+		goto out;
+
+	for (i = 0; i < CROSSOVER_SIZES; i++) {
+		sg_init_one(&sg, buf, crossover_sizes[i]);
+		async_ns[i] = crossover_time(&cdata, &hdata, &sg,
+					crossover_sizes[i], digest);
+		sync_ns[i] = crossover_time(&sync_cdata, &sync_hdata, &sg,
+					crossover_sizes[i], digest);
+		if (unlikely(async_ns[i] == U64_MAX || sync_ns[i] == U64_MAX)) {
+			ret = -EIO;
+			goto out;
+		}
+	}
+
+	for (i = 0, bytes = 0; i < CROSSOVER_SIZES; i++) {
+		if (sync_ns[i] > async_ns[i])
+			break;
+		bytes = crossover_sizes[i];
+	}
+	ACCESS_ONCE(x->bytes) = i == CROSSOVER_SIZES ? UINT_MAX : bytes;
+	memcpy(x->async_ns, async_ns, sizeof(async_ns));
+	memcpy(x->sync_ns, sync_ns, sizeof(sync_ns));
+out:
+	cryptodev_hash_clone_deinit(&sync_hdata);
+	cryptodev_hash_clone_deinit(&hdata);
+	cryptodev_cipher_clone_deinit(&sync_cdata);
+	cryptodev_cipher_clone_deinit(&cdata);
+	kfree(buf);
+	return ret;
+}
+
+struct cryptodev_crossover *cryptodev_crossover_get(struct csession *ses_ptr,
+						    int measure)
+{
+	char async_name[2 * CRYPTO_MAX_ALG_NAME];
+	char sync_name[2 * CRYPTO_MAX_ALG_NAME];
+	struct cryptodev_crossover *x;
+	int ret;
+
+	if (!ses_ptr->sync_cdata.init && !ses_ptr->sync_hdata.init)
+		return NULL;
+
+	crossover_name(async_name, sizeof(async_name),
+			&ses_ptr->cdata, &ses_ptr->hdata);
+	crossover_name(sync_name, sizeof(sync_name),
+			&ses_ptr->sync_cdata, &ses_ptr->sync_hdata);
+
+	mutex_lock(&crossover_lock);
+	list_for_each_entry(x, &crossovers, entry) {
+		if (strcmp(x->async_name, async_name) == 0 &&
+		    strcmp(x->sync_name, sync_name) == 0)
+			goto found;
+	}
+
+	if ((!measure && !cryptodev_autotune) || nr_crossovers >= CROSSOVER_MAX) {
+		x = NULL;
+		goto out;
+	}
+
+	x = kzalloc(sizeof(*x), GFP_KERNEL);
+	if (unlikely(!x))
+		goto out;
+	strcpy(x->async_name, async_name);
+	strcpy(x->sync_name, sync_name);
+	ret = crossover_measure(x, ses_ptr);
+	if (unlikely(ret)) {
+		ddebug(1, "cannot time %s against %s: %d", sync_name,
+				async_name, ret);
+		kfree(x);
+		x = NULL;
+		goto out;
+	}
+	list_add_tail(&x->entry, &crossovers);
+	nr_crossovers++;
+	ddebug(2, "%s is faster than %s up to %u bytes", sync_name,
+			async_name, x->bytes);
+	goto out;
+
+found:
+	/* on failure the previous timings are kept */
+	if (measure)
+		crossover_measure(x, ses_ptr);
+out:
+	mutex_unlock(&crossover_lock);
+	return x;
+}
+
+/* /sys/module/cryptodev/parameters/crossovers: a line per pair of
+ * drivers, with the crossover and the nanoseconds each size took on
+ * the asynchronous and the synchronous driver */
+static int crossover_show(char *buf, const struct kernel_param *kp)
+{
+	struct cryptodev_crossover *x;
+	int i, len = 0;
+
+	mutex_lock(&crossover_lock);
+	list_for_each_entry(x, &crossovers, entry) {
+		len += scnprintf(buf + len, PAGE_SIZE - len, "%s %s ",
+				x->async_name, x->sync_name);
+		if (x->bytes == UINT_MAX)
+			len += scnprintf(buf + len, PAGE_SIZE - len, "all");
+		else
+			len += scnprintf(buf + len, PAGE_SIZE - len, "%u",
+					x->bytes);
+		for (i = 0; i < CROSSOVER_SIZES; i++)
+			len += scnprintf(buf + len, PAGE_SIZE - len,
+					" %u:%llu/%llu", crossover_sizes[i],
+					(unsigned long long)x->async_ns[i],
+					(unsigned long long)x->sync_ns[i]);
+		len += scnprintf(buf + len, PAGE_SIZE - len, "\n");
+	}
+	mutex_unlock(&crossover_lock);
+	return len;
+}
+
+static const struct kernel_param_ops crossover_ops = {
+	.get = crossover_show,
+};
+module_param_cb(crossovers, &crossover_ops, NULL, 0444);
+MODULE_PARM_DESC(crossovers, "the crossovers of SOP_FLAG_DRIVER_AUTO sessions");
+
+void cryptodev_crossover_exit(void)
+{
+	struct cryptodev_crossover *x, *tmp;
+
+	list_for_each_entry_safe(x, tmp, &crossovers, entry)
+		kfree(x);
+	INIT_LIST_HEAD(&crossovers);
+	nr_crossovers = 0;
+}
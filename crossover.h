@@ -0,0 +1,27 @@
+#ifndef CROSSOVER_H
+# define CROSSOVER_H
+
+#define CROSSOVER_SIZES 5
+
+/* Where the synchronous implementation of a pair of drivers stops being
+ * faster than the asynchronous one, as timed by crossover.c */
+struct cryptodev_crossover {
+	struct list_head entry;
+	/* the drivers of the cipher and of the hash ("cipher+hash") */
+	char async_name[2 * CRYPTO_MAX_ALG_NAME];
+	char sync_name[2 * CRYPTO_MAX_ALG_NAME];
+	/* operations of up to this many bytes run on the synchronous one */
+	unsigned int bytes;
+	u64 async_ns[CROSSOVER_SIZES];
+	u64 sync_ns[CROSSOVER_SIZES];
+};
+
+/* The crossover of an SOP_FLAG_DRIVER_AUTO session, which is timed if
+ * none of its drivers is known yet, or again with measure set. NULL if
+ * there is none. */
+struct cryptodev_crossover *cryptodev_crossover_get(struct csession *ses_ptr,
+						    int measure);
+
+void cryptodev_crossover_exit(void);
+
+#endif
@@ -24,6 +24,7 @@
  */
 
 #include <linux/crypto.h>
+#include <linux/module.h>
 #include <linux/mm.h>
 #include <linux/highmem.h>
 #include <linux/ioctl.h>
@@ -37,13 +38,29 @@
 #include <linux/rtnetlink.h>
 #include <crypto/authenc.h>
 #include "cryptodev_int.h"
-
-
+#include "stats.h"
+#include "cryptodev_trace.h"
+#include "tfm_pool.h"
+
+/* Engines that complete an operation in a few microseconds finish it
+ * before a sleeping waiter is scheduled back in. Waiters thus poll for
+ * the completion this long first, unless the CPU is wanted elsewhere. */
+static unsigned int cryptodev_poll_ns;
+module_param(cryptodev_poll_ns, uint, 0644);
+MODULE_PARM_DESC(cryptodev_poll_ns,
+	"nanoseconds to poll for the completion of an operation before "
+	"sleeping on it (0 to always sleep)");
+
+/* The request of a cipher_data or hash_data is allocated along with its
+ * result, right after it, so that setting up a session costs one
+ * allocation less and an operation touches a single block. */
 struct cryptodev_result {
 	struct completion completion;
 	int err;
 };
 
+#define RESULT_SIZE ALIGN(sizeof(struct cryptodev_result), CRYPTO_MINALIGN)
+
 static void cryptodev_complete(struct crypto_async_request *req, int err)
 {
 	struct cryptodev_result *res = req->data;
@@ -55,6 +72,81 @@ static void cryptodev_complete(struct crypto_async_request *req, int err)
 	complete(&res->completion);
 }
 
+/* Allocate a result followed by reqsize bytes for the request, which is
+ * returned, on node. The request is freed along with the result, by
+ * cryptodev_result_free(). */
+static void *cryptodev_result_alloc(struct cryptodev_result **result,
+				unsigned int reqsize, int node)
+{
+	struct cryptodev_result *res;
+
+	res = kzalloc_node(RESULT_SIZE + reqsize, GFP_KERNEL, node);
+	if (unlikely(!res))
+		return NULL;
+
+	init_completion(&res->completion);
+	*result = res;
+	return (char *)res + RESULT_SIZE;
+}
+
+static inline void cryptodev_result_free(struct cryptodev_result *result)
+{
+	/* the request may hold key material */
+	kzfree(result);
+}
+
+static cryptodev_blkcipher_request_t *
+alloc_cipher_request(cryptodev_crypto_blkcipher_t *tfm,
+		struct cryptodev_result **result, int node)
+{
+	cryptodev_blkcipher_request_t *req;
+
+	req = cryptodev_result_alloc(result, sizeof(*req) +
+				cryptodev_crypto_blkcipher_reqsize(tfm), node);
+	if (unlikely(!req))
+		return NULL;
+
+	cryptodev_blkcipher_request_set_tfm(req, tfm);
+	cryptodev_blkcipher_request_set_callback(req,
+				CRYPTO_TFM_REQ_MAY_BACKLOG,
+				cryptodev_complete, *result);
+	return req;
+}
+
+static struct aead_request *
+alloc_aead_request(struct crypto_aead *tfm,
+		struct cryptodev_result **result, int node)
+{
+	struct aead_request *req;
+
+	req = cryptodev_result_alloc(result, sizeof(*req) +
+				crypto_aead_reqsize(tfm), node);
+	if (unlikely(!req))
+		return NULL;
+
+	aead_request_set_tfm(req, tfm);
+	aead_request_set_callback(req, CRYPTO_TFM_REQ_MAY_BACKLOG,
+				cryptodev_complete, *result);
+	return req;
+}
+
+static struct ahash_request *
+alloc_hash_request(struct crypto_ahash *tfm, struct cryptodev_result **result,
+		int node)
+{
+	struct ahash_request *req;
+
+	req = cryptodev_result_alloc(result, sizeof(*req) +
+				crypto_ahash_reqsize(tfm), node);
+	if (unlikely(!req))
+		return NULL;
+
+	ahash_request_set_tfm(req, tfm);
+	ahash_request_set_callback(req, CRYPTO_TFM_REQ_MAY_BACKLOG,
+				cryptodev_complete, *result);
+	return req;
+}
+
 int cryptodev_get_cipher_keylen(unsigned int *keylen, struct session_op *sop,
 		int aead)
 {
@@ -127,40 +219,50 @@ error:
 }
 
 
+/* alg_name is either the name of the algorithm or that of a driver of
+ * it; type and mask are those of crypto_alloc_skcipher(). Only the
+ * transforms of plain algorithm names go back to the pool on deinit.
+ * The requests are allocated on node; the transform is allocated by
+ * CryptoAPI, on the node of the caller. */
 int cryptodev_cipher_init(struct cipher_data *out, const char *alg_name,
-				uint8_t *keyp, size_t keylen, int stream, int aead)
+				u32 type, u32 mask,
+				uint8_t *keyp, size_t keylen, int stream, int aead,
+				int node)
 {
+	unsigned int reqsize;
 	int ret;
 
 	if (aead == 0) {
-		struct ablkcipher_alg *alg;
+		unsigned int min_keysize, max_keysize;
 
-		out->async.s = crypto_alloc_ablkcipher(alg_name, 0, 0);
+		out->async.s = cryptodev_alloc_blkcipher(alg_name, type, mask);
 		if (unlikely(IS_ERR(out->async.s))) {
 			ddebug(1, "Failed to load cipher %s", alg_name);
 				return -EINVAL;
 		}
-
-		alg = crypto_ablkcipher_alg(out->async.s);
-		if (alg != NULL) {
-			/* Was correct key length supplied? */
-			if (alg->max_keysize > 0 &&
-					unlikely((keylen < alg->min_keysize) ||
-					(keylen > alg->max_keysize))) {
-				ddebug(1, "Wrong keylen '%zu' for algorithm '%s'. Use %u to %u.",
-						keylen, alg_name, alg->min_keysize, alg->max_keysize);
-				ret = -EINVAL;
-				goto error;
-			}
+		out->pooled = !type && !mask && strcmp(alg_name,
+			crypto_tfm_alg_name(cryptodev_crypto_blkcipher_tfm(out->async.s))) == 0;
+
+		cryptodev_crypto_blkcipher_keysizes(out->async.s,
+					&min_keysize, &max_keysize);
+		/* Was correct key length supplied? */
+		if (max_keysize > 0 &&
+				unlikely((keylen < min_keysize) ||
+				(keylen > max_keysize))) {
+			ddebug(1, "Wrong keylen '%zu' for algorithm '%s'. Use %u to %u.",
+					keylen, alg_name, min_keysize, max_keysize);
+			ret = -EINVAL;
+			goto error;
 		}
 
-		out->blocksize = crypto_ablkcipher_blocksize(out->async.s);
-		out->ivsize = crypto_ablkcipher_ivsize(out->async.s);
-		out->alignmask = crypto_ablkcipher_alignmask(out->async.s);
+		out->blocksize = cryptodev_crypto_blkcipher_blocksize(out->async.s);
+		out->ivsize = cryptodev_crypto_blkcipher_ivsize(out->async.s);
+		out->alignmask = cryptodev_crypto_blkcipher_alignmask(out->async.s);
+		reqsize = cryptodev_crypto_blkcipher_reqsize(out->async.s);
 
-		ret = crypto_ablkcipher_setkey(out->async.s, keyp, keylen);
+		ret = cryptodev_crypto_blkcipher_setkey(out->async.s, keyp, keylen);
 	} else {
-		out->async.as = crypto_alloc_aead(alg_name, 0, 0);
+		out->async.as = crypto_alloc_aead(alg_name, type, mask);
 		if (unlikely(IS_ERR(out->async.as))) {
 			ddebug(1, "Failed to load cipher %s", alg_name);
 			return -EINVAL;
@@ -169,6 +271,7 @@ int cryptodev_cipher_init(struct cipher_data *out, const char *alg_name,
 		out->blocksize = crypto_aead_blocksize(out->async.as);
 		out->ivsize = crypto_aead_ivsize(out->async.as);
 		out->alignmask = crypto_aead_alignmask(out->async.as);
+		reqsize = crypto_aead_reqsize(out->async.as);
 
 		ret = crypto_aead_setkey(out->async.as, keyp, keylen);
 	}
@@ -181,54 +284,40 @@ int cryptodev_cipher_init(struct cipher_data *out, const char *alg_name,
 
 	out->stream = stream;
 	out->aead = aead;
-
-	out->async.result = kzalloc(sizeof(*out->async.result), GFP_KERNEL);
-	if (unlikely(!out->async.result)) {
-		ret = -ENOMEM;
-		goto error;
-	}
-
-	init_completion(&out->async.result->completion);
+	out->node = node;
+	out->async.assoc = NULL;
+	out->async.assoclen = 0;
+	out->on_stack = !tfm_is_async(cryptodev_cipher_tfm(out)) &&
+			reqsize <= CRYPTODEV_MAX_STACK_REQSIZE;
 
 	if (aead == 0) {
-		out->async.request = ablkcipher_request_alloc(out->async.s, GFP_KERNEL);
+		out->async.request = alloc_cipher_request(out->async.s,
+						&out->async.result, node);
 		if (unlikely(!out->async.request)) {
 			derr(1, "error allocating async crypto request");
 			ret = -ENOMEM;
 			goto error;
 		}
-
-		ablkcipher_request_set_callback(out->async.request,
-					CRYPTO_TFM_REQ_MAY_BACKLOG,
-					cryptodev_complete, out->async.result);
 	} else {
-		out->async.arequest = aead_request_alloc(out->async.as, GFP_KERNEL);
+		out->async.arequest = alloc_aead_request(out->async.as,
+						&out->async.result, node);
 		if (unlikely(!out->async.arequest)) {
 			derr(1, "error allocating async crypto request");
 			ret = -ENOMEM;
 			goto error;
 		}
-
-		aead_request_set_callback(out->async.arequest,
-					CRYPTO_TFM_REQ_MAY_BACKLOG,
-					cryptodev_complete, out->async.result);
 	}
 
 	out->init = 1;
 	return 0;
 error:
 	if (aead == 0) {
-		if (out->async.request)
-			ablkcipher_request_free(out->async.request);
 		if (out->async.s)
-			crypto_free_ablkcipher(out->async.s);
+			cryptodev_crypto_free_blkcipher(out->async.s);
 	} else {
-		if (out->async.arequest)
-			aead_request_free(out->async.arequest);
 		if (out->async.as)
 			crypto_free_aead(out->async.as);
 	}
-	kfree(out->async.result);
 
 	return ret;
 }
@@ -236,31 +325,91 @@ error:
 void cryptodev_cipher_deinit(struct cipher_data *cdata)
 {
 	if (cdata->init) {
+		/* the request goes with it */
+		cryptodev_result_free(cdata->async.result);
+
 		if (cdata->aead == 0) {
-			if (cdata->async.request)
-				ablkcipher_request_free(cdata->async.request);
-			if (cdata->async.s)
-				crypto_free_ablkcipher(cdata->async.s);
+			if (cdata->async.s && cdata->pooled)
+				cryptodev_free_blkcipher(cdata->async.s);
+			else if (cdata->async.s)
+				cryptodev_crypto_free_blkcipher(cdata->async.s);
 		} else {
-			if (cdata->async.arequest)
-				aead_request_free(cdata->async.arequest);
 			if (cdata->async.as)
 				crypto_free_aead(cdata->async.as);
 		}
 
-		kfree(cdata->async.result);
 		cdata->init = 0;
 	}
 }
 
-static inline int waitfor(struct cryptodev_result *cr, ssize_t ret)
+/* Set up out to use the transform of cdata with a request of its own,
+ * so that both can be used at the same time. Block ciphers only. */
+int cryptodev_cipher_clone(struct cipher_data *out,
+			const struct cipher_data *cdata)
 {
+	*out = *cdata;
+	out->init = 0;
+	if (cdata->init == 0)
+		return 0;
+
+	out->async.request = alloc_cipher_request(out->async.s,
+					&out->async.result, out->node);
+	if (unlikely(!out->async.request)) {
+		derr(1, "error allocating async crypto request");
+		return -ENOMEM;
+	}
+
+	out->init = 1;
+	return 0;
+}
+
+/* the transform belongs to the original */
+void cryptodev_cipher_clone_deinit(struct cipher_data *cdata)
+{
+	if (cdata->init) {
+		cryptodev_result_free(cdata->async.result);
+		cdata->init = 0;
+	}
+}
+
+/* Whether cr completed within cryptodev_poll_ns of start */
+static int poll_for(struct cryptodev_result *cr, ktime_t start)
+{
+	unsigned int poll_ns = ACCESS_ONCE(cryptodev_poll_ns);
+
+	if (!poll_ns)
+		return 0;
+
+	do {
+		if (try_wait_for_completion(&cr->completion)) {
+			cryptodev_stat_inc(NULL, CRYPTODEV_STAT_POLLED);
+			return 1;
+		}
+		cpu_relax();
+	} while (!need_resched() &&
+		 ktime_to_ns(ktime_sub(ktime_get(), start)) < poll_ns);
+
+	return 0;
+}
+
+static inline int waitfor(struct cryptodev_result *cr, struct crypto_tfm *tfm,
+			ssize_t ret)
+{
+	ktime_t start;
+
 	switch (ret) {
 	case 0:
 		break;
 	case -EINPROGRESS:
 	case -EBUSY:
-		wait_for_completion(&cr->completion);
+		trace_cryptodev_wait_start(tfm, 0);
+		start = ktime_get();
+		if (!poll_for(cr, start))
+			wait_for_completion(&cr->completion);
+		cryptodev_stat_inc(NULL, CRYPTODEV_STAT_WAITS);
+		cryptodev_stat_add(NULL, CRYPTODEV_STAT_WAIT_NS,
+			ktime_to_ns(ktime_sub(ktime_get(), start)));
+		trace_cryptodev_wait_done(tfm, cr->err);
 		/* At this point we known for sure the request has finished,
 		 * because wait_for_completion above was not interruptible.
 		 * This is important because otherwise hardware or driver
@@ -280,63 +429,165 @@ static inline int waitfor(struct cryptodev_result *cr, ssize_t ret)
 	return 0;
 }
 
-ssize_t cryptodev_cipher_encrypt(struct cipher_data *cdata,
+static int cipher_run(struct cipher_data *cdata,
+		cryptodev_blkcipher_request_t *req, int encrypt,
 		const struct scatterlist *src, struct scatterlist *dst,
 		size_t len)
 {
-	int ret;
+	cryptodev_blkcipher_request_set_crypt(req, (struct scatterlist *)src,
+			dst, len, cdata->async.iv);
+	if (encrypt)
+		return cryptodev_crypto_blkcipher_encrypt(req);
+	else
+		return cryptodev_crypto_blkcipher_decrypt(req);
+}
 
+static int aead_run(struct cipher_data *cdata, struct aead_request *req,
+		int encrypt, const struct scatterlist *src,
+		struct scatterlist *dst, size_t len)
+{
+	/* for some reason we _have_ to call that even for zero length sgs */
+	aead_request_set_assoc(req, cdata->async.assoc, cdata->async.assoclen);
+	aead_request_set_crypt(req, (struct scatterlist *)src, dst,
+			len, cdata->async.iv);
+	if (encrypt)
+		return crypto_aead_encrypt(req);
+	else
+		return crypto_aead_decrypt(req);
+}
+
+/* Start an operation on the request of cdata without waiting for it.
+ * What this returns is to be given to cryptodev_cipher_wait(), and the
+ * request must not be used until then. */
+int cryptodev_cipher_submit(struct cipher_data *cdata, int encrypt,
+		const struct scatterlist *src, struct scatterlist *dst,
+		size_t len)
+{
 	reinit_completion(&cdata->async.result->completion);
 
+	if (cdata->aead == 0)
+		return cipher_run(cdata, cdata->async.request, encrypt,
+				src, dst, len);
+	else
+		return aead_run(cdata, cdata->async.arequest, encrypt,
+				src, dst, len);
+}
+
+ssize_t cryptodev_cipher_wait(struct cipher_data *cdata, int ret)
+{
+	return waitfor(cdata->async.result,
+			cryptodev_cipher_tfm(cdata), ret);
+}
+
+/* A synchronous transform has finished by the time it returns; its
+ * request goes on the stack, and there is no completion to wait for. */
+static ssize_t cipher_run_on_stack(struct cipher_data *cdata, int encrypt,
+		const struct scatterlist *src, struct scatterlist *dst,
+		size_t len)
+{
+	ssize_t ret;
+
 	if (cdata->aead == 0) {
-		ablkcipher_request_set_crypt(cdata->async.request,
-			(struct scatterlist *)src, dst,
-			len, cdata->async.iv);
-		ret = crypto_ablkcipher_encrypt(cdata->async.request);
+		CRYPTODEV_REQUEST_ON_STACK(req, cryptodev_blkcipher_request_t);
+
+		cryptodev_blkcipher_request_set_tfm(req, cdata->async.s);
+		cryptodev_blkcipher_request_set_callback(req, 0, NULL, NULL);
+		ret = cipher_run(cdata, req, encrypt, src, dst, len);
+		memzero_explicit(req, sizeof(*req) +
+			cryptodev_crypto_blkcipher_reqsize(cdata->async.s));
 	} else {
-		aead_request_set_crypt(cdata->async.arequest,
-			(struct scatterlist *)src, dst,
-			len, cdata->async.iv);
-		ret = crypto_aead_encrypt(cdata->async.arequest);
+		CRYPTODEV_REQUEST_ON_STACK(req, struct aead_request);
+
+		aead_request_set_tfm(req, cdata->async.as);
+		aead_request_set_callback(req, 0, NULL, NULL);
+		ret = aead_run(cdata, req, encrypt, src, dst, len);
+		memzero_explicit(req, sizeof(*req) +
+			crypto_aead_reqsize(cdata->async.as));
 	}
 
-	return waitfor(cdata->async.result, ret);
+	if (unlikely(ret))
+		derr(0, "error from sync request: %zd", ret);
+	return ret;
+}
+
+ssize_t cryptodev_cipher_encrypt(struct cipher_data *cdata,
+		const struct scatterlist *src, struct scatterlist *dst,
+		size_t len)
+{
+	if (cdata->on_stack)
+		return cipher_run_on_stack(cdata, 1, src, dst, len);
+
+	return cryptodev_cipher_wait(cdata,
+			cryptodev_cipher_submit(cdata, 1, src, dst, len));
 }
 
 ssize_t cryptodev_cipher_decrypt(struct cipher_data *cdata,
 		const struct scatterlist *src, struct scatterlist *dst,
 		size_t len)
 {
-	int ret;
+	if (cdata->on_stack)
+		return cipher_run_on_stack(cdata, 0, src, dst, len);
 
-	reinit_completion(&cdata->async.result->completion);
-	if (cdata->aead == 0) {
-		ablkcipher_request_set_crypt(cdata->async.request,
-			(struct scatterlist *)src, dst,
-			len, cdata->async.iv);
-		ret = crypto_ablkcipher_decrypt(cdata->async.request);
-	} else {
-		aead_request_set_crypt(cdata->async.arequest,
-			(struct scatterlist *)src, dst,
-			len, cdata->async.iv);
-		ret = crypto_aead_decrypt(cdata->async.arequest);
+	return cryptodev_cipher_wait(cdata,
+			cryptodev_cipher_submit(cdata, 0, src, dst, len));
+}
+
+/* Allocate a request for cryptodev_cipher_start(). Unlike the one of
+ * cdata it is not waited for; done() is called (possibly in interrupt
+ * context) when an operation that did not complete synchronously is
+ * finished. Block ciphers only. */
+cryptodev_blkcipher_request_t *
+cryptodev_cipher_request_alloc(struct cipher_data *cdata,
+			crypto_completion_t done, void *data)
+{
+	cryptodev_blkcipher_request_t *req;
+
+	/* as ablkcipher_request_alloc(), on the node of cdata */
+	req = kmalloc_node(sizeof(*req) +
+			cryptodev_crypto_blkcipher_reqsize(cdata->async.s),
+			GFP_KERNEL, cdata->node);
+	if (unlikely(!req)) {
+		derr(1, "error allocating async crypto request");
+		return NULL;
 	}
 
-	return waitfor(cdata->async.result, ret);
+	cryptodev_blkcipher_request_set_tfm(req, cdata->async.s);
+	cryptodev_blkcipher_request_set_callback(req,
+				CRYPTO_TFM_REQ_MAY_BACKLOG, done, data);
+	return req;
+}
+
+/* Start an encryption or decryption; iv is updated in place. Returns
+ * the value of CryptoAPI, i.e. -EINPROGRESS or -EBUSY if the request
+ * has been queued. */
+int cryptodev_cipher_start(cryptodev_blkcipher_request_t *req, int encrypt,
+			struct scatterlist *src, struct scatterlist *dst,
+			size_t len, void *iv)
+{
+	cryptodev_blkcipher_request_set_crypt(req, src, dst, len, iv);
+
+	if (encrypt)
+		return cryptodev_crypto_blkcipher_encrypt(req);
+	else
+		return cryptodev_crypto_blkcipher_decrypt(req);
 }
 
 /* Hash functions */
 
+/* alg_name, type, mask and node as for cryptodev_cipher_init() */
 int cryptodev_hash_init(struct hash_data *hdata, const char *alg_name,
-			int hmac_mode, void *mackey, size_t mackeylen)
+			u32 type, u32 mask,
+			int hmac_mode, void *mackey, size_t mackeylen, int node)
 {
 	int ret;
 
-	hdata->async.s = crypto_alloc_ahash(alg_name, 0, 0);
+	hdata->async.s = cryptodev_alloc_ahash(alg_name, type, mask);
 	if (unlikely(IS_ERR(hdata->async.s))) {
 		ddebug(1, "Failed to load transform for %s", alg_name);
 		return -EINVAL;
 	}
+	hdata->pooled = !type && !mask && strcmp(alg_name,
+			crypto_tfm_alg_name(crypto_ahash_tfm(hdata->async.s))) == 0;
 
 	/* Copy the key from user and set to TFM. */
 	if (hmac_mode != 0) {
@@ -351,26 +602,18 @@ int cryptodev_hash_init(struct hash_data *hdata, const char *alg_name,
 
 	hdata->digestsize = crypto_ahash_digestsize(hdata->async.s);
 	hdata->alignmask = crypto_ahash_alignmask(hdata->async.s);
+	hdata->on_stack = !tfm_is_async(crypto_ahash_tfm(hdata->async.s)) &&
+		crypto_ahash_reqsize(hdata->async.s) <= CRYPTODEV_MAX_STACK_REQSIZE;
 
-	hdata->async.result = kzalloc(sizeof(*hdata->async.result), GFP_KERNEL);
-	if (unlikely(!hdata->async.result)) {
-		ret = -ENOMEM;
-		goto error;
-	}
-
-	init_completion(&hdata->async.result->completion);
-
-	hdata->async.request = ahash_request_alloc(hdata->async.s, GFP_KERNEL);
+	hdata->node = node;
+	hdata->async.request = alloc_hash_request(hdata->async.s,
+					&hdata->async.result, node);
 	if (unlikely(!hdata->async.request)) {
 		derr(0, "error allocating async crypto request");
 		ret = -ENOMEM;
 		goto error;
 	}
 
-	ahash_request_set_callback(hdata->async.request,
-			CRYPTO_TFM_REQ_MAY_BACKLOG,
-			cryptodev_complete, hdata->async.result);
-
 	ret = crypto_ahash_init(hdata->async.request);
 	if (unlikely(ret)) {
 		derr(0, "error in crypto_hash_init()");
@@ -381,9 +624,8 @@ int cryptodev_hash_init(struct hash_data *hdata, const char *alg_name,
 	return 0;
 
 error_request:
-	ahash_request_free(hdata->async.request);
+	cryptodev_result_free(hdata->async.result);
 error:
-	kfree(hdata->async.result);
 	crypto_free_ahash(hdata->async.s);
 	return ret;
 }
@@ -391,15 +633,45 @@ error:
 void cryptodev_hash_deinit(struct hash_data *hdata)
 {
 	if (hdata->init) {
-		if (hdata->async.request)
-			ahash_request_free(hdata->async.request);
-		kfree(hdata->async.result);
-		if (hdata->async.s)
+		/* the request goes with it */
+		cryptodev_result_free(hdata->async.result);
+		if (hdata->async.s && hdata->pooled)
+			cryptodev_free_ahash(hdata->async.s);
+		else if (hdata->async.s)
 			crypto_free_ahash(hdata->async.s);
 		hdata->init = 0;
 	}
 }
 
+/* The hash counterpart of cryptodev_cipher_clone(). The state of the
+ * clone is undefined until cryptodev_hash_reset(). */
+int cryptodev_hash_clone(struct hash_data *out, const struct hash_data *hdata)
+{
+	*out = *hdata;
+	out->init = 0;
+	if (hdata->init == 0)
+		return 0;
+
+	out->async.request = alloc_hash_request(out->async.s,
+					&out->async.result, out->node);
+	if (unlikely(!out->async.request)) {
+		derr(0, "error allocating async crypto request");
+		return -ENOMEM;
+	}
+
+	out->init = 1;
+	return 0;
+}
+
+/* the transform belongs to the original */
+void cryptodev_hash_clone_deinit(struct hash_data *hdata)
+{
+	if (hdata->init) {
+		cryptodev_result_free(hdata->async.result);
+		hdata->init = 0;
+	}
+}
+
 int cryptodev_hash_reset(struct hash_data *hdata)
 {
 	int ret;
@@ -424,7 +696,70 @@ ssize_t cryptodev_hash_update(struct hash_data *hdata,
 
 	ret = crypto_ahash_update(hdata->async.request);
 
-	return waitfor(hdata->async.result, ret);
+	return waitfor(hdata->async.result,
+			crypto_ahash_tfm(hdata->async.s), ret);
+}
+
+/* Allocate a request for cryptodev_hash_start(), which is not waited
+ * for; see cryptodev_cipher_request_alloc() */
+struct ahash_request *
+cryptodev_hash_request_alloc(struct hash_data *hdata,
+			crypto_completion_t done, void *data)
+{
+	struct ahash_request *req;
+
+	req = kmalloc_node(sizeof(*req) + crypto_ahash_reqsize(hdata->async.s),
+			GFP_KERNEL, hdata->node);
+	if (unlikely(!req)) {
+		derr(1, "error allocating async crypto request");
+		return NULL;
+	}
+
+	ahash_request_set_tfm(req, hdata->async.s);
+
+	ahash_request_set_callback(req, CRYPTO_TFM_REQ_MAY_BACKLOG,
+				done, data);
+	return req;
+}
+
+/* Start the digest of len bytes of sg into output, see
+ * cryptodev_cipher_start() */
+int cryptodev_hash_start(struct ahash_request *req, struct scatterlist *sg,
+			size_t len, void *output)
+{
+	ahash_request_set_crypt(req, sg, output, len);
+	return crypto_ahash_digest(req);
+}
+
+/* init, update and final in one request, which for HMAC starts from
+ * the inner and outer states that the transform keeps since setkey.
+ * The request of hdata is left alone when it goes on the stack. */
+int cryptodev_hash_digest(struct hash_data *hdata, struct scatterlist *sg,
+			size_t len, void *output)
+{
+	int ret;
+
+	if (hdata->on_stack) {
+		CRYPTODEV_REQUEST_ON_STACK(req, struct ahash_request);
+
+		ahash_request_set_tfm(req, hdata->async.s);
+		ahash_request_set_callback(req, 0, NULL, NULL);
+		ahash_request_set_crypt(req, sg, output, len);
+		ret = crypto_ahash_digest(req);
+		memzero_explicit(req, sizeof(*req) +
+				crypto_ahash_reqsize(hdata->async.s));
+		if (unlikely(ret))
+			derr(0, "error from sync request: %d", ret);
+		return ret;
+	}
+
+	reinit_completion(&hdata->async.result->completion);
+	ahash_request_set_crypt(hdata->async.request, sg, output, len);
+
+	ret = crypto_ahash_digest(hdata->async.request);
+
+	return waitfor(hdata->async.result,
+			crypto_ahash_tfm(hdata->async.s), ret);
 }
 
 int cryptodev_hash_final(struct hash_data *hdata, void *output)
@@ -436,6 +771,7 @@ int cryptodev_hash_final(struct hash_data *hdata, void *output)
 
 	ret = crypto_ahash_final(hdata->async.request);
 
-	return waitfor(hdata->async.result, ret);
+	return waitfor(hdata->async.result,
+			crypto_ahash_tfm(hdata->async.s), ret);
 }
 
@@ -8,23 +8,38 @@ struct cipher_data {
 	int stream;
 	int ivsize;
 	int alignmask;
+	/* the transform goes back to the pool of tfm_pool.c */
+	int pooled;
+	/* the transform is synchronous, and its requests fit on the stack */
+	int on_stack;
+	/* the NUMA node of its requests */
+	int node;
 	struct {
 		/* block ciphers */
-		struct crypto_ablkcipher *s;
-		struct ablkcipher_request *request;
+		cryptodev_crypto_blkcipher_t *s;
+		cryptodev_blkcipher_request_t *request;
 
 		/* AEAD ciphers */
 		struct crypto_aead *as;
 		struct aead_request *arequest;
+		/* the associated data of the next operation */
+		struct scatterlist *assoc;
+		unsigned int assoclen;
 
+		/* the request is in the same allocation */
 		struct cryptodev_result *result;
 		uint8_t iv[EALG_MAX_BLOCK_LEN];
 	} async;
 };
 
 int cryptodev_cipher_init(struct cipher_data *out, const char *alg_name,
-			  uint8_t *key, size_t keylen, int stream, int aead);
+			  u32 type, u32 mask,
+			  uint8_t *key, size_t keylen, int stream, int aead,
+			  int node);
 void cryptodev_cipher_deinit(struct cipher_data *cdata);
+int cryptodev_cipher_clone(struct cipher_data *out,
+			const struct cipher_data *cdata);
+void cryptodev_cipher_clone_deinit(struct cipher_data *cdata);
 int cryptodev_get_cipher_key(uint8_t *key, struct session_op *sop, int aead);
 int cryptodev_get_cipher_keylen(unsigned int *keylen, struct session_op *sop,
 		int aead);
@@ -34,13 +49,44 @@ ssize_t cryptodev_cipher_decrypt(struct cipher_data *cdata,
 ssize_t cryptodev_cipher_encrypt(struct cipher_data *cdata,
 				const struct scatterlist *sg1,
 				struct scatterlist *sg2, size_t len);
+int cryptodev_cipher_submit(struct cipher_data *cdata, int encrypt,
+				const struct scatterlist *src,
+				struct scatterlist *dst, size_t len);
+ssize_t cryptodev_cipher_wait(struct cipher_data *cdata, int ret);
 
-/* AEAD */
+/* Requests of their own, to start operations without waiting for them */
+cryptodev_blkcipher_request_t *
+cryptodev_cipher_request_alloc(struct cipher_data *cdata,
+			crypto_completion_t done, void *data);
+int cryptodev_cipher_start(cryptodev_blkcipher_request_t *req, int encrypt,
+			struct scatterlist *src, struct scatterlist *dst,
+			size_t len, void *iv);
+
+static inline void
+cryptodev_cipher_request_free(cryptodev_blkcipher_request_t *req)
+{
+	cryptodev_blkcipher_request_free(req);
+}
+
+static inline int tfm_is_async(struct crypto_tfm *tfm)
+{
+	return tfm->__crt_alg->cra_flags & CRYPTO_ALG_ASYNC;
+}
+
+static inline struct crypto_tfm *cryptodev_cipher_tfm(struct cipher_data *cdata)
+{
+	if (cdata->aead == 0)
+		return cryptodev_crypto_blkcipher_tfm(cdata->async.s);
+	else
+		return crypto_aead_tfm(cdata->async.as);
+}
+
+/* AEAD: the associated data of the next encryption or decryption */
 static inline void cryptodev_cipher_auth(struct cipher_data *cdata,
 					 struct scatterlist *sg1, size_t len)
 {
-	/* for some reason we _have_ to call that even for zero length sgs */
-	aead_request_set_assoc(cdata->async.arequest, len ? sg1 : NULL, len);
+	cdata->async.assoc = len ? sg1 : NULL;
+	cdata->async.assoclen = len;
 }
 
 static inline void cryptodev_cipher_set_tag_size(struct cipher_data *cdata, int size)
@@ -74,20 +120,43 @@ struct hash_data {
 	int init; /* 0 uninitialized */
 	int digestsize;
 	int alignmask;
+	/* the transform goes back to the pool of tfm_pool.c */
+	int pooled;
+	/* as for cipher_data, for cryptodev_hash_digest() */
+	int on_stack;
+	int node;
 	struct {
 		struct crypto_ahash *s;
+		/* the request is in the same allocation */
 		struct cryptodev_result *result;
 		struct ahash_request *request;
 	} async;
 };
 
 int cryptodev_hash_final(struct hash_data *hdata, void *output);
+int cryptodev_hash_digest(struct hash_data *hdata, struct scatterlist *sg,
+			size_t len, void *output);
 ssize_t cryptodev_hash_update(struct hash_data *hdata,
 			struct scatterlist *sg, size_t len);
 int cryptodev_hash_reset(struct hash_data *hdata);
 void cryptodev_hash_deinit(struct hash_data *hdata);
 int cryptodev_hash_init(struct hash_data *hdata, const char *alg_name,
-			int hmac_mode, void *mackey, size_t mackeylen);
+			u32 type, u32 mask,
+			int hmac_mode, void *mackey, size_t mackeylen, int node);
+int cryptodev_hash_clone(struct hash_data *out, const struct hash_data *hdata);
+
+/* Requests of their own, to start digests without waiting for them */
+struct ahash_request *
+cryptodev_hash_request_alloc(struct hash_data *hdata,
+			crypto_completion_t done, void *data);
+int cryptodev_hash_start(struct ahash_request *req, struct scatterlist *sg,
+			size_t len, void *output);
+
+static inline void cryptodev_hash_request_free(struct ahash_request *req)
+{
+	ahash_request_free(req);
+}
+void cryptodev_hash_clone_deinit(struct hash_data *hdata);
 
 
 #endif
@@ -91,6 +91,96 @@ struct session_op {
 	__u32	ses;		/* session identifier */
 };
 
+/* input of CIOCGSESSION2: a session with the options below */
+struct session2_op {
+	struct session_op sop;
+
+	__u32	flags;		/* see SOP_FLAG_* */
+	/* the first IV of an SOP_FLAG_IV_* session, all zeros if NULL */
+	__u8	__user *iv;
+	/* the transforms of an SOP_FLAG_TFM_SHARDS session */
+	__u32	shards;
+	/* the drivers (cra_driver_name) of an SOP_FLAG_DRIVER session */
+	char	cipher_driver[CRYPTODEV_MAX_ALG_NAME];
+	char	hash_driver[CRYPTODEV_MAX_ALG_NAME];
+	/* the NUMA node of an SOP_FLAG_NUMA_NODE session */
+	__s32	node;
+};
+
+/* The IVs of the session are generated by the module, and the iv of
+ * an operation is only written with the IV used, when it is set along
+ * with COP_FLAG_WRITE_IV. This is meant for counter modes (CTR, GCM),
+ * and is refused for the others.
+ *
+ * SOP_FLAG_IV_COUNTER: the IV is a big endian counter of IV sized
+ *  blocks, so that each operation continues the key stream of the
+ *  previous one. An empty operation advances it by one.
+ * SOP_FLAG_IV_SEQNUM: the IV is a salt followed by a big endian 64-bit
+ *  sequence number, which is incremented by one on each operation.
+ *  Only for AEAD ciphers, whose block counter is not part of the IV.
+ */
+#define SOP_FLAG_IV_COUNTER	(1 << 0)
+#define SOP_FLAG_IV_SEQNUM	(1 << 1)
+
+/* SOP_FLAG_TFM_SHARDS: the operations that run on the session at the same
+ * time get transforms of their own, keyed like the one of the session,
+ * instead of sharing it. This is for drivers that serialize the requests
+ * on a transform. shards is the number of transforms besides the one of
+ * the session, or 0 for one per CPU; more operations than that at a time
+ * share them. Not for AEAD ciphers. Those of all the sessions of a file
+ * descriptor are limited, and a session past the limit fails with ENOSPC.
+ */
+#define SOP_FLAG_TFM_SHARDS	(1 << 2)
+
+/* Which implementation of its algorithms the session uses. Without
+ * these the one of highest priority is used. At most one is set.
+ *
+ * SOP_FLAG_DRIVER: the drivers named by cipher_driver and hash_driver,
+ *  which have to implement the algorithms of the session. An empty name
+ *  leaves the choice of that driver to the kernel.
+ * SOP_FLAG_PREFER_SYNC: a synchronous implementation (software, SIMD)
+ *  if there is one, the usual one otherwise.
+ * SOP_FLAG_PREFER_ASYNC: an asynchronous implementation (offload engines)
+ *  if there is one, the usual one otherwise.
+ * SOP_FLAG_DRIVER_AUTO: both, when the usual implementation is
+ *  asynchronous. The operations that need no state of the previous ones
+ *  run on the synchronous one up to the size where the other gets faster.
+ *  That is timed by the first session of the pair of drivers, and again
+ *  by CIOCCALIBRATE. Not for AEAD ciphers.
+ *
+ * CIOCGSESSINFO tells the drivers in use.
+ */
+#define SOP_FLAG_DRIVER		(1 << 3)
+#define SOP_FLAG_PREFER_SYNC	(1 << 4)
+#define SOP_FLAG_PREFER_ASYNC	(1 << 5)
+#define SOP_FLAG_DRIVER_AUTO	(1 << 6)
+
+/* SOP_FLAG_SRTP: an AES-CTR and HMAC session of one SRTP stream (SSRC),
+ * for CIOCSRTPMULTI. iv has the 14 bytes of the session salt. The module
+ * keeps the rollover counter, and derives the IV of each packet from the
+ * salt, the SSRC and the index of the packet (RFC 3711, 4.1.1).
+ */
+#define SOP_FLAG_SRTP		(1 << 7)
+
+/* SOP_FLAG_NUMA_NODE: the session, its requests and its buffers are
+ * allocated on node, and the asynchronous operations on it are queued
+ * to CPUs of node. Without it that is the node of the CPU that creates
+ * the session. The kernel does not tell which device serves a
+ * transform, so this is how to keep the work of a session near its
+ * offload engine (see /sys/bus/pci/devices/.../numa_node).
+ */
+#define SOP_FLAG_NUMA_NODE	(1 << 8)
+
+/* SOP_FLAG_INTERACTIVE: the asynchronous jobs on the session go ahead of
+ * the jobs of the other sessions queued on the file descriptor: they
+ * start as soon as the job that is running ends, and may be fetched as
+ * soon as they are done. The jobs of a session still run and are fetched
+ * in order, and the others are still fetched in the order they were
+ * queued. Meant for small operations that should not wait behind bulk
+ * ones.
+ */
+#define SOP_FLAG_INTERACTIVE	(1 << 9)
+
 struct session_info_op {
 	__u32 ses;		/* session identifier */
 
@@ -204,6 +294,385 @@ struct crypt_auth_op {
  */
 
 
+/* input of CIOCCRYPTMULTI and CIOCAUTHCRYPTMULTI.
+ *  count   : the number of entries in ops and status
+ *  ops     : an array of struct crypt_op (CIOCCRYPTMULTI) or struct
+ *            crypt_auth_op (CIOCAUTHCRYPTMULTI). Each entry is treated
+ *            exactly as if it was passed to CIOCCRYPT or CIOCAUTHCRYPT
+ *            and it is updated in the same way.
+ *  status  : receives the result of each operation; 0 on success
+ *            or a negative error code.
+ *
+ * The operations are run in order. The ioctl itself only fails
+ * if the arrays cannot be accessed; the outcome of each operation
+ * has to be checked in status.
+ */
+struct crypt_multi_op {
+	__u32	count;
+	__u32	flags;		/* unused, must be zero */
+	void	__user *ops;
+	__s32	__user *status;
+};
+
+/* A job fetched by CIOCASYNCFETCHV: its crypt_op as CIOCASYNCFETCH passes
+ * it back, and what CIOCASYNCFETCH would have returned. The crypt_op is
+ * only written back for the jobs that succeeded. */
+struct crypt_async_done {
+	struct crypt_op cop;
+	__s32	result;
+	__u32	__reserved;
+};
+
+/* input of CIOCASYNCFETCHV. It fails with EBUSY if no job is ready
+ * yet, and otherwise sets count to the jobs fetched. It fails with
+ * EFAULT, before fetching any job, if done cannot be written. A job
+ * whose crypt_op cannot be written back has EFAULT as its result. */
+struct crypt_fetch_op {
+	__u32	count;		/* in: the room in done; out: the jobs fetched */
+	__u32	flags;		/* unused, must be zero */
+	struct crypt_async_done __user *done;
+};
+
+/* the maximum number of operations in a single CIOC*MULTI call */
+#define CRYPTODEV_MAX_MULTI_OPS	256
+
+/* Shared submission and completion rings.
+ *
+ * CIOCRINGSETUP creates an area that holds a ring of submission
+ * entries and a ring of completion entries, to be mapped with
+ * mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0).
+ * The area starts with a struct crypt_ring, and the entries are
+ * at sq_off and cq_off respectively.
+ *
+ * To submit, fill in crypt_ring_sqe[sq_tail & mask] and then advance
+ * sq_tail. CIOCRINGENTER (or polling for POLLIN after CIOCRINGENTER)
+ * makes the kernel run all the submitted entries. For each one
+ * a crypt_ring_cqe is written at cq_tail; it is consumed by advancing
+ * cq_head. The crypt_op of a submission entry is handled as in
+ * CIOCASYNCCRYPT except that it is not written back; the result is
+ * in the completion entry.
+ *
+ * Only native (not compat) userland can use the rings because the
+ * entries contain pointers.
+ */
+struct crypt_ring_params {
+	__u32	entries;	/* in: requested ring size; out: actual size */
+	__u32	flags;		/* unused, must be zero */
+	__u32	size;		/* out: size of the area to mmap() */
+	__u32	sq_off;		/* out: offset of the submission entries */
+	__u32	cq_off;		/* out: offset of the completion entries */
+};
+
+struct crypt_ring {
+	__u32	sq_head;	/* written by the kernel */
+	__u32	sq_tail;	/* written by userspace */
+	__u32	cq_head;	/* written by userspace */
+	__u32	cq_tail;	/* written by the kernel */
+	__u32	mask;		/* entries - 1, for both rings */
+};
+
+struct crypt_ring_sqe {
+	struct crypt_op cop;
+	__u64	user_data;	/* copied to the completion entry */
+};
+
+struct crypt_ring_cqe {
+	__u64	user_data;
+	__s32	result;		/* 0 or a negative error code */
+	__u32	pad;
+};
+
+/* a segment of the data of CIOCCRYPTV and CIOCAUTHCRYPTV */
+struct crypt_iovec {
+	__u8	__user *base;
+	__u32	len;
+};
+
+/* the maximum number of segments of src or dst */
+#define CRYPTODEV_MAX_IOV	64
+
+/* input of CIOCCRYPTV.
+ *  cop     : as for CIOCCRYPT, except that its src and dst are ignored
+ *  src     : the segments holding the source data; their first cop.len
+ *            bytes are used
+ *  dst     : the segments to hold the output data. Use the same array
+ *            as src for in-place operation.
+ *
+ * The segments are always accessed in place (zero-copy), and cop is
+ * updated as for CIOCCRYPT.
+ */
+struct crypt_iov_op {
+	struct crypt_op	cop;
+	__u32	src_count;	/* the number of entries in src */
+	__u32	dst_count;	/* the number of entries in dst */
+	struct crypt_iovec	__user *src;
+	struct crypt_iovec	__user *dst;
+};
+
+/* input of CIOCAUTHCRYPTV. That is CIOCAUTHCRYPT in plain AEAD mode
+ * (the TLS and SRTP modes are not available) with src and dst given
+ * as in struct crypt_iov_op. As with CIOCAUTHCRYPT, encryption writes
+ * the tag to dst right after the data, and decryption reads it from the
+ * last bytes of src; either way it can be in a segment of its own.
+ * caop.tag is not updated.
+ */
+struct crypt_auth_iov_op {
+	struct crypt_auth_op	caop;
+	__u32	src_count;	/* the number of entries in src */
+	__u32	dst_count;	/* the number of entries in dst */
+	struct crypt_iovec	__user *src;
+	struct crypt_iovec	__user *dst;
+};
+
+/* input of CIOCHASHMULTI: the digests (or MACs) of many independent
+ * buffers, with a single session.
+ *  ses     : a session with a mac and no cipher
+ *  count   : the number of buffers, at most CRYPTODEV_MAX_MULTI_OPS
+ *  bufs    : the buffers
+ *  digests : receives count digests of the session's size, one after
+ *            the other
+ *
+ * The buffers are hashed concurrently, so that drivers that hash several
+ * at once (sha1_mb, sha256_mb, hardware engines) are kept busy. Unlike
+ * those of CIOCCRYPTMULTI the ioctl fails as a whole if a buffer fails.
+ */
+struct crypt_hash_multi_op {
+	__u32	ses;
+	__u32	count;
+	struct crypt_iovec __user *bufs;
+	__u8	__user *digests;
+};
+
+/* input of CIOCCIPHERMULTI: many independent buffers encrypted or
+ * decrypted with a single session, each with an IV of its own.
+ *  ses     : a session with a cipher and no mac (not AEAD)
+ *  op      : COP_ENCRYPT or COP_DECRYPT
+ *  flags   : COP_FLAG_WRITE_IV to write back to ivs the IV that each
+ *            buffer left, or 0
+ *  count   : the number of buffers, at most CRYPTODEV_MAX_MULTI_OPS
+ *  src     : the buffers
+ *  dst     : where each buffer goes, of the same length as in src; NULL
+ *            to work in place
+ *  ivs     : count IVs of the session's size, one after the other. On
+ *            a session with an SOP_FLAG_IV_* mode they are taken from
+ *            the session instead, ivs may be NULL, and with
+ *            COP_FLAG_WRITE_IV it receives the IVs used.
+ *
+ * The buffers are started together and run concurrently, so that CBC
+ * decryption and CTR on engines and on multi-buffer drivers handle them
+ * as one batch. As with CIOCHASHMULTI the ioctl fails as a whole if a
+ * buffer fails. The buffers are never copied, so that they are best
+ * aligned to the alignmask of CIOCGSESSINFO.
+ */
+struct crypt_cipher_multi_op {
+	__u32	ses;
+	__u16	op;
+	__u16	flags;
+	__u32	count;
+	__u32	__reserved;	/* must be zero */
+	struct crypt_iovec __user *src;
+	struct crypt_iovec __user *dst;
+	__u8	__user *ivs;
+};
+
+/* a record of CIOCTLSMULTI */
+struct crypt_tls_record {
+	/* the record, encrypted in place. To encrypt it needs room for
+	 * len + tag size + block size, as dst in TLS mode. */
+	__u8	__user *buf;
+	__u32	len;		/* in: length of the data; out: of the result */
+	__s32	status;		/* out: 0 or a negative errno */
+};
+
+/* input of CIOCTLSMULTI: records of one TLS connection that are run
+ * as one CIOCAUTHCRYPT each, with COP_FLAG_AEAD_TLS_TYPE, in one call.
+ *  ses     : a session with a block cipher and a mac
+ *  op      : COP_ENCRYPT or COP_DECRYPT
+ *  flags   : COP_FLAG_WRITE_IV to write back to iv the one the last
+ *            record left, or 0
+ *  count   : the number of records, at most CRYPTODEV_MAX_MULTI_OPS
+ *  type    : the content type of the records (e.g. 23, application data)
+ *  version : the protocol version (e.g. 0x0303 for TLS 1.2)
+ *  seq     : the sequence number of the first record; the others
+ *            follow it
+ *  records : the records
+ *  iv      : the IV of the first record, or NULL to carry on from the
+ *            session. Each record continues from the IV the previous
+ *            one left, as in TLS 1.0; with an explicit IV it is the
+ *            first block of the data.
+ *
+ * The associated data (seq, type, version and the length of the
+ * plaintext) are put together by the module. The records are pinned all
+ * at once; one that fails only sets its status, except for EFAULT,
+ * which ends the ioctl.
+ */
+struct crypt_tls_multi_op {
+	__u32	ses;
+	__u16	op;
+	__u16	flags;
+	__u32	count;
+	__u8	type;
+	__u8	__reserved;	/* must be zero */
+	__u16	version;
+	__u64	seq;
+	struct crypt_tls_record __user *records;
+	__u8	__user *iv;
+};
+
+/* a packet of CIOCSRTPMULTI */
+struct crypt_srtp_packet {
+	/* the RTP header and the payload, followed by the tag. To encrypt
+	 * it needs room for len + tag_len. */
+	__u8	__user *buf;
+	__u32	len;		/* in: the length of the packet, with the tag
+				 * to decrypt; out: with the tag once
+				 * encrypted, without it once decrypted */
+	__u16	hdr_len;	/* the length of the RTP header, at least 12 */
+	__u16	__reserved;	/* must be zero */
+	__s32	status;		/* out: 0 or a negative errno */
+	__u32	roc;		/* out: the rollover counter of the packet */
+};
+
+/* input of CIOCSRTPMULTI: packets of the stream of an SOP_FLAG_SRTP
+ * session, which are encrypted and authenticated the SRTP way in place.
+ *  ses     : an SOP_FLAG_SRTP session
+ *  op      : COP_ENCRYPT or COP_DECRYPT
+ *  flags   : unused, must be zero
+ *  count   : the number of packets, at most CRYPTODEV_MAX_MULTI_OPS
+ *  tag_len : the length of the tag (10 for HMAC-SHA1-80), zero for the
+ *            digest size
+ *  packets : the packets
+ *
+ * The index of each packet is estimated from its sequence number as in
+ * RFC 3711, 3.3.1, and the rollover counter is authenticated along with
+ * the packet. Decrypting only advances the counter once a packet is
+ * authenticated. Replays are not detected; that is up to the caller.
+ * The packets are pinned all at once; one that fails only sets its
+ * status, except for EFAULT, which ends the ioctl.
+ */
+struct crypt_srtp_multi_op {
+	__u32	ses;
+	__u16	op;
+	__u16	flags;
+	__u32	count;
+	__u32	tag_len;
+	struct crypt_srtp_packet __user *packets;
+};
+
+/* input of CIOCSTREAM, which binds the file descriptor to a session
+ * for read() and write().
+ *  ses     : a session with a cipher and no mac (not AEAD), or 0 to
+ *            end the stream
+ *  op      : COP_ENCRYPT or COP_DECRYPT
+ *  flags   : unused, must be zero
+ *  iv      : the IV to start from, or NULL for the one of the session.
+ *            When the stream is ended, where the IV it left is written,
+ *            if not NULL.
+ *
+ * What is written is encrypted or decrypted in whole blocks, to be read
+ * back. splice() and sendfile() move data in and out without a pass
+ * through userspace. At most CRYPTODEV_STREAM_BUF bytes are held: write()
+ * takes less, or fails with EAGAIN while that much waits to be read, and
+ * read() fails with EAGAIN when nothing is ready. While a stream is bound
+ * poll() tells of it instead of the asynchronous jobs: POLLIN when there
+ * is something to read, POLLOUT when there is room to write. Ending the
+ * stream processes the last partial block of a stream cipher (it fails
+ * with EINVAL for a block cipher); what has not been read can still be
+ * read afterwards, but not written to, and then the descriptor is
+ * unbound, and read() returns 0. Binding another session drops what is
+ * left. Streams need Linux 3.16 or later; before that CIOCSTREAM fails
+ * with ENOTTY.
+ */
+struct crypt_stream_op {
+	__u32	ses;
+	__u16	op;
+	__u16	flags;
+	__u8	__user *iv;
+};
+
+/* the most a CIOCSTREAM stream holds */
+#define CRYPTODEV_STREAM_BUF	(64 * 1024)
+
+/* input of CIOCCRYPTCHAIN: steps on different sessions that run one
+ * after the other over the same data, which are pinned once.
+ *  count   : the number of steps, at most CRYPTODEV_MAX_CHAIN
+ *  flags   : unused, must be zero
+ *  len     : the length of the data
+ *  src     : the data
+ *  dst     : the output of the cipher steps; may be the same as src
+ *  ops     : the steps. Their ses, op, flags, iv and mac are used as
+ *            with CIOCCRYPT, and they are updated in the same way;
+ *            their src, dst and len are set to those above.
+ *
+ * The first cipher step reads src and writes dst, and the steps after
+ * it work on dst. Hash steps read the data as left by the steps before
+ * them, so an encrypt-then-MAC is a cipher step followed by a MAC step.
+ * The steps after a failing one are not run, and the ioctl returns its
+ * error. The data are not copied for a step, which fails with EINVAL
+ * unless src and dst are aligned to the alignmask of its session (see
+ * CIOCGSESSINFO).
+ */
+struct crypt_chain_op {
+	__u32	count;
+	__u32	flags;
+	__u32	len;
+	__u8	__user *src;
+	__u8	__user *dst;
+	struct crypt_op	__user *ops;
+};
+
+/* the maximum number of steps of a CIOCCRYPTCHAIN */
+#define CRYPTODEV_MAX_CHAIN	8
+
+/* input of CIOCREGBUF.
+ *  addr    : the start of the region
+ *  len     : its length in bytes
+ *  handle  : out: identifies the region to CIOCUNREGBUF
+ *
+ * The pages of a registered region stay pinned until CIOCUNREGBUF or
+ * until the file descriptor is closed. Zero-copy operations whose
+ * source and destination both lie within registered regions use these
+ * pages directly instead of looking them up on every call, and are
+ * otherwise handled as usual. Remapping a registered region has no
+ * effect on the pages used. The pinned pages count against the
+ * RLIMIT_MEMLOCK of the process, unless the caller has CAP_IPC_LOCK.
+ * A region is only used by operations of the process that registered
+ * it, not by those of a process the descriptor was passed on to. An
+ * operation with COP_FLAG_REGION names the place of its data in a
+ * region by handle, so that the region does not have to be looked up
+ * by address; see below. A descriptor has at most CRYPTODEV_MAX_REGIONS
+ * regions, after which CIOCREGBUF fails with ENOSPC.
+ */
+struct crypt_region_op {
+	void	__user *addr;
+	__u32	len;
+	__u32	handle;
+};
+
+/* the maximum length of a single registered region */
+#define CRYPTODEV_MAX_REGION_LEN	(16 * 1024 * 1024)
+/* the maximum number of regions of a file descriptor */
+#define CRYPTODEV_MAX_REGIONS		255
+
+/* With COP_FLAG_REGION, what src and dst of a crypt_op or crypt_auth_op
+ * are given as: offset bytes into the region of handle. It fits in 32
+ * bits, so it is the same for 32-bit userland. */
+#define CRYPTODEV_REGION_SHIFT		24
+#define CRYPTODEV_REGION_PTR(handle, offset) \
+	((void *)(unsigned long)(((unsigned long)(handle) << \
+				  CRYPTODEV_REGION_SHIFT) | (offset)))
+
+/* output of CIOCGSTATS: the counters of the file descriptor. Those of
+ * the module are in debugfs, under cryptodev/. */
+struct crypt_stats {
+	__u64	ops;		/* operations run */
+	__u64	bytes;		/* bytes of data processed */
+	__u64	zc_ops;		/* operations on the user pages (zero-copy) */
+	__u64	copy_ops;	/* operations that copied the data */
+	__u64	unaligned_ops;	/* of those, because of the alignmask */
+	__u64	async_busy;	/* CIOCASYNCCRYPT calls with the queue full */
+};
+
 /* struct crypt_op flags */
 
 #define COP_FLAG_NONE		(0 << 0) /* totally no flag */
@@ -218,6 +687,26 @@ struct crypt_auth_op {
 #define COP_FLAG_RESET		(1 << 6) /* multi-update reset the state.
                                           * should be used in combination
                                           * with COP_FLAG_UPDATE */
+#define COP_FLAG_VERIFY		(1 << 7) /* check the MAC at mac, see below */
+#define COP_FLAG_REGION		(1 << 15) /* src and dst are in registered
+                                           * regions, see below */
+
+/* COP_FLAG_VERIFY: mac holds the expected MAC instead of receiving the
+ * computed one. The two are compared in constant time, the operation
+ * fails with EBADMSG if they differ, and nothing is written to mac.
+ * A truncated MAC has its length in bits 8 to 14 of flags, set with
+ * COP_VERIFY_LEN(); 0 is the whole digest. This needs an operation that
+ * finishes the hash.
+ */
+#define COP_VERIFY_LEN(len)	(((len) & 0x7f) << 8)
+#define COP_VERIFY_LEN_OF(flags) (((flags) >> 8) & 0x7f)
+
+/* COP_FLAG_REGION: src and dst (when not NULL) are made with
+ * CRYPTODEV_REGION_PTR() from the handle CIOCREGBUF returned and an
+ * offset in the region, and the data there have to fit in it. The
+ * operation fails with EINVAL otherwise. They are passed back as they
+ * were given. It is not taken by the steps of CIOCCRYPTCHAIN.
+ */
 
 
 /* Stuff for bignum arithmetic and public key
@@ -288,5 +777,66 @@ enum cryptodev_crk_op_t {
  */
 #define CIOCASYNCCRYPT    _IOW('c', 110, struct crypt_op)
 #define CIOCASYNCFETCH    _IOR('c', 111, struct crypt_op)
+/* Set the number of jobs that can be outstanding (queued or not yet
+ * fetched) on a file descriptor. The value is rounded up to a power
+ * of two, and it can only be changed while there are no outstanding
+ * jobs. The default is 64 and the maximum 4096. */
+#define CIOCASYNCRINGSIZE _IOW('c', 114, __u32)
+/* fetch many jobs at once, see struct crypt_fetch_op */
+#define CIOCASYNCFETCHV   _IOWR('c', 126, struct crypt_fetch_op)
+/* Signal an eventfd with the number of jobs (and shared ring entries)
+ * completed, as each batch of them completes; -1 stops that. An event
+ * loop then fetches them all with CIOCASYNCFETCHV. */
+#define CIOCASYNCEVENTFD  _IOW('c', 127, __s32)
+/* CIOCAUTHCRYPT queued on the same ring as CIOCASYNCCRYPT. A job is
+ * fetched with the ioctl of its kind: while the next one to fetch is of
+ * the other kind, CIOCASYNCFETCH (or CIOCASYNCFETCHV) and
+ * CIOCASYNCAUTHFETCH fail with EINVAL. A failed tag check is EBADMSG. */
+#define CIOCASYNCAUTHCRYPT _IOW('c', 132, struct crypt_auth_op)
+#define CIOCASYNCAUTHFETCH _IOR('c', 133, struct crypt_auth_op)
+
+/* shared rings, see struct crypt_ring */
+#define CIOCRINGSETUP     _IOWR('c', 115, struct crypt_ring_params)
+#define CIOCRINGENTER     _IO('c', 116)
+
+/* batched operation, see struct crypt_multi_op */
+#define CIOCCRYPTMULTI     _IOWR('c', 112, struct crypt_multi_op)
+#define CIOCAUTHCRYPTMULTI _IOWR('c', 113, struct crypt_multi_op)
+
+/* registered user memory, see struct crypt_region_op */
+#define CIOCREGBUF   _IOWR('c', 117, struct crypt_region_op)
+#define CIOCUNREGBUF _IOW('c', 118, __u32)
+
+/* operations on scattered data, see struct crypt_iov_op */
+#define CIOCCRYPTV     _IOWR('c', 119, struct crypt_iov_op)
+#define CIOCAUTHCRYPTV _IOWR('c', 120, struct crypt_auth_iov_op)
+
+/* performance counters, see struct crypt_stats */
+#define CIOCGSTATS _IOR('c', 121, struct crypt_stats)
+
+/* session with options, see struct session2_op */
+#define CIOCGSESSION2 _IOWR('c', 122, struct session2_op)
+
+/* many digests at once, see struct crypt_hash_multi_op */
+#define CIOCHASHMULTI _IOW('c', 123, struct crypt_hash_multi_op)
+
+/* steps on several sessions over the same data, see struct crypt_chain_op */
+#define CIOCCRYPTCHAIN _IOW('c', 124, struct crypt_chain_op)
+
+/* time the drivers of an SOP_FLAG_DRIVER_AUTO session again, which
+ * needs CAP_SYS_ADMIN */
+#define CIOCCALIBRATE _IOW('c', 125, __u32)
+
+/* many buffers with one session, see struct crypt_cipher_multi_op */
+#define CIOCCIPHERMULTI _IOW('c', 128, struct crypt_cipher_multi_op)
+
+/* TLS records with one session, see struct crypt_tls_multi_op */
+#define CIOCTLSMULTI _IOW('c', 129, struct crypt_tls_multi_op)
+
+/* SRTP packets with one session, see struct crypt_srtp_multi_op */
+#define CIOCSRTPMULTI _IOW('c', 130, struct crypt_srtp_multi_op)
+
+/* read() and write() through a session, see struct crypt_stream_op */
+#define CIOCSTREAM _IOW('c', 131, struct crypt_stream_op)
 
 #endif /* L_CRYPTODEV_H */
@@ -8,6 +8,11 @@
 #  define reinit_completion(x) INIT_COMPLETION(*(x))
 #endif
 
+#if (LINUX_VERSION_CODE < KERNEL_VERSION(3, 18, 0))
+#  define memzero_explicit(s, count) \
+	do { memset(s, 0, count); barrier(); } while (0)
+#endif
+
 #include <linux/init.h>
 #include <linux/sched.h>
 #include <linux/fs.h>
@@ -17,8 +22,28 @@
 #include <linux/module.h>
 #include <linux/moduleparam.h>
 #include <linux/scatterlist.h>
+#include <linux/idr.h>
+#include <linux/rcupdate.h>
+#include <linux/cache.h>
 #include <crypto/cryptodev.h>
 #include <crypto/aead.h>
+#include <crypto/hash.h>
+
+#if (LINUX_VERSION_CODE < KERNEL_VERSION(3, 13, 0))
+/* nonzero if a and b differ, in a time that does not depend on where */
+static inline unsigned long
+crypto_memneq(const void *a, const void *b, size_t size)
+{
+	const unsigned char *x = a, *y = b;
+	unsigned long neq = 0;
+
+	while (size--)
+		neq |= *x++ ^ *y++;
+	return neq;
+}
+#else
+#  include <crypto/algapi.h>
+#endif
 
 #define PFX "cryptodev: "
 #define dprintk(level, severity, format, a...)			\
@@ -38,8 +63,46 @@
 extern int cryptodev_verbosity;
 
 struct fcrypt {
-	struct list_head list;
+	/* sessions indexed by their sid. Lookups are lockless (RCU),
+	 * sem serializes the insertions and removals. */
+	struct idr sessions;
 	struct mutex sem;
+	/* user memory regions indexed by their handle, see CIOCREGBUF.
+	 * Lookups are lockless (RCU) like those of sessions. */
+	struct idr regions;
+	/* the number of pages pinned by the regions, protected by sem */
+	unsigned long region_pages;
+	/* per CPU, see stats.c */
+	struct cryptodev_stats __percpu *stats;
+	/* struct zc_scratch not lent to any operation, see zc_get_scratch() */
+	spinlock_t scratch_lock;
+	struct list_head spare_scratch;
+	unsigned int nr_spare_scratch;
+	/* what read() and write() go through, see CIOCSTREAM; stream_sem
+	 * protects it, and stream_wait is woken when it can be read from
+	 * or written to */
+	struct mutex stream_sem;
+	struct crypt_stream *stream;
+	wait_queue_head_t stream_wait;
+	/* the SOP_FLAG_INTERACTIVE sessions, so that the async queue only
+	 * looks for their jobs when there are any */
+	atomic_t nr_interactive;
+	/* the transforms of the SOP_FLAG_TFM_SHARDS sessions, protected by
+	 * sem */
+	unsigned int nr_shards;
+};
+
+/* a user memory region with its pages pinned, see CIOCREGBUF */
+struct user_region {
+	struct rcu_head rcu;
+	/* one reference is held by fcrypt->regions, one by each user */
+	atomic_t refcnt;
+	/* the address space the region is in, charged with its pages */
+	struct mm_struct *mm;
+	unsigned long addr;
+	uint32_t len;
+	unsigned int nr_pages;
+	struct page *pages[0];
 };
 
 /* compatibility stuff */
@@ -61,6 +124,17 @@ struct compat_session_op {
 	uint32_t	ses;		/* session identifier */
 };
 
+/* input of CIOCGSESSION2 */
+struct compat_session2_op {
+	struct compat_session_op	sop;
+	uint32_t	flags;
+	compat_uptr_t	iv;
+	uint32_t	shards;
+	char		cipher_driver[CRYPTODEV_MAX_ALG_NAME];
+	char		hash_driver[CRYPTODEV_MAX_ALG_NAME];
+	int32_t		node;
+};
+
 /* input of CIOCCRYPT */
 struct compat_crypt_op {
 	uint32_t	ses;		/* session identifier */
@@ -73,26 +147,210 @@ struct compat_crypt_op {
 	compat_uptr_t	iv;/* initialization vector for encryption operations */
 };
 
+struct compat_crypt_auth_op {
+	uint32_t	ses;		/* session identifier */
+	uint16_t	op;		/* COP_ENCRYPT or COP_DECRYPT */
+	uint16_t	flags;		/* see COP_FLAG_AEAD_* */
+	uint32_t	len;		/* length of source data */
+	uint32_t	auth_len;	/* length of auth data */
+	compat_uptr_t	auth_src;	/* authenticated-only data */
+	compat_uptr_t	src;		/* data to be encrypted and authenticated */
+	compat_uptr_t	dst;		/* pointer to output data */
+	compat_uptr_t	tag;		/* where the tag is copied to */
+	uint32_t	tag_len;	/* the length of the tag */
+	compat_uptr_t	iv;		/* initialization vector */
+	uint32_t	iv_len;
+};
+
+/* input of CIOCREGBUF */
+struct compat_crypt_region_op {
+	compat_uptr_t	addr;
+	uint32_t	len;
+	uint32_t	handle;
+};
+
+/* input of CIOCCRYPTV */
+struct compat_crypt_iovec {
+	compat_uptr_t	base;
+	uint32_t	len;
+};
+
+/* input of CIOCSTREAM */
+struct compat_crypt_stream_op {
+	uint32_t	ses;
+	uint16_t	op;
+	uint16_t	flags;
+	compat_uptr_t	iv;
+};
+
+struct compat_crypt_iov_op {
+	struct compat_crypt_op	cop;
+	uint32_t	src_count;
+	uint32_t	dst_count;
+	compat_uptr_t	src;
+	compat_uptr_t	dst;
+};
+
+/* input of CIOCCRYPTMULTI and CIOCAUTHCRYPTMULTI */
+struct compat_crypt_multi_op {
+	uint32_t	count;
+	uint32_t	flags;
+	compat_uptr_t	ops;		/* compat_crypt_op or compat_crypt_auth_op */
+	compat_uptr_t	status;
+};
+
+/* a job fetched by CIOCASYNCFETCHV */
+struct compat_crypt_async_done {
+	struct compat_crypt_op	cop;
+	int32_t		result;
+	uint32_t	__reserved;
+};
+
+/* input of CIOCASYNCFETCHV */
+struct compat_crypt_fetch_op {
+	uint32_t	count;
+	uint32_t	flags;
+	compat_uptr_t	done;
+};
+
+/* input of CIOCAUTHCRYPTV */
+struct compat_crypt_auth_iov_op {
+	struct compat_crypt_auth_op	caop;
+	uint32_t	src_count;
+	uint32_t	dst_count;
+	compat_uptr_t	src;
+	compat_uptr_t	dst;
+};
+
+/* input of CIOCHASHMULTI */
+struct compat_crypt_hash_multi_op {
+	uint32_t	ses;
+	uint32_t	count;
+	compat_uptr_t	bufs;
+	compat_uptr_t	digests;
+};
+
+/* input of CIOCCIPHERMULTI */
+struct compat_crypt_cipher_multi_op {
+	uint32_t	ses;
+	uint16_t	op;
+	uint16_t	flags;
+	uint32_t	count;
+	uint32_t	__reserved;
+	compat_uptr_t	src;
+	compat_uptr_t	dst;
+	compat_uptr_t	ivs;
+};
+
+/* a record of CIOCTLSMULTI */
+struct compat_crypt_tls_record {
+	compat_uptr_t	buf;
+	uint32_t	len;
+	int32_t		status;
+};
+
+/* input of CIOCTLSMULTI */
+struct compat_crypt_tls_multi_op {
+	uint32_t	ses;
+	uint16_t	op;
+	uint16_t	flags;
+	uint32_t	count;
+	uint8_t		type;
+	uint8_t		__reserved;
+	uint16_t	version;
+	compat_u64	seq;
+	compat_uptr_t	records;
+	compat_uptr_t	iv;
+};
+
+/* a packet of CIOCSRTPMULTI */
+struct compat_crypt_srtp_packet {
+	compat_uptr_t	buf;
+	uint32_t	len;
+	uint16_t	hdr_len;
+	uint16_t	__reserved;
+	int32_t		status;
+	uint32_t	roc;
+};
+
+/* input of CIOCSRTPMULTI */
+struct compat_crypt_srtp_multi_op {
+	uint32_t	ses;
+	uint16_t	op;
+	uint16_t	flags;
+	uint32_t	count;
+	uint32_t	tag_len;
+	compat_uptr_t	packets;
+};
+
+/* input of CIOCCRYPTCHAIN */
+struct compat_crypt_chain_op {
+	uint32_t	count;
+	uint32_t	flags;
+	uint32_t	len;
+	compat_uptr_t	src;
+	compat_uptr_t	dst;
+	compat_uptr_t	ops;
+};
+
 /* compat ioctls, defined for the above structs */
 #define COMPAT_CIOCGSESSION    _IOWR('c', 102, struct compat_session_op)
 #define COMPAT_CIOCCRYPT       _IOWR('c', 104, struct compat_crypt_op)
 #define COMPAT_CIOCASYNCCRYPT  _IOW('c', 107, struct compat_crypt_op)
 #define COMPAT_CIOCASYNCFETCH  _IOR('c', 108, struct compat_crypt_op)
+#define COMPAT_CIOCAUTHCRYPT   _IOWR('c', 109, struct compat_crypt_auth_op)
+#define COMPAT_CIOCREGBUF      _IOWR('c', 117, struct compat_crypt_region_op)
+#define COMPAT_CIOCCRYPTV      _IOWR('c', 119, struct compat_crypt_iov_op)
+#define COMPAT_CIOCGSESSION2   _IOWR('c', 122, struct compat_session2_op)
+#define COMPAT_CIOCSTREAM      _IOW('c', 131, struct compat_crypt_stream_op)
+#define COMPAT_CIOCASYNCAUTHCRYPT _IOW('c', 132, struct compat_crypt_auth_op)
+#define COMPAT_CIOCASYNCAUTHFETCH _IOR('c', 133, struct compat_crypt_auth_op)
+#define COMPAT_CIOCCRYPTMULTI  _IOWR('c', 112, struct compat_crypt_multi_op)
+#define COMPAT_CIOCAUTHCRYPTMULTI _IOWR('c', 113, struct compat_crypt_multi_op)
+#define COMPAT_CIOCAUTHCRYPTV  _IOWR('c', 120, struct compat_crypt_auth_iov_op)
+#define COMPAT_CIOCHASHMULTI   _IOW('c', 123, struct compat_crypt_hash_multi_op)
+#define COMPAT_CIOCCRYPTCHAIN  _IOW('c', 124, struct compat_crypt_chain_op)
+#define COMPAT_CIOCASYNCFETCHV _IOWR('c', 126, struct compat_crypt_fetch_op)
+#define COMPAT_CIOCCIPHERMULTI _IOW('c', 128, struct compat_crypt_cipher_multi_op)
+#define COMPAT_CIOCTLSMULTI    _IOW('c', 129, struct compat_crypt_tls_multi_op)
+#define COMPAT_CIOCSRTPMULTI   _IOW('c', 130, struct compat_crypt_srtp_multi_op)
 
 #endif /* CONFIG_COMPAT */
 
-/* kernel-internal extension to struct crypt_op */
+/* the segments of the data of an operation, see CIOCCRYPTV. For
+ * in-place operation dst is the same as src. */
+struct kernel_crypt_iov {
+	struct crypt_iovec *src, *dst;
+	unsigned int src_count, dst_count;
+};
+
+/* kernel-internal extension to struct crypt_op. What every operation
+ * looks at comes first, within the first two cache lines on 64-bit; the
+ * buffers for the IV and the digest follow. */
 struct kernel_crypt_op {
 	struct crypt_op cop;
 
 	int ivlen;
-	__u8 iv[EALG_MAX_BLOCK_LEN];
-
 	int digestsize;
-	uint8_t hash_output[AALG_MAX_RESULT_LEN];
+
+	/* used instead of cop.src and cop.dst if set */
+	struct kernel_crypt_iov *iov;
+	/* or the data, pinned by the caller, see CIOCCRYPTCHAIN */
+	struct scatterlist *src_sg, *dst_sg;
 
 	struct task_struct *task;
 	struct mm_struct *mm;
+
+	__u8 iv[EALG_MAX_BLOCK_LEN];
+	uint8_t hash_output[AALG_MAX_RESULT_LEN];
+	/* the MAC of COP_FLAG_VERIFY, read when the operation is */
+	int verifylen;
+	uint8_t verify_mac[AALG_MAX_RESULT_LEN];
+
+	/* with COP_FLAG_REGION, the handles of the regions of cop.src and
+	 * cop.dst, and what they were given as before they were resolved */
+	uint32_t region[2];
+	uint8_t __user *region_ptr[2];
 };
 
 struct kernel_crypt_auth_op {
@@ -100,10 +358,18 @@ struct kernel_crypt_auth_op {
 
 	int dst_len; /* based on src_len + pad + tag */
 	int ivlen;
-	__u8 iv[EALG_MAX_BLOCK_LEN];
+
+	/* used instead of caop.src and caop.dst if set */
+	struct kernel_crypt_iov *iov;
 
 	struct task_struct *task;
 	struct mm_struct *mm;
+
+	__u8 iv[EALG_MAX_BLOCK_LEN];
+
+	/* as in struct kernel_crypt_op */
+	uint32_t region[2];
+	uint8_t __user *region_ptr[2];
 };
 
 /* auth */
@@ -112,34 +378,228 @@ int kcaop_from_user(struct kernel_crypt_auth_op *kcop,
 			struct fcrypt *fcr, void __user *arg);
 int kcaop_to_user(struct kernel_crypt_auth_op *kcaop,
 		struct fcrypt *fcr, void __user *arg);
+/* the same, around copying caop itself */
+int fill_kcaop_from_caop(struct kernel_crypt_auth_op *kcaop, struct fcrypt *fcr);
+int fill_caop_from_kcaop(struct kernel_crypt_auth_op *kcaop, struct fcrypt *fcr);
 int crypto_auth_run(struct fcrypt *fcr, struct kernel_crypt_auth_op *kcaop);
 int crypto_run(struct fcrypt *fcr, struct kernel_crypt_op *kcop);
 
+/* How the arrays that the batched ioctls point to are laid out, for a
+ * native task or a compat one; see native_abi in ioctl.c */
+struct user_abi {
+	/* an element of the ops of CIOCCRYPTMULTI and the like, and how it
+	 * is passed back as kcop_to_user() does */
+	int (*cop_from_user)(struct crypt_op *cop, void __user *arg);
+	int (*kcop_to_user)(struct kernel_crypt_op *kcop,
+			struct fcrypt *fcr, void __user *arg);
+	int (*caop_from_user)(struct crypt_auth_op *caop, void __user *arg);
+	int (*kcaop_to_user)(struct kernel_crypt_auth_op *kcaop,
+			struct fcrypt *fcr, void __user *arg);
+	size_t cop_size, caop_size;
+	/* struct crypt_async_done, and where its result is */
+	size_t done_size, done_result;
+
+	/* count elements of the arrays at arg */
+	int (*iovecs_from_user)(struct crypt_iovec *iov, void __user *arg,
+			unsigned int count);
+	int (*records_from_user)(struct crypt_tls_record *recs,
+			void __user *arg, unsigned int count);
+	int (*records_to_user)(void __user *arg,
+			const struct crypt_tls_record *recs, unsigned int count);
+	int (*packets_from_user)(struct crypt_srtp_packet *pkts,
+			void __user *arg, unsigned int count);
+	int (*packets_to_user)(void __user *arg,
+			const struct crypt_srtp_packet *pkts, unsigned int count);
+};
+
+int crypto_tls_run_multi(struct fcrypt *fcr, struct crypt_tls_multi_op *tmo,
+		const struct user_abi *abi);
+int crypto_srtp_run_multi(struct fcrypt *fcr, struct crypt_srtp_multi_op *smo,
+		const struct user_abi *abi);
+int crypto_hash_multi(struct fcrypt *fcr, struct crypt_hash_multi_op *hop,
+		const struct user_abi *abi);
+int crypto_cipher_multi(struct fcrypt *fcr, struct crypt_cipher_multi_op *cmo,
+		const struct user_abi *abi);
+
+#include <cipherapi.h>
 #include <cryptlib.h>
 
 /* other internal structs */
-struct csession {
-	struct list_head entry;
-	struct mutex sem;
-	struct cipher_data cdata;
-	struct hash_data hdata;
-	uint32_t sid;
-	uint32_t alignmask;
 
+/* the user pages of a zero-copy operation, see zc.c */
+struct zc_pages {
 	unsigned int array_size;
 	unsigned int used_pages; /* the number of pages that are used */
 	/* the number of pages marked as NOT-writable; they preceed writeables */
 	unsigned int readonly_pages;
 	struct page **pages;
 	struct scatterlist *sg;
+	/* the registered regions the operation is on instead, if any; their
+	 * pages are not counted in used_pages */
+	struct user_region *region[2];
+	/* the written pages of the regions, to be flushed on release */
+	struct page **region_dst;
+	unsigned int region_dst_pages;
+	/* the bounce buffer of operations that copy the data instead,
+	 * allocated as needed and kept for the next ones */
+	struct page **bounce;
+	unsigned int bounce_pages;
+};
+
+/* The user page arrays an operation borrows from its file descriptor for
+ * its duration, see zc_get_scratch() */
+struct zc_scratch {
+	struct list_head entry;
+	struct zc_pages zc;
+	/* for associated data too large to be copied into the session */
+	struct zc_pages aad_zc;
+};
+
+/* TLS and IPsec associated data are 13 to 20 bytes */
+#define CRYPTODEV_INLINE_AAD 64
+
+/* an operation in flight, see __crypto_run_nowait() */
+struct crypto_nowait_op {
+	struct zc_pages zc;
+	cryptodev_blkcipher_request_t *req;
+	/* called on completion, possibly in interrupt context */
+	void (*done)(struct crypto_nowait_op *op, int err);
 };
 
+/* The requests for an operation that runs concurrently with others on a
+ * session, see crypto_get_ctx(). The transforms are those of the
+ * session, unless it is one of the SOP_FLAG_TFM_SHARDS of the session. */
+struct csession_ctx {
+	struct list_head entry;
+	struct cipher_data cdata;
+	struct hash_data hdata;
+	int shard;
+};
+
+/* the salt of SRTP with AES-CM, 112 bits */
+#define SRTP_SALT_SIZE 14
+
+/* The stream of an SOP_FLAG_SRTP session, written by the holder of
+ * the session's sem */
+struct srtp_state {
+	/* the session salt, shifted to make the IV as in RFC 3711 */
+	uint8_t salt[EALG_MAX_BLOCK_LEN];
+	/* the rollover counter and the highest sequence number so far */
+	uint32_t roc;
+	uint16_t s_l;
+	/* s_l is unset until the first packet */
+	int started;
+};
+
+/* The fields of a session are grouped by how they are used, so that
+ * the ones that operations only read do not share cache lines with the
+ * ones they write: first what is set up at creation and read by each
+ * operation, then what the holder of sem writes, then what concurrent
+ * operations contend on, and last the rarely used transforms. */
+struct csession {
+	uint32_t sid;
+	uint32_t alignmask;
+	/* the file descriptor the session belongs to */
+	struct fcrypt *fcr;
+	/* the algorithm its latencies are counted for, see stats.h */
+	unsigned int stat_alg;
+	uint32_t iv_mode;
+	/* up to where sync_cdata and sync_hdata are faster, NULL if that
+	 * was not timed */
+	struct cryptodev_crossover *crossover;
+	/* the stream of an SOP_FLAG_SRTP session, NULL otherwise */
+	struct srtp_state *srtp;
+	/* where its memory is and its asynchronous work runs, see
+	 * SOP_FLAG_NUMA_NODE */
+	int node;
+	/* its async jobs go first, see SOP_FLAG_INTERACTIVE */
+	int interactive;
+	struct cipher_data cdata;
+	struct hash_data hdata;
+
+	/* one reference is held by fcrypt->sessions, one by each user */
+	atomic_t refcnt ____cacheline_aligned;
+	/* entered by the operations that use the session's own requests
+	 * above */
+	struct mutex sem;
+	/* the user pages of the operation that holds sem */
+	struct zc_scratch *scratch;
+	/* the associated data of AEAD operations, copied if they fit in
+	 * aad and mapped into scratch->aad_zc otherwise */
+	uint8_t aad[CRYPTODEV_INLINE_AAD];
+
+	/* protects iv and spare_ctx */
+	spinlock_t lock ____cacheline_aligned;
+	/* where the last operation left the IV, or with an iv_mode
+	 * (SOP_FLAG_IV_*) the IV of the next operation */
+	uint8_t iv[EALG_MAX_BLOCK_LEN];
+	struct list_head spare_ctx;
+	unsigned int nr_spare_ctx;
+	/* the contexts with transforms of their own, which are always
+	 * kept, see SOP_FLAG_TFM_SHARDS */
+	unsigned int nr_shards;
+
+	/* the one-pass TLS transform of cdata and hdata, if any */
+	struct cipher_data tls ____cacheline_aligned;
+	/* the synchronous transforms of an SOP_FLAG_DRIVER_AUTO session,
+	 * uninitialized if it has none */
+	struct cipher_data sync_cdata;
+	struct hash_data sync_hdata;
+	struct rcu_head rcu;
+};
+
+/* the driver of the session's cipher, or else of its hash */
+static inline const char *crypto_session_driver_name(struct csession *ses_ptr)
+{
+	if (ses_ptr->cdata.init)
+		return crypto_tfm_alg_driver_name(
+				cryptodev_cipher_tfm(&ses_ptr->cdata));
+	else
+		return crypto_tfm_alg_driver_name(
+				crypto_ahash_tfm(ses_ptr->hdata.async.s));
+}
+
+struct csession *crypto_ref_session_by_sid(struct fcrypt *fcr, uint32_t sid);
+void crypto_release_session(struct csession *ses_ptr);
 struct csession *crypto_get_session_by_sid(struct fcrypt *fcr, uint32_t sid);
+void crypto_put_session(struct csession *ses_ptr);
+struct csession_ctx *crypto_get_ctx(struct csession *ses_ptr);
+void crypto_put_ctx(struct csession *ses_ptr, struct csession_ctx *ctx);
+
+/* An operation without an IV of its own continues from where the last
+ * one on the session left it */
+static inline void crypto_session_get_iv(struct csession *ses_ptr, void *iv)
+{
+	spin_lock(&ses_ptr->lock);
+	memcpy(iv, ses_ptr->iv, min_t(size_t, ses_ptr->cdata.ivsize,
+				sizeof(ses_ptr->iv)));
+	spin_unlock(&ses_ptr->lock);
+}
 
-static inline void crypto_put_session(struct csession *ses_ptr)
+static inline void crypto_session_set_iv(struct csession *ses_ptr,
+				const void *iv)
 {
-	mutex_unlock(&ses_ptr->sem);
+	/* only advanced by crypto_session_next_iv() */
+	if (ses_ptr->iv_mode)
+		return;
+
+	spin_lock(&ses_ptr->lock);
+	memcpy(ses_ptr->iv, iv, min_t(size_t, ses_ptr->cdata.ivsize,
+				sizeof(ses_ptr->iv)));
+	spin_unlock(&ses_ptr->lock);
 }
-int adjust_sg_array(struct csession *ses, int pagecount);
+void crypto_session_next_iv(struct csession *ses_ptr, void *iv,
+				unsigned int len);
+int adjust_sg_array(struct zc_pages *zc, int pagecount);
+
+/* variants of the above for an already looked up session */
+int __fill_kcaop_from_caop(struct kernel_crypt_auth_op *kcaop,
+			struct csession *ses_ptr);
+int __crypto_auth_run(struct csession *ses_ptr,
+			struct kernel_crypt_auth_op *kcaop);
+int __crypto_run(struct csession *ses_ptr, struct kernel_crypt_op *kcop);
+int __crypto_run_nowait(struct csession *ses_ptr, struct kernel_crypt_op *kcop,
+			struct crypto_nowait_op *op);
+void __crypto_nowait_finish(struct crypto_nowait_op *op);
 
 #endif /* CRYPTODEV_INT_H */
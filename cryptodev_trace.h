@@ -0,0 +1,122 @@
+/* Tracepoints of cryptodev. The copying, page pinning, queueing and
+ * driver time of an operation can be told apart with them. */
+#undef TRACE_SYSTEM
+#define TRACE_SYSTEM cryptodev
+
+#if !defined(CRYPTODEV_TRACE_H) || defined(TRACE_HEADER_MULTI_READ)
+#define CRYPTODEV_TRACE_H
+
+#include <linux/tracepoint.h>
+#include <linux/crypto.h>
+#include "cryptodev_int.h"
+
+TRACE_EVENT(cryptodev_session_create,
+	TP_PROTO(struct csession *ses),
+	TP_ARGS(ses),
+	TP_STRUCT__entry(
+		__field(u32, sid)
+		__string(driver, crypto_session_driver_name(ses))
+	),
+	TP_fast_assign(
+		__entry->sid = ses->sid;
+		__assign_str(driver, crypto_session_driver_name(ses));
+	),
+	TP_printk("sid=0x%08x driver=%s", __entry->sid, __get_str(driver))
+);
+
+DECLARE_EVENT_CLASS(cryptodev_op,
+	TP_PROTO(struct csession *ses, u16 op, u32 len, int ret),
+	TP_ARGS(ses, op, len, ret),
+	TP_STRUCT__entry(
+		__field(u32, sid)
+		__field(u16, op)
+		__field(u32, len)
+		__field(int, ret)
+		__string(driver, crypto_session_driver_name(ses))
+	),
+	TP_fast_assign(
+		__entry->sid = ses->sid;
+		__entry->op = op;
+		__entry->len = len;
+		__entry->ret = ret;
+		__assign_str(driver, crypto_session_driver_name(ses));
+	),
+	TP_printk("sid=0x%08x op=%u len=%u ret=%d driver=%s",
+		  __entry->sid, __entry->op, __entry->len, __entry->ret,
+		  __get_str(driver))
+);
+
+/* crypto_run() and crypto_auth_run(); ret is zero on start */
+DEFINE_EVENT(cryptodev_op, cryptodev_op_start,
+	TP_PROTO(struct csession *ses, u16 op, u32 len, int ret),
+	TP_ARGS(ses, op, len, ret)
+);
+
+DEFINE_EVENT(cryptodev_op, cryptodev_op_done,
+	TP_PROTO(struct csession *ses, u16 op, u32 len, int ret),
+	TP_ARGS(ses, op, len, ret)
+);
+
+/* user pages pinned and unpinned in zc.c */
+TRACE_EVENT(cryptodev_pin,
+	TP_PROTO(unsigned long addr, u32 len, unsigned int pages),
+	TP_ARGS(addr, len, pages),
+	TP_STRUCT__entry(
+		__field(unsigned long, addr)
+		__field(u32, len)
+		__field(unsigned int, pages)
+	),
+	TP_fast_assign(
+		__entry->addr = addr;
+		__entry->len = len;
+		__entry->pages = pages;
+	),
+	TP_printk("addr=0x%lx len=%u pages=%u",
+		  __entry->addr, __entry->len, __entry->pages)
+);
+
+TRACE_EVENT(cryptodev_unpin,
+	TP_PROTO(unsigned int pages),
+	TP_ARGS(pages),
+	TP_STRUCT__entry(
+		__field(unsigned int, pages)
+	),
+	TP_fast_assign(
+		__entry->pages = pages;
+	),
+	TP_printk("pages=%u", __entry->pages)
+);
+
+/* around the wait for a request the driver queued */
+DECLARE_EVENT_CLASS(cryptodev_wait,
+	TP_PROTO(struct crypto_tfm *tfm, int err),
+	TP_ARGS(tfm, err),
+	TP_STRUCT__entry(
+		__field(int, err)
+		__string(driver, crypto_tfm_alg_driver_name(tfm))
+	),
+	TP_fast_assign(
+		__entry->err = err;
+		__assign_str(driver, crypto_tfm_alg_driver_name(tfm));
+	),
+	TP_printk("err=%d driver=%s", __entry->err, __get_str(driver))
+);
+
+DEFINE_EVENT(cryptodev_wait, cryptodev_wait_start,
+	TP_PROTO(struct crypto_tfm *tfm, int err),
+	TP_ARGS(tfm, err)
+);
+
+DEFINE_EVENT(cryptodev_wait, cryptodev_wait_done,
+	TP_PROTO(struct crypto_tfm *tfm, int err),
+	TP_ARGS(tfm, err)
+);
+
+#endif /* CRYPTODEV_TRACE_H */
+
+/* this is not under include/trace */
+#undef TRACE_INCLUDE_PATH
+#define TRACE_INCLUDE_PATH .
+#undef TRACE_INCLUDE_FILE
+#define TRACE_INCLUDE_FILE cryptodev_trace
+#include <trace/define_trace.h>
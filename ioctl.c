@@ -34,15 +34,24 @@
  */
 
 #include <crypto/hash.h>
+#include <linux/capability.h>
 #include <linux/crypto.h>
+#include <linux/eventfd.h>
 #include <linux/mm.h>
 #include <linux/highmem.h>
 #include <linux/ioctl.h>
+#include <linux/idr.h>
+#include <linux/llist.h>
+#include <linux/log2.h>
+#include <linux/mmu_context.h>
 #include <linux/random.h>
+#include <linux/rcupdate.h>
 #include <linux/syscalls.h>
+#include <linux/topology.h>
 #include <linux/pagemap.h>
 #include <linux/poll.h>
 #include <linux/uaccess.h>
+#include <linux/vmalloc.h>
 #include <crypto/cryptodev.h>
 #include <linux/scatterlist.h>
 #include <linux/rtnetlink.h>
@@ -52,18 +61,40 @@
 
 #include "cryptodev_int.h"
 #include "zc.h"
+#include "stats.h"
+#include "tfm_pool.h"
+#include "crossover.h"
+#include "stream.h"
 #include "version.h"
 
+#define CREATE_TRACE_POINTS
+#include "cryptodev_trace.h"
+
 MODULE_AUTHOR("Nikos Mavrogiannopoulos <nmav@gnutls.org>");
 MODULE_DESCRIPTION("CryptoDev driver");
 MODULE_LICENSE("GPL");
 
 /* ====== Compile-time config ====== */
 
-/* Default (pre-allocated) and maximum size of the job queue.
- * These are free, pending and done items all together. */
-#define DEF_COP_RINGSIZE 16
-#define MAX_COP_RINGSIZE 64
+/* Default and maximum size of the job ring of a file descriptor.
+ * These are free, pending and done items all together. The default is
+ * the most jobs the lists of items grew to before the ring, so that
+ * no client gets -EBUSY sooner than it did then. The size can be
+ * changed per file descriptor with CIOCASYNCRINGSIZE. */
+#define DEF_COP_RINGSIZE 64
+#define MAX_COP_RINGSIZE 4096
+
+/* The number of request contexts a session keeps around for operations
+ * that run concurrently on it. More are allocated when needed. */
+#define MAX_SPARE_CTX 4
+
+/* the most transforms of SOP_FLAG_TFM_SHARDS a session may have, and
+ * all the sessions of a file descriptor together */
+#define MAX_TFM_SHARDS 64
+#define MAX_FD_TFM_SHARDS 256
+
+/* upper limit of cryptodev_async_lanes */
+#define MAX_ASYNC_LANES 64
 
 /* ====== Module parameters ====== */
 
@@ -71,26 +102,119 @@ int cryptodev_verbosity;
 module_param(cryptodev_verbosity, int, 0644);
 MODULE_PARM_DESC(cryptodev_verbosity, "0: normal, 1: verbose, 2: debug");
 
+static int cryptodev_async_lanes = 1;
+module_param(cryptodev_async_lanes, int, 0644);
+MODULE_PARM_DESC(cryptodev_async_lanes,
+	"number of async jobs of a file descriptor that may run in parallel, "
+	"on any CPU; the jobs of a session still run in order");
+
 /* ====== CryptoAPI ====== */
+
+/* states of a job ring slot */
+enum {
+	TODO_FREE = 0,
+	TODO_FILLING,	/* reserved by a submitter */
+	TODO_QUEUED,	/* ready to be run by cryptask */
+	TODO_INFLIGHT,	/* started by cryptask, on the non-blocking path */
+	TODO_DONE,	/* waiting to be fetched */
+	TODO_CANCELLED,	/* the submission failed, skip it */
+	TODO_FETCHING,	/* being fetched ahead of the tail */
+	TODO_FETCHED,	/* fetched ahead of the tail, freed when it gets here */
+};
+
+/* A slot of the async queue. Each is on cache lines of its own, as the
+ * submitter, the worker and the fetcher of neighbouring slots run on
+ * different CPUs. The fetchers poll state, which comes first. */
 struct todo_list_item {
-	struct list_head __hook;
-	struct kernel_crypt_op kcop;
+	int state;
 	int result;
+	int interactive; /* of an SOP_FLAG_INTERACTIVE session, once started */
+	int auth; /* kcaop rather than kcop, see CIOCASYNCAUTHCRYPT */
+	uint32_t sid;
+	/* while in flight */
+	struct crypt_priv *pcr;
+	struct csession *ses;
+	struct llist_node reap;
+	struct list_head lane_entry;
+	struct crypto_nowait_op nowait;
+	union {
+		struct kernel_crypt_op kcop;
+		struct kernel_crypt_auth_op kcaop;
+	};
+} ____cacheline_aligned;
+
+/* The jobs of the sessions assigned to a lane, in the order cryptask
+ * dispatched them. Each lane runs them one after another on the
+ * unbound workqueue, those of SOP_FLAG_INTERACTIVE sessions first. */
+struct crypt_lane {
+	struct crypt_priv *pcr;
+	spinlock_t lock;
+	struct list_head urgent, jobs;
+	struct work_struct work;
 };
 
-struct locked_list {
-	struct list_head list;
-	struct mutex lock;
+/* kernel side of the shared rings, see struct crypt_ring */
+struct shared_ring {
+	void *area;		/* mapped by userspace */
+	struct crypt_ring *hdr;
+	struct crypt_ring_sqe *sqes;
+	struct crypt_ring_cqe *cqes;
+	unsigned int entries;	/* a power of two */
+	/* the indices owned by the kernel; their copies in hdr are
+	 * only written, as userspace may scribble over them */
+	unsigned int sq_head, cq_tail;
+	/* the address space the entries' pointers refer to */
+	struct mm_struct *mm;
 };
 
+/* The job ring. Jobs stay in their slot from submission until they
+ * are fetched, and three free running indices walk over the ring:
+ * head is where the next job is submitted, run is the next job for
+ * cryptask and tail the next job to be fetched. Only cryptask ever
+ * advances run, so it runs without any locks; concurrent submitters
+ * and fetchers each serialize on a spinlock just for claiming a slot.
+ *
+ * Jobs that can take the non-blocking path are only started by
+ * cryptask, so several of them can be in flight at once. On completion
+ * they are put on the reaped list, and cryptask finishes them. Jobs are
+ * still fetched in the order they were submitted.
+ *
+ * The jobs of SOP_FLAG_INTERACTIVE sessions are the exception: before
+ * each other job cryptask runs those queued after it, from ahead on,
+ * and a fetcher that finds the job at the tail not done yet may take
+ * the first of them that is. run then skips the slots it finds already
+ * started, and tail those already fetched. tail never passes run, so
+ * that the slots run has yet to skip are not reused under it.
+ *
+ * With more than one lane cryptask only dispatches the jobs, by session,
+ * and the lanes run them in parallel.
+ */
 struct crypt_priv {
 	struct fcrypt fcrypt;
-	struct locked_list free, todo, done;
-	int itemcount;
+	struct todo_list_item *ring;
+	unsigned int ringsize; /* a power of two */
+	unsigned int head, run, tail;
+	unsigned int ahead; /* the next job cryptask looks at after run */
+	atomic_t interactive_done; /* interactive jobs not fetched yet */
+	spinlock_t submit_lock, fetch_lock;
+	struct llist_head reaped;
+	atomic_t inflight;
 	struct work_struct cryptask;
+	struct crypt_lane *lanes;
+	unsigned int nr_lanes;
+	int closing; /* no more jobs are started */
+	int resizing; /* no jobs are queued, see crypto_async_set_ringsize() */
 	wait_queue_head_t user_waiter;
+	/* signalled with the number of completions, see CIOCASYNCEVENTFD */
+	struct eventfd_ctx *eventfd;
+	spinlock_t eventfd_lock;
+	atomic_t unsignalled;
+	struct shared_ring *sring; /* set up once, by CIOCRINGSETUP */
+	struct work_struct ringtask;
 };
 
+#define RING_SLOT(pcr, idx) (&(pcr)->ring[(idx) & ((pcr)->ringsize - 1)])
+
 #define FILL_SG(sg, ptr, len)					\
 	do {							\
 		(sg)->page = virt_to_page(ptr);			\
@@ -101,16 +225,220 @@ struct crypt_priv {
 
 /* cryptodev's own workqueue, keeps crypto tasks from disturbing the force */
 static struct workqueue_struct *cryptodev_wq;
+/* where the lanes run, on whatever CPU is free */
+static struct workqueue_struct *cryptodev_lane_wq;
+
+/* sessions are allocated from a cache of their own, as TLS servers
+ * may create and end thousands of them per second */
+static struct kmem_cache *cryptodev_session_cache;
+/* and so are their request contexts, of which each thread that runs an
+ * operation on a session may take one */
+static struct kmem_cache *cryptodev_ctx_cache;
+
+/* Set for a cipher and hash pair once no tls10 AEAD could be found for
+ * it, so that sessions do not keep on asking for the module */
+#define TLS_AEAD_PAIR(cipher, mac) ((cipher) * CRYPTO_ALGORITHM_ALL + (mac))
+static DECLARE_BITMAP(tls_aead_missing,
+		      CRYPTO_ALGORITHM_ALL * CRYPTO_ALGORITHM_ALL);
+
+static void crypto_free_ctx(struct csession_ctx *ctx)
+{
+	if (ctx->shard) {
+		cryptodev_cipher_deinit(&ctx->cdata);
+		cryptodev_hash_deinit(&ctx->hdata);
+	} else {
+		cryptodev_cipher_clone_deinit(&ctx->cdata);
+		cryptodev_hash_clone_deinit(&ctx->hdata);
+	}
+	kmem_cache_free(cryptodev_ctx_cache, ctx);
+}
+
+static void crypto_uncharge_shards(struct fcrypt *fcr, unsigned int nr)
+{
+	if (!nr)
+		return;
+
+	mutex_lock(&fcr->sem);
+	fcr->nr_shards -= nr;
+	mutex_unlock(&fcr->sem);
+}
+
+/* Give a SOP_FLAG_TFM_SHARDS session nr contexts with transforms of their
+ * own, keyed as those of the session. They are kept in spare_ctx, ahead
+ * of the contexts that share the transforms of the session. alg_name and
+ * hash_name are the drivers of those, so that the shards run on the same
+ * implementation. */
+static int crypto_create_shards(struct csession *ses_ptr, unsigned int nr,
+		const char *alg_name, uint8_t *key, unsigned int keylen,
+		int stream, const char *hash_name, int hmac_mode,
+		uint8_t *mackey, unsigned int mackeylen)
+{
+	struct csession_ctx *ctx;
+	unsigned int i;
+	int ret;
+
+	for (i = 0; i < nr; i++) {
+		ctx = kmem_cache_alloc_node(cryptodev_ctx_cache,
+				GFP_KERNEL | __GFP_ZERO, ses_ptr->node);
+		if (unlikely(!ctx))
+			return -ENOMEM;
+		ctx->shard = 1;
+		list_add(&ctx->entry, &ses_ptr->spare_ctx);
+		ses_ptr->nr_spare_ctx++;
+		ses_ptr->nr_shards++;
+
+		if (alg_name) {
+			ret = cryptodev_cipher_init(&ctx->cdata, alg_name, 0, 0,
+						key, keylen, stream, 0,
+						ses_ptr->node);
+			if (unlikely(ret))
+				return ret;
+		}
+
+		if (hash_name) {
+			ret = cryptodev_hash_init(&ctx->hdata, hash_name, 0, 0,
+						hmac_mode, mackey, mackeylen,
+						ses_ptr->node);
+			if (unlikely(ret))
+				return ret;
+		}
+	}
+
+	ddebug(2, "%u transforms of its own for the session", nr);
+	return 0;
+}
+
+#define SOP_FLAG_IMPL (SOP_FLAG_DRIVER | SOP_FLAG_PREFER_SYNC | \
+		       SOP_FLAG_PREFER_ASYNC | SOP_FLAG_DRIVER_AUTO)
+
+/* The name, type and mask to look up alg_name with, as asked for by the
+ * SOP_FLAG_IMPL flags of sop2. driver is the one named by sop2 for it. */
+static const char *crypto_session_impl(struct session2_op *sop2,
+		const char *alg_name, const char *driver, u32 *type, u32 *mask)
+{
+	*type = *mask = 0;
+
+	switch (sop2->flags & SOP_FLAG_IMPL) {
+	case SOP_FLAG_DRIVER:
+		if (driver[0])
+			return driver;
+		break;
+	case SOP_FLAG_PREFER_SYNC:
+		*mask = CRYPTO_ALG_ASYNC;
+		break;
+	case SOP_FLAG_PREFER_ASYNC:
+		*type = *mask = CRYPTO_ALG_ASYNC;
+		break;
+	}
+	return alg_name;
+}
+
+/* Whether the implementation of tfm is the one named for alg_name */
+static int crypto_session_impl_matches(struct crypto_tfm *tfm,
+		const char *alg_name, const char *name)
+{
+	if (name == alg_name || strcmp(crypto_tfm_alg_name(tfm), alg_name) == 0)
+		return 1;
+
+	ddebug(1, "%s is not a driver of %s", name, alg_name);
+	return 0;
+}
+
+static int crypto_session_cipher_init(struct cipher_data *cdata,
+		struct session2_op *sop2, const char *alg_name,
+		uint8_t *key, unsigned int keylen, int stream, int aead,
+		int node)
+{
+	const char *name;
+	u32 type, mask;
+	int ret;
+
+	name = crypto_session_impl(sop2, alg_name, sop2->cipher_driver,
+				   &type, &mask);
+	ret = cryptodev_cipher_init(cdata, name, type, mask,
+				    key, keylen, stream, aead, node);
+	/* a preference only */
+	if (ret < 0 && mask)
+		ret = cryptodev_cipher_init(cdata, alg_name, 0, 0,
+					    key, keylen, stream, aead, node);
+	if (ret == 0 && !crypto_session_impl_matches(
+				cryptodev_cipher_tfm(cdata), alg_name, name)) {
+		cryptodev_cipher_deinit(cdata);
+		ret = -EINVAL;
+	}
+	return ret;
+}
+
+static int crypto_session_hash_init(struct hash_data *hdata,
+		struct session2_op *sop2, const char *hash_name,
+		int hmac_mode, uint8_t *mackey, unsigned int mackeylen,
+		int node)
+{
+	const char *name;
+	u32 type, mask;
+	int ret;
+
+	name = crypto_session_impl(sop2, hash_name, sop2->hash_driver,
+				   &type, &mask);
+	ret = cryptodev_hash_init(hdata, name, type, mask,
+				  hmac_mode, mackey, mackeylen, node);
+	if (ret < 0 && mask)
+		ret = cryptodev_hash_init(hdata, hash_name, 0, 0,
+					  hmac_mode, mackey, mackeylen, node);
+	if (ret == 0 && !crypto_session_impl_matches(
+				crypto_ahash_tfm(hdata->async.s), hash_name, name)) {
+		cryptodev_hash_deinit(hdata);
+		ret = -EINVAL;
+	}
+	return ret;
+}
+
+/* Give an SOP_FLAG_DRIVER_AUTO session synchronous transforms for its
+ * small operations. It gets none if its own are synchronous already, or
+ * if some of its algorithms have no synchronous implementation. */
+static void crypto_create_sync(struct csession *ses_ptr, const char *alg_name,
+		uint8_t *key, unsigned int keylen, int stream,
+		const char *hash_name, int hmac_mode,
+		uint8_t *mackey, unsigned int mackeylen)
+{
+	if (!(alg_name && tfm_is_async(cryptodev_cipher_tfm(&ses_ptr->cdata))) &&
+	    !(hash_name && tfm_is_async(crypto_ahash_tfm(ses_ptr->hdata.async.s))))
+		return;
+
+	if (alg_name && cryptodev_cipher_init(&ses_ptr->sync_cdata, alg_name,
+				0, CRYPTO_ALG_ASYNC, key, keylen, stream, 0,
+				ses_ptr->node))
+		goto missing;
+
+	if (hash_name && cryptodev_hash_init(&ses_ptr->sync_hdata, hash_name,
+				0, CRYPTO_ALG_ASYNC, hmac_mode, mackey, mackeylen,
+				ses_ptr->node))
+		goto missing;
+
+	ddebug(2, "small operations on %s", alg_name ?
+		crypto_tfm_alg_driver_name(cryptodev_cipher_tfm(&ses_ptr->sync_cdata)) :
+		crypto_tfm_alg_driver_name(crypto_ahash_tfm(ses_ptr->sync_hdata.async.s)));
+	return;
+
+missing:
+	ddebug(2, "no synchronous implementation of %s",
+			alg_name ? alg_name : hash_name);
+	cryptodev_cipher_deinit(&ses_ptr->sync_cdata);
+	cryptodev_hash_deinit(&ses_ptr->sync_hdata);
+}
 
 /* Prepare session for future use. */
 static int
-crypto_create_session(struct fcrypt *fcr, struct session_op *sop)
+crypto_create_session(struct fcrypt *fcr, struct session2_op *sop2)
 {
-	struct csession	*ses_new = NULL, *ses_ptr;
+	struct session_op *sop = &sop2->sop;
+	struct csession	*ses_new = NULL;
 	int ret = 0;
 	const char *alg_name = NULL;
 	const char *hash_name = NULL;
-	int hmac_mode = 1, stream = 0, aead = 0;
+	int hmac_mode = 1, stream = 0, aead = 0, node;
+	unsigned int keylen = 0;
+	struct csession_ctx *ctx, *tmp;
 	/*
 	 * With composite aead ciphers, only ckey is used and it can cover all the
 	 * structure space; otherwise both keys may be used simultaneously but they
@@ -129,6 +457,28 @@ crypto_create_session(struct fcrypt *fcr, struct session_op *sop)
 		return -EINVAL;
 	}
 
+	if (unlikely(sop2->flags & ~(SOP_FLAG_IV_COUNTER | SOP_FLAG_IV_SEQNUM |
+				     SOP_FLAG_TFM_SHARDS | SOP_FLAG_IMPL |
+				     SOP_FLAG_SRTP | SOP_FLAG_NUMA_NODE |
+				     SOP_FLAG_INTERACTIVE) ||
+		     hweight32(sop2->flags & SOP_FLAG_IMPL) > 1)) {
+		ddebug(1, "bad session flags: 0x%x", sop2->flags);
+		return -EINVAL;
+	}
+	sop2->cipher_driver[sizeof(sop2->cipher_driver) - 1] = '\0';
+	sop2->hash_driver[sizeof(sop2->hash_driver) - 1] = '\0';
+
+	if (sop2->flags & SOP_FLAG_NUMA_NODE) {
+		if (unlikely(sop2->node < 0 || sop2->node >= MAX_NUMNODES ||
+			     !node_online(sop2->node))) {
+			ddebug(1, "bad NUMA node: %d", sop2->node);
+			return -EINVAL;
+		}
+		node = sop2->node;
+	} else {
+		node = numa_node_id();
+	}
+
 	switch (sop->cipher) {
 	case 0:
 		break;
@@ -229,13 +579,16 @@ crypto_create_session(struct fcrypt *fcr, struct session_op *sop)
 	}
 
 	/* Create a session and put it to the list. */
-	ses_new = kzalloc(sizeof(*ses_new), GFP_KERNEL);
+	ses_new = kmem_cache_alloc_node(cryptodev_session_cache,
+					GFP_KERNEL | __GFP_ZERO, node);
 	if (!ses_new)
 		return -ENOMEM;
+	INIT_LIST_HEAD(&ses_new->spare_ctx);
+	ses_new->node = node;
+	ses_new->interactive = !!(sop2->flags & SOP_FLAG_INTERACTIVE);
 
 	/* Set-up crypto transform. */
 	if (alg_name) {
-		unsigned int keylen;
 		ret = cryptodev_get_cipher_keylen(&keylen, sop, aead);
 		if (unlikely(ret < 0)) {
 			ddebug(1, "Setting key failed for %s-%zu.",
@@ -247,8 +600,8 @@ crypto_create_session(struct fcrypt *fcr, struct session_op *sop)
 		if (unlikely(ret < 0))
 			goto error_cipher;
 
-		ret = cryptodev_cipher_init(&ses_new->cdata, alg_name, keys.ckey,
-						keylen, stream, aead);
+		ret = crypto_session_cipher_init(&ses_new->cdata, sop2,
+				alg_name, keys.ckey, keylen, stream, aead, node);
 		if (ret < 0) {
 			ddebug(1, "Failed to load cipher for %s", alg_name);
 			ret = -EINVAL;
@@ -270,8 +623,9 @@ crypto_create_session(struct fcrypt *fcr, struct session_op *sop)
 			goto error_hash;
 		}
 
-		ret = cryptodev_hash_init(&ses_new->hdata, hash_name, hmac_mode,
-							keys.mkey, sop->mackeylen);
+		ret = crypto_session_hash_init(&ses_new->hdata, sop2,
+				hash_name, hmac_mode, keys.mkey, sop->mackeylen,
+				node);
 		if (ret != 0) {
 			ddebug(1, "Failed to load hash for %s", hash_name);
 			ret = -EINVAL;
@@ -279,40 +633,173 @@ crypto_create_session(struct fcrypt *fcr, struct session_op *sop)
 		}
 	}
 
-	ses_new->alignmask = max(ses_new->cdata.alignmask,
-	                                          ses_new->hdata.alignmask);
+	if (sop2->flags & SOP_FLAG_TFM_SHARDS) {
+		unsigned int nr = sop2->shards ? sop2->shards :
+						 num_online_cpus() - 1;
+
+		if (unlikely(aead || nr > MAX_TFM_SHARDS)) {
+			ddebug(1, "%u transforms are not usable with %s", nr,
+					alg_name ? alg_name : hash_name);
+			ret = -EINVAL;
+			goto error_hash;
+		}
+
+		/* those of all the sessions are charged to the descriptor,
+		 * and are given back by crypto_uncharge_shards() */
+		mutex_lock(&fcr->sem);
+		if (unlikely(fcr->nr_shards + nr > MAX_FD_TFM_SHARDS)) {
+			ret = -ENOSPC;
+		} else {
+			fcr->nr_shards += nr;
+			ret = 0;
+		}
+		mutex_unlock(&fcr->sem);
+		if (unlikely(ret)) {
+			ddebug(1, "no room for %u more transforms", nr);
+			goto error_hash;
+		}
+
+		ret = crypto_create_shards(ses_new, nr,
+				alg_name ? crypto_tfm_alg_driver_name(
+					cryptodev_cipher_tfm(&ses_new->cdata)) : NULL,
+				keys.ckey, keylen, stream,
+				hash_name ? crypto_tfm_alg_driver_name(
+					crypto_ahash_tfm(ses_new->hdata.async.s)) : NULL,
+				hmac_mode, keys.mkey, sop->mackeylen);
+		if (unlikely(ret)) {
+			ddebug(1, "Failed to load the transforms of the session");
+			/* error_hash gives back those that were created */
+			crypto_uncharge_shards(fcr, nr - ses_new->nr_shards);
+			goto error_hash;
+		}
+	}
+
+	if (sop2->flags & SOP_FLAG_DRIVER_AUTO) {
+		if (unlikely(aead)) {
+			ddebug(1, "%s has a single implementation per session",
+					alg_name);
+			ret = -EINVAL;
+			goto error_hash;
+		}
+
+		crypto_create_sync(ses_new, alg_name, keys.ckey, keylen, stream,
+				hash_name, hmac_mode, keys.mkey, sop->mackeylen);
+		ses_new->crossover = cryptodev_crossover_get(ses_new, 0);
+	}
+
+	/* TLS records of a CBC and HMAC session can be done in a single
+	 * pass, by drivers that implement the tls10 AEAD. Not for sessions
+	 * that chose their implementation, as its driver would be another. */
+	if (alg_name && hash_name && hmac_mode && !stream && !aead &&
+	    !(sop2->flags & SOP_FLAG_IMPL) &&
+	    sop->cipher < CRYPTO_ALGORITHM_ALL && sop->mac < CRYPTO_ALGORITHM_ALL &&
+	    !test_bit(TLS_AEAD_PAIR(sop->cipher, sop->mac), tls_aead_missing)) {
+		char tls_name[CRYPTO_MAX_ALG_NAME];
+
+		snprintf(tls_name, sizeof(tls_name), "tls10(%s,%s)",
+				hash_name, alg_name);
+		if (!crypto_has_alg(tls_name, CRYPTO_ALG_TYPE_AEAD,
+				    CRYPTO_ALG_TYPE_MASK)) {
+			/* only a missing algorithm is remembered, not a
+			 * failure to set up this session's key */
+			set_bit(TLS_AEAD_PAIR(sop->cipher, sop->mac),
+				tls_aead_missing);
+		} else if (cryptodev_get_cipher_keylen(&keylen, sop, 1) == 0 &&
+			   cryptodev_get_cipher_key(keys.ckey, sop, 1) == 0 &&
+			   cryptodev_cipher_init(&ses_new->tls, tls_name, 0, 0,
+					keys.ckey, keylen, 0, 1, node) == 0) {
+			ddebug(2, "using %s for TLS records", tls_name);
+		} else {
+			memset(&ses_new->tls, 0, sizeof(ses_new->tls));
+		}
+	}
+
+	ses_new->alignmask = max3(ses_new->cdata.alignmask,
+				  ses_new->hdata.alignmask,
+				  ses_new->tls.alignmask);
+	ses_new->alignmask = max3(ses_new->alignmask,
+				  ses_new->sync_cdata.alignmask,
+				  ses_new->sync_hdata.alignmask);
 	ddebug(2, "got alignmask %d", ses_new->alignmask);
 
-	ses_new->array_size = DEFAULT_PREALLOC_PAGES;
-	ddebug(2, "preallocating for %d user pages", ses_new->array_size);
-	ses_new->pages = kzalloc(ses_new->array_size *
-			sizeof(struct page *), GFP_KERNEL);
-	ses_new->sg = kzalloc(ses_new->array_size *
-			sizeof(struct scatterlist), GFP_KERNEL);
-	if (ses_new->sg == NULL || ses_new->pages == NULL) {
-		ddebug(0, "Memory error");
-		ret = -ENOMEM;
-		goto error_hash;
+	/* Generated IVs are only safe with counter modes, and the sequence
+	 * number takes the last 8 bytes of the IV. */
+	ses_new->iv_mode = sop2->flags & (SOP_FLAG_IV_COUNTER | SOP_FLAG_IV_SEQNUM);
+	if (ses_new->iv_mode) {
+		unsigned int ivsize = ses_new->cdata.ivsize;
+
+		if (unlikely(!stream || ivsize == 0 ||
+			     (ses_new->iv_mode == SOP_FLAG_IV_SEQNUM &&
+			      (!aead || ivsize < 8)) ||
+			     ses_new->iv_mode == (SOP_FLAG_IV_COUNTER | SOP_FLAG_IV_SEQNUM))) {
+			ddebug(1, "IV mode 0x%x is not usable with %s",
+					ses_new->iv_mode, alg_name ? alg_name : hash_name);
+			ret = -EINVAL;
+			goto error_hash;
+		}
+
+		if (sop2->iv && unlikely(copy_from_user(ses_new->iv, sop2->iv,
+							ivsize))) {
+			ret = -EFAULT;
+			goto error_hash;
+		}
 	}
 
-	/* put the new session to the list */
-	get_random_bytes(&ses_new->sid, sizeof(ses_new->sid));
-	mutex_init(&ses_new->sem);
+	/* SRTP takes AES-CM with a MAC, and IVs of its own */
+	if (sop2->flags & SOP_FLAG_SRTP) {
+		if (unlikely(sop->cipher != CRYPTO_AES_CTR || !hash_name ||
+			     !hmac_mode || ses_new->iv_mode)) {
+			ddebug(1, "SRTP is not usable with %s and %s",
+					alg_name ? alg_name : "no cipher",
+					hash_name ? hash_name : "no mac");
+			ret = -EINVAL;
+			goto error_hash;
+		}
 
-	mutex_lock(&fcr->sem);
-restart:
-	list_for_each_entry(ses_ptr, &fcr->list, entry) {
-		/* Check for duplicate SID */
-		if (unlikely(ses_new->sid == ses_ptr->sid)) {
-			get_random_bytes(&ses_new->sid, sizeof(ses_new->sid));
-			/* Unless we have a broken RNG this
-			   shouldn't loop forever... ;-) */
-			goto restart;
+		ses_new->srtp = kzalloc_node(sizeof(*ses_new->srtp),
+					     GFP_KERNEL, node);
+		if (unlikely(!ses_new->srtp)) {
+			ret = -ENOMEM;
+			goto error_hash;
+		}
+		if (sop2->iv && unlikely(copy_from_user(ses_new->srtp->salt,
+						sop2->iv, SRTP_SALT_SIZE))) {
+			ret = -EFAULT;
+			goto error_hash;
 		}
 	}
 
-	list_add(&ses_new->entry, &fcr->list);
+	ses_new->fcr = fcr;
+	ses_new->stat_alg = sop->cipher ? sop->cipher : sop->mac;
+	cryptodev_stat_alg_name(ses_new->stat_alg,
+				alg_name ? alg_name : hash_name);
+
+	mutex_init(&ses_new->sem);
+	atomic_set(&ses_new->refcnt, 1);
+	spin_lock_init(&ses_new->lock);
+
+	/* Reserve a sid, and make the session visible to lookups only
+	 * after the sid has been set. IDs are handed out cyclically so
+	 * that a sid is not reused right after its session was freed. */
+	idr_preload(GFP_KERNEL);
+	mutex_lock(&fcr->sem);
+	ret = idr_alloc_cyclic(&fcr->sessions, NULL, 1, 0, GFP_NOWAIT);
+	if (likely(ret > 0)) {
+		ses_new->sid = ret;
+		idr_replace(&fcr->sessions, ses_new, ret);
+		if (ses_new->interactive)
+			atomic_inc(&fcr->nr_interactive);
+	}
 	mutex_unlock(&fcr->sem);
+	idr_preload_end();
+
+	if (unlikely(ret < 0)) {
+		ddebug(0, "Cannot allocate a session ID: %d", ret);
+		mutex_destroy(&ses_new->sem);
+		goto error_hash;
+	}
+
+	trace_cryptodev_session_create(ses_new);
 
 	/* Fill in some values for the user. */
 	sop->ses = ses_new->sid;
@@ -320,398 +807,1692 @@ restart:
 	return 0;
 
 error_hash:
+	crypto_uncharge_shards(fcr, ses_new->nr_shards);
+	kzfree(ses_new->srtp);
+	list_for_each_entry_safe(ctx, tmp, &ses_new->spare_ctx, entry)
+		crypto_free_ctx(ctx);
+	cryptodev_cipher_deinit(&ses_new->tls);
+	cryptodev_hash_deinit(&ses_new->sync_hdata);
+	cryptodev_cipher_deinit(&ses_new->sync_cdata);
+	cryptodev_hash_deinit(&ses_new->hdata);
 	cryptodev_cipher_deinit(&ses_new->cdata);
-	kfree(ses_new->sg);
-	kfree(ses_new->pages);
 error_cipher:
-	kfree(ses_new);
+	kmem_cache_free(cryptodev_session_cache, ses_new);
 
 	return ret;
 
 }
 
-/* Everything that needs to be done when remowing a session. */
-static inline void
+static void crypto_free_session_rcu(struct rcu_head *head)
+{
+	kmem_cache_free(cryptodev_session_cache,
+			container_of(head, struct csession, rcu));
+}
+
+/* Everything that needs to be done when remowing a session.
+ * Called when the last reference to it is dropped. */
+static void
 crypto_destroy_session(struct csession *ses_ptr)
 {
-	if (!mutex_trylock(&ses_ptr->sem)) {
-		ddebug(2, "Waiting for semaphore of sid=0x%08X", ses_ptr->sid);
-		mutex_lock(&ses_ptr->sem);
-	}
+	struct csession_ctx *ctx, *tmp;
+
 	ddebug(2, "Removed session 0x%08X", ses_ptr->sid);
+	kzfree(ses_ptr->srtp);
+	list_for_each_entry_safe(ctx, tmp, &ses_ptr->spare_ctx, entry)
+		crypto_free_ctx(ctx);
+	cryptodev_cipher_deinit(&ses_ptr->tls);
+	cryptodev_cipher_deinit(&ses_ptr->sync_cdata);
+	cryptodev_hash_deinit(&ses_ptr->sync_hdata);
 	cryptodev_cipher_deinit(&ses_ptr->cdata);
 	cryptodev_hash_deinit(&ses_ptr->hdata);
-	ddebug(2, "freeing space for %d user pages", ses_ptr->array_size);
-	kfree(ses_ptr->pages);
-	kfree(ses_ptr->sg);
-	mutex_unlock(&ses_ptr->sem);
 	mutex_destroy(&ses_ptr->sem);
-	kfree(ses_ptr);
+	/* lockless lookups may still be looking at refcnt */
+	call_rcu(&ses_ptr->rcu, crypto_free_session_rcu);
+}
+
+void crypto_release_session(struct csession *ses_ptr)
+{
+	if (atomic_dec_and_test(&ses_ptr->refcnt))
+		crypto_destroy_session(ses_ptr);
 }
 
 /* Look up a session by ID and remove. */
 static int
 crypto_finish_session(struct fcrypt *fcr, uint32_t sid)
 {
-	struct csession *tmp, *ses_ptr;
-	struct list_head *head;
-	int ret = 0;
+	struct csession *ses_ptr;
 
 	mutex_lock(&fcr->sem);
-	head = &fcr->list;
-	list_for_each_entry_safe(ses_ptr, tmp, head, entry) {
-		if (ses_ptr->sid == sid) {
-			list_del(&ses_ptr->entry);
-			crypto_destroy_session(ses_ptr);
-			break;
-		}
+	ses_ptr = idr_find(&fcr->sessions, sid);
+	if (likely(ses_ptr)) {
+		idr_remove(&fcr->sessions, sid);
+		if (ses_ptr->interactive)
+			atomic_dec(&fcr->nr_interactive);
+		fcr->nr_shards -= ses_ptr->nr_shards;
 	}
+	mutex_unlock(&fcr->sem);
 
 	if (unlikely(!ses_ptr)) {
 		derr(1, "Session with sid=0x%08X not found!", sid);
-		ret = -ENOENT;
+		return -ENOENT;
 	}
-	mutex_unlock(&fcr->sem);
 
-	return ret;
+	/* users of the session (if any) will destroy it */
+	crypto_release_session(ses_ptr);
+	return 0;
 }
 
 /* Remove all sessions when closing the file */
 static int
 crypto_finish_all_sessions(struct fcrypt *fcr)
 {
-	struct csession *tmp, *ses_ptr;
-	struct list_head *head;
+	struct csession *ses_ptr;
+	int id;
 
 	mutex_lock(&fcr->sem);
-
-	head = &fcr->list;
-	list_for_each_entry_safe(ses_ptr, tmp, head, entry) {
-		list_del(&ses_ptr->entry);
-		crypto_destroy_session(ses_ptr);
+	idr_for_each_entry(&fcr->sessions, ses_ptr, id) {
+		idr_remove(&fcr->sessions, id);
+		crypto_release_session(ses_ptr);
 	}
 	mutex_unlock(&fcr->sem);
 
+	idr_destroy(&fcr->sessions);
 	return 0;
 }
 
-/* Look up session by session ID. The returned session is locked. */
+/* Look up session by session ID. The returned session is referenced,
+ * but not locked; release it with crypto_release_session(). */
 struct csession *
-crypto_get_session_by_sid(struct fcrypt *fcr, uint32_t sid)
+crypto_ref_session_by_sid(struct fcrypt *fcr, uint32_t sid)
 {
-	struct csession *ses_ptr, *retval = NULL;
+	struct csession *ses_ptr;
 
 	if (unlikely(fcr == NULL))
 		return NULL;
 
-	mutex_lock(&fcr->sem);
-	list_for_each_entry(ses_ptr, &fcr->list, entry) {
-		if (ses_ptr->sid == sid) {
-			mutex_lock(&ses_ptr->sem);
-			retval = ses_ptr;
-			break;
-		}
-	}
-	mutex_unlock(&fcr->sem);
+	rcu_read_lock();
+	ses_ptr = idr_find(&fcr->sessions, sid);
+	if (ses_ptr && unlikely(!atomic_inc_not_zero(&ses_ptr->refcnt)))
+		ses_ptr = NULL;
+	rcu_read_unlock();
 
-	return retval;
+	return ses_ptr;
 }
 
-static void cryptask_routine(struct work_struct *work)
+/* Look up session by session ID. The returned session is locked
+ * and referenced; release it with crypto_put_session(). */
+struct csession *
+crypto_get_session_by_sid(struct fcrypt *fcr, uint32_t sid)
 {
-	struct crypt_priv *pcr = container_of(work, struct crypt_priv, cryptask);
-	struct todo_list_item *item;
-	LIST_HEAD(tmp);
-
-	/* fetch all pending jobs into the temporary list */
-	mutex_lock(&pcr->todo.lock);
-	list_cut_position(&tmp, &pcr->todo.list, pcr->todo.list.prev);
-	mutex_unlock(&pcr->todo.lock);
-
-	/* handle each job locklessly */
-	list_for_each_entry(item, &tmp, __hook) {
-		item->result = crypto_run(&pcr->fcrypt, &item->kcop);
-		if (unlikely(item->result))
-			derr(0, "crypto_run() failed: %d", item->result);
-	}
+	struct csession *ses_ptr;
 
-	/* push all handled jobs to the done list at once */
-	mutex_lock(&pcr->done.lock);
-	list_splice_tail(&tmp, &pcr->done.list);
-	mutex_unlock(&pcr->done.lock);
+	ses_ptr = crypto_ref_session_by_sid(fcr, sid);
+	if (likely(ses_ptr))
+		mutex_lock(&ses_ptr->sem);
 
-	/* wake for POLLIN */
-	wake_up_interruptible(&pcr->user_waiter);
+	return ses_ptr;
 }
 
-/* ====== /dev/crypto ====== */
-
-static int
-cryptodev_open(struct inode *inode, struct file *filp)
+void crypto_put_session(struct csession *ses_ptr)
 {
-	struct todo_list_item *tmp, *tmp_next;
-	struct crypt_priv *pcr;
-	int i;
-
-	pcr = kzalloc(sizeof(*pcr), GFP_KERNEL);
-	if (!pcr)
-		return -ENOMEM;
-	filp->private_data = pcr;
+	mutex_unlock(&ses_ptr->sem);
+	crypto_release_session(ses_ptr);
+}
 
-	mutex_init(&pcr->fcrypt.sem);
-	mutex_init(&pcr->free.lock);
-	mutex_init(&pcr->todo.lock);
-	mutex_init(&pcr->done.lock);
+/* Get a request context for an operation that does not enter the
+ * session. Not for sessions with an AEAD cipher. */
+struct csession_ctx *crypto_get_ctx(struct csession *ses_ptr)
+{
+	struct csession_ctx *ctx = NULL;
+
+	spin_lock(&ses_ptr->lock);
+	if (!list_empty(&ses_ptr->spare_ctx)) {
+		ctx = list_first_entry(&ses_ptr->spare_ctx,
+					struct csession_ctx, entry);
+		list_del(&ctx->entry);
+		ses_ptr->nr_spare_ctx--;
+	}
+	spin_unlock(&ses_ptr->lock);
 
-	INIT_LIST_HEAD(&pcr->fcrypt.list);
-	INIT_LIST_HEAD(&pcr->free.list);
-	INIT_LIST_HEAD(&pcr->todo.list);
-	INIT_LIST_HEAD(&pcr->done.list);
+	if (ctx)
+		return ctx;
 
-	INIT_WORK(&pcr->cryptask, cryptask_routine);
+	ctx = kmem_cache_alloc_node(cryptodev_ctx_cache,
+				    GFP_KERNEL | __GFP_ZERO, ses_ptr->node);
+	if (unlikely(!ctx))
+		return NULL;
 
-	init_waitqueue_head(&pcr->user_waiter);
+	if (unlikely(cryptodev_cipher_clone(&ctx->cdata, &ses_ptr->cdata)))
+		goto error;
+	if (unlikely(cryptodev_hash_clone(&ctx->hdata, &ses_ptr->hdata)))
+		goto error;
 
-	for (i = 0; i < DEF_COP_RINGSIZE; i++) {
-		tmp = kzalloc(sizeof(struct todo_list_item), GFP_KERNEL);
-		if (!tmp)
-			goto err_ringalloc;
-		pcr->itemcount++;
-		ddebug(2, "allocated new item at %p", tmp);
-		list_add(&tmp->__hook, &pcr->free.list);
-	}
+	ddebug(2, "new request context for session 0x%08X", ses_ptr->sid);
+	return ctx;
 
-	ddebug(2, "Cryptodev handle initialised, %d elements in queue",
-			DEF_COP_RINGSIZE);
-	return 0;
+error:
+	crypto_free_ctx(ctx);
+	return NULL;
+}
 
-/* In case of errors, free any memory allocated so far */
-err_ringalloc:
-	list_for_each_entry_safe(tmp, tmp_next, &pcr->free.list, __hook) {
-		list_del(&tmp->__hook);
-		kfree(tmp);
+/* Take the IV of an operation of len bytes on an iv_mode session, and
+ * advance the one of the session past it */
+void crypto_session_next_iv(struct csession *ses_ptr, void *iv,
+				unsigned int len)
+{
+	unsigned int ivsize = ses_ptr->cdata.ivsize;
+	unsigned int i, start = 0;
+	u64 carry;
+
+	if (ses_ptr->iv_mode == SOP_FLAG_IV_SEQNUM) {
+		start = ivsize - 8;
+		carry = 1;
+	} else
+		/* an empty operation still uses up its IV, which an AEAD
+		 * cipher must never get twice */
+		carry = max(1U, DIV_ROUND_UP(len, ivsize));
+
+	spin_lock(&ses_ptr->lock);
+	memcpy(iv, ses_ptr->iv, ivsize);
+	for (i = ivsize; i > start && carry; i--) {
+		carry += ses_ptr->iv[i - 1];
+		ses_ptr->iv[i - 1] = carry & 0xff;
+		carry >>= 8;
 	}
-	mutex_destroy(&pcr->done.lock);
-	mutex_destroy(&pcr->todo.lock);
-	mutex_destroy(&pcr->free.lock);
-	mutex_destroy(&pcr->fcrypt.sem);
-	kfree(pcr);
-	filp->private_data = NULL;
-	return -ENOMEM;
+	spin_unlock(&ses_ptr->lock);
 }
 
-static int
-cryptodev_release(struct inode *inode, struct file *filp)
+void crypto_put_ctx(struct csession *ses_ptr, struct csession_ctx *ctx)
 {
-	struct crypt_priv *pcr = filp->private_data;
-	struct todo_list_item *item, *item_safe;
-	int items_freed = 0;
-
-	if (!pcr)
-		return 0;
+	spin_lock(&ses_ptr->lock);
+	if (ctx->shard) {
+		list_add(&ctx->entry, &ses_ptr->spare_ctx);
+		ses_ptr->nr_spare_ctx++;
+		ctx = NULL;
+	} else if (ses_ptr->nr_spare_ctx < ses_ptr->nr_shards + MAX_SPARE_CTX) {
+		list_add_tail(&ctx->entry, &ses_ptr->spare_ctx);
+		ses_ptr->nr_spare_ctx++;
+		ctx = NULL;
+	}
+	spin_unlock(&ses_ptr->lock);
 
-	cancel_work_sync(&pcr->cryptask);
+	if (ctx)
+		crypto_free_ctx(ctx);
+}
 
-	list_splice_tail(&pcr->todo.list, &pcr->free.list);
-	list_splice_tail(&pcr->done.list, &pcr->free.list);
+/* completion of a job in flight */
+static void cryptask_job_done(struct crypto_nowait_op *op, int err)
+{
+	struct todo_list_item *item =
+			container_of(op, struct todo_list_item, nowait);
+	struct crypt_priv *pcr = item->pcr;
 
-	list_for_each_entry_safe(item, item_safe, &pcr->free.list, __hook) {
-		ddebug(2, "freeing item at %p", item);
-		list_del(&item->__hook);
-		kfree(item);
-		items_freed++;
-	}
+	item->result = err;
+	/* the rest needs process context */
+	llist_add(&item->reap, &pcr->reaped);
+	queue_work(cryptodev_wq, &pcr->cryptask);
+}
 
-	if (items_freed != pcr->itemcount) {
-		derr(0, "freed %d items, but %d should exist!",
-				items_freed, pcr->itemcount);
-	}
+/* hand a job over to the fetchers */
+static void cryptask_job_finish(struct crypt_priv *pcr, struct todo_list_item *item)
+{
+	smp_store_release(&item->state, TODO_DONE);
+	if (item->interactive)
+		atomic_inc(&pcr->interactive_done);
+	atomic_inc(&pcr->unsignalled);
+}
 
-	crypto_finish_all_sessions(&pcr->fcrypt);
+/* finish the jobs that completed while in flight */
+static void cryptask_reap(struct crypt_priv *pcr)
+{
+	struct llist_node *node = llist_del_all(&pcr->reaped);
+	struct todo_list_item *item;
 
-	mutex_destroy(&pcr->done.lock);
-	mutex_destroy(&pcr->todo.lock);
-	mutex_destroy(&pcr->free.lock);
-	mutex_destroy(&pcr->fcrypt.sem);
+	while (node) {
+		item = llist_entry(node, struct todo_list_item, reap);
+		/* the slot may be reused as soon as it is done */
+		node = node->next;
 
-	kfree(pcr);
-	filp->private_data = NULL;
+		__crypto_nowait_finish(&item->nowait);
+		if (likely(!item->result))
+			crypto_session_set_iv(item->ses, item->kcop.iv);
+		crypto_release_session(item->ses);
+		if (unlikely(item->result))
+			derr(0, "crypto_run() failed: %d", item->result);
 
-	ddebug(2, "Cryptodev handle deinitialised, %d elements freed",
-			items_freed);
-	return 0;
+		cryptask_job_finish(pcr, item);
+		atomic_dec(&pcr->inflight);
+	}
 }
 
-static int
-clonefd(struct file *filp)
+/* Run an AEAD, TLS or SRTP job. The authenc code reads and writes the
+ * tag and the associated data with copy_*_user(), so this borrows the
+ * address space of the submitter, as cryptring_routine() does. */
+static int cryptask_auth_run(struct csession *ses_ptr,
+			struct kernel_crypt_auth_op *kcaop)
 {
+	struct mm_struct *mm = kcaop->mm;
 	int ret;
-	ret = get_unused_fd_flags(0);
-	if (ret >= 0) {
-			get_file(filp);
-			fd_install(ret, filp);
-	}
 
+	/* the process is exiting */
+	if (unlikely(!atomic_inc_not_zero(&mm->mm_users)))
+		return -EFAULT;
+
+	use_mm(mm);
+	ret = __crypto_auth_run(ses_ptr, kcaop);
+	unuse_mm(mm);
+	mmput(mm);
 	return ret;
 }
 
-#ifdef ENABLE_ASYNC
-/* enqueue a job for asynchronous completion
- *
- * returns:
- * -EBUSY when there are no free queue slots left
- *        (and the number of slots has reached it MAX_COP_RINGSIZE)
- * -EFAULT when there was a memory allocation error
- * 0 on success */
-static int crypto_async_run(struct crypt_priv *pcr, struct kernel_crypt_op *kcop)
+/* run a queued job, or only start it if it can take the non-blocking path */
+static void cryptask_job_run(struct crypt_priv *pcr, struct todo_list_item *item)
 {
-	struct todo_list_item *item = NULL;
-
-	if (unlikely(kcop->cop.flags & COP_FLAG_NO_ZC))
-		return -EINVAL;
+	struct csession *ses_ptr;
+	int ret;
 
-	mutex_lock(&pcr->free.lock);
-	if (likely(!list_empty(&pcr->free.list))) {
-		item = list_first_entry(&pcr->free.list,
-				struct todo_list_item, __hook);
-		list_del(&item->__hook);
-	} else if (pcr->itemcount < MAX_COP_RINGSIZE) {
-		pcr->itemcount++;
-	} else {
-		mutex_unlock(&pcr->free.lock);
-		return -EBUSY;
+	/* this also enters ses_ptr->sem */
+	ses_ptr = crypto_get_session_by_sid(&pcr->fcrypt, item->sid);
+	if (unlikely(!ses_ptr)) {
+		derr(1, "invalid session ID=0x%08X", item->sid);
+		ret = -EINVAL;
+		goto done;
 	}
-	mutex_unlock(&pcr->free.lock);
 
-	if (unlikely(!item)) {
-		item = kzalloc(sizeof(struct todo_list_item), GFP_KERNEL);
-		if (unlikely(!item))
-			return -EFAULT;
-		dinfo(1, "increased item count to %d", pcr->itemcount);
+	item->pcr = pcr;
+	item->ses = ses_ptr;
+	item->interactive = ses_ptr->interactive;
+	item->state = TODO_INFLIGHT;
+	if (item->auth) {
+		ret = cryptask_auth_run(ses_ptr, &item->kcaop);
+		crypto_put_session(ses_ptr);
+		goto done;
 	}
 
-	memcpy(&item->kcop, kcop, sizeof(struct kernel_crypt_op));
+	item->nowait.done = cryptask_job_done;
+	atomic_inc(&pcr->inflight);
 
-	mutex_lock(&pcr->todo.lock);
-	list_add_tail(&item->__hook, &pcr->todo.list);
-	mutex_unlock(&pcr->todo.lock);
+	ret = __crypto_run_nowait(ses_ptr, &item->kcop, &item->nowait);
+	if (ret == -EINPROGRESS) {
+		/* the reference is dropped by cryptask_reap() */
+		mutex_unlock(&ses_ptr->sem);
+		return;
+	}
+	atomic_dec(&pcr->inflight);
 
-	queue_work(cryptodev_wq, &pcr->cryptask);
-	return 0;
+	if (ret == -EAGAIN)
+		ret = __crypto_run(ses_ptr, &item->kcop);
+	crypto_put_session(ses_ptr);
+
+done:
+	if (unlikely(ret))
+		derr(0, "crypto_run() failed: %d", ret);
+	if (item->auth)
+		mmdrop(item->kcaop.mm);
+	item->result = ret;
+	cryptask_job_finish(pcr, item);
 }
 
-/* get the first completed job from the "done" queue
- *
- * returns:
- * -EBUSY if no completed jobs are ready (yet)
- * the return value of crypto_run() otherwise */
-static int crypto_async_fetch(struct crypt_priv *pcr,
-		struct kernel_crypt_op *kcop)
+/* Signal the eventfd with the jobs that completed since the last time */
+static void cryptask_notify(struct crypt_priv *pcr)
+{
+	int n = atomic_xchg(&pcr->unsignalled, 0);
+
+	if (!n)
+		return;
+
+	spin_lock(&pcr->eventfd_lock);
+	if (pcr->eventfd)
+		eventfd_signal(pcr->eventfd, n);
+	spin_unlock(&pcr->eventfd_lock);
+}
+
+static void lane_routine(struct work_struct *work)
+{
+	struct crypt_lane *lane = container_of(work, struct crypt_lane, work);
+	struct crypt_priv *pcr = lane->pcr;
+	struct todo_list_item *item;
+
+	for (;;) {
+		spin_lock(&lane->lock);
+		item = list_first_entry_or_null(&lane->urgent,
+				struct todo_list_item, lane_entry);
+		if (!item)
+			item = list_first_entry_or_null(&lane->jobs,
+					struct todo_list_item, lane_entry);
+		if (item)
+			list_del(&item->lane_entry);
+		spin_unlock(&lane->lock);
+
+		if (!item || ACCESS_ONCE(pcr->closing))
+			break;
+		cryptask_job_run(pcr, item);
+	}
+
+	/* wake for POLLIN */
+	cryptask_notify(pcr);
+	wake_up(&pcr->user_waiter);
+}
+
+/* The CPU to queue the work of a session on: any of its node, which
+ * for the unbound lane_wq picks the worker pool of that node */
+static int crypto_session_cpu(struct fcrypt *fcr, uint32_t sid)
+{
+	struct csession *ses_ptr;
+	int node = NUMA_NO_NODE;
+	int cpu;
+
+	rcu_read_lock();
+	ses_ptr = idr_find(&fcr->sessions, sid);
+	if (ses_ptr)
+		node = ses_ptr->node;
+	rcu_read_unlock();
+
+	if (node == NUMA_NO_NODE || node == numa_node_id())
+		return WORK_CPU_UNBOUND;
+
+	cpu = cpumask_any_and(cpumask_of_node(node), cpu_online_mask);
+	return cpu < nr_cpu_ids ? cpu : WORK_CPU_UNBOUND;
+}
+
+/* whether sid is an SOP_FLAG_INTERACTIVE session */
+static int crypto_session_interactive(struct fcrypt *fcr, uint32_t sid)
+{
+	struct csession *ses_ptr;
+	int ret = 0;
+
+	if (likely(!atomic_read(&fcr->nr_interactive)))
+		return 0;
+
+	rcu_read_lock();
+	ses_ptr = idr_find(&fcr->sessions, sid);
+	if (ses_ptr)
+		ret = ses_ptr->interactive;
+	rcu_read_unlock();
+
+	return ret;
+}
+
+/* queue a job to the lane of its session, on the node of the session */
+static void cryptask_dispatch(struct crypt_priv *pcr, struct todo_list_item *item)
+{
+	struct crypt_lane *lane = &pcr->lanes[item->sid % pcr->nr_lanes];
+	int cpu = crypto_session_cpu(&pcr->fcrypt, item->sid);
+	int interactive = crypto_session_interactive(&pcr->fcrypt,
+						     item->sid);
+
+	spin_lock(&lane->lock);
+	list_add_tail(&item->lane_entry,
+		      interactive ? &lane->urgent : &lane->jobs);
+	spin_unlock(&lane->lock);
+
+	queue_work_on(cpu, cryptodev_lane_wq, &lane->work);
+}
+
+/* Run the jobs of SOP_FLAG_INTERACTIVE sessions queued after run, in
+ * order, up to the first slot that is not ready yet. The other jobs are
+ * left for run to get to. */
+static void cryptask_run_ahead(struct crypt_priv *pcr)
+{
+	struct todo_list_item *item;
+	int state;
+
+	if ((int)(pcr->ahead - pcr->run) <= 0)
+		pcr->ahead = pcr->run + 1;
+
+	while ((int)(ACCESS_ONCE(pcr->head) - pcr->ahead) > 0 &&
+	       !ACCESS_ONCE(pcr->closing)) {
+		item = RING_SLOT(pcr, pcr->ahead);
+		state = smp_load_acquire(&item->state);
+		if (state == TODO_FILLING)
+			break;
+		if (state == TODO_QUEUED &&
+		    crypto_session_interactive(&pcr->fcrypt, item->sid))
+			cryptask_job_run(pcr, item);
+		pcr->ahead++;
+	}
+}
+
+/* free the slots at the tail that have nothing left to fetch */
+static void crypto_async_advance(struct crypt_priv *pcr)
+{
+	struct todo_list_item *item;
+	int state;
+
+	while (pcr->tail != smp_load_acquire(&pcr->run)) {
+		item = RING_SLOT(pcr, pcr->tail);
+		state = smp_load_acquire(&item->state);
+		if (state != TODO_CANCELLED && state != TODO_FETCHED)
+			break;
+		pcr->tail++;
+		smp_store_release(&item->state, TODO_FREE);
+	}
+}
+
+static void cryptask_routine(struct work_struct *work)
+{
+	struct crypt_priv *pcr = container_of(work, struct crypt_priv, cryptask);
+	struct todo_list_item *item;
+	unsigned int run = pcr->run;
+	int state, skipped = 0;
+
+	cryptask_reap(pcr);
+
+	/* handle the queued jobs in order, up to the first slot that
+	 * is not ready yet; its submitter will queue us again */
+	while (!ACCESS_ONCE(pcr->closing)) {
+		item = RING_SLOT(pcr, run);
+		state = smp_load_acquire(&item->state);
+		if (state == TODO_QUEUED && pcr->nr_lanes > 1) {
+			cryptask_dispatch(pcr, item);
+		} else if (state == TODO_QUEUED) {
+			if (atomic_read(&pcr->fcrypt.nr_interactive) &&
+			    !crypto_session_interactive(&pcr->fcrypt,
+							item->sid))
+				cryptask_run_ahead(pcr);
+			cryptask_job_run(pcr, item);
+		} else if (state == TODO_FETCHED) {
+			/* run ahead and fetched already */
+			skipped = 1;
+		} else if (state == TODO_FILLING || state == TODO_FREE) {
+			break;
+		}
+		/* anything else was cancelled or run ahead */
+		run++;
+		/* publish the slot to fetchers */
+		smp_store_release(&pcr->run, run);
+	}
+
+	/* the tail may be held up by the slots skipped */
+	if (skipped) {
+		spin_lock(&pcr->fetch_lock);
+		crypto_async_advance(pcr);
+		spin_unlock(&pcr->fetch_lock);
+	}
+
+	/* wake for POLLIN, and cryptodev_release() */
+	cryptask_notify(pcr);
+	wake_up(&pcr->user_waiter);
+}
+
+static void free_job_ring(struct todo_list_item *ring, unsigned int size)
+{
+	unsigned int i;
+
+	for (i = 0; i < size; i++) {
+		/* never run, see crypto_async_auth_run() */
+		if (ring[i].auth && ring[i].state == TODO_QUEUED)
+			mmdrop(ring[i].kcaop.mm);
+		zc_pages_deinit(&ring[i].nowait.zc);
+	}
+	kfree(ring);
+}
+
+static void crypto_ring_free(struct shared_ring *sr)
+{
+	vfree(sr->area);
+	mmdrop(sr->mm);
+	kfree(sr);
+}
+
+/* ====== /dev/crypto ====== */
+
+#ifdef ENABLE_ASYNC
+static void cryptring_routine(struct work_struct *work);
+#endif
+
+static int
+cryptodev_open(struct inode *inode, struct file *filp)
+{
+	struct crypt_priv *pcr;
+	unsigned int i;
+
+	pcr = kzalloc(sizeof(*pcr), GFP_KERNEL);
+	if (!pcr)
+		return -ENOMEM;
+
+	pcr->ring = kcalloc(DEF_COP_RINGSIZE, sizeof(*pcr->ring), GFP_KERNEL);
+	if (!pcr->ring) {
+		kfree(pcr);
+		return -ENOMEM;
+	}
+	pcr->ringsize = DEF_COP_RINGSIZE;
+
+	if (unlikely(cryptodev_fd_stats_init(&pcr->fcrypt))) {
+		kfree(pcr->ring);
+		kfree(pcr);
+		return -ENOMEM;
+	}
+
+	pcr->nr_lanes = clamp(cryptodev_async_lanes, 1, MAX_ASYNC_LANES);
+	if (pcr->nr_lanes > 1) {
+		pcr->lanes = kcalloc(pcr->nr_lanes, sizeof(*pcr->lanes),
+					GFP_KERNEL);
+		if (!pcr->lanes) {
+			cryptodev_fd_stats_deinit(&pcr->fcrypt);
+			kfree(pcr->ring);
+			kfree(pcr);
+			return -ENOMEM;
+		}
+		for (i = 0; i < pcr->nr_lanes; i++) {
+			pcr->lanes[i].pcr = pcr;
+			spin_lock_init(&pcr->lanes[i].lock);
+			INIT_LIST_HEAD(&pcr->lanes[i].urgent);
+			INIT_LIST_HEAD(&pcr->lanes[i].jobs);
+			INIT_WORK(&pcr->lanes[i].work, lane_routine);
+		}
+	}
+
+	filp->private_data = pcr;
+
+	mutex_init(&pcr->fcrypt.sem);
+	spin_lock_init(&pcr->submit_lock);
+	spin_lock_init(&pcr->fetch_lock);
+
+	idr_init(&pcr->fcrypt.sessions);
+	idr_init(&pcr->fcrypt.regions);
+	spin_lock_init(&pcr->fcrypt.scratch_lock);
+	INIT_LIST_HEAD(&pcr->fcrypt.spare_scratch);
+	crypto_stream_init(&pcr->fcrypt);
+
+	atomic_set(&pcr->fcrypt.nr_interactive, 0);
+
+	init_llist_head(&pcr->reaped);
+	atomic_set(&pcr->inflight, 0);
+	atomic_set(&pcr->interactive_done, 0);
+	INIT_WORK(&pcr->cryptask, cryptask_routine);
+#ifdef ENABLE_ASYNC
+	/* not in crypto_ring_setup(), where a second caller would reinit
+	 * it under a ringtask that is already queued */
+	INIT_WORK(&pcr->ringtask, cryptring_routine);
+#endif
+
+	init_waitqueue_head(&pcr->user_waiter);
+	spin_lock_init(&pcr->eventfd_lock);
+	atomic_set(&pcr->unsignalled, 0);
+
+	ddebug(2, "Cryptodev handle initialised, %d elements in queue",
+			pcr->ringsize);
+	return 0;
+}
+
+static int
+cryptodev_release(struct inode *inode, struct file *filp)
+{
+	struct crypt_priv *pcr = filp->private_data;
+	unsigned int i;
+
+	if (!pcr)
+		return 0;
+
+	/* stop starting jobs; those in flight cannot be cancelled, so
+	 * wait until cryptask has reaped them */
+	ACCESS_ONCE(pcr->closing) = 1;
+	flush_work(&pcr->cryptask);
+	for (i = 0; i < pcr->nr_lanes && pcr->lanes; i++)
+		cancel_work_sync(&pcr->lanes[i].work);
+	wait_event(pcr->user_waiter, atomic_read(&pcr->inflight) == 0);
+	cancel_work_sync(&pcr->cryptask);
+	if (pcr->sring) {
+		cancel_work_sync(&pcr->ringtask);
+		crypto_ring_free(pcr->sring);
+	}
+
+	/* the stream holds a reference to its session */
+	crypto_stream_exit(&pcr->fcrypt);
+	crypto_finish_all_sessions(&pcr->fcrypt);
+	crypto_unregister_all_regions(&pcr->fcrypt);
+	zc_free_all_scratch(&pcr->fcrypt);
+	cryptodev_fd_stats_deinit(&pcr->fcrypt);
+	if (pcr->eventfd)
+		eventfd_ctx_put(pcr->eventfd);
+
+	mutex_destroy(&pcr->fcrypt.sem);
+
+	ddebug(2, "Cryptodev handle deinitialised, %d elements freed",
+			pcr->ringsize);
+
+	free_job_ring(pcr->ring, pcr->ringsize);
+	kfree(pcr->lanes);
+	kfree(pcr);
+	filp->private_data = NULL;
+	return 0;
+}
+
+static int
+clonefd(struct file *filp)
+{
+	int ret;
+	ret = get_unused_fd_flags(0);
+	if (ret >= 0) {
+			get_file(filp);
+			fd_install(ret, filp);
+	}
+
+	return ret;
+}
+
+/* this function has to be called from process context */
+static int __fill_kcop_from_cop(struct kernel_crypt_op *kcop,
+				struct csession *ses_ptr)
+{
+	struct crypt_op *cop = &kcop->cop;
+	int rc;
+
+	kcop->ivlen = cop->iv ? ses_ptr->cdata.ivsize : 0;
+	kcop->digestsize = 0; /* will be updated during operation */
+	kcop->iov = NULL;
+	kcop->src_sg = kcop->dst_sg = NULL;
+
+	kcop->task = current;
+	kcop->mm = current->mm;
+
+	kcop->region[0] = kcop->region[1] = 0;
+	if (cop->flags & COP_FLAG_REGION) {
+		kcop->region_ptr[0] = cop->src;
+		kcop->region_ptr[1] = cop->dst;
+		rc = crypto_region_resolve(ses_ptr->fcr, kcop->mm, &cop->src,
+				cop->len, &kcop->region[0]);
+		if (likely(!rc))
+			rc = crypto_region_resolve(ses_ptr->fcr, kcop->mm,
+					&cop->dst, cop->len, &kcop->region[1]);
+		if (unlikely(rc))
+			return rc;
+	}
+
+	/* the operation may run where cop->mac cannot be read, see
+	 * CIOCASYNCCRYPT */
+	if (cop->flags & COP_FLAG_VERIFY) {
+		kcop->verifylen = COP_VERIFY_LEN_OF(cop->flags);
+		if (kcop->verifylen == 0)
+			kcop->verifylen = ses_ptr->hdata.digestsize;
+		if (unlikely(!ses_ptr->hdata.init ||
+			     kcop->verifylen > ses_ptr->hdata.digestsize)) {
+			ddebug(1, "bad MAC to verify (%d bytes)",
+					kcop->verifylen);
+			return -EINVAL;
+		}
+		if (unlikely(copy_from_user(kcop->verify_mac, cop->mac,
+					    kcop->verifylen)))
+			return -EFAULT;
+	}
+
+	if (ses_ptr->iv_mode) {
+		/* cop->iv is only written with the IV used */
+		kcop->ivlen = ses_ptr->cdata.ivsize;
+		crypto_session_next_iv(ses_ptr, kcop->iv, cop->len);
+	} else if (cop->iv) {
+		rc = copy_from_user(kcop->iv, cop->iv, kcop->ivlen);
+		if (unlikely(rc)) {
+			derr(1, "error copying IV (%d bytes), copy_from_user returned %d for address %p",
+					kcop->ivlen, rc, cop->iv);
+			return -EFAULT;
+		}
+	}
+
+	return 0;
+}
+
+/* this function has to be called from process context */
+static int fill_kcop_from_cop(struct kernel_crypt_op *kcop, struct fcrypt *fcr)
+{
+	struct crypt_op *cop = &kcop->cop;
+	struct csession *ses_ptr;
+	int ret;
+
+	/* this also enters ses_ptr->sem */
+	ses_ptr = crypto_get_session_by_sid(fcr, cop->ses);
+	if (unlikely(!ses_ptr)) {
+		derr(1, "invalid session ID=0x%08X", cop->ses);
+		return -EINVAL;
+	}
+
+	ret = __fill_kcop_from_cop(kcop, ses_ptr);
+
+	crypto_put_session(ses_ptr);
+	return ret;
+}
+
+/* this function has to be called from process context */
+static int fill_cop_from_kcop(struct kernel_crypt_op *kcop, struct fcrypt *fcr)
+{
+	int ret;
+
+	if (kcop->cop.flags & COP_FLAG_REGION) {
+		kcop->cop.src = kcop->region_ptr[0];
+		kcop->cop.dst = kcop->region_ptr[1];
+	}
+
+	if (kcop->digestsize) {
+		ret = copy_to_user(kcop->cop.mac,
+				kcop->hash_output, kcop->digestsize);
+		if (unlikely(ret))
+			return -EFAULT;
+	}
+	if (kcop->ivlen && kcop->cop.iv && kcop->cop.flags & COP_FLAG_WRITE_IV) {
+		ret = copy_to_user(kcop->cop.iv,
+				kcop->iv, kcop->ivlen);
+		if (unlikely(ret))
+			return -EFAULT;
+	}
+	return 0;
+}
+
+static int kcop_from_user(struct kernel_crypt_op *kcop,
+			struct fcrypt *fcr, void __user *arg)
+{
+	if (unlikely(copy_from_user(&kcop->cop, arg, sizeof(kcop->cop))))
+		return -EFAULT;
+
+	return fill_kcop_from_cop(kcop, fcr);
+}
+
+static int kcop_to_user(struct kernel_crypt_op *kcop,
+			struct fcrypt *fcr, void __user *arg)
+{
+	int ret;
+
+	ret = fill_cop_from_kcop(kcop, fcr);
+	if (unlikely(ret)) {
+		derr(1, "Error in fill_cop_from_kcop");
+		return ret;
+	}
+
+	if (unlikely(copy_to_user(arg, &kcop->cop, sizeof(kcop->cop)))) {
+		derr(1, "Cannot copy to userspace");
+		return -EFAULT;
+	}
+	return 0;
+}
+
+/* the arrays of the batched ioctls of a native task, which are copied
+ * as they are */
+static int cop_from_user(struct crypt_op *cop, void __user *arg)
+{
+	return copy_from_user(cop, arg, sizeof(*cop)) ? -EFAULT : 0;
+}
+
+static int caop_from_user(struct crypt_auth_op *caop, void __user *arg)
+{
+	return copy_from_user(caop, arg, sizeof(*caop)) ? -EFAULT : 0;
+}
+
+static int iovecs_from_user(struct crypt_iovec *iov, void __user *arg,
+		unsigned int count)
+{
+	return copy_from_user(iov, arg, count * sizeof(*iov)) ? -EFAULT : 0;
+}
+
+static int records_from_user(struct crypt_tls_record *recs,
+		void __user *arg, unsigned int count)
+{
+	return copy_from_user(recs, arg, count * sizeof(*recs)) ? -EFAULT : 0;
+}
+
+static int records_to_user(void __user *arg,
+		const struct crypt_tls_record *recs, unsigned int count)
+{
+	return copy_to_user(arg, recs, count * sizeof(*recs)) ? -EFAULT : 0;
+}
+
+static int packets_from_user(struct crypt_srtp_packet *pkts,
+		void __user *arg, unsigned int count)
+{
+	return copy_from_user(pkts, arg, count * sizeof(*pkts)) ? -EFAULT : 0;
+}
+
+static int packets_to_user(void __user *arg,
+		const struct crypt_srtp_packet *pkts, unsigned int count)
+{
+	return copy_to_user(arg, pkts, count * sizeof(*pkts)) ? -EFAULT : 0;
+}
+
+static const struct user_abi native_abi = {
+	.cop_from_user = cop_from_user,
+	.kcop_to_user = kcop_to_user,
+	.caop_from_user = caop_from_user,
+	.kcaop_to_user = kcaop_to_user,
+	.cop_size = sizeof(struct crypt_op),
+	.caop_size = sizeof(struct crypt_auth_op),
+	.done_size = sizeof(struct crypt_async_done),
+	.done_result = offsetof(struct crypt_async_done, result),
+	.iovecs_from_user = iovecs_from_user,
+	.records_from_user = records_from_user,
+	.records_to_user = records_to_user,
+	.packets_from_user = packets_from_user,
+	.packets_to_user = packets_to_user,
+};
+
+#ifdef ENABLE_ASYNC
+typedef int (*kcop_from_user_fn)(struct kernel_crypt_op *kcop,
+			struct fcrypt *fcr, void __user *arg);
+typedef int (*kcop_to_user_fn)(struct kernel_crypt_op *kcop,
+			struct fcrypt *fcr, void __user *arg);
+typedef int (*kcaop_from_user_fn)(struct kernel_crypt_auth_op *kcaop,
+			struct fcrypt *fcr, void __user *arg);
+typedef int (*kcaop_to_user_fn)(struct kernel_crypt_auth_op *kcaop,
+			struct fcrypt *fcr, void __user *arg);
+
+/* reserve the slot at the head for a job, NULL if there is none free */
+static struct todo_list_item *crypto_async_reserve(struct crypt_priv *pcr,
+			int auth)
+{
+	struct todo_list_item *item;
+
+	spin_lock(&pcr->submit_lock);
+	item = RING_SLOT(pcr, pcr->head);
+	if (unlikely(pcr->resizing ||
+		     smp_load_acquire(&item->state) != TODO_FREE)) {
+		spin_unlock(&pcr->submit_lock);
+		cryptodev_stat_inc(&pcr->fcrypt, CRYPTODEV_STAT_ASYNC_BUSY);
+		return NULL;
+	}
+	item->state = TODO_FILLING;
+	item->interactive = 0;
+	item->auth = auth;
+	pcr->head++;
+	spin_unlock(&pcr->submit_lock);
+
+	return item;
+}
+
+/* hand a reserved slot over to cryptask, filled in unless ret is set */
+static void crypto_async_queue(struct crypt_priv *pcr,
+			struct todo_list_item *item, int ret)
+{
+	/* a cancelled slot is skipped by cryptask and the fetchers */
+	smp_store_release(&item->state, ret ? TODO_CANCELLED : TODO_QUEUED);
+
+	queue_work(cryptodev_wq, &pcr->cryptask);
+}
+
+/* enqueue a job for asynchronous completion. The job is read from
+ * userspace straight into its ring slot.
+ *
+ * returns:
+ * -EBUSY when there are no free queue slots left
+ * the error of from_user() if the job could not be read
+ * 0 on success */
+static int crypto_async_run(struct crypt_priv *pcr, void __user *arg,
+			kcop_from_user_fn from_user)
+{
+	struct todo_list_item *item;
+	int ret;
+
+	item = crypto_async_reserve(pcr, 0);
+	if (unlikely(!item))
+		return -EBUSY;
+
+	ret = from_user(&item->kcop, &pcr->fcrypt, arg);
+	if (likely(!ret) && unlikely(item->kcop.cop.flags & COP_FLAG_NO_ZC))
+		ret = -EINVAL;
+	item->sid = item->kcop.cop.ses;
+
+	crypto_async_queue(pcr, item, ret);
+	return ret;
+}
+
+/* CIOCASYNCAUTHCRYPT: crypto_async_run() for an AEAD, TLS or SRTP job */
+static int crypto_async_auth_run(struct crypt_priv *pcr, void __user *arg,
+			kcaop_from_user_fn from_user)
+{
+	struct todo_list_item *item;
+	int ret;
+
+	item = crypto_async_reserve(pcr, 1);
+	if (unlikely(!item))
+		return -EBUSY;
+
+	ret = from_user(&item->kcaop, &pcr->fcrypt, arg);
+	/* kept until the job has run, see cryptask_auth_run() */
+	if (likely(!ret))
+		atomic_inc(&item->kcaop.mm->mm_count);
+	item->sid = item->kcaop.caop.ses;
+
+	crypto_async_queue(pcr, item, ret);
+	return ret;
+}
+
+/* The index of the first completed job of an SOP_FLAG_INTERACTIVE
+ * session in [tail, end), end if there is none or if one of theirs
+ * before it is still running. Called with fetch_lock held. */
+static unsigned int crypto_async_find_ahead(struct crypt_priv *pcr,
+			unsigned int end)
+{
+	struct todo_list_item *item;
+	unsigned int idx;
+	int state;
+
+	for (idx = pcr->tail; idx != end; idx++) {
+		item = RING_SLOT(pcr, idx);
+		state = smp_load_acquire(&item->state);
+		/* not queued yet, and neither is anything after it */
+		if (state == TODO_FILLING)
+			break;
+		if (!item->interactive)
+			continue;
+		if (state == TODO_DONE)
+			return idx;
+		if (state == TODO_INFLIGHT)
+			break;
+	}
+	return end;
+}
+
+/* claim a job of an SOP_FLAG_INTERACTIVE session ahead of the tail */
+static struct todo_list_item *crypto_async_claim_ahead(struct crypt_priv *pcr,
+			int auth)
+{
+	unsigned int head = ACCESS_ONCE(pcr->head);
+	unsigned int idx = crypto_async_find_ahead(pcr, head);
+	struct todo_list_item *item;
+
+	if (idx == head)
+		return NULL;
+
+	/* Look again up to it: a job started before it may not have been
+	 * seen as such the first time, but it is now that it is done */
+	head = idx + 1;
+	idx = crypto_async_find_ahead(pcr, head);
+	if (idx == head)
+		return NULL;
+
+	item = RING_SLOT(pcr, idx);
+	if (item->auth != auth)
+		return NULL;
+	item->state = TODO_FETCHING;
+	return item;
+}
+
+/* take the first completed job from the ring, NULL if there is none and
+ * -EINVAL if it is not of the kind of auth; its slot is freed by
+ * crypto_async_release() once read */
+static struct todo_list_item *crypto_async_claim(struct crypt_priv *pcr,
+			int auth)
+{
+	struct todo_list_item *item = NULL;
+	int state;
+
+	spin_lock(&pcr->fetch_lock);
+	/* a failed submission with nothing to report, or a job fetched
+	 * ahead of the tail */
+	crypto_async_advance(pcr);
+	if (pcr->tail != smp_load_acquire(&pcr->run)) {
+		item = RING_SLOT(pcr, pcr->tail);
+		state = smp_load_acquire(&item->state);
+		if (unlikely(state == TODO_DONE && item->auth != auth))
+			item = ERR_PTR(-EINVAL);
+		else if (likely(state == TODO_DONE))
+			pcr->tail++;
+		else
+			item = NULL;
+	}
+	if (!item && atomic_read(&pcr->interactive_done))
+		item = crypto_async_claim_ahead(pcr, auth);
+	if (!IS_ERR_OR_NULL(item) && item->interactive)
+		atomic_dec(&pcr->interactive_done);
+	spin_unlock(&pcr->fetch_lock);
+
+	return item;
+}
+
+/* free the slot of a job claimed and read */
+static void crypto_async_release(struct crypt_priv *pcr,
+			struct todo_list_item *item)
+{
+	if (likely(item->state != TODO_FETCHING)) {
+		smp_store_release(&item->state, TODO_FREE);
+		return;
+	}
+
+	spin_lock(&pcr->fetch_lock);
+	smp_store_release(&item->state, TODO_FETCHED);
+	crypto_async_advance(pcr);
+	spin_unlock(&pcr->fetch_lock);
+}
+
+/* get the first completed job from the ring and pass it to userspace
+ *
+ * returns:
+ * -EBUSY if no completed jobs are ready (yet)
+ * the return value of crypto_run() or to_user() otherwise */
+static int crypto_async_fetch(struct crypt_priv *pcr, void __user *arg,
+			kcop_to_user_fn to_user)
 {
 	struct todo_list_item *item;
 	int retval;
 
-	mutex_lock(&pcr->done.lock);
-	if (list_empty(&pcr->done.list)) {
-		mutex_unlock(&pcr->done.lock);
+	item = crypto_async_claim(pcr, 0);
+	if (IS_ERR_OR_NULL(item))
+		return item ? PTR_ERR(item) : -EBUSY;
+
+	retval = item->result;
+	if (likely(!retval))
+		retval = to_user(&item->kcop, &pcr->fcrypt, arg);
+
+	crypto_async_release(pcr, item);
+
+	/* wake for POLLOUT */
+	wake_up_interruptible(&pcr->user_waiter);
+
+	return retval;
+}
+
+/* CIOCASYNCAUTHFETCH: crypto_async_fetch() for an AEAD, TLS or SRTP job.
+ * A failed tag check is -EBADMSG, as with CIOCAUTHCRYPT. */
+static int crypto_async_auth_fetch(struct crypt_priv *pcr, void __user *arg,
+			kcaop_to_user_fn to_user)
+{
+	struct todo_list_item *item;
+	int retval;
+
+	item = crypto_async_claim(pcr, 1);
+	if (IS_ERR_OR_NULL(item))
+		return item ? PTR_ERR(item) : -EBUSY;
+
+	retval = item->result;
+	if (likely(!retval))
+		retval = to_user(&item->kcaop, &pcr->fcrypt, arg);
+
+	crypto_async_release(pcr, item);
+
+	/* wake for POLLOUT */
+	wake_up_interruptible(&pcr->user_waiter);
+
+	return retval;
+}
+
+/* CIOCASYNCFETCHV: get up to fop->count completed jobs at once
+ *
+ * returns:
+ * -EBUSY if no completed jobs are ready (yet)
+ * -EFAULT if a job could not be passed back
+ * 0 otherwise, with fop->count set to the jobs fetched */
+static int crypto_async_fetchv(struct crypt_priv *pcr,
+			struct crypt_fetch_op *fop, const struct user_abi *abi)
+{
+	void __user *done = fop->done;
+	struct todo_list_item *item = NULL;
+	unsigned int i, count;
+	int result, ret = 0;
+
+	if (unlikely(fop->flags || fop->count == 0)) {
+		ddebug(1, "invalid fetch (count=%u, flags=0x%x)",
+				fop->count, fop->flags);
+		return -EINVAL;
+	}
+
+	/* a job claimed cannot be put back, so done is checked before any
+	 * is; there are never more than the ring holds */
+	count = min_t(unsigned int, fop->count, ACCESS_ONCE(pcr->ringsize));
+	if (unlikely(!access_ok(VERIFY_WRITE, done, count * abi->done_size)))
+		return -EFAULT;
+
+	for (i = 0; i < count; i++) {
+		item = crypto_async_claim(pcr, 0);
+		if (IS_ERR_OR_NULL(item))
+			break;
+
+		/* failing to pass the job back is its own error */
+		result = item->result;
+		if (likely(!result))
+			result = abi->kcop_to_user(&item->kcop, &pcr->fcrypt,
+					done + i * abi->done_size);
+		ret = put_user(result, (int32_t __user *)(done +
+				i * abi->done_size + abi->done_result));
+
+		crypto_async_release(pcr, item);
+		if (unlikely(ret))
+			break;
+	}
+
+	/* wake for POLLOUT */
+	if (i)
+		wake_up_interruptible(&pcr->user_waiter);
+
+	/* done was unmapped under us; the jobs passed back are still
+	 * counted */
+	if (unlikely(ret) && i == 0)
+		return -EFAULT;
+	/* an AEAD job first is fetched with CIOCASYNCAUTHFETCH */
+	if (i == 0)
+		return IS_ERR(item) ? PTR_ERR(item) : -EBUSY;
+	fop->count = i;
+	return 0;
+}
+
+/* CIOCASYNCEVENTFD: signal the eventfd fd on completions, or stop with
+ * fd -1 */
+static int crypto_async_set_eventfd(struct crypt_priv *pcr,
+			int32_t __user *arg)
+{
+	struct eventfd_ctx *ctx = NULL, *old;
+	int32_t fd;
+	int ret;
+
+	ret = get_user(fd, arg);
+	if (unlikely(ret))
+		return ret;
+
+	if (fd >= 0) {
+		ctx = eventfd_ctx_fdget(fd);
+		if (IS_ERR(ctx))
+			return PTR_ERR(ctx);
+	} else if (unlikely(fd != -1)) {
+		return -EINVAL;
+	}
+
+	spin_lock(&pcr->eventfd_lock);
+	old = pcr->eventfd;
+	pcr->eventfd = ctx;
+	spin_unlock(&pcr->eventfd_lock);
+
+	if (old)
+		eventfd_ctx_put(old);
+	return 0;
+}
+
+/* change the size of the job ring; only possible while it is idle */
+static int crypto_async_set_ringsize(struct crypt_priv *pcr,
+			uint32_t __user *arg)
+{
+	struct todo_list_item *ring, *old_ring;
+	unsigned int i, old_size;
+	uint32_t size;
+	int ret;
+
+	ret = get_user(size, arg);
+	if (unlikely(ret))
+		return ret;
+
+	if (unlikely(size == 0 || size > MAX_COP_RINGSIZE)) {
+		ddebug(1, "invalid ring size %u (maximum is %u)",
+				size, MAX_COP_RINGSIZE);
+		return -EINVAL;
+	}
+	size = roundup_pow_of_two(size);
+
+	ring = kcalloc(size, sizeof(*ring), GFP_KERNEL);
+	if (unlikely(!ring))
+		return -ENOMEM;
+
+	spin_lock(&pcr->submit_lock);
+	spin_lock(&pcr->fetch_lock);
+	for (i = 0; i < pcr->ringsize; i++) {
+		if (pcr->ring[i].state != TODO_FREE)
+			break;
+	}
+	if (unlikely(i != pcr->ringsize || pcr->resizing)) {
+		spin_unlock(&pcr->fetch_lock);
+		spin_unlock(&pcr->submit_lock);
+		kfree(ring);
 		return -EBUSY;
 	}
-	item = list_first_entry(&pcr->done.list, struct todo_list_item, __hook);
-	list_del(&item->__hook);
-	mutex_unlock(&pcr->done.lock);
+	/* keep the ring empty until it is swapped */
+	pcr->resizing = 1;
+	spin_unlock(&pcr->fetch_lock);
+	spin_unlock(&pcr->submit_lock);
+
+	/* cryptask reads the ring without the locks, and may still be
+	 * peeking at it; with nothing queued it is not queued again */
+	flush_work(&pcr->cryptask);
+
+	spin_lock(&pcr->submit_lock);
+	spin_lock(&pcr->fetch_lock);
+	old_ring = pcr->ring;
+	old_size = pcr->ringsize;
+	pcr->ring = ring;
+	pcr->ringsize = size;
+	pcr->resizing = 0;
+	spin_unlock(&pcr->fetch_lock);
+	spin_unlock(&pcr->submit_lock);
+
+	free_job_ring(old_ring, old_size);
+
+	dinfo(1, "job ring resized to %u elements", size);
+	return 0;
+}
 
-	memcpy(kcop, &item->kcop, sizeof(struct kernel_crypt_op));
-	retval = item->result;
+/* Run the submission ring entries, for as long as there is room for
+ * their completions. This runs in the address space of the process that
+ * set up the rings, so the entries are handled as in CIOCASYNCCRYPT. */
+static void cryptring_routine(struct work_struct *work)
+{
+	struct crypt_priv *pcr = container_of(work, struct crypt_priv, ringtask);
+	struct shared_ring *sr = pcr->sring;
+	struct crypt_ring *hdr = sr->hdr;
+	unsigned int mask = sr->entries - 1;
+	struct kernel_crypt_op kcop;
+	struct crypt_ring_sqe *sqe;
+	struct crypt_ring_cqe *cqe;
+	unsigned int tail;
+	__u64 user_data;
+	int ret;
 
-	mutex_lock(&pcr->free.lock);
-	list_add_tail(&item->__hook, &pcr->free.list);
-	mutex_unlock(&pcr->free.lock);
+	/* the process is exiting */
+	if (unlikely(!atomic_inc_not_zero(&sr->mm->mm_users)))
+		return;
+	use_mm(sr->mm);
 
-	/* wake for POLLOUT */
+	for (;;) {
+		tail = smp_load_acquire(&hdr->sq_tail);
+		if (tail == sr->sq_head)
+			break;
+		if (unlikely(tail - sr->sq_head > sr->entries)) {
+			derr(1, "invalid submission ring tail %u (head %u)",
+					tail, sr->sq_head);
+			break;
+		}
+		/* no room for the completion; userspace has to enter again
+		 * after consuming some */
+		if (sr->cq_tail - smp_load_acquire(&hdr->cq_head) >= sr->entries)
+			break;
+
+		/* userspace may change the entry behind our back, so it is
+		 * only read once */
+		sqe = &sr->sqes[sr->sq_head & mask];
+		memcpy(&kcop.cop, &sqe->cop, sizeof(kcop.cop));
+		user_data = sqe->user_data;
+		sr->sq_head++;
+		smp_store_release(&hdr->sq_head, sr->sq_head);
+
+		ret = fill_kcop_from_cop(&kcop, &pcr->fcrypt);
+		if (likely(!ret))
+			ret = crypto_run(&pcr->fcrypt, &kcop);
+		if (likely(!ret))
+			ret = fill_cop_from_kcop(&kcop, &pcr->fcrypt);
+
+		cqe = &sr->cqes[sr->cq_tail & mask];
+		cqe->user_data = user_data;
+		cqe->result = ret;
+		sr->cq_tail++;
+		smp_store_release(&hdr->cq_tail, sr->cq_tail);
+		atomic_inc(&pcr->unsignalled);
+	}
+
+	unuse_mm(sr->mm);
+	mmput(sr->mm);
+
+	/* wake for POLLIN */
+	cryptask_notify(pcr);
 	wake_up_interruptible(&pcr->user_waiter);
+}
 
-	return retval;
+/* create the shared rings (CIOCRINGSETUP); there can only be one set
+ * per file descriptor */
+static int crypto_ring_setup(struct crypt_priv *pcr, struct crypt_ring_params *p)
+{
+	struct shared_ring *sr;
+	unsigned int entries;
+
+	if (unlikely(p->flags || p->entries == 0 ||
+			p->entries > MAX_COP_RINGSIZE)) {
+		ddebug(1, "invalid ring setup (entries=%u, flags=0x%x)",
+				p->entries, p->flags);
+		return -EINVAL;
+	}
+	entries = roundup_pow_of_two(p->entries);
+
+	sr = kzalloc(sizeof(*sr), GFP_KERNEL);
+	if (unlikely(!sr))
+		return -ENOMEM;
+
+	p->entries = entries;
+	p->sq_off = ALIGN(sizeof(struct crypt_ring), SMP_CACHE_BYTES);
+	p->cq_off = ALIGN(p->sq_off + entries * sizeof(struct crypt_ring_sqe),
+			SMP_CACHE_BYTES);
+	p->size = PAGE_ALIGN(p->cq_off + entries * sizeof(struct crypt_ring_cqe));
+
+	/* zeroed, and suitable for remap_vmalloc_range() */
+	sr->area = vmalloc_user(p->size);
+	if (unlikely(!sr->area)) {
+		kfree(sr);
+		return -ENOMEM;
+	}
+	sr->hdr = sr->area;
+	sr->sqes = sr->area + p->sq_off;
+	sr->cqes = sr->area + p->cq_off;
+	sr->hdr->mask = entries - 1;
+	sr->entries = entries;
+
+	sr->mm = current->mm;
+	atomic_inc(&sr->mm->mm_count);
+
+	if (unlikely(cmpxchg(&pcr->sring, NULL, sr) != NULL)) {
+		crypto_ring_free(sr);
+		return -EBUSY;
+	}
+
+	ddebug(2, "shared rings set up, %u entries", entries);
+	return 0;
 }
 #endif
 
-/* this function has to be called from process context */
-static int fill_kcop_from_cop(struct kernel_crypt_op *kcop, struct fcrypt *fcr)
+/* Run a batch of operations (CIOCCRYPTMULTI). A session that was looked
+ * up is kept locked for the next operations, for as long as they use the
+ * same session ID. */
+static int crypto_run_multi(struct fcrypt *fcr, struct crypt_multi_op *mop,
+		const struct user_abi *abi)
 {
-	struct crypt_op *cop = &kcop->cop;
-	struct csession *ses_ptr;
-	int rc;
+	void __user *ops = mop->ops;
+	struct kernel_crypt_op kcop;
+	struct csession *ses_ptr = NULL;
+	unsigned int i;
+	int ret;
 
-	/* this also enters ses_ptr->sem */
-	ses_ptr = crypto_get_session_by_sid(fcr, cop->ses);
-	if (unlikely(!ses_ptr)) {
-		derr(1, "invalid session ID=0x%08X", cop->ses);
+	if (unlikely(mop->flags || mop->count > CRYPTODEV_MAX_MULTI_OPS)) {
+		ddebug(1, "invalid multi op (count=%u, flags=0x%x)",
+				mop->count, mop->flags);
 		return -EINVAL;
 	}
-	kcop->ivlen = cop->iv ? ses_ptr->cdata.ivsize : 0;
-	kcop->digestsize = 0; /* will be updated during operation */
 
-	crypto_put_session(ses_ptr);
+	for (i = 0; i < mop->count; i++) {
+		if (unlikely(abi->cop_from_user(&kcop.cop,
+						ops + i * abi->cop_size))) {
+			ret = -EFAULT;
+			goto out;
+		}
 
-	kcop->task = current;
-	kcop->mm = current->mm;
+		if (ses_ptr == NULL || ses_ptr->sid != kcop.cop.ses) {
+			if (ses_ptr)
+				crypto_put_session(ses_ptr);
+			/* this also enters ses_ptr->sem */
+			ses_ptr = crypto_get_session_by_sid(fcr, kcop.cop.ses);
+		}
 
-	if (cop->iv) {
-		rc = copy_from_user(kcop->iv, cop->iv, kcop->ivlen);
-		if (unlikely(rc)) {
-			derr(1, "error copying IV (%d bytes), copy_from_user returned %d for address %p",
-					kcop->ivlen, rc, cop->iv);
-			return -EFAULT;
+		if (unlikely(!ses_ptr)) {
+			derr(1, "invalid session ID=0x%08X", kcop.cop.ses);
+			ret = -EINVAL;
+		} else {
+			ret = __fill_kcop_from_cop(&kcop, ses_ptr);
+			if (likely(!ret))
+				ret = __crypto_run(ses_ptr, &kcop);
+			if (likely(!ret))
+				ret = abi->kcop_to_user(&kcop, fcr,
+						ops + i * abi->cop_size);
+		}
+
+		if (unlikely(put_user(ret, &mop->status[i]))) {
+			ret = -EFAULT;
+			goto out;
 		}
 	}
+	ret = 0;
 
-	return 0;
+out:
+	if (ses_ptr)
+		crypto_put_session(ses_ptr);
+	return ret;
 }
 
-/* this function has to be called from process context */
-static int fill_cop_from_kcop(struct kernel_crypt_op *kcop, struct fcrypt *fcr)
+/* Run the steps of a CIOCCRYPTCHAIN over the data, which are pinned
+ * once for all of them */
+static int crypto_run_chain(struct fcrypt *fcr, struct crypt_chain_op *chop,
+		const struct user_abi *abi)
 {
+	void __user *ops = chop->ops;
+	struct scatterlist *src_sg, *dst_sg, *data_sg;
+	struct kernel_crypt_op kcop;
+	struct csession *ses_ptr;
+	struct zc_scratch *scratch;
+	unsigned int i;
 	int ret;
 
-	if (kcop->digestsize) {
-		ret = copy_to_user(kcop->cop.mac,
-				kcop->hash_output, kcop->digestsize);
-		if (unlikely(ret))
-			return -EFAULT;
+	if (unlikely(chop->flags || chop->count == 0 ||
+		     chop->count > CRYPTODEV_MAX_CHAIN)) {
+		ddebug(1, "invalid chain op (count=%u, flags=0x%x)",
+				chop->count, chop->flags);
+		return -EINVAL;
 	}
-	if (kcop->ivlen && kcop->cop.flags & COP_FLAG_WRITE_IV) {
-		ret = copy_to_user(kcop->cop.iv,
-				kcop->iv, kcop->ivlen);
+
+	scratch = zc_get_scratch(fcr);
+	if (unlikely(!scratch))
+		return -ENOMEM;
+
+	ret = get_userbuf(&scratch->zc, fcr, NULL, chop->src, chop->len,
+			chop->dst, chop->len, current, current->mm,
+			&src_sg, &dst_sg);
+	if (unlikely(ret)) {
+		derr(1, "Error getting user pages of the chain.");
+		goto out;
+	}
+
+	/* where the data are as left by the steps so far */
+	data_sg = src_sg;
+
+	for (i = 0; i < chop->count; i++) {
+		if (unlikely(abi->cop_from_user(&kcop.cop,
+						ops + i * abi->cop_size))) {
+			ret = -EFAULT;
+			break;
+		}
+		/* the data are those of chop */
+		if (unlikely(kcop.cop.flags & COP_FLAG_REGION)) {
+			ret = -EINVAL;
+			break;
+		}
+		kcop.cop.len = chop->len;
+		kcop.cop.src = chop->src;
+		kcop.cop.dst = chop->dst;
+
+		/* this also enters ses_ptr->sem */
+		ses_ptr = crypto_get_session_by_sid(fcr, kcop.cop.ses);
+		if (unlikely(!ses_ptr)) {
+			derr(1, "invalid session ID=0x%08X", kcop.cop.ses);
+			ret = -EINVAL;
+			break;
+		}
+
+		ret = __fill_kcop_from_cop(&kcop, ses_ptr);
+		if (likely(!ret)) {
+			if (ses_ptr->cdata.init != 0) {
+				if (unlikely(!dst_sg)) {
+					ret = -EINVAL;
+				} else {
+					kcop.src_sg = data_sg;
+					kcop.dst_sg = data_sg = dst_sg;
+				}
+			} else {
+				kcop.src_sg = kcop.dst_sg = data_sg;
+			}
+		}
+		if (likely(!ret))
+			ret = __crypto_run(ses_ptr, &kcop);
+		crypto_put_session(ses_ptr);
+
+		if (likely(!ret))
+			ret = abi->kcop_to_user(&kcop, fcr,
+					ops + i * abi->cop_size);
 		if (unlikely(ret))
-			return -EFAULT;
+			break;
 	}
-	return 0;
+
+	release_user_pages(&scratch->zc);
+out:
+	zc_put_scratch(fcr, scratch);
+	return ret;
 }
 
-static int kcop_from_user(struct kernel_crypt_op *kcop,
-			struct fcrypt *fcr, void __user *arg)
+/* The CIOCAUTHCRYPTMULTI counterpart of crypto_run_multi() */
+static int crypto_auth_run_multi(struct fcrypt *fcr, struct crypt_multi_op *mop,
+		const struct user_abi *abi)
 {
-	if (unlikely(copy_from_user(&kcop->cop, arg, sizeof(kcop->cop))))
+	void __user *ops = mop->ops;
+	struct kernel_crypt_auth_op kcaop;
+	struct csession *ses_ptr = NULL;
+	unsigned int i;
+	int ret;
+
+	if (unlikely(mop->flags || mop->count > CRYPTODEV_MAX_MULTI_OPS)) {
+		ddebug(1, "invalid multi op (count=%u, flags=0x%x)",
+				mop->count, mop->flags);
+		return -EINVAL;
+	}
+
+	for (i = 0; i < mop->count; i++) {
+		if (unlikely(abi->caop_from_user(&kcaop.caop,
+						 ops + i * abi->caop_size))) {
+			ret = -EFAULT;
+			goto out;
+		}
+
+		if (ses_ptr == NULL || ses_ptr->sid != kcaop.caop.ses) {
+			if (ses_ptr)
+				crypto_put_session(ses_ptr);
+			/* this also enters ses_ptr->sem */
+			ses_ptr = crypto_get_session_by_sid(fcr, kcaop.caop.ses);
+		}
+
+		if (unlikely(!ses_ptr)) {
+			derr(1, "invalid session ID=0x%08X", kcaop.caop.ses);
+			ret = -EINVAL;
+		} else {
+			ret = __fill_kcaop_from_caop(&kcaop, ses_ptr);
+			if (likely(!ret))
+				ret = __crypto_auth_run(ses_ptr, &kcaop);
+			if (likely(!ret))
+				ret = abi->kcaop_to_user(&kcaop, fcr,
+						ops + i * abi->caop_size);
+		}
+
+		if (unlikely(put_user(ret, &mop->status[i]))) {
+			ret = -EFAULT;
+			goto out;
+		}
+	}
+	ret = 0;
+
+out:
+	if (ses_ptr)
+		crypto_put_session(ses_ptr);
+	return ret;
+}
+
+/* Fetch the segments of a CIOCCRYPTV or CIOCAUTHCRYPTV operation;
+ * kiov->src has to be freed afterwards. */
+static int kiov_from_user(struct kernel_crypt_iov *kiov,
+		struct crypt_iovec __user *src, uint32_t src_count,
+		struct crypt_iovec __user *dst, uint32_t dst_count)
+{
+	if (src == dst)
+		dst_count = 0;
+
+	if (unlikely(src_count > CRYPTODEV_MAX_IOV ||
+		     dst_count > CRYPTODEV_MAX_IOV)) {
+		ddebug(1, "too many segments (%u, %u)", src_count, dst_count);
+		return -EINVAL;
+	}
+
+	kiov->src = kmalloc((src_count + dst_count) * sizeof(*kiov->src),
+			    GFP_KERNEL);
+	if (unlikely(!kiov->src))
+		return -ENOMEM;
+
+	if (unlikely(copy_from_user(kiov->src, src,
+				    src_count * sizeof(*src)) ||
+		     copy_from_user(kiov->src + src_count, dst,
+				    dst_count * sizeof(*dst)))) {
+		kfree(kiov->src);
 		return -EFAULT;
+	}
 
-	return fill_kcop_from_cop(kcop, fcr);
+	kiov->src_count = src_count;
+	if (src == dst) {
+		kiov->dst = kiov->src;
+		kiov->dst_count = src_count;
+	} else {
+		kiov->dst = kiov->src + src_count;
+		kiov->dst_count = dst_count;
+	}
+	return 0;
 }
 
-static int kcop_to_user(struct kernel_crypt_op *kcop,
-			struct fcrypt *fcr, void __user *arg)
+/* Run a CIOCCRYPTV operation */
+static int crypto_run_iov(struct fcrypt *fcr, struct crypt_iov_op __user *arg)
 {
+	struct crypt_iov_op iop;
+	struct kernel_crypt_op kcop;
+	struct kernel_crypt_iov kiov;
 	int ret;
 
-	ret = fill_cop_from_kcop(kcop, fcr);
-	if (unlikely(ret)) {
-		derr(1, "Error in fill_cop_from_kcop");
+	if (unlikely(copy_from_user(&iop, arg, sizeof(iop))))
+		return -EFAULT;
+
+	ret = kiov_from_user(&kiov, iop.src, iop.src_count,
+			iop.dst, iop.dst_count);
+	if (unlikely(ret))
 		return ret;
+
+	kcop.cop = iop.cop;
+	ret = fill_kcop_from_cop(&kcop, fcr);
+	if (likely(!ret)) {
+		kcop.iov = &kiov;
+		ret = crypto_run(fcr, &kcop);
 	}
+	if (likely(!ret))
+		ret = kcop_to_user(&kcop, fcr, &arg->cop);
 
-	if (unlikely(copy_to_user(arg, &kcop->cop, sizeof(kcop->cop)))) {
-		derr(1, "Cannot copy to userspace");
-		return -EFAULT;
+	kfree(kiov.src);
+	return ret;
+}
+
+/* Run a CIOCAUTHCRYPTV operation, with its segments in kiov */
+static int crypto_auth_run_kiov(struct fcrypt *fcr,
+		struct kernel_crypt_auth_op *kcaop, struct kernel_crypt_iov *kiov)
+{
+	uint8_t __user *tag = kcaop->caop.tag;
+	struct csession *ses_ptr;
+	int ret;
+
+	if (unlikely(kcaop->caop.flags &
+		     (COP_FLAG_AEAD_TLS_TYPE | COP_FLAG_AEAD_SRTP_TYPE))) {
+		ddebug(1, "segments are only supported in plain AEAD mode");
+		return -EINVAL;
 	}
-	return 0;
+
+	/* this also enters ses_ptr->sem */
+	ses_ptr = crypto_get_session_by_sid(fcr, kcaop->caop.ses);
+	if (unlikely(!ses_ptr)) {
+		derr(1, "invalid session ID=0x%08X", kcaop->caop.ses);
+		return -EINVAL;
+	}
+
+	ret = __fill_kcaop_from_caop(kcaop, ses_ptr);
+	if (likely(!ret)) {
+		kcaop->iov = kiov;
+		ret = __crypto_auth_run(ses_ptr, kcaop);
+	}
+	crypto_put_session(ses_ptr);
+
+	/* the tag is within the segments */
+	kcaop->caop.tag = tag;
+	return ret;
+}
+
+/* Run a CIOCAUTHCRYPTV operation */
+static int crypto_auth_run_iov(struct fcrypt *fcr,
+		struct crypt_auth_iov_op __user *arg)
+{
+	struct crypt_auth_iov_op iop;
+	struct kernel_crypt_auth_op kcaop;
+	struct kernel_crypt_iov kiov;
+	int ret;
+
+	if (unlikely(copy_from_user(&iop, arg, sizeof(iop))))
+		return -EFAULT;
+
+	ret = kiov_from_user(&kiov, iop.src, iop.src_count,
+			iop.dst, iop.dst_count);
+	if (unlikely(ret))
+		return ret;
+
+	kcaop.caop = iop.caop;
+	ret = crypto_auth_run_kiov(fcr, &kcaop, &kiov);
+	if (likely(!ret))
+		ret = kcaop_to_user(&kcaop, fcr, &arg->caop);
+
+	kfree(kiov.src);
+	return ret;
 }
 
 static inline void tfm_info_to_alg_info(struct alg_info *dst, struct crypto_tfm *tfm)
@@ -749,6 +2530,37 @@ static unsigned int is_known_accelerated(struct crypto_tfm *tfm)
 }
 #endif
 
+/* Time the drivers of an SOP_FLAG_DRIVER_AUTO session again, for it and
+ * the other sessions on them */
+static int crypto_calibrate_session(struct fcrypt *fcr, uint32_t sid)
+{
+	struct csession *ses_ptr;
+	struct cryptodev_crossover *x;
+	int ret = 0;
+
+	ses_ptr = crypto_ref_session_by_sid(fcr, sid);
+	if (unlikely(!ses_ptr)) {
+		derr(1, "invalid session ID=0x%08X", sid);
+		return -EINVAL;
+	}
+
+	if (!ses_ptr->sync_cdata.init && !ses_ptr->sync_hdata.init) {
+		ddebug(1, "session 0x%08X has a single implementation", sid);
+		ret = -EINVAL;
+		goto out;
+	}
+
+	x = cryptodev_crossover_get(ses_ptr, 1);
+	if (unlikely(!x)) {
+		ret = -ENOMEM;
+		goto out;
+	}
+	ACCESS_ONCE(ses_ptr->crossover) = x;
+out:
+	crypto_release_session(ses_ptr);
+	return ret;
+}
+
 static int get_session_info(struct fcrypt *fcr, struct session_info_op *siop)
 {
 	struct csession *ses_ptr;
@@ -764,10 +2576,7 @@ static int get_session_info(struct fcrypt *fcr, struct session_info_op *siop)
 	siop->flags = 0;
 
 	if (ses_ptr->cdata.init) {
-		if (ses_ptr->cdata.aead == 0)
-			tfm = crypto_ablkcipher_tfm(ses_ptr->cdata.async.s);
-		else
-			tfm = crypto_aead_tfm(ses_ptr->cdata.async.as);
+		tfm = cryptodev_cipher_tfm(&ses_ptr->cdata);
 		tfm_info_to_alg_info(&siop->cipher_info, tfm);
 #ifdef CRYPTO_ALG_KERN_DRIVER_ONLY
 		if (tfm->__crt_alg->cra_flags & CRYPTO_ALG_KERN_DRIVER_ONLY)
@@ -795,18 +2604,70 @@ static int get_session_info(struct fcrypt *fcr, struct session_info_op *siop)
 	return 0;
 }
 
+/* CIOCCRYPT and CIOCAUTHCRYPT have functions of their own, so that the
+ * frame of cryptodev_ioctl() does not carry a kernel_crypt_op and a
+ * kernel_crypt_auth_op next to each other through every ioctl. */
+static noinline int crypto_ioctl_crypt(struct fcrypt *fcr, void __user *arg)
+{
+	struct kernel_crypt_op kcop;
+	int ret;
+
+	if (unlikely(ret = kcop_from_user(&kcop, fcr, arg))) {
+		dwarning(1, "Error copying from user");
+		return ret;
+	}
+
+	ret = crypto_run(fcr, &kcop);
+	if (unlikely(ret)) {
+		dwarning(1, "Error in crypto_run");
+		return ret;
+	}
+
+	return kcop_to_user(&kcop, fcr, arg);
+}
+
+static noinline int crypto_ioctl_auth_crypt(struct fcrypt *fcr,
+			void __user *arg)
+{
+	struct kernel_crypt_auth_op kcaop;
+	int ret;
+
+	if (unlikely(ret = kcaop_from_user(&kcaop, fcr, arg))) {
+		dwarning(1, "Error copying from user");
+		return ret;
+	}
+
+	ret = crypto_auth_run(fcr, &kcaop);
+	if (unlikely(ret)) {
+		dwarning(1, "Error in crypto_auth_run");
+		return ret;
+	}
+	return kcaop_to_user(&kcaop, fcr, arg);
+}
+
 static long
 cryptodev_ioctl(struct file *filp, unsigned int cmd, unsigned long arg_)
 {
 	void __user *arg = (void __user *)arg_;
 	int __user *p = arg;
-	struct session_op sop;
-	struct kernel_crypt_op kcop;
-	struct kernel_crypt_auth_op kcaop;
+	struct session2_op sop;
 	struct crypt_priv *pcr = filp->private_data;
 	struct fcrypt *fcr;
 	struct session_info_op siop;
-	uint32_t ses;
+	struct crypt_multi_op mop;
+	struct crypt_hash_multi_op hop;
+	struct crypt_cipher_multi_op cmo;
+	struct crypt_tls_multi_op tmo;
+	struct crypt_srtp_multi_op smo;
+	struct crypt_stream_op stop;
+	struct crypt_chain_op chop;
+	struct crypt_region_op rop;
+	struct crypt_stats st;
+#ifdef ENABLE_ASYNC
+	struct crypt_ring_params rp;
+	struct crypt_fetch_op fop;
+#endif
+	uint32_t ses, handle;
 	int ret, fd;
 
 	if (unlikely(!pcr))
@@ -825,7 +2686,21 @@ cryptodev_ioctl(struct file *filp, unsigned int cmd, unsigned long arg_)
 			return ret;
 		}
 		return ret;
-	case CIOCGSESSION:
+	case CIOCGSESSION:
+		memset(&sop, 0, sizeof(sop));
+		if (unlikely(copy_from_user(&sop.sop, arg, sizeof(sop.sop))))
+			return -EFAULT;
+
+		ret = crypto_create_session(fcr, &sop);
+		if (unlikely(ret))
+			return ret;
+		ret = copy_to_user(arg, &sop.sop, sizeof(sop.sop));
+		if (unlikely(ret)) {
+			crypto_finish_session(fcr, sop.sop.ses);
+			return -EFAULT;
+		}
+		return ret;
+	case CIOCGSESSION2:
 		if (unlikely(copy_from_user(&sop, arg, sizeof(sop))))
 			return -EFAULT;
 
@@ -834,7 +2709,7 @@ cryptodev_ioctl(struct file *filp, unsigned int cmd, unsigned long arg_)
 			return ret;
 		ret = copy_to_user(arg, &sop, sizeof(sop));
 		if (unlikely(ret)) {
-			crypto_finish_session(fcr, sop.ses);
+			crypto_finish_session(fcr, sop.sop.ses);
 			return -EFAULT;
 		}
 		return ret;
@@ -844,6 +2719,15 @@ cryptodev_ioctl(struct file *filp, unsigned int cmd, unsigned long arg_)
 			return ret;
 		ret = crypto_finish_session(fcr, ses);
 		return ret;
+	case CIOCCALIBRATE:
+		/* the crossover found is shared by all the sessions on the
+		 * pair of drivers, of any user */
+		if (!capable(CAP_SYS_ADMIN))
+			return -EPERM;
+		ret = get_user(ses, (uint32_t __user *)arg);
+		if (unlikely(ret))
+			return ret;
+		return crypto_calibrate_session(fcr, ses);
 	case CIOCGSESSINFO:
 		if (unlikely(copy_from_user(&siop, arg, sizeof(siop))))
 			return -EFAULT;
@@ -853,42 +2737,110 @@ cryptodev_ioctl(struct file *filp, unsigned int cmd, unsigned long arg_)
 			return ret;
 		return copy_to_user(arg, &siop, sizeof(siop));
 	case CIOCCRYPT:
-		if (unlikely(ret = kcop_from_user(&kcop, fcr, arg))) {
-			dwarning(1, "Error copying from user");
-			return ret;
-		}
+		return crypto_ioctl_crypt(fcr, arg);
+	case CIOCAUTHCRYPT:
+		return crypto_ioctl_auth_crypt(fcr, arg);
+	case CIOCCRYPTMULTI:
+		if (unlikely(copy_from_user(&mop, arg, sizeof(mop))))
+			return -EFAULT;
 
-		ret = crypto_run(fcr, &kcop);
-		if (unlikely(ret)) {
-			dwarning(1, "Error in crypto_run");
-			return ret;
-		}
+		return crypto_run_multi(fcr, &mop, &native_abi);
+	case CIOCAUTHCRYPTMULTI:
+		if (unlikely(copy_from_user(&mop, arg, sizeof(mop))))
+			return -EFAULT;
 
-		return kcop_to_user(&kcop, fcr, arg);
-	case CIOCAUTHCRYPT:
-		if (unlikely(ret = kcaop_from_user(&kcaop, fcr, arg))) {
-			dwarning(1, "Error copying from user");
-			return ret;
-		}
+		return crypto_auth_run_multi(fcr, &mop, &native_abi);
+	case CIOCCRYPTCHAIN:
+		if (unlikely(copy_from_user(&chop, arg, sizeof(chop))))
+			return -EFAULT;
 
-		ret = crypto_auth_run(fcr, &kcaop);
-		if (unlikely(ret)) {
-			dwarning(1, "Error in crypto_auth_run");
+		return crypto_run_chain(fcr, &chop, &native_abi);
+	case CIOCHASHMULTI:
+		if (unlikely(copy_from_user(&hop, arg, sizeof(hop))))
+			return -EFAULT;
+
+		return crypto_hash_multi(fcr, &hop, &native_abi);
+	case CIOCCIPHERMULTI:
+		if (unlikely(copy_from_user(&cmo, arg, sizeof(cmo))))
+			return -EFAULT;
+
+		return crypto_cipher_multi(fcr, &cmo, &native_abi);
+	case CIOCTLSMULTI:
+		if (unlikely(copy_from_user(&tmo, arg, sizeof(tmo))))
+			return -EFAULT;
+
+		return crypto_tls_run_multi(fcr, &tmo, &native_abi);
+	case CIOCSRTPMULTI:
+		if (unlikely(copy_from_user(&smo, arg, sizeof(smo))))
+			return -EFAULT;
+
+		return crypto_srtp_run_multi(fcr, &smo, &native_abi);
+	case CIOCSTREAM:
+		if (unlikely(copy_from_user(&stop, arg, sizeof(stop))))
+			return -EFAULT;
+
+		return crypto_stream_bind(fcr, &stop);
+	case CIOCCRYPTV:
+		return crypto_run_iov(fcr, arg);
+	case CIOCAUTHCRYPTV:
+		return crypto_auth_run_iov(fcr, arg);
+	case CIOCGSTATS:
+		cryptodev_fd_stats_get(fcr, &st);
+		return copy_to_user(arg, &st, sizeof(st)) ? -EFAULT : 0;
+	case CIOCREGBUF:
+		if (unlikely(copy_from_user(&rop, arg, sizeof(rop))))
+			return -EFAULT;
+
+		ret = crypto_register_region(fcr, &rop, current, current->mm);
+		if (unlikely(ret))
 			return ret;
+		ret = copy_to_user(arg, &rop, sizeof(rop));
+		if (unlikely(ret)) {
+			crypto_unregister_region(fcr, rop.handle);
+			return -EFAULT;
 		}
-		return kcaop_to_user(&kcaop, fcr, arg);
+		return ret;
+	case CIOCUNREGBUF:
+		ret = get_user(handle, (uint32_t __user *)arg);
+		if (unlikely(ret))
+			return ret;
+		return crypto_unregister_region(fcr, handle);
 #ifdef ENABLE_ASYNC
 	case CIOCASYNCCRYPT:
-		if (unlikely(ret = kcop_from_user(&kcop, fcr, arg)))
+		return crypto_async_run(pcr, arg, kcop_from_user);
+	case CIOCASYNCFETCH:
+		return crypto_async_fetch(pcr, arg, kcop_to_user);
+	case CIOCASYNCAUTHCRYPT:
+		return crypto_async_auth_run(pcr, arg, kcaop_from_user);
+	case CIOCASYNCAUTHFETCH:
+		return crypto_async_auth_fetch(pcr, arg, kcaop_to_user);
+	case CIOCASYNCRINGSIZE:
+		return crypto_async_set_ringsize(pcr, arg);
+	case CIOCASYNCFETCHV:
+		if (unlikely(copy_from_user(&fop, arg, sizeof(fop))))
+			return -EFAULT;
+
+		ret = crypto_async_fetchv(pcr, &fop, &native_abi);
+		if (unlikely(ret))
 			return ret;
+		return put_user(fop.count,
+				&((struct crypt_fetch_op __user *)arg)->count);
+	case CIOCASYNCEVENTFD:
+		return crypto_async_set_eventfd(pcr, arg);
+	case CIOCRINGSETUP:
+		if (unlikely(copy_from_user(&rp, arg, sizeof(rp))))
+			return -EFAULT;
 
-		return crypto_async_run(pcr, &kcop);
-	case CIOCASYNCFETCH:
-		ret = crypto_async_fetch(pcr, &kcop);
+		ret = crypto_ring_setup(pcr, &rp);
 		if (unlikely(ret))
 			return ret;
+		return copy_to_user(arg, &rp, sizeof(rp)) ? -EFAULT : 0;
+	case CIOCRINGENTER:
+		if (unlikely(!pcr->sring))
+			return -EINVAL;
 
-		return kcop_to_user(&kcop, fcr, arg);
+		queue_work(cryptodev_wq, &pcr->ringtask);
+		return 0;
 #endif
 	default:
 		return -EINVAL;
@@ -952,14 +2904,24 @@ crypt_op_to_compat(struct crypt_op *cop, struct compat_crypt_op *compat)
 	compat->iv  = ptr_to_compat(cop->iv);
 }
 
-static int compat_kcop_from_user(struct kernel_crypt_op *kcop,
-                                 struct fcrypt *fcr, void __user *arg)
+static int compat_cop_from_user(struct crypt_op *cop, void __user *arg)
 {
 	struct compat_crypt_op compat_cop;
 
 	if (unlikely(copy_from_user(&compat_cop, arg, sizeof(compat_cop))))
 		return -EFAULT;
-	compat_to_crypt_op(&compat_cop, &kcop->cop);
+	compat_to_crypt_op(&compat_cop, cop);
+	return 0;
+}
+
+static int compat_kcop_from_user(struct kernel_crypt_op *kcop,
+                                 struct fcrypt *fcr, void __user *arg)
+{
+	int ret;
+
+	ret = compat_cop_from_user(&kcop->cop, arg);
+	if (unlikely(ret))
+		return ret;
 
 	return fill_kcop_from_cop(kcop, fcr);
 }
@@ -984,15 +2946,349 @@ static int compat_kcop_to_user(struct kernel_crypt_op *kcop,
 	return 0;
 }
 
+static inline void
+compat_to_crypt_auth_op(struct compat_crypt_auth_op *compat,
+			struct crypt_auth_op *caop)
+{
+	caop->ses = compat->ses;
+	caop->op = compat->op;
+	caop->flags = compat->flags;
+	caop->len = compat->len;
+	caop->auth_len = compat->auth_len;
+	caop->tag_len = compat->tag_len;
+	caop->iv_len = compat->iv_len;
+
+	caop->auth_src = compat_ptr(compat->auth_src);
+	caop->src = compat_ptr(compat->src);
+	caop->dst = compat_ptr(compat->dst);
+	caop->tag = compat_ptr(compat->tag);
+	caop->iv  = compat_ptr(compat->iv);
+}
+
+static inline void
+crypt_auth_op_to_compat(struct crypt_auth_op *caop,
+			struct compat_crypt_auth_op *compat)
+{
+	compat->ses = caop->ses;
+	compat->op = caop->op;
+	compat->flags = caop->flags;
+	compat->len = caop->len;
+	compat->auth_len = caop->auth_len;
+	compat->tag_len = caop->tag_len;
+	compat->iv_len = caop->iv_len;
+
+	compat->auth_src = ptr_to_compat(caop->auth_src);
+	compat->src = ptr_to_compat(caop->src);
+	compat->dst = ptr_to_compat(caop->dst);
+	compat->tag = ptr_to_compat(caop->tag);
+	compat->iv  = ptr_to_compat(caop->iv);
+}
+
+static int compat_caop_from_user(struct crypt_auth_op *caop, void __user *arg)
+{
+	struct compat_crypt_auth_op compat_caop;
+
+	if (unlikely(copy_from_user(&compat_caop, arg, sizeof(compat_caop))))
+		return -EFAULT;
+	compat_to_crypt_auth_op(&compat_caop, caop);
+	return 0;
+}
+
+static int compat_kcaop_from_user(struct kernel_crypt_auth_op *kcaop,
+                                  struct fcrypt *fcr, void __user *arg)
+{
+	int ret;
+
+	ret = compat_caop_from_user(&kcaop->caop, arg);
+	if (unlikely(ret))
+		return ret;
+
+	return fill_kcaop_from_caop(kcaop, fcr);
+}
+
+static int compat_kcaop_to_user(struct kernel_crypt_auth_op *kcaop,
+                                struct fcrypt *fcr, void __user *arg)
+{
+	int ret;
+	struct compat_crypt_auth_op compat_caop;
+
+	ret = fill_caop_from_kcaop(kcaop, fcr);
+	if (unlikely(ret)) {
+		dwarning(1, "Error in fill_caop_from_kcaop");
+		return ret;
+	}
+	crypt_auth_op_to_compat(&kcaop->caop, &compat_caop);
+
+	if (unlikely(copy_to_user(arg, &compat_caop, sizeof(compat_caop)))) {
+		dwarning(1, "Error copying to user");
+		return -EFAULT;
+	}
+	return 0;
+}
+
+/* crypto_ioctl_auth_crypt() for COMPAT_CIOCAUTHCRYPT */
+static noinline int compat_crypto_auth_crypt(struct fcrypt *fcr,
+			void __user *arg)
+{
+	struct kernel_crypt_auth_op kcaop;
+	int ret;
+
+	ret = compat_kcaop_from_user(&kcaop, fcr, arg);
+	if (unlikely(ret))
+		return ret;
+
+	ret = crypto_auth_run(fcr, &kcaop);
+	if (unlikely(ret))
+		return ret;
+
+	return compat_kcaop_to_user(&kcaop, fcr, arg);
+}
+
+/* kiov_from_user() with compat segments */
+static int compat_kiov_from_user(struct kernel_crypt_iov *kiov,
+		compat_uptr_t src, uint32_t src_count,
+		compat_uptr_t dst, uint32_t dst_count)
+{
+	struct compat_crypt_iovec __user *usrc = compat_ptr(src);
+	struct compat_crypt_iovec __user *udst = compat_ptr(dst);
+	struct compat_crypt_iovec compat_iov;
+	unsigned int i;
+
+	if (src == dst)
+		dst_count = 0;
+
+	if (unlikely(src_count > CRYPTODEV_MAX_IOV ||
+		     dst_count > CRYPTODEV_MAX_IOV)) {
+		ddebug(1, "too many segments (%u, %u)", src_count, dst_count);
+		return -EINVAL;
+	}
+
+	kiov->src = kmalloc((src_count + dst_count) * sizeof(*kiov->src),
+			    GFP_KERNEL);
+	if (unlikely(!kiov->src))
+		return -ENOMEM;
+
+	for (i = 0; i < src_count + dst_count; i++) {
+		if (unlikely(copy_from_user(&compat_iov,
+				i < src_count ? &usrc[i] : &udst[i - src_count],
+				sizeof(compat_iov)))) {
+			kfree(kiov->src);
+			return -EFAULT;
+		}
+		kiov->src[i].base = compat_ptr(compat_iov.base);
+		kiov->src[i].len = compat_iov.len;
+	}
+
+	kiov->src_count = src_count;
+	if (src == dst) {
+		kiov->dst = kiov->src;
+		kiov->dst_count = src_count;
+	} else {
+		kiov->dst = kiov->src + src_count;
+		kiov->dst_count = dst_count;
+	}
+	return 0;
+}
+
+/* crypto_run_iov() for COMPAT_CIOCCRYPTV */
+static int compat_crypto_run_iov(struct fcrypt *fcr,
+		struct compat_crypt_iov_op __user *arg)
+{
+	struct compat_crypt_iov_op compat_iop;
+	struct kernel_crypt_op kcop;
+	struct kernel_crypt_iov kiov;
+	int ret;
+
+	if (unlikely(copy_from_user(&compat_iop, arg, sizeof(compat_iop))))
+		return -EFAULT;
+
+	ret = compat_kiov_from_user(&kiov, compat_iop.src, compat_iop.src_count,
+			compat_iop.dst, compat_iop.dst_count);
+	if (unlikely(ret))
+		return ret;
+
+	compat_to_crypt_op(&compat_iop.cop, &kcop.cop);
+	ret = fill_kcop_from_cop(&kcop, fcr);
+	if (likely(!ret)) {
+		kcop.iov = &kiov;
+		ret = crypto_run(fcr, &kcop);
+	}
+	if (likely(!ret))
+		ret = compat_kcop_to_user(&kcop, fcr, &arg->cop);
+
+	kfree(kiov.src);
+	return ret;
+}
+
+/* crypto_auth_run_iov() for COMPAT_CIOCAUTHCRYPTV */
+static int compat_crypto_auth_run_iov(struct fcrypt *fcr,
+		struct compat_crypt_auth_iov_op __user *arg)
+{
+	struct compat_crypt_auth_iov_op compat_iop;
+	struct kernel_crypt_auth_op kcaop;
+	struct kernel_crypt_iov kiov;
+	int ret;
+
+	if (unlikely(copy_from_user(&compat_iop, arg, sizeof(compat_iop))))
+		return -EFAULT;
+
+	ret = compat_kiov_from_user(&kiov, compat_iop.src, compat_iop.src_count,
+			compat_iop.dst, compat_iop.dst_count);
+	if (unlikely(ret))
+		return ret;
+
+	compat_to_crypt_auth_op(&compat_iop.caop, &kcaop.caop);
+	ret = crypto_auth_run_kiov(fcr, &kcaop, &kiov);
+	if (likely(!ret))
+		ret = compat_kcaop_to_user(&kcaop, fcr, &arg->caop);
+
+	kfree(kiov.src);
+	return ret;
+}
+
+/* the arrays of the batched ioctls of a compat task, converted one
+ * element at a time */
+static int compat_iovecs_from_user(struct crypt_iovec *iov, void __user *arg,
+		unsigned int count)
+{
+	struct compat_crypt_iovec __user *uiov = arg;
+	struct compat_crypt_iovec compat_iov;
+	unsigned int i;
+
+	for (i = 0; i < count; i++) {
+		if (unlikely(copy_from_user(&compat_iov, &uiov[i],
+					    sizeof(compat_iov))))
+			return -EFAULT;
+		iov[i].base = compat_ptr(compat_iov.base);
+		iov[i].len = compat_iov.len;
+	}
+	return 0;
+}
+
+static int compat_records_from_user(struct crypt_tls_record *recs,
+		void __user *arg, unsigned int count)
+{
+	struct compat_crypt_tls_record __user *urecs = arg;
+	struct compat_crypt_tls_record compat_rec;
+	unsigned int i;
+
+	for (i = 0; i < count; i++) {
+		if (unlikely(copy_from_user(&compat_rec, &urecs[i],
+					    sizeof(compat_rec))))
+			return -EFAULT;
+		recs[i].buf = compat_ptr(compat_rec.buf);
+		recs[i].len = compat_rec.len;
+		recs[i].status = compat_rec.status;
+	}
+	return 0;
+}
+
+static int compat_records_to_user(void __user *arg,
+		const struct crypt_tls_record *recs, unsigned int count)
+{
+	struct compat_crypt_tls_record __user *urecs = arg;
+	struct compat_crypt_tls_record compat_rec;
+	unsigned int i;
+
+	for (i = 0; i < count; i++) {
+		compat_rec.buf = ptr_to_compat(recs[i].buf);
+		compat_rec.len = recs[i].len;
+		compat_rec.status = recs[i].status;
+		if (unlikely(copy_to_user(&urecs[i], &compat_rec,
+					  sizeof(compat_rec))))
+			return -EFAULT;
+	}
+	return 0;
+}
+
+static int compat_packets_from_user(struct crypt_srtp_packet *pkts,
+		void __user *arg, unsigned int count)
+{
+	struct compat_crypt_srtp_packet __user *upkts = arg;
+	struct compat_crypt_srtp_packet compat_pkt;
+	unsigned int i;
+
+	for (i = 0; i < count; i++) {
+		if (unlikely(copy_from_user(&compat_pkt, &upkts[i],
+					    sizeof(compat_pkt))))
+			return -EFAULT;
+		pkts[i].buf = compat_ptr(compat_pkt.buf);
+		pkts[i].len = compat_pkt.len;
+		pkts[i].hdr_len = compat_pkt.hdr_len;
+		pkts[i].__reserved = compat_pkt.__reserved;
+		pkts[i].status = compat_pkt.status;
+		pkts[i].roc = compat_pkt.roc;
+	}
+	return 0;
+}
+
+static int compat_packets_to_user(void __user *arg,
+		const struct crypt_srtp_packet *pkts, unsigned int count)
+{
+	struct compat_crypt_srtp_packet __user *upkts = arg;
+	struct compat_crypt_srtp_packet compat_pkt;
+	unsigned int i;
+
+	for (i = 0; i < count; i++) {
+		compat_pkt.buf = ptr_to_compat(pkts[i].buf);
+		compat_pkt.len = pkts[i].len;
+		compat_pkt.hdr_len = pkts[i].hdr_len;
+		compat_pkt.__reserved = pkts[i].__reserved;
+		compat_pkt.status = pkts[i].status;
+		compat_pkt.roc = pkts[i].roc;
+		if (unlikely(copy_to_user(&upkts[i], &compat_pkt,
+					  sizeof(compat_pkt))))
+			return -EFAULT;
+	}
+	return 0;
+}
+
+static const struct user_abi compat_abi = {
+	.cop_from_user = compat_cop_from_user,
+	.kcop_to_user = compat_kcop_to_user,
+	.caop_from_user = compat_caop_from_user,
+	.kcaop_to_user = compat_kcaop_to_user,
+	.cop_size = sizeof(struct compat_crypt_op),
+	.caop_size = sizeof(struct compat_crypt_auth_op),
+	.done_size = sizeof(struct compat_crypt_async_done),
+	.done_result = offsetof(struct compat_crypt_async_done, result),
+	.iovecs_from_user = compat_iovecs_from_user,
+	.records_from_user = compat_records_from_user,
+	.records_to_user = compat_records_to_user,
+	.packets_from_user = compat_packets_from_user,
+	.packets_to_user = compat_packets_to_user,
+};
+
 static long
 cryptodev_compat_ioctl(struct file *file, unsigned int cmd, unsigned long arg_)
 {
 	void __user *arg = (void __user *)arg_;
 	struct crypt_priv *pcr = file->private_data;
 	struct fcrypt *fcr;
-	struct session_op sop;
+	struct session2_op sop;
 	struct compat_session_op compat_sop;
+	struct compat_session2_op compat_sop2;
+	struct compat_crypt_stream_op compat_stop;
+	struct crypt_stream_op stop;
 	struct kernel_crypt_op kcop;
+	struct crypt_region_op rop;
+	struct compat_crypt_region_op compat_rop;
+	struct crypt_multi_op mop;
+	struct compat_crypt_multi_op compat_mop;
+	struct crypt_chain_op chop;
+	struct compat_crypt_chain_op compat_chop;
+	struct crypt_hash_multi_op hop;
+	struct compat_crypt_hash_multi_op compat_hop;
+	struct crypt_cipher_multi_op cmo;
+	struct compat_crypt_cipher_multi_op compat_cmo;
+	struct crypt_tls_multi_op tmo;
+	struct compat_crypt_tls_multi_op compat_tmo;
+	struct crypt_srtp_multi_op smo;
+	struct compat_crypt_srtp_multi_op compat_smo;
+#ifdef ENABLE_ASYNC
+	struct crypt_fetch_op fop;
+	struct compat_crypt_fetch_op compat_fop;
+#endif
 	int ret;
 
 	if (unlikely(!pcr))
@@ -1004,27 +3300,68 @@ cryptodev_compat_ioctl(struct file *file, unsigned int cmd, unsigned long arg_)
 	case CIOCASYMFEAT:
 	case CRIOGET:
 	case CIOCFSESSION:
+	case CIOCCALIBRATE:
 	case CIOCGSESSINFO:
+	case CIOCUNREGBUF:
+	case CIOCGSTATS:
 		return cryptodev_ioctl(file, cmd, arg_);
 
 	case COMPAT_CIOCGSESSION:
 		if (unlikely(copy_from_user(&compat_sop, arg,
 					    sizeof(compat_sop))))
 			return -EFAULT;
-		compat_to_session_op(&compat_sop, &sop);
+		memset(&sop, 0, sizeof(sop));
+		compat_to_session_op(&compat_sop, &sop.sop);
 
 		ret = crypto_create_session(fcr, &sop);
 		if (unlikely(ret))
 			return ret;
 
-		session_op_to_compat(&sop, &compat_sop);
+		session_op_to_compat(&sop.sop, &compat_sop);
 		ret = copy_to_user(arg, &compat_sop, sizeof(compat_sop));
 		if (unlikely(ret)) {
-			crypto_finish_session(fcr, sop.ses);
+			crypto_finish_session(fcr, sop.sop.ses);
+			return -EFAULT;
+		}
+		return ret;
+
+	case COMPAT_CIOCGSESSION2:
+		if (unlikely(copy_from_user(&compat_sop2, arg,
+					    sizeof(compat_sop2))))
+			return -EFAULT;
+		compat_to_session_op(&compat_sop2.sop, &sop.sop);
+		sop.flags = compat_sop2.flags;
+		sop.iv = compat_ptr(compat_sop2.iv);
+		sop.shards = compat_sop2.shards;
+		memcpy(sop.cipher_driver, compat_sop2.cipher_driver,
+		       sizeof(sop.cipher_driver));
+		memcpy(sop.hash_driver, compat_sop2.hash_driver,
+		       sizeof(sop.hash_driver));
+		sop.node = compat_sop2.node;
+
+		ret = crypto_create_session(fcr, &sop);
+		if (unlikely(ret))
+			return ret;
+
+		session_op_to_compat(&sop.sop, &compat_sop2.sop);
+		ret = copy_to_user(arg, &compat_sop2, sizeof(compat_sop2));
+		if (unlikely(ret)) {
+			crypto_finish_session(fcr, sop.sop.ses);
 			return -EFAULT;
 		}
 		return ret;
 
+	case COMPAT_CIOCSTREAM:
+		if (unlikely(copy_from_user(&compat_stop, arg,
+					    sizeof(compat_stop))))
+			return -EFAULT;
+		stop.ses = compat_stop.ses;
+		stop.op = compat_stop.op;
+		stop.flags = compat_stop.flags;
+		stop.iv = compat_ptr(compat_stop.iv);
+
+		return crypto_stream_bind(fcr, &stop);
+
 	case COMPAT_CIOCCRYPT:
 		ret = compat_kcop_from_user(&kcop, fcr, arg);
 		if (unlikely(ret))
@@ -1035,18 +3372,140 @@ cryptodev_compat_ioctl(struct file *file, unsigned int cmd, unsigned long arg_)
 			return ret;
 
 		return compat_kcop_to_user(&kcop, fcr, arg);
-#ifdef ENABLE_ASYNC
-	case COMPAT_CIOCASYNCCRYPT:
-		if (unlikely(ret = compat_kcop_from_user(&kcop, fcr, arg)))
+
+	case COMPAT_CIOCCRYPTV:
+		return compat_crypto_run_iov(fcr, arg);
+	case COMPAT_CIOCAUTHCRYPT:
+		return compat_crypto_auth_crypt(fcr, arg);
+	case COMPAT_CIOCAUTHCRYPTV:
+		return compat_crypto_auth_run_iov(fcr, arg);
+
+	case COMPAT_CIOCCRYPTMULTI:
+	case COMPAT_CIOCAUTHCRYPTMULTI:
+		if (unlikely(copy_from_user(&compat_mop, arg,
+					    sizeof(compat_mop))))
+			return -EFAULT;
+		mop.count = compat_mop.count;
+		mop.flags = compat_mop.flags;
+		mop.ops = compat_ptr(compat_mop.ops);
+		mop.status = compat_ptr(compat_mop.status);
+
+		if (cmd == COMPAT_CIOCCRYPTMULTI)
+			return crypto_run_multi(fcr, &mop, &compat_abi);
+		return crypto_auth_run_multi(fcr, &mop, &compat_abi);
+
+	case COMPAT_CIOCCRYPTCHAIN:
+		if (unlikely(copy_from_user(&compat_chop, arg,
+					    sizeof(compat_chop))))
+			return -EFAULT;
+		chop.count = compat_chop.count;
+		chop.flags = compat_chop.flags;
+		chop.len = compat_chop.len;
+		chop.src = compat_ptr(compat_chop.src);
+		chop.dst = compat_ptr(compat_chop.dst);
+		chop.ops = compat_ptr(compat_chop.ops);
+
+		return crypto_run_chain(fcr, &chop, &compat_abi);
+
+	case COMPAT_CIOCHASHMULTI:
+		if (unlikely(copy_from_user(&compat_hop, arg,
+					    sizeof(compat_hop))))
+			return -EFAULT;
+		hop.ses = compat_hop.ses;
+		hop.count = compat_hop.count;
+		hop.bufs = compat_ptr(compat_hop.bufs);
+		hop.digests = compat_ptr(compat_hop.digests);
+
+		return crypto_hash_multi(fcr, &hop, &compat_abi);
+
+	case COMPAT_CIOCCIPHERMULTI:
+		if (unlikely(copy_from_user(&compat_cmo, arg,
+					    sizeof(compat_cmo))))
+			return -EFAULT;
+		cmo.ses = compat_cmo.ses;
+		cmo.op = compat_cmo.op;
+		cmo.flags = compat_cmo.flags;
+		cmo.count = compat_cmo.count;
+		cmo.__reserved = compat_cmo.__reserved;
+		cmo.src = compat_ptr(compat_cmo.src);
+		cmo.dst = compat_ptr(compat_cmo.dst);
+		cmo.ivs = compat_ptr(compat_cmo.ivs);
+
+		return crypto_cipher_multi(fcr, &cmo, &compat_abi);
+
+	case COMPAT_CIOCTLSMULTI:
+		if (unlikely(copy_from_user(&compat_tmo, arg,
+					    sizeof(compat_tmo))))
+			return -EFAULT;
+		tmo.ses = compat_tmo.ses;
+		tmo.op = compat_tmo.op;
+		tmo.flags = compat_tmo.flags;
+		tmo.count = compat_tmo.count;
+		tmo.type = compat_tmo.type;
+		tmo.__reserved = compat_tmo.__reserved;
+		tmo.version = compat_tmo.version;
+		tmo.seq = compat_tmo.seq;
+		tmo.records = compat_ptr(compat_tmo.records);
+		tmo.iv = compat_ptr(compat_tmo.iv);
+
+		return crypto_tls_run_multi(fcr, &tmo, &compat_abi);
+
+	case COMPAT_CIOCSRTPMULTI:
+		if (unlikely(copy_from_user(&compat_smo, arg,
+					    sizeof(compat_smo))))
+			return -EFAULT;
+		smo.ses = compat_smo.ses;
+		smo.op = compat_smo.op;
+		smo.flags = compat_smo.flags;
+		smo.count = compat_smo.count;
+		smo.tag_len = compat_smo.tag_len;
+		smo.packets = compat_ptr(compat_smo.packets);
+
+		return crypto_srtp_run_multi(fcr, &smo, &compat_abi);
+
+	case COMPAT_CIOCREGBUF:
+		if (unlikely(copy_from_user(&compat_rop, arg,
+					    sizeof(compat_rop))))
+			return -EFAULT;
+		rop.addr = compat_ptr(compat_rop.addr);
+		rop.len = compat_rop.len;
+
+		ret = crypto_register_region(fcr, &rop, current, current->mm);
+		if (unlikely(ret))
 			return ret;
 
-		return crypto_async_run(pcr, &kcop);
+		compat_rop.handle = rop.handle;
+		ret = copy_to_user(arg, &compat_rop, sizeof(compat_rop));
+		if (unlikely(ret)) {
+			crypto_unregister_region(fcr, rop.handle);
+			return -EFAULT;
+		}
+		return ret;
+#ifdef ENABLE_ASYNC
+	case CIOCASYNCRINGSIZE:
+	case CIOCASYNCEVENTFD:
+		return cryptodev_ioctl(file, cmd, arg_);
+	case COMPAT_CIOCASYNCCRYPT:
+		return crypto_async_run(pcr, arg, compat_kcop_from_user);
 	case COMPAT_CIOCASYNCFETCH:
-		ret = crypto_async_fetch(pcr, &kcop);
+		return crypto_async_fetch(pcr, arg, compat_kcop_to_user);
+	case COMPAT_CIOCASYNCAUTHCRYPT:
+		return crypto_async_auth_run(pcr, arg, compat_kcaop_from_user);
+	case COMPAT_CIOCASYNCAUTHFETCH:
+		return crypto_async_auth_fetch(pcr, arg, compat_kcaop_to_user);
+	case COMPAT_CIOCASYNCFETCHV:
+		if (unlikely(copy_from_user(&compat_fop, arg,
+					    sizeof(compat_fop))))
+			return -EFAULT;
+		fop.count = compat_fop.count;
+		fop.flags = compat_fop.flags;
+		fop.done = compat_ptr(compat_fop.done);
+
+		ret = crypto_async_fetchv(pcr, &fop, &compat_abi);
 		if (unlikely(ret))
 			return ret;
-
-		return compat_kcop_to_user(&kcop, fcr, arg);
+		return put_user(fop.count,
+				&((struct compat_crypt_fetch_op __user *)arg)->count);
 #endif
 	default:
 		return -EINVAL;
@@ -1058,18 +3517,65 @@ cryptodev_compat_ioctl(struct file *file, unsigned int cmd, unsigned long arg_)
 static unsigned int cryptodev_poll(struct file *file, poll_table *wait)
 {
 	struct crypt_priv *pcr = file->private_data;
-	int ret = 0;
+	struct shared_ring *sr;
+	int ret = 0, state;
+
+	/* a bound stream is what read() and write() go to */
+	ret = crypto_stream_poll(&pcr->fcrypt, file, wait);
+	if (ret >= 0)
+		return ret;
+	ret = 0;
 
 	poll_wait(file, &pcr->user_waiter, wait);
 
-	if (!list_empty_careful(&pcr->done.list))
+	spin_lock(&pcr->fetch_lock);
+	state = smp_load_acquire(&RING_SLOT(pcr, pcr->tail)->state);
+	if ((pcr->tail != smp_load_acquire(&pcr->run) &&
+	     (state == TODO_DONE || state == TODO_CANCELLED)) ||
+	    atomic_read(&pcr->interactive_done))
 		ret |= POLLIN | POLLRDNORM;
-	if (!list_empty_careful(&pcr->free.list) || pcr->itemcount < MAX_COP_RINGSIZE)
+	spin_unlock(&pcr->fetch_lock);
+
+	spin_lock(&pcr->submit_lock);
+	if (RING_SLOT(pcr, pcr->head)->state == TODO_FREE)
 		ret |= POLLOUT | POLLWRNORM;
+	spin_unlock(&pcr->submit_lock);
+
+	sr = ACCESS_ONCE(pcr->sring);
+	if (sr && ACCESS_ONCE(sr->cq_tail) != ACCESS_ONCE(sr->hdr->cq_head))
+		ret |= POLLIN | POLLRDNORM;
 
 	return ret;
 }
 
+#ifdef CRYPTODEV_HAVE_STREAM
+static ssize_t cryptodev_read_iter(struct kiocb *iocb, struct iov_iter *to)
+{
+	struct crypt_priv *pcr = iocb->ki_filp->private_data;
+
+	return crypto_stream_read(&pcr->fcrypt, to);
+}
+
+static ssize_t cryptodev_write_iter(struct kiocb *iocb, struct iov_iter *from)
+{
+	struct crypt_priv *pcr = iocb->ki_filp->private_data;
+
+	return crypto_stream_write(&pcr->fcrypt, from);
+}
+#endif
+
+/* map the shared rings */
+static int cryptodev_mmap(struct file *file, struct vm_area_struct *vma)
+{
+	struct crypt_priv *pcr = file->private_data;
+	struct shared_ring *sr = ACCESS_ONCE(pcr->sring);
+
+	if (unlikely(!sr))
+		return -ENODEV;
+
+	return remap_vmalloc_range(vma, sr->area, vma->vm_pgoff);
+}
+
 static const struct file_operations cryptodev_fops = {
 	.owner = THIS_MODULE,
 	.open = cryptodev_open,
@@ -1079,6 +3585,19 @@ static const struct file_operations cryptodev_fops = {
 	.compat_ioctl = cryptodev_compat_ioctl,
 #endif /* CONFIG_COMPAT */
 	.poll = cryptodev_poll,
+	.mmap = cryptodev_mmap,
+	/* the stream of CIOCSTREAM; splice() into it passes the pages of
+	 * the pipe to write_iter, and splice() out of it goes through
+	 * read_iter */
+#ifdef CRYPTODEV_HAVE_STREAM
+#if (LINUX_VERSION_CODE < KERNEL_VERSION(4, 1, 0))
+	.read = new_sync_read,
+	.write = new_sync_write,
+#endif
+	.read_iter = cryptodev_read_iter,
+	.write_iter = cryptodev_write_iter,
+	.splice_write = iter_file_splice_write,
+#endif
 };
 
 static struct miscdevice cryptodev = {
@@ -1139,12 +3658,41 @@ static int __init init_cryptodev(void)
 		return -EFAULT;
 	}
 
+	cryptodev_lane_wq = alloc_workqueue("cryptodev_lanes", WQ_UNBOUND, 0);
+	if (unlikely(!cryptodev_lane_wq)) {
+		pr_err(PFX "failed to allocate the cryptodev lane workqueue\n");
+		destroy_workqueue(cryptodev_wq);
+		return -EFAULT;
+	}
+
+	cryptodev_session_cache = KMEM_CACHE(csession, 0);
+	if (unlikely(!cryptodev_session_cache)) {
+		pr_err(PFX "failed to allocate the session cache\n");
+		destroy_workqueue(cryptodev_lane_wq);
+		destroy_workqueue(cryptodev_wq);
+		return -ENOMEM;
+	}
+
+	cryptodev_ctx_cache = KMEM_CACHE(csession_ctx, SLAB_HWCACHE_ALIGN);
+	if (unlikely(!cryptodev_ctx_cache)) {
+		pr_err(PFX "failed to allocate the request context cache\n");
+		kmem_cache_destroy(cryptodev_session_cache);
+		destroy_workqueue(cryptodev_lane_wq);
+		destroy_workqueue(cryptodev_wq);
+		return -ENOMEM;
+	}
+
 	rc = cryptodev_register();
 	if (unlikely(rc)) {
+		kmem_cache_destroy(cryptodev_ctx_cache);
+		kmem_cache_destroy(cryptodev_session_cache);
+		destroy_workqueue(cryptodev_lane_wq);
 		destroy_workqueue(cryptodev_wq);
 		return rc;
 	}
 
+	cryptodev_stats_init();
+
 	verbosity_sysctl_header = register_sysctl_table(verbosity_ctl_root);
 
 	pr_info(PFX "driver %s loaded.\n", VERSION);
@@ -1156,11 +3704,20 @@ static void __exit exit_cryptodev(void)
 {
 	flush_workqueue(cryptodev_wq);
 	destroy_workqueue(cryptodev_wq);
+	flush_workqueue(cryptodev_lane_wq);
+	destroy_workqueue(cryptodev_lane_wq);
 
 	if (verbosity_sysctl_header)
 		unregister_sysctl_table(verbosity_sysctl_header);
 
 	cryptodev_deregister();
+	cryptodev_stats_exit();
+	/* the sessions still waiting for a grace period */
+	rcu_barrier();
+	kmem_cache_destroy(cryptodev_ctx_cache);
+	kmem_cache_destroy(cryptodev_session_cache);
+	cryptodev_tfm_pool_exit();
+	cryptodev_crossover_exit();
 	pr_info(PFX "driver unloaded.\n");
 }
 
@@ -17,72 +17,152 @@
  * along with this program.  If not, see <http://www.gnu.org/licenses/>.
  */
 
+#define _GNU_SOURCE
 #include <stdio.h>
 #include <string.h>
-#include <signal.h>
-#include <sys/time.h>
+#include <sched.h>
+#include <math.h>
 #include <time.h>
-#include <unistd.h>
 #include "benchmark.h"
 
-int benchmark_must_finish = 0;
-
-static void
-alarm_handler (int signo)
+/* The operation is run for WARMUP_NS before anything is measured, to
+ * fault in the buffers and warm up the caches and the transforms. A
+ * trial then runs it as many times as take TRIAL_NS, and trials are
+ * repeated until the 95% confidence interval of their mean is within
+ * TARGET_CI of it, or MAX_TRIALS were run.
+ */
+#define WARMUP_NS (10*1000*1000ULL)
+#define TRIAL_NS (5*1000*1000ULL)
+#define MIN_TRIALS 5
+#define MAX_TRIALS 20
+#define TARGET_CI 0.02
+
+/* Student's t for a two sided 95% interval, by degrees of freedom */
+static const double t95[MAX_TRIALS] = {
+  0, 12.706, 4.303, 3.182, 2.776, 2.571, 2.447, 2.365, 2.306, 2.262,
+  2.228, 2.201, 2.179, 2.160, 2.145, 2.131, 2.120, 2.110, 2.101, 2.093
+};
+
+static unsigned long long
+now_ns (void)
 {
-  benchmark_must_finish = 1;
+  struct timespec ts;
+
+  clock_gettime (CLOCK_MONOTONIC_RAW, &ts);
+  return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
 }
 
-int start_benchmark(struct benchmark_st * st)
+/* Runs func n times, and returns the nanoseconds that took or 0 on
+ * error. */
+static unsigned long long
+run_n (benchmark_func func, void *ctx, int size, unsigned long n)
 {
-  int ret;
-  struct itimerval timer;
+  unsigned long long start, elapsed;
+  unsigned long i;
 
-  memset(st, 0, sizeof(*st));
+  start = now_ns ();
+  for (i = 0; i < n; i++)
+    if (func (ctx, size) < 0)
+      return 0;
+  elapsed = now_ns () - start;
 
-  st->old_handler = signal (SIGPROF, alarm_handler);
+  return elapsed ? elapsed : 1;
+}
 
-  ret = gettimeofday (&st->start, NULL);
-  if (ret < 0) {
-    perror("gettimeofday");
-    return -1;
-  }
+/* Pins the calling thread to the CPU it runs on, so that the trials
+ * are not spread over CPUs of different speed or cache state. The
+ * previous affinity is kept in old. Returns -1 if it could not pin.
+ */
+static int
+pin_cpu (cpu_set_t * old)
+{
+  cpu_set_t set;
+  int cpu;
 
-  benchmark_must_finish = 0;
+  if (sched_getaffinity (0, sizeof (*old), old) < 0)
+    return -1;
 
-  memset(&timer, 0, sizeof(timer));
-  timer.it_value.tv_sec = 0;
-  timer.it_value.tv_usec = 100*1000;
+  cpu = sched_getcpu ();
+  if (cpu < 0)
+    return -1;
 
-  ret = setitimer(ITIMER_PROF, &timer, NULL);
-  if (ret < 0) {
-    perror("setitimer");
+  CPU_ZERO (&set);
+  CPU_SET (cpu, &set);
+  if (sched_setaffinity (0, sizeof (set), &set) < 0)
     return -1;
-  }
 
   return 0;
 }
 
-/* Returns -1 on error or 0 on success.
- * elapsed: the elapsed time in milliseconds
+/* Measures the throughput of func on size bytes. Returns -1 on error
+ * or 0 on success.
  */
-int stop_benchmark(struct benchmark_st * st, unsigned long * elapsed)
+int
+run_benchmark (benchmark_func func, void *ctx, int size,
+               struct benchmark_result * res)
 {
-  unsigned long msecs;
-  struct timeval stop;
-  int ret;
-
-  signal(SIGPROF, st->old_handler);
-
-  ret = gettimeofday (&stop, NULL);
-  if (ret < 0)
-    return -1;
-
-  msecs = (stop.tv_sec * 1000 + stop.tv_usec / 1000 -
-          (st->start.tv_sec * 1000 + st->start.tv_usec / (1000)));
-
-  if (elapsed) *elapsed = msecs;
-
-  return 0;
+  double tput[MAX_TRIALS], sum = 0, var = 0;
+  unsigned long long elapsed;
+  unsigned long n;
+  cpu_set_t old;
+  int pinned, ret = -1;
+  unsigned i, j;
+
+  memset (res, 0, sizeof (*res));
+  pinned = pin_cpu (&old) == 0;
+
+  /* warm up, and find how many operations make a trial */
+  n = 1;
+  for (;;)
+    {
+      elapsed = run_n (func, ctx, size, n);
+      if (elapsed == 0)
+        goto finish;
+      if (elapsed >= WARMUP_NS)
+        break;
+      n *= 2;
+    }
+  n = n * TRIAL_NS / elapsed;
+  if (n == 0)
+    n = 1;
+
+  for (i = 0; i < MAX_TRIALS; i++)
+    {
+      elapsed = run_n (func, ctx, size, n);
+      if (elapsed == 0)
+        goto finish;
+
+      tput[i] = (double) size * n / elapsed;
+      sum += tput[i];
+      res->trials = i + 1;
+      res->mean = sum / res->trials;
+
+      if (res->trials < MIN_TRIALS)
+        continue;
+
+      var = 0;
+      for (j = 0; j < res->trials; j++)
+        var += (tput[j] - res->mean) * (tput[j] - res->mean);
+      var /= res->trials - 1;
+      res->ci = t95[res->trials - 1] * sqrt (var / res->trials);
+
+      if (res->ci <= res->mean * TARGET_CI)
+        break;
+    }
+  ret = 0;
+
+finish:
+  if (pinned)
+    sched_setaffinity (0, sizeof (old), &old);
+  return ret;
 }
 
+/* Returns non-zero if a is faster than b, with their confidence
+ * intervals apart.
+ */
+int
+benchmark_faster (const struct benchmark_result * a,
+                  const struct benchmark_result * b)
+{
+  return a->mean - a->ci > b->mean + b->ci;
+}
@@ -1,18 +1,21 @@
-#include <sys/time.h>
-#include <time.h>
-#include <sys/time.h>
-#include <signal.h>
+#ifndef BENCHMARK_H
+# define BENCHMARK_H
 
-typedef void (*sighandler_t)(int);
+/* Runs one operation over size bytes. Returns negative on error. */
+typedef int (*benchmark_func)(void *ctx, int size);
 
-struct benchmark_st
+struct benchmark_result
 {
-  struct timeval start;
-  sighandler_t old_handler;
+  /* the mean throughput of the trials, in bytes per nanosecond */
+  double mean;
+  /* the half width of its 95% confidence interval */
+  double ci;
+  unsigned trials;
 };
 
-extern int benchmark_must_finish;
-
-int start_benchmark(struct benchmark_st * st);
-int stop_benchmark(struct benchmark_st * st, unsigned long * elapsed);
+int run_benchmark(benchmark_func func, void *ctx, int size,
+                  struct benchmark_result * res);
+int benchmark_faster(const struct benchmark_result * a,
+                     const struct benchmark_result * b);
 
+#endif
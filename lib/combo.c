@@ -83,19 +83,43 @@ aead_encrypt(struct cryptodev_ctx* ctx, const void* iv, const void* plaintext, v
 
 static const int sizes[] = {64, 256, 512, 1024, 4096, 16*1024};
 
+struct aead_bench {
+	struct cryptodev_ctx* ctx;
+	void* user_ctx;
+	void (*user_combo)(void* user_ctx, void* plaintext, void* ciphertext, int size, void* res);
+	char* text;
+	char* ctext;
+	char* iv;
+	uint8_t* digest;
+};
+
+static int kernel_combo(void* p, int size)
+{
+	struct aead_bench* b = p;
+
+	return aead_encrypt(b->ctx, b->iv, b->text, b->text, size, b->digest);
+}
+
+static int user_combo(void* p, int size)
+{
+	struct aead_bench* b = p;
+
+	b->user_combo(b->user_ctx, b->text, b->ctext, size, b->digest);
+	return 0;
+}
 
 int aead_test(int cipher, int mac, void* ukey, int ukey_size,
-		void* user_ctx, void (*user_combo)(void* user_ctx, void* plaintext, void* ciphertext, int size, void* res))
+		void* user_ctx, void (*user_combo_func)(void* user_ctx, void* plaintext, void* ciphertext, int size, void* res))
 {
 	int cfd = -1, i, ret;
 	struct cryptodev_ctx ctx;
 	uint8_t digest[AALG_MAX_RESULT_LEN];
-	char text[16*1024];
-	char ctext[16*1024];
+	/* room for the MAC and the padding of the kernel's TLS records */
+	static char text[16*1024 + 64];
+	static char ctext[16*1024];
 	char iv[16];
-	unsigned long elapsed, counted;
-	double t1, t2;
-	struct benchmark_st bst;
+	struct benchmark_result kernel, user;
+	struct aead_bench b = { &ctx, user_ctx, user_combo_func, text, ctext, iv, digest };
 
 	/* Open the crypto device */
 	cfd = open("/dev/crypto", O_RDWR, 0);
@@ -104,55 +128,29 @@ int aead_test(int cipher, int mac, void* ukey, int ukey_size,
 		return -1;
 	}
 
-	aead_ctx_init(&ctx, cipher, mac, ukey, ukey_size, cfd);
-
-	for (i=0;i<sizeof(sizes)/sizeof(sizes[0]);i++) {
-		counted = 0;
-		ret = start_benchmark(&bst);
-		if (ret < 0) {
-			ret = -1;
-			goto finish;
-		}
-
-		do {
-			if (aead_encrypt(&ctx, iv, text, text, sizes[i], digest) < 0)
-				return -2;
-			counted += sizes[i];
-		} while(benchmark_must_finish==0);
-
-		ret = stop_benchmark(&bst, &elapsed);
-		if (ret < 0) {
-			ret = -1;
-			goto finish;
-		}
+	if (aead_ctx_init(&ctx, cipher, mac, ukey, ukey_size, cfd) < 0) {
+		close(cfd);
+		return -1;
+	}
 
-		t1 = (double)counted/(double)elapsed;
+	memset(iv, 0, sizeof(iv));
 
-		/* now check the user function */
-		counted = 0;
-		ret = start_benchmark(&bst);
-		if (ret < 0) {
-			ret = -1;
+	for (i=0;i<sizeof(sizes)/sizeof(sizes[0]);i++) {
+		if (run_benchmark(kernel_combo, &b, sizes[i], &kernel) < 0) {
+			ret = -2;
 			goto finish;
 		}
-
-		do {
-			user_combo(user_ctx, text, ctext, sizes[i], digest);
-			counted += sizes[i];
-		} while(benchmark_must_finish==0);
-
-		ret = stop_benchmark(&bst, &elapsed);
-		if (ret < 0) {
+		if (run_benchmark(user_combo, &b, sizes[i], &user) < 0) {
 			ret = -1;
 			goto finish;
 		}
 
-		t2 = (double)counted/(double)elapsed;
-
 #ifdef DEBUG
-		printf("%d: kernel: %.4f bytes/msec, user: %.4f bytes/msec\n", sizes[i], t1, t2);
+		printf("%d: kernel: %.2f +- %.2f MB/sec, user: %.2f +- %.2f MB/sec (%u and %u trials)\n",
+			sizes[i], kernel.mean * 1000, kernel.ci * 1000,
+			user.mean * 1000, user.ci * 1000, kernel.trials, user.trials);
 #endif
-		if (t1 > t2) {
+		if (benchmark_faster(&kernel, &user)) {
 			ret = sizes[i];
 			goto finish;
 		}
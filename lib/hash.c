@@ -75,17 +75,38 @@ hash(struct cryptodev_ctx* ctx, const void* text, size_t size, void* digest)
 
 static const int sizes[] = {64, 256, 512, 1024, 4096, 16*1024};
 
-/* Worst case running time: around 1.2 secs
+struct hash_bench {
+	struct cryptodev_ctx* ctx;
+	void (*user_hash)(void* text, int size, void* res);
+	char* text;
+	uint8_t* digest;
+};
+
+static int kernel_hash(void* p, int size)
+{
+	struct hash_bench* b = p;
+
+	return hash(b->ctx, b->text, size, b->digest);
+}
+
+static int user_hash(void* p, int size)
+{
+	struct hash_bench* b = p;
+
+	b->user_hash(b->text, size, b->digest);
+	return 0;
+}
+
+/* Worst case running time: around 1.5 secs
  */
-int hash_test(int algo, void (*user_hash)(void* text, int size, void* res))
+int hash_test(int algo, void (*user_hash_func)(void* text, int size, void* res))
 {
 	int cfd = -1, i, ret;
 	struct cryptodev_ctx ctx;
 	uint8_t digest[AALG_MAX_RESULT_LEN];
-	char text[16*1024];
-	unsigned long elapsed, counted;
-	double t1, t2;
-	struct benchmark_st bst;
+	static char text[16*1024];
+	struct benchmark_result kernel, user;
+	struct hash_bench b = { &ctx, user_hash_func, text, digest };
 
 	/* Open the crypto device */
 	cfd = open("/dev/crypto", O_RDWR, 0);
@@ -94,57 +115,27 @@ int hash_test(int algo, void (*user_hash)(void* text, int size, void* res))
 		return -1;
 	}
 
-	hash_ctx_init(&ctx, algo, cfd);
+	if (hash_ctx_init(&ctx, algo, cfd) < 0) {
+		close(cfd);
+		return -1;
+	}
 
 	for (i=0;i<sizeof(sizes)/sizeof(sizes[0]);i++) {
-		counted = 0;
-		ret = start_benchmark(&bst);
-		if (ret < 0) {
-			ret = -1;
-			goto finish;
-		}
-
-		do {
-			hash(&ctx, text, sizes[i], digest);
-			counted += sizes[i];
-		} while(benchmark_must_finish==0);
-
-		ret = stop_benchmark(&bst, &elapsed);
-		if (ret < 0) {
+		if (run_benchmark(kernel_hash, &b, sizes[i], &kernel) < 0 ||
+		    run_benchmark(user_hash, &b, sizes[i], &user) < 0) {
 			ret = -1;
 			goto finish;
 		}
-		t1 = (double)counted/(double)elapsed;
 
-		/* now check the user function */
-		counted = 0;
-		ret = start_benchmark(&bst);
-		if (ret < 0) {
-			ret = -1;
-			goto finish;
-		}
-
-
-		do {
-			user_hash(text, sizes[i], digest);
-			counted += sizes[i];
-		} while(benchmark_must_finish==0);
-
-		ret = stop_benchmark(&bst, &elapsed);
-		if (ret < 0) {
-			ret = -1;
-			goto finish;
-		}
-
-		t2 = (double)counted/(double)elapsed;
-
-		if (t1 > t2) {
+#ifdef DEBUG
+		printf("%d: kernel: %.2f +- %.2f MB/sec, user: %.2f +- %.2f MB/sec (%u and %u trials)\n",
+			sizes[i], kernel.mean * 1000, kernel.ci * 1000,
+			user.mean * 1000, user.ci * 1000, kernel.trials, user.trials);
+#endif
+		if (benchmark_faster(&kernel, &user)) {
 			ret = sizes[i];
 			goto finish;
 		}
-#ifdef DEBUG
-		printf("%d: kernel: %.4f bytes/msec, user: %.4f bytes/msec\n", sizes[i], t1, t2);
-#endif
 	}
 
 	ret = -1;
@@ -158,4 +149,3 @@ finish:
 	}
 	return ret;
 }
-
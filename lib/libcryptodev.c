@@ -0,0 +1,364 @@
+/*
+ * A userspace library over /dev/crypto, see libcryptodev.h.
+ *
+ * Placed under public domain.
+ *
+ */
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <crypto/cryptodev.h>
+#include "libcryptodev.h"
+
+struct thread_state {
+	int fd;			/* -1 until opened */
+	int async;		/* the async queue is there; -1 until probed */
+	unsigned int cached;	/* sessions that nothing holds */
+	/* the most recently used first */
+	struct cryptodev_session *sessions;
+};
+
+static __thread struct thread_state ts = { -1, -1, 0, NULL };
+
+static pthread_key_t exit_key;
+static pthread_once_t exit_once = PTHREAD_ONCE_INIT;
+
+static void thread_exit(void *unused)
+{
+	cryptodev_thread_done();
+}
+
+static void make_exit_key(void)
+{
+	pthread_key_create(&exit_key, thread_exit);
+}
+
+int cryptodev_fd(void)
+{
+	if (ts.fd >= 0)
+		return ts.fd;
+
+	pthread_once(&exit_once, make_exit_key);
+
+	ts.fd = open("/dev/crypto", O_RDWR | O_CLOEXEC, 0);
+	if (ts.fd < 0)
+		return -1;
+
+	/* any non-NULL value, for thread_exit() to be called */
+	pthread_setspecific(exit_key, &ts);
+	return ts.fd;
+}
+
+/* memset() that is not optimized out, for the keys */
+static void wipe(void *p, size_t len)
+{
+	volatile uint8_t *v = p;
+
+	while (len--)
+		*v++ = 0;
+}
+
+static void session_free(struct cryptodev_session *s, int fsession)
+{
+	if (fsession)
+		ioctl(ts.fd, CIOCFSESSION, &s->ses);
+	wipe(s->keys, s->keylen + s->mackeylen);
+	free(s);
+}
+
+void cryptodev_thread_done(void)
+{
+	struct cryptodev_session *s, *next;
+
+	if (ts.fd < 0)
+		return;
+
+	/* closing the descriptor ends the sessions in the kernel */
+	for (s = ts.sessions; s; s = next) {
+		next = s->next;
+		session_free(s, 0);
+	}
+	close(ts.fd);
+
+	ts.fd = -1;
+	ts.async = -1;
+	ts.cached = 0;
+	ts.sessions = NULL;
+	pthread_setspecific(exit_key, NULL);
+}
+
+/* ends the least recently used session that nothing holds */
+static void evict(void)
+{
+	struct cryptodev_session **prev, **victim = NULL;
+
+	for (prev = &ts.sessions; *prev; prev = &(*prev)->next)
+		if ((*prev)->refs == 0)
+			victim = prev;
+
+	if (victim) {
+		struct cryptodev_session *s = *victim;
+
+		*victim = s->next;
+		ts.cached--;
+		session_free(s, 1);
+	}
+}
+
+static int session_matches(const struct cryptodev_session *s,
+		int cipher, const void *key, unsigned int keylen,
+		int mac, const void *mackey, unsigned int mackeylen)
+{
+	return s->cipher == cipher && s->mac == mac &&
+	       s->keylen == keylen && s->mackeylen == mackeylen &&
+	       memcmp(s->keys, key, keylen) == 0 &&
+	       memcmp(s->keys + keylen, mackey, mackeylen) == 0;
+}
+
+struct cryptodev_session *
+cryptodev_session_get(int cipher, const void *key, unsigned int keylen,
+		int mac, const void *mackey, unsigned int mackeylen)
+{
+	struct cryptodev_session **prev, *s;
+	struct session_info_op siop;
+	struct session_op sess;
+
+	if (cryptodev_fd() < 0)
+		return NULL;
+
+	if (keylen > CRYPTO_CIPHER_MAX_KEY_LEN ||
+	    mackeylen > CRYPTO_HMAC_MAX_KEY_LEN) {
+		errno = EINVAL;
+		return NULL;
+	}
+
+	for (prev = &ts.sessions; (s = *prev); prev = &s->next) {
+		if (!session_matches(s, cipher, key, keylen,
+				     mac, mackey, mackeylen))
+			continue;
+
+		*prev = s->next;
+		s->next = ts.sessions;
+		ts.sessions = s;
+		if (s->refs++ == 0)
+			ts.cached--;
+		return s;
+	}
+
+	s = calloc(1, sizeof(*s) + keylen + mackeylen);
+	if (!s)
+		return NULL;
+	s->cipher = cipher;
+	s->mac = mac;
+	s->keylen = keylen;
+	s->mackeylen = mackeylen;
+	memcpy(s->keys, key, keylen);
+	memcpy(s->keys + keylen, mackey, mackeylen);
+
+	memset(&sess, 0, sizeof(sess));
+	sess.cipher = cipher;
+	sess.keylen = keylen;
+	sess.key = s->keys;
+	sess.mac = mac;
+	sess.mackeylen = mackeylen;
+	sess.mackey = s->keys + keylen;
+	if (ioctl(ts.fd, CIOCGSESSION, &sess)) {
+		session_free(s, 0);
+		return NULL;
+	}
+	s->ses = sess.ses;
+
+	memset(&siop, 0, sizeof(siop));
+	siop.ses = sess.ses;
+	if (ioctl(ts.fd, CIOCGSESSINFO, &siop)) {
+		session_free(s, 1);
+		return NULL;
+	}
+	s->alignmask = siop.alignmask;
+
+	s->refs = 1;
+	s->next = ts.sessions;
+	ts.sessions = s;
+	return s;
+}
+
+void cryptodev_session_put(struct cryptodev_session *s)
+{
+	if (--s->refs)
+		return;
+
+	if (++ts.cached > CRYPTODEV_CACHE_MAX)
+		evict();
+}
+
+void *cryptodev_alloc(const struct cryptodev_session *s, size_t size)
+{
+	size_t align = s->alignmask + 1;
+	void *p;
+	int ret;
+
+	if (align < sizeof(void *))
+		align = sizeof(void *);
+
+	ret = posix_memalign(&p, align, size);
+	if (ret) {
+		errno = ret;
+		return NULL;
+	}
+	return p;
+}
+
+static void fill_cop(struct crypt_op *cop, struct cryptodev_session *s,
+		int op, const void *src, void *dst, size_t len, void *iv,
+		void *mac)
+{
+	memset(cop, 0, sizeof(*cop));
+	cop->ses = s->ses;
+	cop->op = op;
+	cop->len = len;
+	cop->src = (void *)src;
+	cop->dst = dst;
+	cop->iv = iv;
+	cop->mac = mac;
+}
+
+int cryptodev_crypt(struct cryptodev_session *s, int op, const void *src,
+		void *dst, size_t len, void *iv, void *mac)
+{
+	struct crypt_op cop;
+
+	fill_cop(&cop, s, op, src, dst, len, iv, mac);
+	return ioctl(ts.fd, CIOCCRYPT, &cop);
+}
+
+void cryptodev_batch_init(struct cryptodev_batch *b, int flags,
+		cryptodev_done_fn done, void *data)
+{
+	memset(b, 0, sizeof(*b));
+	b->flags = flags;
+	b->done = done;
+	b->data = data;
+}
+
+int cryptodev_batch_add(struct cryptodev_batch *b,
+		struct cryptodev_session *s, int op, const void *src,
+		void *dst, size_t len, void *iv, void *mac)
+{
+	if (b->count == CRYPTODEV_BATCH_MAX && cryptodev_batch_flush(b))
+		return -1;
+
+	fill_cop(&b->cop[b->count++], s, op, src, dst, len, iv, mac);
+	return 0;
+}
+
+/* Whether the module has the async queue. It is probed by sizing the
+ * queue for a whole batch, which fails with EINVAL without it.
+ */
+static int have_async(void)
+{
+	uint32_t size = CRYPTODEV_BATCH_MAX;
+
+	if (ts.async < 0)
+		ts.async = ioctl(ts.fd, CIOCASYNCRINGSIZE, &size) == 0;
+	return ts.async;
+}
+
+/* Fetches completed jobs, waiting for at least one. The queue hands
+ * them back in the order they were submitted, which map[] has.
+ */
+static int reap(struct cryptodev_batch *b, const unsigned int *map,
+		unsigned int submitted, unsigned int *fetched)
+{
+	struct crypt_async_done done[CRYPTODEV_BATCH_MAX];
+	struct crypt_fetch_op fop;
+	struct pollfd pfd;
+	unsigned int i, j;
+
+	for (;;) {
+		memset(&fop, 0, sizeof(fop));
+		fop.count = submitted - *fetched;
+		fop.done = done;
+		if (ioctl(ts.fd, CIOCASYNCFETCHV, &fop) == 0)
+			break;
+		if (errno != EBUSY)
+			return -1;
+
+		pfd.fd = ts.fd;
+		pfd.events = POLLIN;
+		if (poll(&pfd, 1, -1) < 0 && errno != EINTR)
+			return -1;
+	}
+
+	for (i = 0; i < fop.count; i++) {
+		j = map[(*fetched)++];
+		b->status[j] = done[i].result;
+		if (done[i].result == 0)
+			b->cop[j] = done[i].cop;
+	}
+	return 0;
+}
+
+static int flush_async(struct cryptodev_batch *b)
+{
+	unsigned int map[CRYPTODEV_BATCH_MAX];
+	unsigned int i, submitted = 0, fetched = 0;
+
+	for (i = 0; i < b->count; i++) {
+		while (ioctl(ts.fd, CIOCASYNCCRYPT, &b->cop[i])) {
+			if (errno != EBUSY || fetched == submitted) {
+				b->status[i] = -errno;
+				break;
+			}
+			/* the queue is full of our own jobs */
+			if (reap(b, map, submitted, &fetched))
+				return -1;
+		}
+		if (b->status[i] == 0)
+			map[submitted++] = i;
+	}
+
+	while (fetched < submitted)
+		if (reap(b, map, submitted, &fetched))
+			return -1;
+	return 0;
+}
+
+static int flush_multi(struct cryptodev_batch *b)
+{
+	struct crypt_multi_op mop;
+
+	memset(&mop, 0, sizeof(mop));
+	mop.count = b->count;
+	mop.ops = b->cop;
+	mop.status = b->status;
+	return ioctl(ts.fd, CIOCCRYPTMULTI, &mop);
+}
+
+int cryptodev_batch_flush(struct cryptodev_batch *b)
+{
+	unsigned int i;
+	int ret;
+
+	if (b->count == 0)
+		return 0;
+
+	memset(b->status, 0, sizeof(b->status));
+	if (cryptodev_fd() < 0)
+		ret = -1;
+	else if ((b->flags & CRYPTODEV_BATCH_ASYNC) && have_async())
+		ret = flush_async(b);
+	else
+		ret = flush_multi(b);
+
+	if (ret == 0 && b->done)
+		for (i = 0; i < b->count; i++)
+			b->done(b->data, &b->cop[i], b->status[i]);
+
+	b->count = 0;
+	return ret;
+}
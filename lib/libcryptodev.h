@@ -0,0 +1,94 @@
+#ifndef LIBCRYPTODEV_H
+# define LIBCRYPTODEV_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <crypto/cryptodev.h>
+
+/* A userspace library over /dev/crypto.
+ *
+ * Each thread gets a descriptor of its own, opened on first use. The
+ * sessions are cached per thread, by algorithm and key, so that the
+ * same key does not cost a CIOCGSESSION each time. Operations can be
+ * batched and submitted with CIOCCRYPTMULTI, or through the async
+ * queue where the module has it.
+ *
+ * Errors are returned as -1 with errno set, like the system calls.
+ * Sessions and batches belong to the thread that made them, and the
+ * descriptor of a thread is not to be used for CIOCASYNCCRYPT other
+ * than through a batch.
+ */
+
+/* the descriptor of the calling thread */
+int cryptodev_fd(void);
+/* closes the descriptor of the calling thread and all its sessions;
+ * it is also done when the thread exits */
+void cryptodev_thread_done(void);
+
+/* the sessions of a thread that are cached when nothing holds them */
+#define CRYPTODEV_CACHE_MAX	64
+
+struct cryptodev_session {
+	uint32_t ses;
+	/* buffers aligned to alignmask + 1 avoid a copy in the kernel */
+	uint32_t alignmask;
+	int cipher;
+	int mac;
+	unsigned int keylen;
+	unsigned int mackeylen;
+	/* private to the cache */
+	unsigned int refs;
+	struct cryptodev_session *next;
+	uint8_t keys[];
+};
+
+/* A session of the calling thread for the given algorithms and keys,
+ * either a cached one or a new one. cipher or mac may be 0. Release it
+ * with cryptodev_session_put(). Returns NULL on error.
+ */
+struct cryptodev_session *
+cryptodev_session_get(int cipher, const void *key, unsigned int keylen,
+		int mac, const void *mackey, unsigned int mackeylen);
+void cryptodev_session_put(struct cryptodev_session *s);
+
+/* size bytes aligned for zero-copy operations on s; free() them */
+void *cryptodev_alloc(const struct cryptodev_session *s, size_t size);
+
+/* A single CIOCCRYPT. iv and mac may be NULL if the session has no use
+ * for them. */
+int cryptodev_crypt(struct cryptodev_session *s, int op, const void *src,
+		void *dst, size_t len, void *iv, void *mac);
+
+/* At most that many operations are held before a batch is flushed */
+#define CRYPTODEV_BATCH_MAX	64
+
+/* run the operations through the async queue, when the module has one */
+#define CRYPTODEV_BATCH_ASYNC	(1 << 0)
+
+/* Called for every operation of a batch when it is flushed, in the
+ * order they were added. status is 0 or a negative errno. */
+typedef void (*cryptodev_done_fn)(void *data, const struct crypt_op *cop,
+		int status);
+
+struct cryptodev_batch {
+	int flags;
+	unsigned int count;
+	cryptodev_done_fn done;
+	void *data;
+	struct crypt_op cop[CRYPTODEV_BATCH_MAX];
+	__s32 status[CRYPTODEV_BATCH_MAX];
+};
+
+void cryptodev_batch_init(struct cryptodev_batch *b, int flags,
+		cryptodev_done_fn done, void *data);
+/* Adds an operation as cryptodev_crypt() would run it. The batch is
+ * flushed first if it is full. Returns -1 if that flush failed. */
+int cryptodev_batch_add(struct cryptodev_batch *b,
+		struct cryptodev_session *s, int op, const void *src,
+		void *dst, size_t len, void *iv, void *mac);
+/* Runs the operations added so far. Returns -1 if they could not be
+ * submitted at all, and they are dropped; otherwise the outcome of
+ * each is passed to the done function. */
+int cryptodev_batch_flush(struct cryptodev_batch *b);
+
+#endif
@@ -4,7 +4,7 @@
  * cannot, or shouldn't be used, because it is always
  * slower.
  *
- * Running time ~= 1.2 seconds per call.
+ * Running time: 0.5 to 1.5 seconds per call.
  */
 int get_sha1_threshold();
 int get_aes_sha1_threshold();
@@ -46,17 +46,41 @@
 #include <linux/scatterlist.h>
 #include "cryptodev_int.h"
 #include "zc.h"
+#include "stats.h"
+#include "cryptodev_trace.h"
 #include "cryptlib.h"
+#include "crossover.h"
 #include "version.h"
 
 /* This file contains the traditional operations of encryption
  * and hashing of /dev/crypto.
  */
 
+/* Pinning the pages of a small buffer and mapping them costs more than
+ * copying it, so up to this many bytes the data are copied. */
+static unsigned int cryptodev_copy_threshold = 256;
+module_param(cryptodev_copy_threshold, uint, 0644);
+MODULE_PARM_DESC(cryptodev_copy_threshold,
+	"operations of up to this many bytes copy the data instead of "
+	"using the user pages (zero-copy)");
+
+/* Offload engines take longer than the CPU to set up an operation, so
+ * the small operations of SOP_FLAG_DRIVER_AUTO sessions run on their
+ * synchronous transforms instead: up to the crossover timed for their
+ * drivers (see crossover.c), or else up to this. */
+static unsigned int cryptodev_sync_threshold = 2048;
+module_param(cryptodev_sync_threshold, uint, 0644);
+MODULE_PARM_DESC(cryptodev_sync_threshold,
+	"operations of up to this many bytes of SOP_FLAG_DRIVER_AUTO sessions "
+	"whose drivers were not timed run on a synchronous implementation");
+
+/* With digest set the hash of the data is finished in a single call,
+ * into digest, instead of being updated */
 static int
-hash_n_crypt(struct csession *ses_ptr, struct crypt_op *cop,
+hash_n_crypt(struct cipher_data *cdata, struct hash_data *hdata,
+		struct crypt_op *cop,
 		struct scatterlist *src_sg, struct scatterlist *dst_sg,
-		uint32_t len)
+		uint32_t len, uint8_t *digest)
 {
 	int ret;
 
@@ -64,31 +88,39 @@ hash_n_crypt(struct csession *ses_ptr, struct crypt_op *cop,
 	 * we should introduce a flag to switch... TBD later on.
 	 */
 	if (cop->op == COP_ENCRYPT) {
-		if (ses_ptr->hdata.init != 0) {
-			ret = cryptodev_hash_update(&ses_ptr->hdata,
+		if (hdata->init != 0) {
+			if (digest)
+				ret = cryptodev_hash_digest(hdata,
+							src_sg, len, digest);
+			else
+				ret = cryptodev_hash_update(hdata,
 							src_sg, len);
 			if (unlikely(ret))
 				goto out_err;
 		}
-		if (ses_ptr->cdata.init != 0) {
-			ret = cryptodev_cipher_encrypt(&ses_ptr->cdata,
+		if (cdata->init != 0) {
+			ret = cryptodev_cipher_encrypt(cdata,
 							src_sg, dst_sg, len);
 
 			if (unlikely(ret))
 				goto out_err;
 		}
 	} else {
-		if (ses_ptr->cdata.init != 0) {
-			ret = cryptodev_cipher_decrypt(&ses_ptr->cdata,
+		if (cdata->init != 0) {
+			ret = cryptodev_cipher_decrypt(cdata,
 							src_sg, dst_sg, len);
 
 			if (unlikely(ret))
 				goto out_err;
 		}
 
-		if (ses_ptr->hdata.init != 0) {
-			ret = cryptodev_hash_update(&ses_ptr->hdata,
-								dst_sg, len);
+		if (hdata->init != 0) {
+			if (digest)
+				ret = cryptodev_hash_digest(hdata,
+							dst_sg, len, digest);
+			else
+				ret = cryptodev_hash_update(hdata,
+							dst_sg, len);
 			if (unlikely(ret))
 				goto out_err;
 		}
@@ -99,26 +131,101 @@ out_err:
 	return ret;
 }
 
+/* copy len bytes between user memory and the bounce buffer of zc */
+static int bounce_from_user(struct zc_pages *zc, const char __user *src,
+		size_t len)
+{
+	unsigned int i;
+	size_t n;
+
+	for (i = 0; len > 0; i++, src += n, len -= n) {
+		n = min_t(size_t, len, PAGE_SIZE);
+		if (unlikely(copy_from_user(page_address(zc->bounce[i]),
+					    src, n)))
+			return -EFAULT;
+	}
+	return 0;
+}
+
+static int bounce_to_user(struct zc_pages *zc, char __user *dst, size_t len)
+{
+	unsigned int i;
+	size_t n;
+
+	for (i = 0; len > 0; i++, dst += n, len -= n) {
+		n = min_t(size_t, len, PAGE_SIZE);
+		if (unlikely(copy_to_user(dst, page_address(zc->bounce[i]), n)))
+			return -EFAULT;
+	}
+	return 0;
+}
+
+/* The copying edition for data of up to a page, below
+ * cryptodev_copy_threshold: a single copy each way and a single
+ * scatterlist entry. */
+static int
+__crypto_run_small(struct cipher_data *cdata, struct hash_data *hdata,
+		struct zc_pages *zc, struct crypt_op *cop, uint8_t *digest)
+{
+	struct scatterlist sg;
+	void *buf;
+	int ret;
+
+	ret = zc_bounce_alloc(zc, 1);
+	if (unlikely(ret)) {
+		derr(1, "Error getting a free page.");
+		return ret;
+	}
+	buf = page_address(zc->bounce[0]);
+
+	if (unlikely(copy_from_user(buf, cop->src, cop->len)))
+		return -EFAULT;
+
+	sg_init_one(&sg, buf, cop->len);
+	ret = hash_n_crypt(cdata, hdata, cop, &sg, &sg, cop->len, digest);
+	if (unlikely(ret))
+		return ret;
+
+	if (cdata->init != 0 &&
+	    unlikely(copy_to_user(cop->dst, buf, cop->len)))
+		return -EFAULT;
+
+	return 0;
+}
+
 /* This is the main crypto function - feed it with plaintext
-   and get a ciphertext (or vice versa :-) */
+   and get a ciphertext (or vice versa :-). The data go through the
+   bounce buffer of zc, BOUNCE_PAGES at a time. */
 static int
-__crypto_run_std(struct csession *ses_ptr, struct crypt_op *cop)
+__crypto_run_std(struct cipher_data *cdata, struct hash_data *hdata,
+		struct zc_pages *zc, struct crypt_op *cop, uint8_t *digest)
 {
-	char *data;
 	char __user *src, *dst;
-	struct scatterlist sg;
 	size_t nbytes, bufsize;
+	unsigned int i, npages;
+	uint8_t *final = NULL;
 	int ret = 0;
 
+	/* the scatterlist of zc holds the bounce buffer */
+	BUILD_BUG_ON(BOUNCE_PAGES > DEFAULT_PREALLOC_PAGES);
+
 	nbytes = cop->len;
-	data = (char *)__get_free_page(GFP_KERNEL);
+	bufsize = min_t(size_t, nbytes, BOUNCE_PAGES * PAGE_SIZE);
 
-	if (unlikely(!data)) {
-		derr(1, "Error getting free page.");
-		return -ENOMEM;
+	ret = zc_bounce_alloc(zc, DIV_ROUND_UP(bufsize, PAGE_SIZE));
+	if (unlikely(ret)) {
+		derr(1, "Error getting free pages.");
+		return ret;
 	}
 
-	bufsize = PAGE_SIZE < nbytes ? PAGE_SIZE : nbytes;
+	/* a single call only covers data that fit in the buffer */
+	if (digest && nbytes > bufsize) {
+		ret = cryptodev_hash_reset(hdata);
+		if (unlikely(ret))
+			return ret;
+		final = digest;
+		digest = NULL;
+	}
 
 	src = cop->src;
 	dst = cop->dst;
@@ -126,23 +233,29 @@ __crypto_run_std(struct csession *ses_ptr, struct crypt_op *cop)
 	while (nbytes > 0) {
 		size_t current_len = nbytes > bufsize ? bufsize : nbytes;
 
-		if (unlikely(copy_from_user(data, src, current_len))) {
+		if (unlikely(bounce_from_user(zc, src, current_len))) {
 		        derr(1, "Error copying %zu bytes from user address %p.", current_len, src);
 			ret = -EFAULT;
 			break;
 		}
 
-		sg_init_one(&sg, data, current_len);
+		npages = DIV_ROUND_UP(current_len, PAGE_SIZE);
+		sg_init_table(zc->sg, npages);
+		for (i = 0; i < npages; i++)
+			sg_set_page(&zc->sg[i], zc->bounce[i],
+				    min_t(size_t, current_len - i * PAGE_SIZE,
+					  PAGE_SIZE), 0);
 
-		ret = hash_n_crypt(ses_ptr, cop, &sg, &sg, current_len);
+		ret = hash_n_crypt(cdata, hdata, cop, zc->sg, zc->sg,
+				current_len, digest);
 
 		if (unlikely(ret)) {
 		        derr(1, "hash_n_crypt failed.");
 			break;
 		}
 
-		if (ses_ptr->cdata.init != 0) {
-			if (unlikely(copy_to_user(dst, data, current_len))) {
+		if (cdata->init != 0) {
+			if (unlikely(bounce_to_user(zc, dst, current_len))) {
 			        derr(1, "could not copy to user.");
 				ret = -EFAULT;
 				break;
@@ -154,114 +267,985 @@ __crypto_run_std(struct csession *ses_ptr, struct crypt_op *cop)
 		src += current_len;
 	}
 
-	free_page((unsigned long)data);
+	if (final && likely(!ret))
+		ret = cryptodev_hash_final(hdata, final);
+
 	return ret;
 }
 
 
 
+/* The zero-copy edition for operations over more than a window. The
+   data are pinned STREAM_WINDOW_PAGES at a time, and the next window is
+   pinned while the engine is on the current one, so that the arrays of
+   zc stay of the size of two windows however long the data are. */
+static int
+__crypto_run_stream(struct cipher_data *cdata, struct hash_data *hdata,
+		struct zc_pages *zc, struct fcrypt *fcr,
+		struct kernel_crypt_op *kcop, uint8_t *digest)
+{
+	struct crypt_op *cop = &kcop->cop;
+	struct zc_pages next_zc, *win[2] = { zc, &next_zc };
+	struct scatterlist *src_sg[2], *dst_sg[2];
+	const size_t window = STREAM_WINDOW_PAGES * PAGE_SIZE;
+	const int encrypt = cop->op == COP_ENCRYPT;
+	size_t off, len, next_len;
+	int cur = 0, ret, err;
+
+	ret = zc_pages_init(&next_zc, ZC_CACHED_PAGES);
+	if (unlikely(ret))
+		return ret;
+
+	len = window;
+	ret = get_userbuf(zc, fcr, kcop->region, cop->src, len, cop->dst, len,
+	                  kcop->task, kcop->mm, &src_sg[0], &dst_sg[0]);
+	if (unlikely(ret)) {
+		derr(1, "Error getting user pages. Falling back to non zero copy.");
+		zc_pages_deinit(&next_zc);
+		cryptodev_stat_inc(fcr, CRYPTODEV_STAT_COPY);
+		return __crypto_run_std(cdata, hdata, zc, cop, digest);
+	}
+	cryptodev_stat_inc(fcr, CRYPTODEV_STAT_ZC);
+
+	/* the hash takes several updates */
+	if (digest) {
+		ret = cryptodev_hash_reset(hdata);
+		if (unlikely(ret))
+			goto out_release;
+	}
+
+	for (off = 0; off < cop->len;
+	     off += len, len = next_len, cur ^= 1) {
+		if (hdata->init != 0 && encrypt) {
+			ret = cryptodev_hash_update(hdata, src_sg[cur], len);
+			if (unlikely(ret))
+				goto out_release;
+		}
+
+		err = 0;
+		if (cdata->init != 0)
+			err = cryptodev_cipher_submit(cdata, encrypt,
+					src_sg[cur], dst_sg[cur], len);
+
+		next_len = min_t(size_t, cop->len - off - len, window);
+		if (next_len) {
+			ret = get_userbuf(win[cur ^ 1], fcr, kcop->region,
+					cop->src + off + len, next_len,
+					cop->dst ? cop->dst + off + len : NULL,
+					next_len,
+					kcop->task, kcop->mm,
+					&src_sg[cur ^ 1], &dst_sg[cur ^ 1]);
+			if (unlikely(ret))
+				derr(1, "Error getting user pages of the next window.");
+		}
+
+		if (cdata->init != 0) {
+			err = cryptodev_cipher_wait(cdata, err);
+			if (unlikely(err)) {
+				derr(0, "CryptoAPI failure: %d", err);
+				if (!ret)
+					release_user_pages(win[cur ^ 1]);
+				ret = err;
+			}
+		}
+
+		if (hdata->init != 0 && !encrypt && likely(!ret)) {
+			ret = cryptodev_hash_update(hdata, dst_sg[cur], len);
+			if (unlikely(ret))
+				release_user_pages(win[cur ^ 1]);
+		}
+
+		release_user_pages(win[cur]);
+		if (unlikely(ret))
+			goto out;
+	}
+
+	if (digest)
+		ret = cryptodev_hash_final(hdata, digest);
+	goto out;
+
+out_release:
+	release_user_pages(win[cur]);
+out:
+	zc_pages_deinit(&next_zc);
+	return ret;
+}
+
 /* This is the main crypto function - zero-copy edition */
 static int
-__crypto_run_zc(struct csession *ses_ptr, struct kernel_crypt_op *kcop)
+__crypto_run_zc(struct cipher_data *cdata, struct hash_data *hdata,
+		struct zc_pages *zc, struct fcrypt *fcr,
+		struct kernel_crypt_op *kcop, uint8_t *digest)
 {
 	struct scatterlist *src_sg, *dst_sg;
 	struct crypt_op *cop = &kcop->cop;
 	int ret = 0;
 
-	ret = get_userbuf(ses_ptr, cop->src, cop->len, cop->dst, cop->len,
-	                  kcop->task, kcop->mm, &src_sg, &dst_sg);
+	if (cop->len > STREAM_WINDOW_PAGES * PAGE_SIZE &&
+	    (cdata->init == 0 || cdata->aead == 0))
+		return __crypto_run_stream(cdata, hdata, zc, fcr, kcop, digest);
+
+	ret = get_userbuf(zc, fcr, kcop->region, cop->src, cop->len,
+	                  cop->dst, cop->len, kcop->task, kcop->mm,
+	                  &src_sg, &dst_sg);
 	if (unlikely(ret)) {
 		derr(1, "Error getting user pages. Falling back to non zero copy.");
-		return __crypto_run_std(ses_ptr, cop);
+		cryptodev_stat_inc(fcr, CRYPTODEV_STAT_COPY);
+		return __crypto_run_std(cdata, hdata, zc, cop, digest);
 	}
+	cryptodev_stat_inc(fcr, CRYPTODEV_STAT_ZC);
 
-	ret = hash_n_crypt(ses_ptr, cop, src_sg, dst_sg, cop->len);
+	ret = hash_n_crypt(cdata, hdata, cop, src_sg, dst_sg, cop->len,
+			digest);
 
-	release_user_pages(ses_ptr);
+	release_user_pages(zc);
 	return ret;
 }
 
-int crypto_run(struct fcrypt *fcr, struct kernel_crypt_op *kcop)
+/* The bytes at the start of buf that are copied for the rest of it to be
+ * aligned as the driver wants, i.e. those before its first page boundary */
+static inline uint32_t unaligned_head(void __user *buf, uint32_t len,
+		uint32_t alignmask)
+{
+	if (!buf || IS_ALIGNED((unsigned long)buf, alignmask + 1))
+		return 0;
+	return min_t(uint32_t, len, PAGE_SIZE - offset_in_page(buf));
+}
+
+/* Whether the entries of sg that cover len bytes all start where the
+ * driver wants them to */
+static int sg_is_aligned(struct scatterlist *sg, uint32_t len,
+		uint32_t alignmask)
+{
+	for (; sg && len; sg = sg_next(sg)) {
+		if (!IS_ALIGNED(sg->offset, alignmask + 1))
+			return 0;
+		len -= min(len, sg->length);
+	}
+	return 1;
+}
+
+/* The zero-copy edition for buffers that are not aligned as the driver
+   wants. Only the entry of the first page of such a buffer is unaligned,
+   so its head is copied into the bounce buffer and the pages after it
+   are used in place. */
+static int
+__crypto_run_zc_unaligned(struct cipher_data *cdata, struct hash_data *hdata,
+		struct zc_pages *zc, struct csession *ses_ptr,
+		struct kernel_crypt_op *kcop, uint8_t *digest)
 {
-	struct csession *ses_ptr;
 	struct crypt_op *cop = &kcop->cop;
+	uint8_t __user *src = cop->src, *dst = cop->dst;
+	uint32_t len = cop->len, src_head, dst_head;
+	unsigned int src_pages, dst_pages = 0;
+	struct scatterlist *src_sg, *dst_sg = NULL;
+	struct page *dst_bounce = NULL;
+	const int inplace = src == dst;
 	int ret;
 
+	src_head = unaligned_head(src, len, ses_ptr->alignmask);
+	dst_head = inplace ? src_head :
+			unaligned_head(dst, len, ses_ptr->alignmask);
+	src_pages = PAGECOUNT(src + src_head, len - src_head);
+	if (!inplace && dst)
+		dst_pages = PAGECOUNT(dst + dst_head, len - dst_head);
+
+	ret = zc_bounce_alloc(zc, 2);
+	if (unlikely(ret))
+		goto fallback;
+
+	/* an entry for the head of each buffer, then those of the pages */
+	if (src_pages + dst_pages + 2 > zc->array_size) {
+		ret = adjust_sg_array(zc, src_pages + dst_pages + 2);
+		if (unlikely(ret))
+			goto fallback;
+	}
+
+	src_sg = zc->sg;
+	sg_init_table(src_sg, src_pages + 1);
+	sg_set_page(&src_sg[0], zc->bounce[0], src_head, 0);
+	ret = __get_userbuf(src + src_head, len - src_head, inplace,
+			src_pages, zc->pages, src_sg + 1,
+			kcop->task, kcop->mm);
+	if (unlikely(ret))
+		goto fallback;
+	zc->used_pages = src_pages;
+	zc->readonly_pages = inplace ? 0 : src_pages;
+	if (!src_head)
+		src_sg++;
+
+	if (inplace) {
+		dst_sg = src_sg;
+		dst_bounce = zc->bounce[0];
+	} else if (dst) {
+		dst_sg = zc->sg + src_pages + 1;
+		dst_bounce = zc->bounce[1];
+		sg_init_table(dst_sg, dst_pages + 1);
+		sg_set_page(&dst_sg[0], dst_bounce, dst_head, 0);
+		ret = __get_userbuf(dst + dst_head, len - dst_head, 1,
+				dst_pages, zc->pages + src_pages, dst_sg + 1,
+				kcop->task, kcop->mm);
+		if (unlikely(ret)) {
+			release_user_pages(zc);
+			goto fallback;
+		}
+		zc->used_pages += dst_pages;
+		if (!dst_head)
+			dst_sg++;
+	}
+
+	cryptodev_stat_inc(ses_ptr->fcr, CRYPTODEV_STAT_ZC);
+	cryptodev_stat_inc(NULL, CRYPTODEV_STAT_HEAD_BOUNCE);
+
+	if (unlikely(copy_from_user(page_address(zc->bounce[0]), src,
+				    src_head))) {
+		ret = -EFAULT;
+		goto out;
+	}
+
+	ret = hash_n_crypt(cdata, hdata, cop, src_sg, dst_sg, len, digest);
+
+	if (likely(!ret) && cdata->init != 0 && dst_head &&
+	    unlikely(copy_to_user(dst, page_address(dst_bounce), dst_head)))
+		ret = -EFAULT;
+out:
+	release_user_pages(zc);
+	return ret;
+
+fallback:
+	derr(1, "Error getting user pages. Falling back to non zero copy.");
+	cryptodev_stat_inc(ses_ptr->fcr, CRYPTODEV_STAT_COPY);
+	cryptodev_stat_inc(ses_ptr->fcr, CRYPTODEV_STAT_UNALIGNED);
+	return __crypto_run_std(cdata, hdata, zc, cop, digest);
+}
+
+/* The zero-copy edition for operations given in segments. There is no
+ * fallback; the segments are not copied. */
+static int
+__crypto_run_iov(struct cipher_data *cdata, struct hash_data *hdata,
+		struct zc_pages *zc, struct kernel_crypt_op *kcop,
+		uint8_t *digest)
+{
+	struct scatterlist *src_sg, *dst_sg;
+	struct crypt_op *cop = &kcop->cop;
+	int ret;
+
+	ret = get_userbuf_iov(zc, kcop->iov, cop->len,
+	                      cdata->init ? cop->len : 0,
+	                      kcop->task, kcop->mm, &src_sg, &dst_sg);
+	if (unlikely(ret)) {
+		derr(1, "Error getting user pages of the segments.");
+		return ret;
+	}
+
+	ret = hash_n_crypt(cdata, hdata, cop, src_sg, dst_sg, cop->len,
+			digest);
+
+	release_user_pages(zc);
+	return ret;
+}
+
+/* whether kcop starts a new hash, and whether it finishes it */
+static inline int hash_resets(struct crypt_op *cop)
+{
+	uint16_t flags = cop->flags & ~(COP_FLAG_VERIFY | COP_VERIFY_LEN(0x7f) |
+					COP_FLAG_REGION);
+
+	return flags == 0 || flags & COP_FLAG_RESET;
+}
+
+static inline int hash_finalizes(struct crypt_op *cop)
+{
+	return (cop->flags & COP_FLAG_FINAL) ||
+		!(cop->flags & COP_FLAG_UPDATE) || cop->len == 0;
+}
+
+/* Run kcop with the requests and pages given, which are either the
+ * session's own or those of a context from crypto_get_ctx() */
+static int __crypto_run_on(struct csession *ses_ptr, struct cipher_data *cdata,
+		struct hash_data *hdata, struct zc_pages *zc,
+		struct kernel_crypt_op *kcop)
+{
+	struct crypt_op *cop = &kcop->cop;
+	uint8_t *digest = NULL;
+	int ret = 0;
+
 	if (unlikely(cop->op != COP_ENCRYPT && cop->op != COP_DECRYPT)) {
 		ddebug(1, "invalid operation op=%u", cop->op);
 		return -EINVAL;
 	}
 
-	/* this also enters ses_ptr->sem */
-	ses_ptr = crypto_get_session_by_sid(fcr, cop->ses);
-	if (unlikely(!ses_ptr)) {
-		derr(1, "invalid session ID=0x%08X", cop->ses);
+	if (unlikely(cop->flags & COP_FLAG_VERIFY && !hash_finalizes(cop))) {
+		ddebug(1, "COP_FLAG_VERIFY on an operation that does not finish the hash");
 		return -EINVAL;
 	}
 
-	if (ses_ptr->hdata.init != 0 && (cop->flags == 0 || cop->flags & COP_FLAG_RESET)) {
-		ret = cryptodev_hash_reset(&ses_ptr->hdata);
+	/* a hash that is started and finished by kcop is done in a
+	 * single call */
+	if (hdata->init != 0 && cop->len && hash_resets(cop) &&
+	    hash_finalizes(cop))
+		digest = kcop->hash_output;
+	else if (hdata->init != 0 && hash_resets(cop)) {
+		ret = cryptodev_hash_reset(hdata);
 		if (unlikely(ret)) {
 			derr(1, "error in cryptodev_hash_reset()");
-			goto out_unlock;
+			return ret;
 		}
 	}
 
-	if (ses_ptr->cdata.init != 0) {
-		int blocksize = ses_ptr->cdata.blocksize;
+	if (cdata->init != 0) {
+		int blocksize = cdata->blocksize;
 
 		if (unlikely(cop->len % blocksize)) {
 			derr(1, "data size (%u) isn't a multiple of block size (%u)",
 				cop->len, blocksize);
-			ret = -EINVAL;
-			goto out_unlock;
+			return -EINVAL;
 		}
 
-		cryptodev_cipher_set_iv(&ses_ptr->cdata, kcop->iv,
-				min(ses_ptr->cdata.ivsize, kcop->ivlen));
+		/* kcop->ivlen stays zero, the IV is not passed back */
+		if (kcop->ivlen == 0)
+			crypto_session_get_iv(ses_ptr, kcop->iv);
+		cryptodev_cipher_set_iv(cdata, kcop->iv, cdata->ivsize);
 	}
 
+	cryptodev_stat_inc(ses_ptr->fcr, CRYPTODEV_STAT_OPS);
+	cryptodev_stat_add(ses_ptr->fcr, CRYPTODEV_STAT_BYTES, cop->len);
+
 	if (likely(cop->len)) {
-		if (cop->flags & COP_FLAG_NO_ZC) {
-			if (unlikely(ses_ptr->alignmask && !IS_ALIGNED((unsigned long)cop->src, ses_ptr->alignmask))) {
-				dwarning(2, "source address %p is not %d byte aligned - disabling zero copy",
+		int unaligned = 0;
+
+		if (!(cop->flags & COP_FLAG_NO_ZC) && !kcop->iov &&
+		    !kcop->src_sg) {
+			if (unlikely(ses_ptr->alignmask && !IS_ALIGNED((unsigned long)cop->src, ses_ptr->alignmask + 1))) {
+				dwarning(2, "source address %p is not %d byte aligned - copying its head",
 						cop->src, ses_ptr->alignmask + 1);
-				cop->flags &= ~COP_FLAG_NO_ZC;
+				unaligned = 1;
 			}
 
-			if (unlikely(ses_ptr->alignmask && !IS_ALIGNED((unsigned long)cop->dst, ses_ptr->alignmask))) {
-				dwarning(2, "destination address %p is not %d byte aligned - disabling zero copy",
+			if (unlikely(ses_ptr->alignmask && !IS_ALIGNED((unsigned long)cop->dst, ses_ptr->alignmask + 1))) {
+				dwarning(2, "destination address %p is not %d byte aligned - copying its head",
 						cop->dst, ses_ptr->alignmask + 1);
-				cop->flags &= ~COP_FLAG_NO_ZC;
+				unaligned = 1;
 			}
 		}
 
-		if (cop->flags & COP_FLAG_NO_ZC)
-			ret = __crypto_run_std(ses_ptr, &kcop->cop);
+		if (kcop->src_sg) {
+			/* the pages of a chain are pinned once for all its
+			 * steps, so they cannot be bounced for one of them */
+			if (unlikely(ses_ptr->alignmask &&
+				     (!sg_is_aligned(kcop->src_sg, cop->len,
+						     ses_ptr->alignmask) ||
+				      !sg_is_aligned(kcop->dst_sg, cop->len,
+						     ses_ptr->alignmask)))) {
+				dwarning(2, "data of a chain step are not %d byte aligned",
+						ses_ptr->alignmask + 1);
+				return -EINVAL;
+			}
+			ret = hash_n_crypt(cdata, hdata, cop, kcop->src_sg,
+					kcop->dst_sg, cop->len, digest);
+		} else if (kcop->iov) {
+			cryptodev_stat_inc(ses_ptr->fcr, CRYPTODEV_STAT_ZC);
+			ret = __crypto_run_iov(cdata, hdata, zc, kcop, digest);
+		} else if (cop->len <= ACCESS_ONCE(cryptodev_copy_threshold) &&
+			   cop->len <= PAGE_SIZE) {
+			cryptodev_stat_inc(ses_ptr->fcr, CRYPTODEV_STAT_COPY);
+			ret = __crypto_run_small(cdata, hdata, zc, cop, digest);
+		} else if (cop->flags & COP_FLAG_NO_ZC) {
+			cryptodev_stat_inc(ses_ptr->fcr, CRYPTODEV_STAT_COPY);
+			ret = __crypto_run_std(cdata, hdata, zc, &kcop->cop,
+					digest);
+		} else if (unaligned)
+			ret = __crypto_run_zc_unaligned(cdata, hdata, zc,
+					ses_ptr, kcop, digest);
 		else
-			ret = __crypto_run_zc(ses_ptr, kcop);
+			ret = __crypto_run_zc(cdata, hdata, zc, ses_ptr->fcr,
+					kcop, digest);
 		if (unlikely(ret))
-			goto out_unlock;
+			return ret;
+	}
+
+	/* a generated IV is passed back as it was used */
+	if (cdata->init != 0 && !ses_ptr->iv_mode) {
+		cryptodev_cipher_get_iv(cdata, kcop->iv, cdata->ivsize);
+		crypto_session_set_iv(ses_ptr, kcop->iv);
 	}
 
-	if (ses_ptr->cdata.init != 0) {
-		cryptodev_cipher_get_iv(&ses_ptr->cdata, kcop->iv,
-				min(ses_ptr->cdata.ivsize, kcop->ivlen));
+	if (hdata->init != 0 && hash_finalizes(cop)) {
+		if (!digest) {
+			ret = cryptodev_hash_final(hdata, kcop->hash_output);
+			if (unlikely(ret)) {
+				derr(0, "CryptoAPI failure: %d", ret);
+				return ret;
+			}
+		}
+
+		/* the digest is only checked, not passed back */
+		if (cop->flags & COP_FLAG_VERIFY) {
+			if (crypto_memneq(kcop->hash_output, kcop->verify_mac,
+					  kcop->verifylen)) {
+				derr(2, "MAC verification failed");
+				return -EBADMSG;
+			}
+			return 0;
+		}
+		kcop->digestsize = hdata->digestsize;
 	}
 
+	return 0;
+}
+
+/* Whether kcop runs on the synchronous transforms of the session, see
+ * cryptodev_sync_threshold. Hashes over several operations stay on the
+ * transform they were started on. */
+static inline int crypto_run_is_sync(struct csession *ses_ptr,
+		struct crypt_op *cop)
+{
+	struct cryptodev_crossover *x = ACCESS_ONCE(ses_ptr->crossover);
+
+	if (!ses_ptr->sync_cdata.init && !ses_ptr->sync_hdata.init)
+		return 0;
+
+	if (cop->len > (x ? ACCESS_ONCE(x->bytes) :
+			    ACCESS_ONCE(cryptodev_sync_threshold)))
+		return 0;
+
+	return !ses_ptr->hdata.init || (hash_resets(cop) && hash_finalizes(cop));
+}
+
+/* Run kcop on an already looked up (and locked) session */
+int __crypto_run(struct csession *ses_ptr, struct kernel_crypt_op *kcop)
+{
+	int ret;
+
+	ses_ptr->scratch = zc_get_scratch(ses_ptr->fcr);
+	if (unlikely(!ses_ptr->scratch))
+		return -ENOMEM;
+
+	if (crypto_run_is_sync(ses_ptr, &kcop->cop))
+		ret = __crypto_run_on(ses_ptr, &ses_ptr->sync_cdata,
+				&ses_ptr->sync_hdata, &ses_ptr->scratch->zc, kcop);
+	else
+		ret = __crypto_run_on(ses_ptr, &ses_ptr->cdata, &ses_ptr->hdata,
+				&ses_ptr->scratch->zc, kcop);
+
+	zc_put_scratch(ses_ptr->fcr, ses_ptr->scratch);
+	ses_ptr->scratch = NULL;
+	return ret;
+}
+
+/* Whether kcop leaves no state in the session's requests for the next
+ * operation, so that it can run on requests of its own. That is anything
+ * but AEAD, hashing over several operations, and ciphers that continue
+ * from the IV the session was left with. */
+static int crypto_run_is_stateless(struct csession *ses_ptr,
+		struct kernel_crypt_op *kcop)
+{
+	struct crypt_op *cop = &kcop->cop;
+
+	if (ses_ptr->cdata.init != 0 && ses_ptr->cdata.aead != 0)
+		return 0;
+
+	/* the session IV is only updated once the operation is done, so
+	 * two of them at once would both start from it */
+	if (ses_ptr->cdata.init != 0 && ses_ptr->cdata.ivsize &&
+	    kcop->ivlen == 0 && !ses_ptr->iv_mode)
+		return 0;
+
 	if (ses_ptr->hdata.init != 0 &&
-		((cop->flags & COP_FLAG_FINAL) ||
-		   (!(cop->flags & COP_FLAG_UPDATE) || cop->len == 0))) {
+	    !(hash_resets(cop) && hash_finalizes(cop)))
+		return 0;
+
+	return 1;
+}
 
-		ret = cryptodev_hash_final(&ses_ptr->hdata, kcop->hash_output);
+/* The non-blocking path. It is taken by zero-copy operations on sessions
+ * with just a (non AEAD) cipher and an IV of their own: these use nothing
+ * of the session but its transform, so any number of them may be in
+ * flight on it. */
+
+static void crypto_nowait_complete(struct crypto_async_request *req, int err)
+{
+	struct crypto_nowait_op *op = req->data;
+
+	/* a backlogged request made it to the queue */
+	if (err == -EINPROGRESS)
+		return;
+
+	op->done(op, err);
+}
+
+/* Start kcop without waiting for it to complete. Returns -EAGAIN if kcop
+ * has to go through __crypto_run() instead. -EINPROGRESS means that
+ * op->done() will be called once kcop has completed, and that
+ * __crypto_nowait_finish() has to be called after that. Anything else
+ * is the result of kcop, which is finished already. */
+int __crypto_run_nowait(struct csession *ses_ptr, struct kernel_crypt_op *kcop,
+			struct crypto_nowait_op *op)
+{
+	struct scatterlist *src_sg, *dst_sg;
+	struct crypt_op *cop = &kcop->cop;
+	int ret;
+
+	if (ses_ptr->cdata.init == 0 || ses_ptr->cdata.aead != 0 ||
+	    ses_ptr->hdata.init != 0 || cop->len == 0 || kcop->iov ||
+	    (cop->flags & COP_FLAG_NO_ZC) ||
+	    kcop->ivlen != ses_ptr->cdata.ivsize)
+		return -EAGAIN;
+
+	if (unlikely(cop->op != COP_ENCRYPT && cop->op != COP_DECRYPT)) {
+		ddebug(1, "invalid operation op=%u", cop->op);
+		return -EINVAL;
+	}
+
+	if (unlikely(cop->len % ses_ptr->cdata.blocksize)) {
+		derr(1, "data size (%u) isn't a multiple of block size (%u)",
+			cop->len, ses_ptr->cdata.blocksize);
+		return -EINVAL;
+	}
+
+	if (op->zc.array_size == 0) {
+		ret = zc_pages_init(&op->zc, DEFAULT_PREALLOC_PAGES);
+		if (unlikely(ret))
+			return ret;
+	}
+
+	ret = get_userbuf(&op->zc, ses_ptr->fcr, kcop->region,
+	                  cop->src, cop->len, cop->dst, cop->len,
+	                  kcop->task, kcop->mm, &src_sg, &dst_sg);
+	if (unlikely(ret))
+		return -EAGAIN;
+
+	cryptodev_stat_inc(ses_ptr->fcr, CRYPTODEV_STAT_OPS);
+	cryptodev_stat_add(ses_ptr->fcr, CRYPTODEV_STAT_BYTES, cop->len);
+	cryptodev_stat_inc(ses_ptr->fcr, CRYPTODEV_STAT_ZC);
+
+	op->req = cryptodev_cipher_request_alloc(&ses_ptr->cdata,
+				crypto_nowait_complete, op);
+	if (unlikely(!op->req)) {
+		release_user_pages(&op->zc);
+		return -ENOMEM;
+	}
+
+	ret = cryptodev_cipher_start(op->req, cop->op == COP_ENCRYPT,
+				src_sg, dst_sg, cop->len, kcop->iv);
+	if (ret == -EINPROGRESS || ret == -EBUSY)
+		return -EINPROGRESS;
+
+	__crypto_nowait_finish(op);
+	return ret;
+}
+
+/* this function has to be called from process context */
+void __crypto_nowait_finish(struct crypto_nowait_op *op)
+{
+	cryptodev_cipher_request_free(op->req);
+	op->req = NULL;
+	release_user_pages(&op->zc);
+}
+
+/* Run kcop. Stateless operations that find the session busy run
+ * concurrently, on requests of their own. */
+int crypto_run(struct fcrypt *fcr, struct kernel_crypt_op *kcop)
+{
+	struct csession *ses_ptr;
+	struct csession_ctx *ctx;
+	struct zc_scratch *scratch;
+	struct crypt_op *cop = &kcop->cop;
+	ktime_t start = ktime_get();
+	int ret;
+
+	ses_ptr = crypto_ref_session_by_sid(fcr, cop->ses);
+	if (unlikely(!ses_ptr)) {
+		derr(1, "invalid session ID=0x%08X", cop->ses);
+		return -EINVAL;
+	}
+	trace_cryptodev_op_start(ses_ptr, cop->op, cop->len, 0);
+
+	if (!crypto_run_is_stateless(ses_ptr, kcop)) {
+		mutex_lock(&ses_ptr->sem);
+	} else if (!mutex_trylock(&ses_ptr->sem)) {
+		ctx = crypto_get_ctx(ses_ptr);
+		scratch = zc_get_scratch(fcr);
+		if (unlikely(!ctx || !scratch)) {
+			if (ctx)
+				crypto_put_ctx(ses_ptr, ctx);
+			if (scratch)
+				zc_put_scratch(fcr, scratch);
+			ret = -ENOMEM;
+			goto out;
+		}
+
+		ret = __crypto_run_on(ses_ptr, &ctx->cdata, &ctx->hdata,
+				&scratch->zc, kcop);
+
+		zc_put_scratch(fcr, scratch);
+		crypto_put_ctx(ses_ptr, ctx);
+		goto out;
+	}
+
+	ret = __crypto_run(ses_ptr, kcop);
+	mutex_unlock(&ses_ptr->sem);
+
+out:
+	trace_cryptodev_op_done(ses_ptr, cop->op, cop->len, ret);
+	cryptodev_stat_latency(ses_ptr->stat_alg, start);
+	crypto_release_session(ses_ptr);
+	return ret;
+}
+
+/* The number of digests of a CIOCHASHMULTI that are in flight at once */
+#define HASH_MULTI_INFLIGHT 16
+
+struct hash_multi_slot {
+	struct ahash_request *req;
+	struct zc_pages zc;
+	struct completion done;
+	/* -EINPROGRESS until done is completed */
+	int err;
+	uint8_t digest[AALG_MAX_RESULT_LEN];
+};
+
+static void hash_multi_done(struct crypto_async_request *req, int err)
+{
+	struct hash_multi_slot *slot = req->data;
+
+	/* a backlogged request has been queued; the result is to come */
+	if (err == -EINPROGRESS)
+		return;
+
+	slot->err = err;
+	complete(&slot->done);
+}
+
+/* Pin buf and start its digest on slot */
+static int hash_multi_start(struct hash_multi_slot *slot,
+		const struct crypt_iovec *buf)
+{
+	struct scatterlist *sg = NULL;
+	int pagecount, ret;
+
+	if (buf->len) {
+		pagecount = PAGECOUNT(buf->base, buf->len);
+		if (slot->zc.array_size == 0)
+			ret = zc_pages_init(&slot->zc, pagecount);
+		else if (slot->zc.array_size < pagecount)
+			ret = adjust_sg_array(&slot->zc, pagecount);
+		else
+			ret = 0;
+		if (unlikely(ret))
+			return ret;
+
+		ret = __get_userbuf(buf->base, buf->len, 0, pagecount,
+				slot->zc.pages, slot->zc.sg, current, current->mm);
 		if (unlikely(ret)) {
-			derr(0, "CryptoAPI failure: %d", ret);
-			goto out_unlock;
+			derr(1, "failed to get user pages of a buffer to hash");
+			return ret;
+		}
+		slot->zc.used_pages = slot->zc.readonly_pages = pagecount;
+		sg = slot->zc.sg;
+	}
+
+	/* set before the request can complete, which hash_multi_done()
+	 * may do before cryptodev_hash_start() returns */
+	reinit_completion(&slot->done);
+	slot->err = -EINPROGRESS;
+	ret = cryptodev_hash_start(slot->req, sg, buf->len, slot->digest);
+	if (ret != -EINPROGRESS && ret != -EBUSY)
+		slot->err = ret;
+	return 0;
+}
+
+static int hash_multi_finish(struct hash_multi_slot *slot)
+{
+	/* the request and the pages are in use until it is done */
+	if (slot->err == -EINPROGRESS)
+		wait_for_completion(&slot->done);
+
+	release_user_pages(&slot->zc);
+	return slot->err;
+}
+
+/* Run CIOCHASHMULTI. Only the transform of the session is used, so other
+ * operations can run on it meanwhile. */
+int crypto_hash_multi(struct fcrypt *fcr, struct crypt_hash_multi_op *hop,
+		const struct user_abi *abi)
+{
+	struct csession *ses_ptr;
+	struct crypt_iovec *bufs = NULL;
+	struct hash_multi_slot *slots = NULL;
+	unsigned int i, j, n, started, nslots, digestsize, ops = 0;
+	uint64_t bytes = 0;
+	int ret, err;
+
+	if (unlikely(hop->count == 0 || hop->count > CRYPTODEV_MAX_MULTI_OPS))
+		return -EINVAL;
+
+	ses_ptr = crypto_ref_session_by_sid(fcr, hop->ses);
+	if (unlikely(!ses_ptr)) {
+		derr(1, "invalid session ID=0x%08X", hop->ses);
+		return -EINVAL;
+	}
+
+	if (unlikely(ses_ptr->hdata.init == 0 || ses_ptr->cdata.init != 0)) {
+		ddebug(1, "CIOCHASHMULTI needs a hash-only session");
+		ret = -EINVAL;
+		goto out;
+	}
+	digestsize = ses_ptr->hdata.digestsize;
+
+	bufs = kmalloc_array(hop->count, sizeof(*bufs), GFP_KERNEL);
+	nslots = min_t(unsigned int, hop->count, HASH_MULTI_INFLIGHT);
+	slots = kcalloc(nslots, sizeof(*slots), GFP_KERNEL);
+	if (unlikely(!bufs || !slots)) {
+		ret = -ENOMEM;
+		goto out;
+	}
+
+	if (unlikely(abi->iovecs_from_user(bufs, hop->bufs, hop->count))) {
+		ret = -EFAULT;
+		goto out;
+	}
+
+	for (j = 0; j < nslots; j++) {
+		init_completion(&slots[j].done);
+		slots[j].req = cryptodev_hash_request_alloc(&ses_ptr->hdata,
+					hash_multi_done, &slots[j]);
+		if (unlikely(!slots[j].req)) {
+			ret = -ENOMEM;
+			goto out;
 		}
-		kcop->digestsize = ses_ptr->hdata.digestsize;
 	}
 
-out_unlock:
-	crypto_put_session(ses_ptr);
+	ret = 0;
+	for (i = 0; i < hop->count && !ret; i += n) {
+		n = min(nslots, hop->count - i);
+
+		for (started = 0; started < n; started++) {
+			ret = hash_multi_start(&slots[started], &bufs[i + started]);
+			if (unlikely(ret))
+				break;
+			bytes += bufs[i + started].len;
+		}
+		ops += started;
+
+		for (j = 0; j < started; j++) {
+			err = hash_multi_finish(&slots[j]);
+			if (!ret)
+				ret = err;
+			if (!ret && unlikely(copy_to_user(hop->digests +
+						(i + j) * digestsize,
+						slots[j].digest, digestsize)))
+				ret = -EFAULT;
+		}
+	}
+
+	cryptodev_stat_add(fcr, CRYPTODEV_STAT_OPS, ops);
+	cryptodev_stat_add(fcr, CRYPTODEV_STAT_BYTES, bytes);
+
+out:
+	if (slots) {
+		for (j = 0; j < nslots; j++) {
+			if (slots[j].req)
+				cryptodev_hash_request_free(slots[j].req);
+			zc_pages_deinit(&slots[j].zc);
+		}
+	}
+	kfree(slots);
+	kfree(bufs);
+	crypto_release_session(ses_ptr);
+	return ret;
+}
+
+/* The number of buffers of a CIOCCIPHERMULTI that are in flight at once */
+#define CIPHER_MULTI_INFLIGHT 16
+
+struct cipher_multi_slot {
+	cryptodev_blkcipher_request_t *req;
+	struct zc_pages zc;
+	struct completion done;
+	/* -EINPROGRESS until done is completed */
+	int err;
+	/* updated in place by the cipher */
+	uint8_t iv[EALG_MAX_BLOCK_LEN];
+	/* what an iv_mode session gave, which is passed back instead */
+	uint8_t iv_used[EALG_MAX_BLOCK_LEN];
+};
+
+static void cipher_multi_done(struct crypto_async_request *req, int err)
+{
+	struct cipher_multi_slot *slot = req->data;
+
+	/* a backlogged request has been queued; the result is to come */
+	if (err == -EINPROGRESS)
+		return;
+
+	slot->err = err;
+	complete(&slot->done);
+}
+
+/* Pin the i-th buffer of cmo, take its IV and start it on slot */
+static int cipher_multi_start(struct fcrypt *fcr, struct csession *ses_ptr,
+		struct cipher_multi_slot *slot, struct crypt_cipher_multi_op *cmo,
+		const struct crypt_iovec *src, const struct crypt_iovec *dst,
+		unsigned int i)
+{
+	struct scatterlist *src_sg, *dst_sg;
+	unsigned int ivsize = ses_ptr->cdata.ivsize;
+	int ret;
+
+	if (unlikely(src->len == 0 || (src->len % ses_ptr->cdata.blocksize) ||
+		     (dst && dst->len != src->len))) {
+		ddebug(1, "buffer %u: length %u does not fit the cipher",
+				i, (unsigned int)src->len);
+		return -EINVAL;
+	}
+
+	if (ses_ptr->iv_mode) {
+		crypto_session_next_iv(ses_ptr, slot->iv_used, src->len);
+		memcpy(slot->iv, slot->iv_used, ivsize);
+	} else if (ivsize && unlikely(copy_from_user(slot->iv,
+				    cmo->ivs + i * ivsize, ivsize)))
+		return -EFAULT;
+
+	if (slot->zc.array_size == 0) {
+		ret = zc_pages_init(&slot->zc, DEFAULT_PREALLOC_PAGES);
+		if (unlikely(ret))
+			return ret;
+	}
+
+	ret = get_userbuf(&slot->zc, fcr, NULL, src->base, src->len,
+			dst ? dst->base : src->base, src->len,
+			current, current->mm, &src_sg, &dst_sg);
+	if (unlikely(ret)) {
+		derr(1, "failed to get user pages of buffer %u", i);
+		return ret;
+	}
+
+	/* as in hash_multi_start(), before the request can complete */
+	reinit_completion(&slot->done);
+	slot->err = -EINPROGRESS;
+	ret = cryptodev_cipher_start(slot->req, cmo->op == COP_ENCRYPT,
+			src_sg, dst_sg, src->len, slot->iv);
+	if (ret != -EINPROGRESS && ret != -EBUSY)
+		slot->err = ret;
+	return 0;
+}
+
+static int cipher_multi_finish(struct cipher_multi_slot *slot)
+{
+	/* the request and the pages are in use until it is done */
+	if (slot->err == -EINPROGRESS)
+		wait_for_completion(&slot->done);
+
+	release_user_pages(&slot->zc);
+	return slot->err;
+}
+
+/* Run CIOCCIPHERMULTI. Like CIOCHASHMULTI it only uses the transform of
+ * the session, each buffer with a request and an IV of its own, so that
+ * the buffers can be in flight together. */
+int crypto_cipher_multi(struct fcrypt *fcr, struct crypt_cipher_multi_op *cmo,
+		const struct user_abi *abi)
+{
+	struct csession *ses_ptr;
+	struct crypt_iovec *src = NULL, *dst = NULL;
+	struct cipher_multi_slot *slots = NULL;
+	unsigned int i, j, n, started, nslots, ivsize, ops = 0;
+	uint64_t bytes = 0;
+	int ret, err;
+
+	if (unlikely(cmo->count == 0 || cmo->count > CRYPTODEV_MAX_MULTI_OPS ||
+		     (cmo->flags & ~COP_FLAG_WRITE_IV) || cmo->__reserved ||
+		     (cmo->op != COP_ENCRYPT && cmo->op != COP_DECRYPT)))
+		return -EINVAL;
+
+	ses_ptr = crypto_ref_session_by_sid(fcr, cmo->ses);
+	if (unlikely(!ses_ptr)) {
+		derr(1, "invalid session ID=0x%08X", cmo->ses);
+		return -EINVAL;
+	}
+
+	if (unlikely(ses_ptr->cdata.init == 0 || ses_ptr->cdata.aead ||
+		     ses_ptr->hdata.init != 0)) {
+		ddebug(1, "CIOCCIPHERMULTI needs a cipher-only session");
+		ret = -EINVAL;
+		goto out;
+	}
+	ivsize = ses_ptr->cdata.ivsize;
+	if (unlikely(ivsize && !ses_ptr->iv_mode && !cmo->ivs)) {
+		ddebug(1, "CIOCCIPHERMULTI needs the IVs");
+		ret = -EINVAL;
+		goto out;
+	}
+
+	src = kmalloc_array(cmo->count, sizeof(*src), GFP_KERNEL);
+	if (cmo->dst)
+		dst = kmalloc_array(cmo->count, sizeof(*dst), GFP_KERNEL);
+	nslots = min_t(unsigned int, cmo->count, CIPHER_MULTI_INFLIGHT);
+	slots = kcalloc(nslots, sizeof(*slots), GFP_KERNEL);
+	if (unlikely(!src || (cmo->dst && !dst) || !slots)) {
+		ret = -ENOMEM;
+		goto out;
+	}
+
+	if (unlikely(abi->iovecs_from_user(src, cmo->src, cmo->count) ||
+		     (dst && abi->iovecs_from_user(dst, cmo->dst, cmo->count)))) {
+		ret = -EFAULT;
+		goto out;
+	}
+
+	for (j = 0; j < nslots; j++) {
+		init_completion(&slots[j].done);
+		slots[j].req = cryptodev_cipher_request_alloc(&ses_ptr->cdata,
+					cipher_multi_done, &slots[j]);
+		if (unlikely(!slots[j].req)) {
+			ret = -ENOMEM;
+			goto out;
+		}
+	}
+
+	ret = 0;
+	for (i = 0; i < cmo->count && !ret; i += n) {
+		n = min(nslots, cmo->count - i);
+
+		for (started = 0; started < n; started++) {
+			ret = cipher_multi_start(fcr, ses_ptr, &slots[started],
+					cmo, &src[i + started],
+					dst ? &dst[i + started] : NULL, i + started);
+			if (unlikely(ret))
+				break;
+			bytes += src[i + started].len;
+		}
+		ops += started;
+
+		for (j = 0; j < started; j++) {
+			err = cipher_multi_finish(&slots[j]);
+			if (!ret)
+				ret = err;
+			if (!ret && ivsize && cmo->ivs &&
+			    (cmo->flags & COP_FLAG_WRITE_IV) &&
+			    unlikely(copy_to_user(cmo->ivs + (i + j) * ivsize,
+					ses_ptr->iv_mode ? slots[j].iv_used
+							 : slots[j].iv,
+					ivsize)))
+				ret = -EFAULT;
+		}
+	}
+
+	cryptodev_stat_add(fcr, CRYPTODEV_STAT_OPS, ops);
+	cryptodev_stat_add(fcr, CRYPTODEV_STAT_BYTES, bytes);
+
+out:
+	if (slots) {
+		for (j = 0; j < nslots; j++) {
+			if (slots[j].req)
+				cryptodev_cipher_request_free(slots[j].req);
+			zc_pages_deinit(&slots[j].zc);
+		}
+	}
+	kfree(slots);
+	kfree(dst);
+	kfree(src);
+	crypto_release_session(ses_ptr);
 	return ret;
 }
@@ -0,0 +1,184 @@
+/*
+ * Driver for /dev/crypto device (aka CryptoDev)
+ *
+ * This file is part of linux cryptodev.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+
+#include <linux/debugfs.h>
+#include <linux/seq_file.h>
+#include <linux/percpu.h>
+#include <linux/cpumask.h>
+#include "cryptodev_int.h"
+#include "stats.h"
+
+/* Performance counters. They are exported in debugfs (cryptodev/stats
+ * and cryptodev/latency); those of a file descriptor are returned by
+ * CIOCGSTATS.
+ */
+
+DEFINE_PER_CPU(struct cryptodev_stats, cryptodev_stats);
+DEFINE_PER_CPU(struct cryptodev_latency, cryptodev_latency);
+
+static const char * const stat_names[NR_CRYPTODEV_STATS] = {
+	[CRYPTODEV_STAT_OPS] = "ops",
+	[CRYPTODEV_STAT_BYTES] = "bytes",
+	[CRYPTODEV_STAT_ZC] = "zc_ops",
+	[CRYPTODEV_STAT_COPY] = "copy_ops",
+	[CRYPTODEV_STAT_UNALIGNED] = "unaligned_ops",
+	[CRYPTODEV_STAT_ASYNC_BUSY] = "async_busy",
+	[CRYPTODEV_STAT_SG_REALLOC] = "sg_reallocs",
+	[CRYPTODEV_STAT_WAITS] = "waits",
+	[CRYPTODEV_STAT_WAIT_NS] = "wait_ns",
+	[CRYPTODEV_STAT_SG_MERGED] = "sg_merged",
+	[CRYPTODEV_STAT_HEAD_BOUNCE] = "head_bounces",
+	[CRYPTODEV_STAT_POLLED] = "polled_waits",
+};
+
+/* the names of the algorithms that sessions were created for */
+static const char *alg_names[CRYPTO_ALGORITHM_ALL];
+
+static struct dentry *stats_dir;
+
+void cryptodev_stat_alg_name(unsigned int alg, const char *name)
+{
+	ACCESS_ONCE(alg_names[alg]) = name;
+}
+
+static void stats_sum(struct cryptodev_stats __percpu *stats,
+		struct cryptodev_stats *sum)
+{
+	int cpu, i;
+
+	memset(sum, 0, sizeof(*sum));
+	for_each_possible_cpu(cpu)
+		for (i = 0; i < NR_CRYPTODEV_STATS; i++)
+			sum->count[i] += per_cpu_ptr(stats, cpu)->count[i];
+}
+
+int cryptodev_fd_stats_init(struct fcrypt *fcr)
+{
+	fcr->stats = alloc_percpu(struct cryptodev_stats);
+	return fcr->stats ? 0 : -ENOMEM;
+}
+
+void cryptodev_fd_stats_deinit(struct fcrypt *fcr)
+{
+	free_percpu(fcr->stats);
+	fcr->stats = NULL;
+}
+
+void cryptodev_fd_stats_get(struct fcrypt *fcr, struct crypt_stats *st)
+{
+	struct cryptodev_stats sum;
+
+	stats_sum(fcr->stats, &sum);
+
+	memset(st, 0, sizeof(*st));
+	st->ops = sum.count[CRYPTODEV_STAT_OPS];
+	st->bytes = sum.count[CRYPTODEV_STAT_BYTES];
+	st->zc_ops = sum.count[CRYPTODEV_STAT_ZC];
+	st->copy_ops = sum.count[CRYPTODEV_STAT_COPY];
+	st->unaligned_ops = sum.count[CRYPTODEV_STAT_UNALIGNED];
+	st->async_busy = sum.count[CRYPTODEV_STAT_ASYNC_BUSY];
+}
+
+static int stats_show(struct seq_file *m, void *v)
+{
+	struct cryptodev_stats sum;
+	int i;
+
+	stats_sum(&cryptodev_stats, &sum);
+	for (i = 0; i < NR_CRYPTODEV_STATS; i++)
+		seq_printf(m, "%-16s %llu\n", stat_names[i],
+			   (unsigned long long)sum.count[i]);
+	return 0;
+}
+
+static int latency_show(struct seq_file *m, void *v)
+{
+	u64 hist[CRYPTODEV_LAT_BUCKETS];
+	int alg, cpu, i, used;
+
+	seq_printf(m, "%-24s", "us <");
+	for (i = 0; i < CRYPTODEV_LAT_BUCKETS - 1; i++)
+		seq_printf(m, " %8u", 1U << i);
+	seq_printf(m, " %8s\n", "more");
+
+	for (alg = 0; alg < CRYPTO_ALGORITHM_ALL; alg++) {
+		memset(hist, 0, sizeof(hist));
+		used = 0;
+		for_each_possible_cpu(cpu) {
+			for (i = 0; i < CRYPTODEV_LAT_BUCKETS; i++) {
+				hist[i] += per_cpu(cryptodev_latency, cpu).hist[alg][i];
+				used |= hist[i] != 0;
+			}
+		}
+		if (!used)
+			continue;
+
+		seq_printf(m, "%-24s", ACCESS_ONCE(alg_names[alg]) ?: "?");
+		for (i = 0; i < CRYPTODEV_LAT_BUCKETS; i++)
+			seq_printf(m, " %8llu", (unsigned long long)hist[i]);
+		seq_putc(m, '\n');
+	}
+	return 0;
+}
+
+static int stats_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, stats_show, NULL);
+}
+
+static int latency_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, latency_show, NULL);
+}
+
+static const struct file_operations stats_fops = {
+	.owner = THIS_MODULE,
+	.open = stats_open,
+	.read = seq_read,
+	.llseek = seq_lseek,
+	.release = single_release,
+};
+
+static const struct file_operations latency_fops = {
+	.owner = THIS_MODULE,
+	.open = latency_open,
+	.read = seq_read,
+	.llseek = seq_lseek,
+	.release = single_release,
+};
+
+/* the counters are kept even if debugfs is not available */
+void cryptodev_stats_init(void)
+{
+	stats_dir = debugfs_create_dir("cryptodev", NULL);
+	if (IS_ERR_OR_NULL(stats_dir)) {
+		stats_dir = NULL;
+		return;
+	}
+
+	debugfs_create_file("stats", 0444, stats_dir, NULL, &stats_fops);
+	debugfs_create_file("latency", 0444, stats_dir, NULL, &latency_fops);
+}
+
+void cryptodev_stats_exit(void)
+{
+	debugfs_remove_recursive(stats_dir);
+}
@@ -0,0 +1,77 @@
+#ifndef STATS_H
+# define STATS_H
+
+#include <linux/percpu.h>
+#include <linux/ktime.h>
+#include "cryptodev_int.h"
+
+/* Counters, kept per CPU for the module and for each file descriptor.
+ * The ones after CRYPTODEV_STAT_ASYNC_BUSY are only kept for the module.
+ */
+enum cryptodev_stat {
+	CRYPTODEV_STAT_OPS,		/* operations run */
+	CRYPTODEV_STAT_BYTES,		/* bytes of data processed */
+	CRYPTODEV_STAT_ZC,		/* operations on the user pages */
+	CRYPTODEV_STAT_COPY,		/* operations that copied the data */
+	CRYPTODEV_STAT_UNALIGNED,	/* of those, because of the alignmask */
+	CRYPTODEV_STAT_ASYNC_BUSY,	/* CIOCASYNCCRYPT found the queue full */
+	CRYPTODEV_STAT_SG_REALLOC,	/* reallocations in adjust_sg_array() */
+	CRYPTODEV_STAT_WAITS,		/* waits for a request to complete */
+	CRYPTODEV_STAT_WAIT_NS,		/* the time spent in them */
+	CRYPTODEV_STAT_SG_MERGED,	/* pages merged into the sg entry before */
+	CRYPTODEV_STAT_HEAD_BOUNCE,	/* zero-copy with unaligned heads copied */
+	CRYPTODEV_STAT_POLLED,		/* waits ended by cryptodev_poll_ns */
+	NR_CRYPTODEV_STATS
+};
+
+struct cryptodev_stats {
+	u64 count[NR_CRYPTODEV_STATS];
+};
+
+/* The latencies of blocking operations are counted for each algorithm
+ * (the cipher of the session, or else its hash) in buckets of powers
+ * of two microseconds (of 1024ns): bucket i has those below 2^i us,
+ * and the last one the rest. */
+#define CRYPTODEV_LAT_BUCKETS 16
+
+struct cryptodev_latency {
+	u64 hist[CRYPTO_ALGORITHM_ALL][CRYPTODEV_LAT_BUCKETS];
+};
+
+DECLARE_PER_CPU(struct cryptodev_stats, cryptodev_stats);
+DECLARE_PER_CPU(struct cryptodev_latency, cryptodev_latency);
+
+/* fcr is NULL for the counters that are only kept for the module */
+static inline void cryptodev_stat_add(struct fcrypt *fcr,
+				enum cryptodev_stat stat, u64 n)
+{
+	this_cpu_add(cryptodev_stats.count[stat], n);
+	if (fcr)
+		this_cpu_add(fcr->stats->count[stat], n);
+}
+
+static inline void cryptodev_stat_inc(struct fcrypt *fcr,
+				enum cryptodev_stat stat)
+{
+	cryptodev_stat_add(fcr, stat, 1);
+}
+
+/* count an operation of alg that started at start */
+static inline void cryptodev_stat_latency(unsigned int alg, ktime_t start)
+{
+	u64 us = ktime_to_ns(ktime_sub(ktime_get(), start)) >> 10;
+
+	this_cpu_inc(cryptodev_latency.hist[alg][min_t(unsigned int,
+				fls64(us), CRYPTODEV_LAT_BUCKETS - 1)]);
+}
+
+void cryptodev_stat_alg_name(unsigned int alg, const char *name);
+
+int cryptodev_fd_stats_init(struct fcrypt *fcr);
+void cryptodev_fd_stats_deinit(struct fcrypt *fcr);
+void cryptodev_fd_stats_get(struct fcrypt *fcr, struct crypt_stats *st);
+
+void cryptodev_stats_init(void);
+void cryptodev_stats_exit(void);
+
+#endif
@@ -0,0 +1,366 @@
+/*
+ * Driver for /dev/crypto device (aka CryptoDev)
+ *
+ * This file is part of linux cryptodev.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+
+#include <linux/crypto.h>
+#include <linux/highmem.h>
+#include <linux/mm.h>
+#include <linux/poll.h>
+#include <linux/slab.h>
+#include <linux/uaccess.h>
+#include <linux/uio.h>
+#include "cryptodev_int.h"
+#include "cryptlib.h"
+#include "stats.h"
+#include "stream.h"
+
+#ifdef CRYPTODEV_HAVE_STREAM
+
+/* A stream holds what was written to the file descriptor in a buffer of
+ * its own pages, and runs the cipher of its session over it in place as
+ * soon as there are whole blocks. The data of splice() and sendfile()
+ * are thus copied once into the buffer and once out of it, both in the
+ * kernel; userspace never sees them.
+ *
+ * The buffer is filled from the start: [head, done) has been processed
+ * and waits to be read, [done, tail) is less than a block that waits for
+ * the rest. It starts over once everything processed has been read.
+ */
+
+#define STREAM_PAGES (CRYPTODEV_STREAM_BUF / PAGE_SIZE)
+
+struct crypt_stream {
+	/* a reference */
+	struct csession *ses;
+	int encrypt;
+	/* no more writes, see CIOCSTREAM */
+	int ended;
+	/* the granularity the cipher runs at */
+	unsigned int unit;
+	size_t head, done, tail;
+	uint8_t iv[EALG_MAX_BLOCK_LEN];
+	struct scatterlist sg[STREAM_PAGES];
+	struct page *pages[STREAM_PAGES];
+};
+
+void crypto_stream_init(struct fcrypt *fcr)
+{
+	mutex_init(&fcr->stream_sem);
+	init_waitqueue_head(&fcr->stream_wait);
+	fcr->stream = NULL;
+}
+
+static void stream_free(struct crypt_stream *st)
+{
+	unsigned int i;
+
+	if (!st)
+		return;
+
+	for (i = 0; i < STREAM_PAGES; i++)
+		if (st->pages[i])
+			__free_page(st->pages[i]);
+	crypto_release_session(st->ses);
+	kzfree(st);
+}
+
+/* Run the cipher over [done, end) of the buffer */
+static int stream_run(struct crypt_stream *st, size_t end)
+{
+	struct csession *ses_ptr = st->ses;
+	struct scatterlist *sg = st->sg;
+	size_t pos = st->done, len = end - st->done;
+	unsigned int n = 0;
+	int ret;
+
+	if (len == 0)
+		return 0;
+
+	sg_init_table(sg, STREAM_PAGES);
+	while (pos < end) {
+		size_t off = offset_in_page(pos);
+		size_t bytes = min_t(size_t, PAGE_SIZE - off, end - pos);
+
+		sg_set_page(&sg[n++], st->pages[pos >> PAGE_SHIFT], bytes, off);
+		pos += bytes;
+	}
+	sg_mark_end(&sg[n - 1]);
+
+	mutex_lock(&ses_ptr->sem);
+	cryptodev_cipher_set_iv(&ses_ptr->cdata, st->iv, ses_ptr->cdata.ivsize);
+	if (st->encrypt)
+		ret = cryptodev_cipher_encrypt(&ses_ptr->cdata, sg, sg, len);
+	else
+		ret = cryptodev_cipher_decrypt(&ses_ptr->cdata, sg, sg, len);
+	cryptodev_cipher_get_iv(&ses_ptr->cdata, st->iv, ses_ptr->cdata.ivsize);
+	mutex_unlock(&ses_ptr->sem);
+	if (unlikely(ret)) {
+		derr(0, "CryptoAPI failure: %d", ret);
+		return ret;
+	}
+
+	cryptodev_stat_inc(ses_ptr->fcr, CRYPTODEV_STAT_OPS);
+	cryptodev_stat_add(ses_ptr->fcr, CRYPTODEV_STAT_BYTES, len);
+	st->done = end;
+	return 0;
+}
+
+/* Stop writes to the stream, and process what is left of it */
+static int stream_end(struct crypt_stream *st, uint8_t __user *iv)
+{
+	int ret;
+
+	if (st->tail != st->done && st->ses->cdata.stream == 0) {
+		ddebug(1, "a stream of a block cipher ends with a partial block");
+		return -EINVAL;
+	}
+
+	ret = stream_run(st, st->tail);
+	if (unlikely(ret))
+		return ret;
+	st->ended = 1;
+
+	if (iv && unlikely(copy_to_user(iv, st->iv, st->ses->cdata.ivsize)))
+		return -EFAULT;
+	return 0;
+}
+
+int crypto_stream_bind(struct fcrypt *fcr, struct crypt_stream_op *sop)
+{
+	struct crypt_stream *st;
+	struct csession *ses_ptr;
+	unsigned int i;
+	int ret;
+
+	if (unlikely(sop->flags ||
+		     (sop->ses && sop->op != COP_ENCRYPT &&
+		      sop->op != COP_DECRYPT)))
+		return -EINVAL;
+
+	if (sop->ses == 0) {
+		mutex_lock(&fcr->stream_sem);
+		if (fcr->stream && !fcr->stream->ended)
+			ret = stream_end(fcr->stream, sop->iv);
+		else
+			ret = -EINVAL;
+		mutex_unlock(&fcr->stream_sem);
+		/* the end of file can be read */
+		wake_up_interruptible(&fcr->stream_wait);
+		return ret;
+	}
+
+	ses_ptr = crypto_ref_session_by_sid(fcr, sop->ses);
+	if (unlikely(!ses_ptr)) {
+		derr(1, "invalid session ID=0x%08X", sop->ses);
+		return -EINVAL;
+	}
+
+	if (unlikely(ses_ptr->cdata.init == 0 || ses_ptr->cdata.aead ||
+		     ses_ptr->hdata.init != 0 || ses_ptr->iv_mode)) {
+		ddebug(1, "CIOCSTREAM needs a cipher-only session");
+		crypto_release_session(ses_ptr);
+		return -EINVAL;
+	}
+
+	st = kzalloc(sizeof(*st), GFP_KERNEL);
+	if (unlikely(!st)) {
+		crypto_release_session(ses_ptr);
+		return -ENOMEM;
+	}
+	st->ses = ses_ptr;
+	st->encrypt = sop->op == COP_ENCRYPT;
+
+	/* a counter mode only continues its key stream at a block */
+	st->unit = ses_ptr->cdata.stream ?
+			max(ses_ptr->cdata.ivsize, 1) : ses_ptr->cdata.blocksize;
+
+	if (sop->iv) {
+		if (unlikely(copy_from_user(st->iv, sop->iv,
+					    ses_ptr->cdata.ivsize))) {
+			ret = -EFAULT;
+			goto fail;
+		}
+	} else {
+		crypto_session_get_iv(ses_ptr, st->iv);
+	}
+
+	for (i = 0; i < STREAM_PAGES; i++) {
+		st->pages[i] = alloc_pages_node(ses_ptr->node, GFP_KERNEL, 0);
+		if (unlikely(!st->pages[i])) {
+			ret = -ENOMEM;
+			goto fail;
+		}
+	}
+
+	mutex_lock(&fcr->stream_sem);
+	swap(st, fcr->stream);
+	mutex_unlock(&fcr->stream_sem);
+	wake_up_interruptible(&fcr->stream_wait);
+
+	/* the stream that was bound before, if any */
+	stream_free(st);
+	return 0;
+
+fail:
+	stream_free(st);
+	return ret;
+}
+
+ssize_t crypto_stream_write(struct fcrypt *fcr, struct iov_iter *from)
+{
+	struct crypt_stream *st;
+	size_t copied = 0, pos, bytes;
+	ssize_t ret;
+
+	mutex_lock(&fcr->stream_sem);
+	st = fcr->stream;
+	if (unlikely(!st || st->ended)) {
+		ret = st ? -EPIPE : -EINVAL;
+		goto out;
+	}
+
+	/* start over once everything processed was read, keeping the
+	 * partial block. It does not cross a page, as done is a multiple
+	 * of the block size. */
+	if (st->head == st->done && st->head) {
+		size_t rest = st->tail - st->done;
+
+		if (rest)
+			memcpy(page_address(st->pages[0]),
+			       page_address(st->pages[st->done >> PAGE_SHIFT]) +
+			       offset_in_page(st->done), rest);
+		st->head = st->done = 0;
+		st->tail = rest;
+	}
+
+	if (st->tail == CRYPTODEV_STREAM_BUF) {
+		ret = -EAGAIN;
+		goto out;
+	}
+
+	while (iov_iter_count(from) && st->tail < CRYPTODEV_STREAM_BUF) {
+		pos = st->tail;
+		bytes = min_t(size_t, PAGE_SIZE - offset_in_page(pos),
+			      iov_iter_count(from));
+		bytes = copy_page_from_iter(st->pages[pos >> PAGE_SHIFT],
+					    offset_in_page(pos), bytes, from);
+		if (unlikely(bytes == 0))
+			break;
+		st->tail += bytes;
+		copied += bytes;
+	}
+
+	ret = stream_run(st, st->done +
+			 rounddown(st->tail - st->done, st->unit));
+	if (likely(!ret))
+		ret = (copied || !iov_iter_count(from)) ? copied : -EFAULT;
+out:
+	mutex_unlock(&fcr->stream_sem);
+	if (ret > 0)
+		wake_up_interruptible(&fcr->stream_wait);
+	return ret;
+}
+
+ssize_t crypto_stream_read(struct fcrypt *fcr, struct iov_iter *to)
+{
+	struct crypt_stream *st;
+	size_t copied = 0, pos, bytes;
+	ssize_t ret;
+
+	mutex_lock(&fcr->stream_sem);
+	/* nothing bound, or an ended stream that was all read, is at its
+	 * end of file; a stream still written to has nothing yet */
+	st = fcr->stream;
+	if (!st) {
+		ret = 0;
+		goto out;
+	}
+
+	while (iov_iter_count(to) && st->head < st->done) {
+		pos = st->head;
+		bytes = min_t(size_t, PAGE_SIZE - offset_in_page(pos),
+			      st->done - pos);
+		bytes = copy_page_to_iter(st->pages[pos >> PAGE_SHIFT],
+					  offset_in_page(pos), bytes, to);
+		if (unlikely(bytes == 0))
+			break;
+		st->head += bytes;
+		copied += bytes;
+	}
+
+	if (copied)
+		ret = copied;
+	else if (st->head != st->done)
+		ret = iov_iter_count(to) ? -EFAULT : 0;
+	else
+		ret = st->ended ? 0 : -EAGAIN;
+
+	if (st->head == st->done && st->tail == st->done) {
+		st->head = st->done = st->tail = 0;
+		/* an ended stream is gone once it has been read */
+		if (st->ended) {
+			fcr->stream = NULL;
+			stream_free(st);
+		}
+	}
+out:
+	mutex_unlock(&fcr->stream_sem);
+	if (ret > 0)
+		wake_up_interruptible(&fcr->stream_wait);
+	return ret;
+}
+
+/* The poll() events of the bound stream, -ENODEV if there is none */
+int crypto_stream_poll(struct fcrypt *fcr, struct file *file,
+		       poll_table *wait)
+{
+	struct crypt_stream *st;
+	int mask = 0;
+
+	poll_wait(file, &fcr->stream_wait, wait);
+
+	mutex_lock(&fcr->stream_sem);
+	st = fcr->stream;
+	if (!st) {
+		mutex_unlock(&fcr->stream_sem);
+		return -ENODEV;
+	}
+
+	/* an ended stream reads its end of file once it is drained */
+	if (st->head != st->done || st->ended)
+		mask |= POLLIN | POLLRDNORM;
+	/* as in crypto_stream_write(), which starts over once everything
+	 * processed was read */
+	if (!st->ended &&
+	    (st->tail < CRYPTODEV_STREAM_BUF || st->head == st->done))
+		mask |= POLLOUT | POLLWRNORM;
+	mutex_unlock(&fcr->stream_sem);
+
+	return mask;
+}
+
+void crypto_stream_exit(struct fcrypt *fcr)
+{
+	stream_free(fcr->stream);
+	fcr->stream = NULL;
+	mutex_destroy(&fcr->stream_sem);
+}
+
+#endif /* CRYPTODEV_HAVE_STREAM */
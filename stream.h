@@ -0,0 +1,44 @@
+#ifndef STREAM_H
+# define STREAM_H
+
+#include <linux/poll.h>
+#include <linux/uio.h>
+#include <linux/version.h>
+
+/* read() and write() through a session, see CIOCSTREAM and stream.c.
+ * They go through read_iter and write_iter, which the kernel has from
+ * 3.16 on; before that CIOCSTREAM fails with ENOTTY. */
+#if (LINUX_VERSION_CODE >= KERNEL_VERSION(3, 16, 0))
+# define CRYPTODEV_HAVE_STREAM
+
+void crypto_stream_init(struct fcrypt *fcr);
+int crypto_stream_bind(struct fcrypt *fcr, struct crypt_stream_op *sop);
+ssize_t crypto_stream_write(struct fcrypt *fcr, struct iov_iter *from);
+ssize_t crypto_stream_read(struct fcrypt *fcr, struct iov_iter *to);
+int crypto_stream_poll(struct fcrypt *fcr, struct file *file,
+		       poll_table *wait);
+void crypto_stream_exit(struct fcrypt *fcr);
+#else
+static inline void crypto_stream_init(struct fcrypt *fcr)
+{
+}
+
+static inline int crypto_stream_bind(struct fcrypt *fcr,
+				     struct crypt_stream_op *sop)
+{
+	return -ENOTTY;
+}
+
+/* no stream is ever bound */
+static inline int crypto_stream_poll(struct fcrypt *fcr, struct file *file,
+				     poll_table *wait)
+{
+	return -ENODEV;
+}
+
+static inline void crypto_stream_exit(struct fcrypt *fcr)
+{
+}
+#endif
+
+#endif
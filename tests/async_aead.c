@@ -0,0 +1,224 @@
+/*
+ * Demo on how to use /dev/crypto device for AEAD asynchronously.
+ *
+ * Placed under public domain.
+ *
+ */
+#include <poll.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <errno.h>
+
+#include <sys/ioctl.h>
+#include <crypto/cryptodev.h>
+
+#ifdef ENABLE_ASYNC
+
+static int debug = 0;
+
+#define	DATA_SIZE	4096
+#define	KEY_SIZE	16
+#define	IV_SIZE		12
+#define	TAG_SIZE	16
+#define	AUTH_SIZE	13
+#define	NOPS		8
+
+static uint8_t plaintext[NOPS][DATA_SIZE];
+static uint8_t ciphertext[NOPS][DATA_SIZE + TAG_SIZE];
+static uint8_t reference[NOPS][DATA_SIZE + TAG_SIZE];
+static uint8_t auth[AUTH_SIZE];
+
+static void fill_op(struct crypt_auth_op *cao, uint32_t ses, int op,
+		    uint8_t *iv, uint8_t *src, uint8_t *dst, int len)
+{
+	memset(cao, 0, sizeof(*cao));
+	cao->ses = ses;
+	cao->op = op;
+	cao->auth_src = auth;
+	cao->auth_len = AUTH_SIZE;
+	cao->len = len;
+	cao->src = src;
+	cao->dst = dst;
+	cao->iv = iv;
+	cao->iv_len = IV_SIZE;
+}
+
+/* waits for a completion and fetches it */
+static int fetch(int cfd, struct crypt_auth_op *cao)
+{
+	struct pollfd pfd;
+
+	pfd.fd = cfd;
+	pfd.events = POLLIN;
+	for (;;) {
+		if (poll(&pfd, 1, -1) < 1) {
+			perror("poll()");
+			return -1;
+		}
+		memset(cao, 0, sizeof(*cao));
+		if (ioctl(cfd, CIOCASYNCAUTHFETCH, cao) == 0)
+			return 0;
+		if (errno != EBUSY)
+			return errno;
+	}
+}
+
+static int
+test_async_aead(int cfd)
+{
+	struct crypt_auth_op cao;
+	struct session_op sess;
+	struct crypt_op cop;
+	uint8_t iv[NOPS][IV_SIZE], key[KEY_SIZE];
+	int i, ret;
+
+	memset(key, 0x33, sizeof(key));
+	memset(auth, 0xf1, sizeof(auth));
+
+	memset(&sess, 0, sizeof(sess));
+	sess.cipher = CRYPTO_AES_GCM;
+	sess.keylen = KEY_SIZE;
+	sess.key = key;
+	if (ioctl(cfd, CIOCGSESSION, &sess)) {
+		perror("ioctl(CIOCGSESSION)");
+		return 1;
+	}
+
+	/* the reference, with CIOCAUTHCRYPT */
+	for (i = 0; i < NOPS; i++) {
+		memset(plaintext[i], 0x15 + i, DATA_SIZE);
+		memset(iv[i], 0x03 + i, IV_SIZE);
+		fill_op(&cao, sess.ses, COP_ENCRYPT, iv[i], plaintext[i],
+			reference[i], DATA_SIZE);
+		if (ioctl(cfd, CIOCAUTHCRYPT, &cao)) {
+			perror("ioctl(CIOCAUTHCRYPT)");
+			return 1;
+		}
+	}
+
+	for (i = 0; i < NOPS; i++) {
+		fill_op(&cao, sess.ses, COP_ENCRYPT, iv[i], plaintext[i],
+			ciphertext[i], DATA_SIZE);
+		if (ioctl(cfd, CIOCASYNCAUTHCRYPT, &cao)) {
+			perror("ioctl(CIOCASYNCAUTHCRYPT)");
+			return 1;
+		}
+	}
+
+	/* the jobs are not for CIOCASYNCFETCH */
+	memset(&cop, 0, sizeof(cop));
+	if (ioctl(cfd, CIOCASYNCFETCH, &cop) == 0 ||
+	    (errno != EINVAL && errno != EBUSY)) {
+		fprintf(stderr, "FAIL: CIOCASYNCFETCH took an AEAD job.\n");
+		return 1;
+	}
+
+	/* they complete in order */
+	for (i = 0; i < NOPS; i++) {
+		ret = fetch(cfd, &cao);
+		if (ret) {
+			fprintf(stderr, "FAIL: job %d returned %d.\n", i, ret);
+			return 1;
+		}
+		if (cao.dst != ciphertext[i] || cao.len != DATA_SIZE + TAG_SIZE ||
+		    memcmp(ciphertext[i], reference[i], DATA_SIZE + TAG_SIZE)) {
+			fprintf(stderr, "FAIL: job %d differs from CIOCAUTHCRYPT.\n", i);
+			return 1;
+		}
+	}
+
+	/* decryption, with one record tampered with */
+	ciphertext[NOPS / 2][7] ^= 1;
+	for (i = 0; i < NOPS; i++) {
+		fill_op(&cao, sess.ses, COP_DECRYPT, iv[i], ciphertext[i],
+			ciphertext[i], DATA_SIZE + TAG_SIZE);
+		if (ioctl(cfd, CIOCASYNCAUTHCRYPT, &cao)) {
+			perror("ioctl(CIOCASYNCAUTHCRYPT)");
+			return 1;
+		}
+	}
+
+	for (i = 0; i < NOPS; i++) {
+		ret = fetch(cfd, &cao);
+		if (i == NOPS / 2) {
+			if (ret != EBADMSG) {
+				fprintf(stderr, "FAIL: the tampered job returned %d.\n",
+					ret);
+				return 1;
+			}
+			continue;
+		}
+		if (ret || cao.len != DATA_SIZE ||
+		    memcmp(ciphertext[i], plaintext[i], DATA_SIZE)) {
+			fprintf(stderr, "FAIL: job %d was not decrypted (%d).\n",
+				i, ret);
+			return 1;
+		}
+	}
+
+	if (debug)
+		printf("Test passed\n");
+
+	/* Finish crypto session */
+	if (ioctl(cfd, CIOCFSESSION, &sess.ses)) {
+		perror("ioctl(CIOCFSESSION)");
+		return 1;
+	}
+
+	return 0;
+}
+
+int
+main(int argc, char** argv)
+{
+	int fd = -1, cfd = -1;
+
+	if (argc > 1) debug = 1;
+
+	/* Open the crypto device */
+	fd = open("/dev/crypto", O_RDWR, 0);
+	if (fd < 0) {
+		perror("open(/dev/crypto)");
+		return 1;
+	}
+
+	/* Clone file descriptor */
+	if (ioctl(fd, CRIOGET, &cfd)) {
+		perror("ioctl(CRIOGET)");
+		return 1;
+	}
+
+	/* Set close-on-exec (not really neede here) */
+	if (fcntl(cfd, F_SETFD, 1) == -1) {
+		perror("fcntl(F_SETFD)");
+		return 1;
+	}
+
+	/* Run the test itself */
+	if (test_async_aead(cfd))
+		return 1;
+
+	/* Close cloned descriptor */
+	if (close(cfd)) {
+		perror("close(cfd)");
+		return 1;
+	}
+
+	/* Close the original descriptor */
+	if (close(fd)) {
+		perror("close(fd)");
+		return 1;
+	}
+
+	return 0;
+}
+#else
+int
+main(int argc, char** argv)
+{
+	return (0);
+}
+#endif
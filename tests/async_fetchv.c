@@ -0,0 +1,235 @@
+/*
+ * Demo on how to use /dev/crypto device for ciphering asynchronously,
+ * woken up by an eventfd and fetching all the completed jobs at once.
+ *
+ * Placed under public domain.
+ *
+ */
+#include <poll.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <stdint.h>
+
+#include <sys/eventfd.h>
+#include <sys/ioctl.h>
+#include <crypto/cryptodev.h>
+
+#ifdef ENABLE_ASYNC
+
+static int debug = 0;
+
+#define	DATA_SIZE	4096
+#define	BLOCK_SIZE	16
+#define	KEY_SIZE	16
+#define	NOPS		16
+
+static int
+test_crypto_fetchv(int cfd)
+{
+	static char plaintext[NOPS][DATA_SIZE], ciphertext[NOPS][DATA_SIZE];
+	char iv[NOPS][BLOCK_SIZE];
+	char key[KEY_SIZE];
+	struct crypt_async_done done[NOPS];
+	struct crypt_fetch_op fop;
+	struct session_op sess;
+	struct pollfd pfd;
+	uint64_t events, completed = 0;
+	int32_t efd;
+	int i, fetched = 0;
+
+	memset(&sess, 0, sizeof(sess));
+	memset(key, 0x33,  sizeof(key));
+
+	/* Get crypto session for AES128 */
+	sess.cipher = CRYPTO_AES_CBC;
+	sess.keylen = KEY_SIZE;
+	sess.key = key;
+	if (ioctl(cfd, CIOCGSESSION, &sess)) {
+		perror("ioctl(CIOCGSESSION)");
+		return 1;
+	}
+
+	efd = eventfd(0, EFD_NONBLOCK);
+	if (efd < 0) {
+		perror("eventfd()");
+		return 1;
+	}
+	if (ioctl(cfd, CIOCASYNCEVENTFD, &efd)) {
+		perror("ioctl(CIOCASYNCEVENTFD)");
+		return 1;
+	}
+
+	/* Room for all the jobs at once */
+	i = NOPS;
+	if (ioctl(cfd, CIOCASYNCRINGSIZE, &i)) {
+		perror("ioctl(CIOCASYNCRINGSIZE)");
+		return 1;
+	}
+
+	for (i = 0; i < NOPS; i++) {
+		struct crypt_op cryp;
+
+		memset(plaintext[i], 0x15 + i, DATA_SIZE);
+		memset(iv[i], 0x03 + i, BLOCK_SIZE);
+
+		memset(&cryp, 0, sizeof(cryp));
+		cryp.ses = sess.ses;
+		cryp.len = DATA_SIZE;
+		cryp.src = plaintext[i];
+		cryp.dst = ciphertext[i];
+		cryp.iv = iv[i];
+		cryp.op = COP_ENCRYPT;
+		if (ioctl(cfd, CIOCASYNCCRYPT, &cryp)) {
+			perror("ioctl(CIOCASYNCCRYPT)");
+			return 1;
+		}
+	}
+
+	/* The eventfd counts the completions */
+	pfd.fd = efd;
+	pfd.events = POLLIN;
+	while (completed < NOPS) {
+		if (poll(&pfd, 1, -1) < 1) {
+			perror("poll()");
+			return 1;
+		}
+		if (read(efd, &events, sizeof(events)) != sizeof(events)) {
+			perror("read(eventfd)");
+			return 1;
+		}
+		completed += events;
+	}
+	if (completed != NOPS) {
+		fprintf(stderr, "FAIL: %llu completions of %d jobs.\n",
+				(unsigned long long)completed, NOPS);
+		return 1;
+	}
+
+	/* ... and they are all fetched in one go */
+	memset(&fop, 0, sizeof(fop));
+	fop.count = NOPS;
+	fop.done = done;
+	if (ioctl(cfd, CIOCASYNCFETCHV, &fop)) {
+		perror("ioctl(CIOCASYNCFETCHV)");
+		return 1;
+	}
+	fetched = fop.count;
+	if (debug)
+		printf("fetched %d jobs\n", fetched);
+
+	if (fetched != NOPS) {
+		fprintf(stderr, "FAIL: fetched %d jobs of %d.\n", fetched, NOPS);
+		return 1;
+	}
+
+	/* Decrypt each buffer separately and verify the result */
+	for (i = 0; i < NOPS; i++) {
+		struct crypt_op dcryp;
+		char *buf = (char *)done[i].cop.dst;
+		int n = (char (*)[DATA_SIZE])buf - ciphertext;
+
+		if (done[i].result != 0 || n < 0 || n >= NOPS) {
+			fprintf(stderr, "FAIL: job %d returned %d.\n", i,
+					done[i].result);
+			return 1;
+		}
+
+		memset(iv[n], 0x03 + n, BLOCK_SIZE);
+		memset(&dcryp, 0, sizeof(dcryp));
+		dcryp.ses = sess.ses;
+		dcryp.len = DATA_SIZE;
+		dcryp.src = buf;
+		dcryp.dst = buf;
+		dcryp.iv = iv[n];
+		dcryp.op = COP_DECRYPT;
+		if (ioctl(cfd, CIOCCRYPT, &dcryp)) {
+			perror("ioctl(CIOCCRYPT)");
+			return 1;
+		}
+
+		if (memcmp(plaintext[n], buf, DATA_SIZE) != 0) {
+			fprintf(stderr,
+				"FAIL: Decrypted data of job %d are different from the input data.\n", n);
+			return 1;
+		}
+	}
+
+	/* Nothing is left */
+	fop.count = NOPS;
+	if (ioctl(cfd, CIOCASYNCFETCHV, &fop) == 0) {
+		fprintf(stderr, "FAIL: fetched jobs that were not submitted.\n");
+		return 1;
+	}
+
+	if (debug)
+		printf("Test passed\n");
+
+	efd = -1;
+	if (ioctl(cfd, CIOCASYNCEVENTFD, &efd)) {
+		perror("ioctl(CIOCASYNCEVENTFD)");
+		return 1;
+	}
+	close(pfd.fd);
+
+	/* Finish crypto session */
+	if (ioctl(cfd, CIOCFSESSION, &sess.ses)) {
+		perror("ioctl(CIOCFSESSION)");
+		return 1;
+	}
+
+	return 0;
+}
+
+int
+main(int argc, char** argv)
+{
+	int fd = -1, cfd = -1;
+
+	if (argc > 1) debug = 1;
+
+	/* Open the crypto device */
+	fd = open("/dev/crypto", O_RDWR, 0);
+	if (fd < 0) {
+		perror("open(/dev/crypto)");
+		return 1;
+	}
+
+	/* Clone file descriptor */
+	if (ioctl(fd, CRIOGET, &cfd)) {
+		perror("ioctl(CRIOGET)");
+		return 1;
+	}
+
+	/* Set close-on-exec (not really neede here) */
+	if (fcntl(cfd, F_SETFD, 1) == -1) {
+		perror("fcntl(F_SETFD)");
+		return 1;
+	}
+
+	/* Run the test itself */
+	if (test_crypto_fetchv(cfd))
+		return 1;
+
+	/* Close cloned descriptor */
+	if (close(cfd)) {
+		perror("close(cfd)");
+		return 1;
+	}
+
+	/* Close the original descriptor */
+	if (close(fd)) {
+		perror("close(fd)");
+		return 1;
+	}
+
+	return 0;
+}
+#else
+int
+main(int argc, char** argv)
+{
+	return (0);
+}
+#endif
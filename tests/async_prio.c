@@ -0,0 +1,236 @@
+/*
+ * Demo on how to use /dev/crypto device for small asynchronous jobs of
+ * an SOP_FLAG_INTERACTIVE session queued behind bulk ones.
+ *
+ * Placed under public domain.
+ *
+ */
+#include <poll.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <errno.h>
+
+#include <sys/ioctl.h>
+#include <crypto/cryptodev.h>
+
+#ifdef ENABLE_ASYNC
+
+static int debug = 0;
+
+#define	BULK_SIZE	(64 * 1024)
+#define	SMALL_SIZE	64
+#define	BLOCK_SIZE	16
+#define	KEY_SIZE	16
+#define	NBULK		15
+
+static char bulk_in[NBULK][BULK_SIZE], bulk_out[NBULK][BULK_SIZE];
+static char small_in[SMALL_SIZE], small_out[SMALL_SIZE];
+
+static int get_session(int cfd, uint32_t flags, uint32_t *ses)
+{
+	struct session2_op sess;
+	char key[KEY_SIZE];
+
+	memset(key, 0x33, sizeof(key));
+	memset(&sess, 0, sizeof(sess));
+	sess.sop.cipher = CRYPTO_AES_CBC;
+	sess.sop.keylen = KEY_SIZE;
+	sess.sop.key = (uint8_t *)key;
+	sess.flags = flags;
+	if (ioctl(cfd, CIOCGSESSION2, &sess)) {
+		perror("ioctl(CIOCGSESSION2)");
+		return 1;
+	}
+	*ses = sess.sop.ses;
+	return 0;
+}
+
+static int submit(int cfd, uint32_t ses, char *src, char *dst, int len)
+{
+	struct crypt_op cryp;
+	char iv[BLOCK_SIZE];
+
+	memset(iv, 0x03, sizeof(iv));
+	memset(&cryp, 0, sizeof(cryp));
+	cryp.ses = ses;
+	cryp.len = len;
+	cryp.src = src;
+	cryp.dst = dst;
+	cryp.iv = iv;
+	cryp.op = COP_ENCRYPT;
+	if (ioctl(cfd, CIOCASYNCCRYPT, &cryp)) {
+		perror("ioctl(CIOCASYNCCRYPT)");
+		return 1;
+	}
+	return 0;
+}
+
+/* decrypts dst with ses and compares it with src */
+static int check(int cfd, uint32_t ses, char *src, char *dst, int len)
+{
+	struct crypt_op cryp;
+	char iv[BLOCK_SIZE];
+
+	memset(iv, 0x03, sizeof(iv));
+	memset(&cryp, 0, sizeof(cryp));
+	cryp.ses = ses;
+	cryp.len = len;
+	cryp.src = dst;
+	cryp.dst = dst;
+	cryp.iv = iv;
+	cryp.op = COP_DECRYPT;
+	if (ioctl(cfd, CIOCCRYPT, &cryp)) {
+		perror("ioctl(CIOCCRYPT)");
+		return 1;
+	}
+	return memcmp(src, dst, len) != 0;
+}
+
+static int
+test_crypto_prio(int cfd)
+{
+	struct crypt_op cryp;
+	struct pollfd pfd;
+	uint32_t bulk, interactive;
+	int i, fetched = 0, next_bulk = 0, small_at = -1;
+
+	if (get_session(cfd, 0, &bulk) ||
+	    get_session(cfd, SOP_FLAG_INTERACTIVE, &interactive))
+		return 1;
+
+	/* Room for all the jobs at once */
+	i = NBULK + 1;
+	if (ioctl(cfd, CIOCASYNCRINGSIZE, &i)) {
+		perror("ioctl(CIOCASYNCRINGSIZE)");
+		return 1;
+	}
+
+	for (i = 0; i < NBULK; i++) {
+		memset(bulk_in[i], 0x15 + i, BULK_SIZE);
+		if (submit(cfd, bulk, bulk_in[i], bulk_out[i], BULK_SIZE))
+			return 1;
+	}
+	memset(small_in, 0x42, SMALL_SIZE);
+	if (submit(cfd, interactive, small_in, small_out, SMALL_SIZE))
+		return 1;
+
+	pfd.fd = cfd;
+	pfd.events = POLLIN;
+	while (fetched < NBULK + 1) {
+		if (poll(&pfd, 1, -1) < 1) {
+			perror("poll()");
+			return 1;
+		}
+
+		memset(&cryp, 0, sizeof(cryp));
+		if (ioctl(cfd, CIOCASYNCFETCH, &cryp)) {
+			if (errno == EBUSY)
+				continue;
+			perror("ioctl(CIOCASYNCFETCH)");
+			return 1;
+		}
+
+		if ((char *)cryp.dst == small_out) {
+			small_at = fetched++;
+			continue;
+		}
+
+		/* the bulk jobs still come back in the order they were
+		 * queued */
+		if ((char *)cryp.dst != bulk_out[next_bulk]) {
+			fprintf(stderr, "FAIL: bulk job %d fetched out of order.\n",
+					next_bulk);
+			return 1;
+		}
+		next_bulk++;
+		fetched++;
+	}
+
+	if (debug)
+		printf("the interactive job was fetched %d of %d\n",
+				small_at + 1, NBULK + 1);
+
+	if (check(cfd, interactive, small_in, small_out, SMALL_SIZE)) {
+		fprintf(stderr, "FAIL: the interactive job is wrong.\n");
+		return 1;
+	}
+	for (i = 0; i < NBULK; i++) {
+		if (check(cfd, bulk, bulk_in[i], bulk_out[i], BULK_SIZE)) {
+			fprintf(stderr, "FAIL: bulk job %d is wrong.\n", i);
+			return 1;
+		}
+	}
+
+	/* Nothing is left */
+	if (ioctl(cfd, CIOCASYNCFETCH, &cryp) == 0) {
+		fprintf(stderr, "FAIL: fetched a job that was not submitted.\n");
+		return 1;
+	}
+
+	if (debug)
+		printf("Test passed\n");
+
+	/* Finish crypto sessions */
+	if (ioctl(cfd, CIOCFSESSION, &bulk) ||
+	    ioctl(cfd, CIOCFSESSION, &interactive)) {
+		perror("ioctl(CIOCFSESSION)");
+		return 1;
+	}
+
+	return 0;
+}
+
+int
+main(int argc, char** argv)
+{
+	int fd = -1, cfd = -1;
+
+	if (argc > 1) debug = 1;
+
+	/* Open the crypto device */
+	fd = open("/dev/crypto", O_RDWR, 0);
+	if (fd < 0) {
+		perror("open(/dev/crypto)");
+		return 1;
+	}
+
+	/* Clone file descriptor */
+	if (ioctl(fd, CRIOGET, &cfd)) {
+		perror("ioctl(CRIOGET)");
+		return 1;
+	}
+
+	/* Set close-on-exec (not really neede here) */
+	if (fcntl(cfd, F_SETFD, 1) == -1) {
+		perror("fcntl(F_SETFD)");
+		return 1;
+	}
+
+	/* Run the test itself */
+	if (test_crypto_prio(cfd))
+		return 1;
+
+	/* Close cloned descriptor */
+	if (close(cfd)) {
+		perror("close(cfd)");
+		return 1;
+	}
+
+	/* Close the original descriptor */
+	if (close(fd)) {
+		perror("close(fd)");
+		return 1;
+	}
+
+	return 0;
+}
+#else
+int
+main(int argc, char** argv)
+{
+	return (0);
+}
+#endif
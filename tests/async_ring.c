@@ -0,0 +1,229 @@
+/*
+ * Demo on how to use the shared rings of /dev/crypto for ciphering.
+ *
+ * Placed under public domain.
+ *
+ */
+#include <poll.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <crypto/cryptodev.h>
+
+#ifdef ENABLE_ASYNC
+
+static int debug = 0;
+
+#define	DATA_SIZE	4096
+#define	BLOCK_SIZE	16
+#define	KEY_SIZE	16
+#define	NOPS		8
+
+static int
+test_crypto_ring(int cfd)
+{
+	char plaintext_raw[NOPS][DATA_SIZE + 63], *plaintext[NOPS];
+	char ciphertext_raw[NOPS][DATA_SIZE + 63], *ciphertext[NOPS];
+	char iv[NOPS][BLOCK_SIZE];
+	char key[KEY_SIZE];
+	unsigned int alignmask = 0;
+	unsigned int head, done = 0;
+	int i;
+
+	struct session_op sess;
+#ifdef CIOCGSESSINFO
+	struct session_info_op siop;
+#endif
+	struct crypt_ring_params params;
+	struct crypt_ring *ring;
+	struct crypt_ring_sqe *sqes;
+	struct crypt_ring_cqe *cqes;
+	struct pollfd pfd;
+	char *area;
+
+	memset(&sess, 0, sizeof(sess));
+	memset(key, 0x33,  sizeof(key));
+
+	/* Get crypto session for AES128 */
+	sess.cipher = CRYPTO_AES_CBC;
+	sess.keylen = KEY_SIZE;
+	sess.key = key;
+	if (ioctl(cfd, CIOCGSESSION, &sess)) {
+		perror("ioctl(CIOCGSESSION)");
+		return 1;
+	}
+
+#ifdef CIOCGSESSINFO
+	siop.ses = sess.ses;
+	if (ioctl(cfd, CIOCGSESSINFO, &siop)) {
+		perror("ioctl(CIOCGSESSINFO)");
+		return 1;
+	}
+	alignmask = siop.alignmask;
+#endif
+
+	/* Set up and map the rings */
+	memset(&params, 0, sizeof(params));
+	params.entries = NOPS;
+	if (ioctl(cfd, CIOCRINGSETUP, &params)) {
+		perror("ioctl(CIOCRINGSETUP)");
+		return 1;
+	}
+	if (debug)
+		printf("got %u ring entries, mapping %u bytes\n",
+				params.entries, params.size);
+
+	area = mmap(NULL, params.size, PROT_READ | PROT_WRITE, MAP_SHARED, cfd, 0);
+	if (area == MAP_FAILED) {
+		perror("mmap()");
+		return 1;
+	}
+	ring = (struct crypt_ring *)area;
+	sqes = (struct crypt_ring_sqe *)(area + params.sq_off);
+	cqes = (struct crypt_ring_cqe *)(area + params.cq_off);
+
+	/* Queue all the operations without a system call */
+	for (i = 0; i < NOPS; i++) {
+		struct crypt_ring_sqe *sqe = &sqes[(ring->sq_tail + i) & ring->mask];
+
+		plaintext[i] = (char *)(((unsigned long)plaintext_raw[i] + alignmask) & ~alignmask);
+		ciphertext[i] = (char *)(((unsigned long)ciphertext_raw[i] + alignmask) & ~alignmask);
+		memset(plaintext[i], 0x15 + i, DATA_SIZE);
+		memset(iv[i], 0x03 + i, BLOCK_SIZE);
+
+		memset(sqe, 0, sizeof(*sqe));
+		sqe->cop.ses = sess.ses;
+		sqe->cop.len = DATA_SIZE;
+		sqe->cop.src = plaintext[i];
+		sqe->cop.dst = ciphertext[i];
+		sqe->cop.iv = iv[i];
+		sqe->cop.op = COP_ENCRYPT;
+		sqe->user_data = i;
+	}
+	__atomic_store_n(&ring->sq_tail, ring->sq_tail + NOPS, __ATOMIC_RELEASE);
+
+	/* ... and let the kernel run them */
+	if (ioctl(cfd, CIOCRINGENTER)) {
+		perror("ioctl(CIOCRINGENTER)");
+		return 1;
+	}
+
+	pfd.fd = cfd;
+	pfd.events = POLLIN;
+	while (done < NOPS) {
+		if (poll(&pfd, 1, -1) < 1) {
+			perror("poll()");
+			return 1;
+		}
+
+		head = ring->cq_head;
+		while (head != __atomic_load_n(&ring->cq_tail, __ATOMIC_ACQUIRE)) {
+			struct crypt_ring_cqe *cqe = &cqes[head & ring->mask];
+
+			if (cqe->result != 0 || cqe->user_data >= NOPS) {
+				fprintf(stderr, "FAIL: completion %llu returned %d.\n",
+					(unsigned long long)cqe->user_data, cqe->result);
+				return 1;
+			}
+			head++;
+			done++;
+		}
+		__atomic_store_n(&ring->cq_head, head, __ATOMIC_RELEASE);
+	}
+
+	/* Decrypt each buffer separately and verify the result */
+	for (i = 0; i < NOPS; i++) {
+		struct crypt_op dcryp;
+
+		memset(iv[i], 0x03 + i, BLOCK_SIZE);
+		memset(&dcryp, 0, sizeof(dcryp));
+		dcryp.ses = sess.ses;
+		dcryp.len = DATA_SIZE;
+		dcryp.src = ciphertext[i];
+		dcryp.dst = ciphertext[i];
+		dcryp.iv = iv[i];
+		dcryp.op = COP_DECRYPT;
+		if (ioctl(cfd, CIOCCRYPT, &dcryp)) {
+			perror("ioctl(CIOCCRYPT)");
+			return 1;
+		}
+
+		if (memcmp(plaintext[i], ciphertext[i], DATA_SIZE) != 0) {
+			fprintf(stderr,
+				"FAIL: Decrypted data of operation %d are different from the input data.\n", i);
+			return 1;
+		}
+	}
+
+	if (debug)
+		printf("Test passed\n");
+
+	if (munmap(area, params.size)) {
+		perror("munmap()");
+		return 1;
+	}
+
+	/* Finish crypto session */
+	if (ioctl(cfd, CIOCFSESSION, &sess.ses)) {
+		perror("ioctl(CIOCFSESSION)");
+		return 1;
+	}
+
+	return 0;
+}
+
+int
+main(int argc, char** argv)
+{
+	int fd = -1, cfd = -1;
+
+	if (argc > 1) debug = 1;
+
+	/* Open the crypto device */
+	fd = open("/dev/crypto", O_RDWR, 0);
+	if (fd < 0) {
+		perror("open(/dev/crypto)");
+		return 1;
+	}
+
+	/* Clone file descriptor */
+	if (ioctl(fd, CRIOGET, &cfd)) {
+		perror("ioctl(CRIOGET)");
+		return 1;
+	}
+
+	/* Set close-on-exec (not really neede here) */
+	if (fcntl(cfd, F_SETFD, 1) == -1) {
+		perror("fcntl(F_SETFD)");
+		return 1;
+	}
+
+	/* Run the test itself */
+	if (test_crypto_ring(cfd))
+		return 1;
+
+	/* Close cloned descriptor */
+	if (close(cfd)) {
+		perror("close(cfd)");
+		return 1;
+	}
+
+	/* Close the original descriptor */
+	if (close(fd)) {
+		perror("close(fd)");
+		return 1;
+	}
+
+	return 0;
+}
+#else
+int
+main(int argc, char** argv)
+{
+	return (0);
+}
+#endif
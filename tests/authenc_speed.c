@@ -0,0 +1,293 @@
+/*  authenc_speed - benchmark of the CIOCAUTHCRYPT paths of cryptodev
+ *
+ *  Measures the three authenc paths with the record sizes and the
+ *  AAD lengths they see in practice: AES-GCM with the 13 bytes of AAD of
+ *  TLS 1.2, TLS-mode AES-CBC with HMAC-SHA1 (tls_auth_n_crypt(), or the
+ *  tls10 AEAD where the kernel has one) and SRTP, AES-CTR with
+ *  HMAC-SHA1-80 over a 12 byte RTP header (srtp_auth_n_crypt()).
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/time.h>
+#include <sys/types.h>
+#include <signal.h>
+
+#include <crypto/cryptodev.h>
+
+static int si = 1; /* SI by default */
+static int secs_per_size = 5;
+
+/* the TLS 1.2 pseudo-header: sequence number, type, version, length */
+#define TLS_AAD_SIZE	13
+#define RTP_HEADER_SIZE	12
+/* HMAC-SHA1-80, the default of SRTP */
+#define SRTP_TAG_SIZE	10
+/* room after the payload for the MAC and the padding of TLS records */
+#define TRAILER_ROOM	64
+
+enum mode { MODE_GCM, MODE_TLS, MODE_SRTP };
+
+static const struct bench {
+	const char *name;
+	enum mode mode;
+	int cipher, mac, keylen, mackeylen;
+	/* 0 terminated */
+	int sizes[8];
+} benches[] = {
+	/* TLS records: small handshake-sized ones, a typical MTU sized
+	 * one and the maximum of 16 KiB */
+	{ "gcm", MODE_GCM, CRYPTO_AES_GCM, 0, 16, 0,
+	  { 64, 256, 1024, 1400, 4096, 16384, 0 } },
+	{ "tls", MODE_TLS, CRYPTO_AES_CBC, CRYPTO_SHA1_HMAC, 16, 20,
+	  { 64, 256, 1024, 1400, 4096, 16384, 0 } },
+	/* RTP payloads: 20ms of G.711 and G.722, then video packets */
+	{ "srtp", MODE_SRTP, CRYPTO_AES_CTR, CRYPTO_SHA1_HMAC, 16, 20,
+	  { 160, 320, 1000, 1200, 0 } },
+	{ NULL }
+};
+
+static double udifftimeval(struct timeval start, struct timeval end)
+{
+	return (double)(end.tv_usec - start.tv_usec) +
+	       (double)(end.tv_sec - start.tv_sec) * 1000 * 1000;
+}
+
+static int must_finish = 0;
+
+static void alarm_handler(int signo)
+{
+        must_finish = 1;
+}
+
+static char *units[] = { "", "Ki", "Mi", "Gi", "Ti", 0};
+static char *si_units[] = { "", "K", "M", "G", "T", 0};
+
+static void value2human(int si, double bytes, double time, double* data, double* speed,char* metric)
+{
+	int unit = 0;
+
+	*data = bytes;
+
+	if (si) {
+		while (*data > 1000 && si_units[unit + 1]) {
+			*data /= 1000;
+			unit++;
+		}
+		*speed = *data / time;
+		sprintf(metric, "%sB", si_units[unit]);
+	} else {
+		while (*data > 1024 && units[unit + 1]) {
+			*data /= 1024;
+			unit++;
+		}
+		*speed = *data / time;
+		sprintf(metric, "%sB", units[unit]);
+	}
+}
+
+#define MAX(x,y) ((x)>(y)?(x):(y))
+
+/* Encrypts one record of len bytes of payload. The record is laid out
+ * as the protocol has it in buffer: the AAD of GCM and TLS sits in a
+ * buffer of its own, the RTP header of SRTP precedes the payload.
+ */
+static int encrypt_record(const struct bench *b, int fdc, uint32_t ses,
+	char *buffer, int len)
+{
+	static char iv[16], aad[TLS_AAD_SIZE], tag[SRTP_TAG_SIZE];
+	struct crypt_auth_op cao;
+
+	memset(&cao, 0, sizeof(cao));
+	cao.ses = ses;
+	cao.op = COP_ENCRYPT;
+	cao.iv = (unsigned char *)iv;
+	cao.len = len;
+
+	switch (b->mode) {
+	case MODE_GCM:
+		cao.iv_len = 12;
+		cao.auth_src = (unsigned char *)aad;
+		cao.auth_len = TLS_AAD_SIZE;
+		cao.src = cao.dst = (unsigned char *)buffer;
+		break;
+	case MODE_TLS:
+		cao.flags = COP_FLAG_AEAD_TLS_TYPE;
+		cao.iv_len = 16;
+		cao.auth_src = (unsigned char *)aad;
+		cao.auth_len = TLS_AAD_SIZE;
+		cao.src = cao.dst = (unsigned char *)buffer;
+		break;
+	case MODE_SRTP:
+		cao.flags = COP_FLAG_AEAD_SRTP_TYPE;
+		cao.iv_len = 16;
+		cao.auth_src = (unsigned char *)buffer;
+		cao.auth_len = RTP_HEADER_SIZE + len;
+		cao.src = cao.dst = (unsigned char *)buffer + RTP_HEADER_SIZE;
+		cao.tag = (unsigned char *)tag;
+		cao.tag_len = SRTP_TAG_SIZE;
+		break;
+	}
+
+	if (ioctl(fdc, CIOCAUTHCRYPT, &cao)) {
+		perror("ioctl(CIOCAUTHCRYPT)");
+		return 1;
+	}
+	return 0;
+}
+
+static int encrypt_data(const struct bench *b, int fdc, uint32_t ses,
+	int chunksize, int alignmask)
+{
+	char *buffer;
+	static int val = 23;
+	struct timeval start, end;
+	double total = 0, ops = 0;
+	double secs, ddata, dspeed;
+	char metric[16];
+	int size = RTP_HEADER_SIZE + chunksize + TRAILER_ROOM;
+
+	if (posix_memalign((void **)&buffer, MAX(alignmask + 1, sizeof(void*)), size)) {
+		printf("posix_memalign() failed! (mask %x, size: %d)\n", alignmask+1, size);
+		return 1;
+	}
+
+	printf("\tEncrypting records of %d bytes: ", chunksize);
+	fflush(stdout);
+
+	memset(buffer, val++, size);
+
+	must_finish = 0;
+	alarm(secs_per_size);
+
+	gettimeofday(&start, NULL);
+	do {
+		if (encrypt_record(b, fdc, ses, buffer, chunksize)) {
+			free(buffer);
+			return 1;
+		}
+		total += chunksize;
+		ops++;
+	} while(must_finish==0);
+	gettimeofday(&end, NULL);
+
+	secs = udifftimeval(start, end)/ 1000000.0;
+
+	value2human(si, total, secs, &ddata, &dspeed, metric);
+	printf ("done. %.2f %s in %.2f secs: ", ddata, metric, secs);
+	printf ("%.2f %s/sec, %.0f records/sec\n", dspeed, metric, ops / secs);
+
+	free(buffer);
+	return 0;
+}
+
+static int run_bench(const struct bench *b, int fdc)
+{
+	struct session_op sess;
+	struct session_info_op siop;
+	char keybuf[32], mackeybuf[32];
+	int i, ret = 0;
+
+	memset(keybuf, 0x42, sizeof(keybuf));
+	memset(mackeybuf, 0x24, sizeof(mackeybuf));
+
+	memset(&sess, 0, sizeof(sess));
+	sess.cipher = b->cipher;
+	sess.keylen = b->keylen;
+	sess.key = (unsigned char *)keybuf;
+	sess.mac = b->mac;
+	sess.mackeylen = b->mackeylen;
+	sess.mackey = (unsigned char *)mackeybuf;
+	if (ioctl(fdc, CIOCGSESSION, &sess)) {
+		perror("ioctl(CIOCGSESSION)");
+		return 1;
+	}
+
+	siop.ses = sess.ses;
+	if (ioctl(fdc, CIOCGSESSINFO, &siop)) {
+		perror("ioctl(CIOCGSESSINFO)");
+		return 1;
+	}
+
+	if (b->mac)
+		fprintf(stderr, "\nTesting %s (%s, %s): \n", b->name,
+			siop.cipher_info.cra_driver_name,
+			siop.hash_info.cra_driver_name);
+	else
+		fprintf(stderr, "\nTesting %s (%s): \n", b->name,
+			siop.cipher_info.cra_driver_name);
+
+	for (i = 0; b->sizes[i]; i++) {
+		ret = encrypt_data(b, fdc, sess.ses, b->sizes[i], siop.alignmask);
+		if (ret)
+			break;
+	}
+
+	if (ioctl(fdc, CIOCFSESSION, &sess.ses)) {
+		perror("ioctl(CIOCFSESSION)");
+		return 1;
+	}
+	return ret;
+}
+
+int main(int argc, char** argv)
+{
+	int fd, i, fdc = -1;
+	const char *only = NULL;
+
+	signal(SIGALRM, alarm_handler);
+
+	for (i = 1; i < argc; i++) {
+		if (strcmp(argv[i], "--help") == 0 || strcmp(argv[i], "-h") == 0) {
+			printf("Usage: authenc_speed [--kib] [--secs N] [gcm|tls|srtp]\n");
+			exit(0);
+		}
+		if (strcmp(argv[i], "--kib") == 0) {
+			si = 0;
+		} else if (strcmp(argv[i], "--secs") == 0 && i + 1 < argc) {
+			secs_per_size = atoi(argv[++i]);
+			if (secs_per_size < 1)
+				secs_per_size = 1;
+		} else {
+			only = argv[i];
+		}
+	}
+
+	if ((fd = open("/dev/crypto", O_RDWR, 0)) < 0) {
+		perror("open()");
+		return 1;
+	}
+	if (ioctl(fd, CRIOGET, &fdc)) {
+		perror("ioctl(CRIOGET)");
+		return 1;
+	}
+
+	for (i = 0; benches[i].name; i++) {
+		if (only && strcmp(only, benches[i].name))
+			continue;
+		if (run_bench(&benches[i], fdc))
+			break;
+	}
+
+	close(fdc);
+	close(fd);
+	return 0;
+}
@@ -0,0 +1,171 @@
+/*
+ * Demo on how to use /dev/crypto device for encrypt-then-MAC with two
+ * sessions in a single call.
+ *
+ * Placed under public domain.
+ *
+ */
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <stdint.h>
+
+#include <sys/ioctl.h>
+#include <crypto/cryptodev.h>
+
+static int debug = 0;
+
+#define	DATA_SIZE	8192
+#define	BLOCK_SIZE	16
+#define	KEY_SIZE	16
+#define SHA1_HASH_LEN   20
+
+static int
+test_crypto_chain(int cfd)
+{
+	static uint8_t plaintext[DATA_SIZE], ciphertext[DATA_SIZE];
+	static uint8_t reference[DATA_SIZE];
+	uint8_t iv[BLOCK_SIZE], key[KEY_SIZE], mackey[KEY_SIZE];
+	uint8_t mac[AALG_MAX_RESULT_LEN], refmac[AALG_MAX_RESULT_LEN];
+	struct session_op cipher_sess, mac_sess;
+	struct crypt_op steps[2], cryp;
+	struct crypt_chain_op chop;
+
+	memset(key, 0x33, sizeof(key));
+	memset(mackey, 0x44, sizeof(mackey));
+	memset(plaintext, 0x15, sizeof(plaintext));
+
+	memset(&cipher_sess, 0, sizeof(cipher_sess));
+	cipher_sess.cipher = CRYPTO_AES_CBC;
+	cipher_sess.keylen = KEY_SIZE;
+	cipher_sess.key = key;
+	if (ioctl(cfd, CIOCGSESSION, &cipher_sess)) {
+		perror("ioctl(CIOCGSESSION)");
+		return 1;
+	}
+
+	memset(&mac_sess, 0, sizeof(mac_sess));
+	mac_sess.mac = CRYPTO_SHA1_HMAC;
+	mac_sess.mackeylen = KEY_SIZE;
+	mac_sess.mackey = mackey;
+	if (ioctl(cfd, CIOCGSESSION, &mac_sess)) {
+		perror("ioctl(CIOCGSESSION)");
+		return 1;
+	}
+
+	/* Encrypt, then MAC the ciphertext, in a single call... */
+	memset(iv, 0x03, sizeof(iv));
+	memset(steps, 0, sizeof(steps));
+	steps[0].ses = cipher_sess.ses;
+	steps[0].op = COP_ENCRYPT;
+	steps[0].iv = iv;
+	steps[1].ses = mac_sess.ses;
+	steps[1].op = COP_ENCRYPT;
+	steps[1].mac = mac;
+
+	memset(&chop, 0, sizeof(chop));
+	chop.count = 2;
+	chop.len = DATA_SIZE;
+	chop.src = plaintext;
+	chop.dst = ciphertext;
+	chop.ops = steps;
+	if (ioctl(cfd, CIOCCRYPTCHAIN, &chop)) {
+		perror("ioctl(CIOCCRYPTCHAIN)");
+		return 1;
+	}
+
+	/* ...which must give the same as two separate operations */
+	memset(iv, 0x03, sizeof(iv));
+	memset(&cryp, 0, sizeof(cryp));
+	cryp.ses = cipher_sess.ses;
+	cryp.len = DATA_SIZE;
+	cryp.src = plaintext;
+	cryp.dst = reference;
+	cryp.iv = iv;
+	cryp.op = COP_ENCRYPT;
+	if (ioctl(cfd, CIOCCRYPT, &cryp)) {
+		perror("ioctl(CIOCCRYPT)");
+		return 1;
+	}
+
+	memset(&cryp, 0, sizeof(cryp));
+	cryp.ses = mac_sess.ses;
+	cryp.len = DATA_SIZE;
+	cryp.src = reference;
+	cryp.mac = refmac;
+	cryp.op = COP_ENCRYPT;
+	if (ioctl(cfd, CIOCCRYPT, &cryp)) {
+		perror("ioctl(CIOCCRYPT)");
+		return 1;
+	}
+
+	if (memcmp(ciphertext, reference, DATA_SIZE) != 0) {
+		fprintf(stderr, "FAIL: Encrypted data of the chain are different.\n");
+		return 1;
+	}
+
+	if (memcmp(mac, refmac, SHA1_HASH_LEN) != 0) {
+		fprintf(stderr, "FAIL: MAC of the chain is different.\n");
+		return 1;
+	}
+
+	if (debug)
+		printf("Test passed\n");
+
+	/* Finish crypto sessions */
+	if (ioctl(cfd, CIOCFSESSION, &cipher_sess.ses)) {
+		perror("ioctl(CIOCFSESSION)");
+		return 1;
+	}
+	if (ioctl(cfd, CIOCFSESSION, &mac_sess.ses)) {
+		perror("ioctl(CIOCFSESSION)");
+		return 1;
+	}
+
+	return 0;
+}
+int
+main(int argc, char** argv)
+{
+	int fd = -1, cfd = -1;
+
+	if (argc > 1) debug = 1;
+
+	/* Open the crypto device */
+	fd = open("/dev/crypto", O_RDWR, 0);
+	if (fd < 0) {
+		perror("open(/dev/crypto)");
+		return 1;
+	}
+
+	/* Clone file descriptor */
+	if (ioctl(fd, CRIOGET, &cfd)) {
+		perror("ioctl(CRIOGET)");
+		return 1;
+	}
+
+	/* Set close-on-exec (not really neede here) */
+	if (fcntl(cfd, F_SETFD, 1) == -1) {
+		perror("fcntl(F_SETFD)");
+		return 1;
+	}
+
+	/* Run the test itself */
+	if (test_crypto_chain(cfd))
+		return 1;
+
+	/* Close cloned descriptor */
+	if (close(cfd)) {
+		perror("close(cfd)");
+		return 1;
+	}
+
+	/* Close the original descriptor */
+	if (close(fd)) {
+		perror("close(fd)");
+		return 1;
+	}
+
+	return 0;
+}
@@ -0,0 +1,258 @@
+/*
+ * Demo on how to use /dev/crypto device for ciphering on a driver of
+ * choice, and on both the synchronous and the offload implementation
+ * with the crossover between them timed, and on a NUMA node of choice.
+ *
+ * Placed under public domain.
+ *
+ */
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <errno.h>
+
+#include <sys/ioctl.h>
+#include <crypto/cryptodev.h>
+
+static int debug = 0;
+
+#define	SMALL_SIZE	64
+#define	DATA_SIZE	16384
+#define	BLOCK_SIZE	16
+#define	KEY_SIZE	16
+
+static uint8_t key[KEY_SIZE];
+
+static int
+create_session(int cfd, struct session2_op *sess, uint32_t flags,
+		const char *driver)
+{
+	memset(sess, 0, sizeof(*sess));
+	sess->sop.cipher = CRYPTO_AES_CBC;
+	sess->sop.keylen = KEY_SIZE;
+	sess->sop.key = key;
+	sess->flags = flags;
+	if (driver)
+		snprintf(sess->cipher_driver, sizeof(sess->cipher_driver),
+				"%s", driver);
+	return ioctl(cfd, CIOCGSESSION2, sess);
+}
+
+static int
+encrypt(int cfd, uint32_t ses, uint8_t *src, uint8_t *dst, int len)
+{
+	uint8_t iv[BLOCK_SIZE];
+	struct crypt_op cryp;
+
+	memset(iv, 0x03, sizeof(iv));
+	memset(&cryp, 0, sizeof(cryp));
+	cryp.ses = ses;
+	cryp.len = len;
+	cryp.src = src;
+	cryp.dst = dst;
+	cryp.iv = iv;
+	cryp.op = COP_ENCRYPT;
+	if (ioctl(cfd, CIOCCRYPT, &cryp)) {
+		perror("ioctl(CIOCCRYPT)");
+		return 1;
+	}
+	return 0;
+}
+
+static int
+test_crypto_driver(int cfd)
+{
+	static uint8_t plaintext[DATA_SIZE], ciphertext[DATA_SIZE];
+	static uint8_t reference[DATA_SIZE];
+	struct session2_op sess, dsess;
+	struct session_info_op siop;
+	uint32_t flags[] = { SOP_FLAG_PREFER_ASYNC, SOP_FLAG_DRIVER_AUTO };
+	int sizes[] = { SMALL_SIZE, DATA_SIZE };
+	int i, j;
+
+	memset(plaintext, 0x15, sizeof(plaintext));
+	memset(key, 0x33, sizeof(key));
+
+	/* Whatever is found for the hint, it is an AES-CBC */
+	if (create_session(cfd, &sess, SOP_FLAG_PREFER_SYNC, NULL)) {
+		perror("ioctl(CIOCGSESSION2)");
+		return 1;
+	}
+
+	memset(&siop, 0, sizeof(siop));
+	siop.ses = sess.sop.ses;
+	if (ioctl(cfd, CIOCGSESSINFO, &siop)) {
+		perror("ioctl(CIOCGSESSINFO)");
+		return 1;
+	}
+	if (strcmp(siop.cipher_info.cra_name, "cbc(aes)") != 0) {
+		fprintf(stderr, "FAIL: got %s for cbc(aes).\n",
+				siop.cipher_info.cra_name);
+		return 1;
+	}
+	if (debug)
+		printf("preferred driver: %s\n",
+				siop.cipher_info.cra_driver_name);
+
+	if (encrypt(cfd, sess.sop.ses, plaintext, reference, DATA_SIZE))
+		return 1;
+
+	/* The same driver by its name */
+	if (create_session(cfd, &dsess, SOP_FLAG_DRIVER,
+			   siop.cipher_info.cra_driver_name)) {
+		perror("ioctl(CIOCGSESSION2)");
+		return 1;
+	}
+	siop.ses = dsess.sop.ses;
+	if (ioctl(cfd, CIOCGSESSINFO, &siop)) {
+		perror("ioctl(CIOCGSESSINFO)");
+		return 1;
+	}
+	if (strcmp(siop.cipher_info.cra_driver_name, dsess.cipher_driver) != 0) {
+		fprintf(stderr, "FAIL: got %s instead of %s.\n",
+				siop.cipher_info.cra_driver_name,
+				dsess.cipher_driver);
+		return 1;
+	}
+	if (encrypt(cfd, dsess.sop.ses, plaintext, ciphertext, DATA_SIZE))
+		return 1;
+	if (memcmp(ciphertext, reference, DATA_SIZE) != 0) {
+		fprintf(stderr, "FAIL: %s gave another ciphertext.\n",
+				dsess.cipher_driver);
+		return 1;
+	}
+	if (ioctl(cfd, CIOCFSESSION, &dsess.sop.ses)) {
+		perror("ioctl(CIOCFSESSION)");
+		return 1;
+	}
+
+	/* A driver of another algorithm is refused */
+	if (create_session(cfd, &dsess, SOP_FLAG_DRIVER, "sha1-generic") == 0 ||
+	    errno != EINVAL) {
+		fprintf(stderr, "FAIL: sha1-generic accepted for cbc(aes).\n");
+		return 1;
+	}
+
+	/* So are several choices at once */
+	if (create_session(cfd, &dsess, SOP_FLAG_PREFER_SYNC |
+			   SOP_FLAG_PREFER_ASYNC, NULL) == 0 || errno != EINVAL) {
+		fprintf(stderr, "FAIL: two choices of driver accepted.\n");
+		return 1;
+	}
+
+	/* A session on a NUMA node of choice; node 0 is always there */
+	if (create_session(cfd, &dsess, SOP_FLAG_NUMA_NODE, NULL)) {
+		perror("ioctl(CIOCGSESSION2)");
+		return 1;
+	}
+	if (encrypt(cfd, dsess.sop.ses, plaintext, ciphertext, DATA_SIZE))
+		return 1;
+	if (memcmp(ciphertext, reference, DATA_SIZE) != 0) {
+		fprintf(stderr, "FAIL: the session on node 0 gave another ciphertext.\n");
+		return 1;
+	}
+	if (ioctl(cfd, CIOCFSESSION, &dsess.sop.ses)) {
+		perror("ioctl(CIOCFSESSION)");
+		return 1;
+	}
+
+	/* and one that is not online is refused */
+	dsess.sop.ses = 0;
+	dsess.node = 1 << 20;
+	if (ioctl(cfd, CIOCGSESSION2, &dsess) == 0 || errno != EINVAL) {
+		fprintf(stderr, "FAIL: node %d accepted.\n", dsess.node);
+		return 1;
+	}
+
+	/* Small and large operations give the same on any implementation */
+	for (i = 0; i < sizeof(flags) / sizeof(flags[0]); i++) {
+		if (create_session(cfd, &dsess, flags[i], NULL)) {
+			perror("ioctl(CIOCGSESSION2)");
+			return 1;
+		}
+
+		/* Sessions without an offload driver have nothing to time,
+		 * and only the administrator may time them */
+		if (flags[i] == SOP_FLAG_DRIVER_AUTO &&
+		    ioctl(cfd, CIOCCALIBRATE, &dsess.sop.ses) &&
+		    errno != EINVAL && errno != EPERM) {
+			perror("ioctl(CIOCCALIBRATE)");
+			return 1;
+		}
+
+		for (j = 0; j < sizeof(sizes) / sizeof(sizes[0]); j++) {
+			if (encrypt(cfd, dsess.sop.ses, plaintext, ciphertext,
+				    sizes[j]))
+				return 1;
+			if (memcmp(ciphertext, reference, sizes[j]) != 0) {
+				fprintf(stderr,
+					"FAIL: %d bytes with flags 0x%x gave another ciphertext.\n",
+					sizes[j], flags[i]);
+				return 1;
+			}
+		}
+
+		if (ioctl(cfd, CIOCFSESSION, &dsess.sop.ses)) {
+			perror("ioctl(CIOCFSESSION)");
+			return 1;
+		}
+	}
+
+	if (debug)
+		printf("Test passed\n");
+
+	/* Finish crypto session */
+	if (ioctl(cfd, CIOCFSESSION, &sess.sop.ses)) {
+		perror("ioctl(CIOCFSESSION)");
+		return 1;
+	}
+
+	return 0;
+}
+
+int
+main(int argc, char** argv)
+{
+	int fd = -1, cfd = -1;
+
+	if (argc > 1) debug = 1;
+
+	/* Open the crypto device */
+	fd = open("/dev/crypto", O_RDWR, 0);
+	if (fd < 0) {
+		perror("open(/dev/crypto)");
+		return 1;
+	}
+
+	/* Clone file descriptor */
+	if (ioctl(fd, CRIOGET, &cfd)) {
+		perror("ioctl(CRIOGET)");
+		return 1;
+	}
+
+	/* Set close-on-exec (not really neede here) */
+	if (fcntl(cfd, F_SETFD, 1) == -1) {
+		perror("fcntl(F_SETFD)");
+		return 1;
+	}
+
+	/* Run the test itself */
+	if (test_crypto_driver(cfd))
+		return 1;
+
+	/* Close cloned descriptor */
+	if (close(cfd)) {
+		perror("close(cfd)");
+		return 1;
+	}
+
+	/* Close the original descriptor */
+	if (close(fd)) {
+		perror("close(fd)");
+		return 1;
+	}
+
+	return 0;
+}
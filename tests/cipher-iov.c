@@ -0,0 +1,177 @@
+/*
+ * Demo on how to use /dev/crypto device for ciphering scattered data.
+ *
+ * Placed under public domain.
+ *
+ */
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+
+#include <sys/ioctl.h>
+#include <crypto/cryptodev.h>
+
+static int debug = 0;
+
+#define	DATA_SIZE	4096
+#define	BLOCK_SIZE	16
+#define	KEY_SIZE	16
+#define	NSEGS		3
+
+/* segment lengths need not be multiples of the block size */
+static const unsigned int seg_len[NSEGS] = { 13, DATA_SIZE - 13 - 7, 7 };
+
+static int
+test_crypto_iov(int cfd)
+{
+	char plaintext[DATA_SIZE], ciphertext[DATA_SIZE];
+	char scattered[NSEGS][DATA_SIZE];
+	char iv[BLOCK_SIZE];
+	char key[KEY_SIZE];
+	unsigned int i, off;
+
+	struct session_op sess;
+	struct crypt_op cryp;
+	struct crypt_iov_op iop;
+	struct crypt_iovec segs[NSEGS], out;
+
+	memset(&sess, 0, sizeof(sess));
+	memset(key, 0x33,  sizeof(key));
+
+	/* Get crypto session for AES128 */
+	sess.cipher = CRYPTO_AES_CBC;
+	sess.keylen = KEY_SIZE;
+	sess.key = key;
+	if (ioctl(cfd, CIOCGSESSION, &sess)) {
+		perror("ioctl(CIOCGSESSION)");
+		return 1;
+	}
+
+	for (i = 0; i < DATA_SIZE; i++)
+		plaintext[i] = i & 0xff;
+
+	/* split the plaintext into segments */
+	for (i = 0, off = 0; i < NSEGS; off += seg_len[i], i++) {
+		memcpy(scattered[i], plaintext + off, seg_len[i]);
+		segs[i].base = scattered[i];
+		segs[i].len = seg_len[i];
+	}
+
+	/* Encrypt the contiguous data as a reference */
+	memset(iv, 0x03, sizeof(iv));
+	memset(&cryp, 0, sizeof(cryp));
+	cryp.ses = sess.ses;
+	cryp.len = DATA_SIZE;
+	cryp.src = plaintext;
+	cryp.dst = ciphertext;
+	cryp.iv = iv;
+	cryp.op = COP_ENCRYPT;
+	if (ioctl(cfd, CIOCCRYPT, &cryp)) {
+		perror("ioctl(CIOCCRYPT)");
+		return 1;
+	}
+
+	/* Encrypt the segments in place */
+	memset(iv, 0x03, sizeof(iv));
+	memset(&iop, 0, sizeof(iop));
+	iop.cop.ses = sess.ses;
+	iop.cop.len = DATA_SIZE;
+	iop.cop.iv = iv;
+	iop.cop.op = COP_ENCRYPT;
+	iop.src_count = iop.dst_count = NSEGS;
+	iop.src = iop.dst = segs;
+	if (ioctl(cfd, CIOCCRYPTV, &iop)) {
+		perror("ioctl(CIOCCRYPTV)");
+		return 1;
+	}
+
+	for (i = 0, off = 0; i < NSEGS; off += seg_len[i], i++) {
+		if (memcmp(scattered[i], ciphertext + off, seg_len[i]) != 0) {
+			fprintf(stderr, "FAIL: Encrypted segment %u is different.\n", i);
+			return 1;
+		}
+	}
+
+	/* Decrypt them into contiguous data */
+	memset(iv, 0x03, sizeof(iv));
+	memset(ciphertext, 0, sizeof(ciphertext));
+	out.base = ciphertext;
+	out.len = DATA_SIZE;
+	iop.cop.op = COP_DECRYPT;
+	iop.dst_count = 1;
+	iop.dst = &out;
+	if (ioctl(cfd, CIOCCRYPTV, &iop)) {
+		perror("ioctl(CIOCCRYPTV)");
+		return 1;
+	}
+
+	if (memcmp(plaintext, ciphertext, DATA_SIZE) != 0) {
+		fprintf(stderr,
+			"FAIL: Decrypted data are different from the input data.\n");
+		return 1;
+	}
+
+	/* segments shorter than the data must be refused */
+	iop.cop.len = DATA_SIZE + BLOCK_SIZE;
+	if (ioctl(cfd, CIOCCRYPTV, &iop) == 0) {
+		fprintf(stderr, "FAIL: short segments were accepted.\n");
+		return 1;
+	}
+
+	if (debug)
+		printf("Test passed\n");
+
+	/* Finish crypto session */
+	if (ioctl(cfd, CIOCFSESSION, &sess.ses)) {
+		perror("ioctl(CIOCFSESSION)");
+		return 1;
+	}
+
+	return 0;
+}
+
+int
+main(int argc, char** argv)
+{
+	int fd = -1, cfd = -1;
+
+	if (argc > 1) debug = 1;
+
+	/* Open the crypto device */
+	fd = open("/dev/crypto", O_RDWR, 0);
+	if (fd < 0) {
+		perror("open(/dev/crypto)");
+		return 1;
+	}
+
+	/* Clone file descriptor */
+	if (ioctl(fd, CRIOGET, &cfd)) {
+		perror("ioctl(CRIOGET)");
+		return 1;
+	}
+
+	/* Set close-on-exec (not really neede here) */
+	if (fcntl(cfd, F_SETFD, 1) == -1) {
+		perror("fcntl(F_SETFD)");
+		return 1;
+	}
+
+	/* Run the test itself */
+	if (test_crypto_iov(cfd))
+		return 1;
+
+	/* Close cloned descriptor */
+	if (close(cfd)) {
+		perror("close(cfd)");
+		return 1;
+	}
+
+	/* Close the original descriptor */
+	if (close(fd)) {
+		perror("close(fd)");
+		return 1;
+	}
+
+	return 0;
+}
@@ -0,0 +1,234 @@
+/*
+ * Demo on how to let /dev/crypto generate the IVs of a session.
+ *
+ * Placed under public domain.
+ *
+ */
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+
+#include <sys/ioctl.h>
+#include <crypto/cryptodev.h>
+
+static int debug = 0;
+
+#define	DATA_SIZE	256
+#define	BLOCK_SIZE	16
+#define	KEY_SIZE	16
+#define	GCM_IV_SIZE	12
+#define	TAG_SIZE	16
+#define	NOPS		4
+
+static int
+test_crypto_ivgen(int cfd)
+{
+	char plaintext[NOPS * DATA_SIZE];
+	char ciphertext[NOPS * DATA_SIZE];
+	char reference[NOPS * DATA_SIZE];
+	char iv[BLOCK_SIZE], used_iv[BLOCK_SIZE], expected_iv[BLOCK_SIZE];
+	char key[KEY_SIZE];
+	int i;
+
+	struct session2_op sess2;
+	struct session_op sess;
+	struct crypt_op cryp;
+
+	memset(key, 0x33,  sizeof(key));
+	memset(iv, 0x03, sizeof(iv));
+	/* leave room for the counter not to wrap into the other bytes */
+	iv[BLOCK_SIZE - 1] = 0;
+	memset(plaintext, 0x15, sizeof(plaintext));
+
+	/* AES-CTR session whose IVs are a counter */
+	memset(&sess2, 0, sizeof(sess2));
+	sess2.sop.cipher = CRYPTO_AES_CTR;
+	sess2.sop.keylen = KEY_SIZE;
+	sess2.sop.key = key;
+	sess2.flags = SOP_FLAG_IV_COUNTER;
+	sess2.iv = iv;
+	if (ioctl(cfd, CIOCGSESSION2, &sess2)) {
+		perror("ioctl(CIOCGSESSION2)");
+		return 1;
+	}
+
+	/* Encrypt in pieces without passing IVs... */
+	memcpy(expected_iv, iv, sizeof(iv));
+	for (i = 0; i < NOPS; i++) {
+		memset(&cryp, 0, sizeof(cryp));
+		cryp.ses = sess2.sop.ses;
+		cryp.len = DATA_SIZE;
+		cryp.src = plaintext + i * DATA_SIZE;
+		cryp.dst = ciphertext + i * DATA_SIZE;
+		cryp.iv = used_iv;
+		cryp.flags = COP_FLAG_WRITE_IV;
+		cryp.op = COP_ENCRYPT;
+		if (ioctl(cfd, CIOCCRYPT, &cryp)) {
+			perror("ioctl(CIOCCRYPT)");
+			return 1;
+		}
+
+		if (memcmp(used_iv, expected_iv, BLOCK_SIZE) != 0) {
+			fprintf(stderr, "FAIL: operation %d used an unexpected IV.\n", i);
+			return 1;
+		}
+		expected_iv[BLOCK_SIZE - 1] += DATA_SIZE / BLOCK_SIZE;
+	}
+
+	/* ...which must give the same as all at once */
+	memset(&sess, 0, sizeof(sess));
+	sess.cipher = CRYPTO_AES_CTR;
+	sess.keylen = KEY_SIZE;
+	sess.key = key;
+	if (ioctl(cfd, CIOCGSESSION, &sess)) {
+		perror("ioctl(CIOCGSESSION)");
+		return 1;
+	}
+
+	memset(&cryp, 0, sizeof(cryp));
+	cryp.ses = sess.ses;
+	cryp.len = sizeof(plaintext);
+	cryp.src = plaintext;
+	cryp.dst = reference;
+	cryp.iv = iv;
+	cryp.op = COP_ENCRYPT;
+	if (ioctl(cfd, CIOCCRYPT, &cryp)) {
+		perror("ioctl(CIOCCRYPT)");
+		return 1;
+	}
+
+	if (memcmp(ciphertext, reference, sizeof(ciphertext)) != 0) {
+		fprintf(stderr, "FAIL: Encrypted data with generated IVs are different.\n");
+		return 1;
+	}
+
+	/* CBC must not have predictable IVs */
+	sess2.sop.cipher = CRYPTO_AES_CBC;
+	if (ioctl(cfd, CIOCGSESSION2, &sess2) == 0) {
+		fprintf(stderr, "FAIL: generated IVs were accepted for CBC.\n");
+		return 1;
+	}
+
+	if (debug)
+		printf("Test passed\n");
+
+	/* Finish crypto sessions */
+	if (ioctl(cfd, CIOCFSESSION, &sess.ses)) {
+		perror("ioctl(CIOCFSESSION)");
+		return 1;
+	}
+	if (ioctl(cfd, CIOCFSESSION, &sess2.sop.ses)) {
+		perror("ioctl(CIOCFSESSION)");
+		return 1;
+	}
+
+	return 0;
+}
+
+/* Operations without data must not get the same GCM nonce */
+static int
+test_crypto_ivgen_empty(int cfd)
+{
+	char iv[GCM_IV_SIZE], used_iv[2][GCM_IV_SIZE];
+	char key[KEY_SIZE], auth[BLOCK_SIZE], tag[TAG_SIZE];
+	int i;
+
+	struct session2_op sess2;
+	struct crypt_auth_op cao;
+
+	memset(key, 0x33,  sizeof(key));
+	memset(iv, 0x03, sizeof(iv));
+	memset(auth, 0xf1, sizeof(auth));
+
+	memset(&sess2, 0, sizeof(sess2));
+	sess2.sop.cipher = CRYPTO_AES_GCM;
+	sess2.sop.keylen = KEY_SIZE;
+	sess2.sop.key = key;
+	sess2.flags = SOP_FLAG_IV_COUNTER;
+	sess2.iv = iv;
+	if (ioctl(cfd, CIOCGSESSION2, &sess2)) {
+		perror("ioctl(CIOCGSESSION2)");
+		return 1;
+	}
+
+	for (i = 0; i < 2; i++) {
+		memset(&cao, 0, sizeof(cao));
+		cao.ses = sess2.sop.ses;
+		cao.op = COP_ENCRYPT;
+		cao.flags = COP_FLAG_WRITE_IV;
+		cao.auth_src = auth;
+		cao.auth_len = sizeof(auth);
+		cao.len = 0;
+		cao.src = tag;
+		cao.dst = tag;
+		cao.iv = used_iv[i];
+		cao.iv_len = GCM_IV_SIZE;
+		if (ioctl(cfd, CIOCAUTHCRYPT, &cao)) {
+			perror("ioctl(CIOCAUTHCRYPT)");
+			return 1;
+		}
+	}
+
+	if (memcmp(used_iv[0], used_iv[1], GCM_IV_SIZE) == 0) {
+		fprintf(stderr, "FAIL: two empty operations used the same IV.\n");
+		return 1;
+	}
+
+	if (debug)
+		printf("Test passed\n");
+
+	if (ioctl(cfd, CIOCFSESSION, &sess2.sop.ses)) {
+		perror("ioctl(CIOCFSESSION)");
+		return 1;
+	}
+
+	return 0;
+}
+
+int
+main(int argc, char** argv)
+{
+	int fd = -1, cfd = -1;
+
+	if (argc > 1) debug = 1;
+
+	/* Open the crypto device */
+	fd = open("/dev/crypto", O_RDWR, 0);
+	if (fd < 0) {
+		perror("open(/dev/crypto)");
+		return 1;
+	}
+
+	/* Clone file descriptor */
+	if (ioctl(fd, CRIOGET, &cfd)) {
+		perror("ioctl(CRIOGET)");
+		return 1;
+	}
+
+	/* Set close-on-exec (not really neede here) */
+	if (fcntl(cfd, F_SETFD, 1) == -1) {
+		perror("fcntl(F_SETFD)");
+		return 1;
+	}
+
+	/* Run the test itself */
+	if (test_crypto_ivgen(cfd))
+		return 1;
+	if (test_crypto_ivgen_empty(cfd))
+		return 1;
+
+	/* Close cloned descriptor */
+	if (close(cfd)) {
+		perror("close(cfd)");
+		return 1;
+	}
+
+	/* Close the original descriptor */
+	if (close(fd)) {
+		perror("close(fd)");
+		return 1;
+	}
+
+	return 0;
+}
@@ -0,0 +1,182 @@
+/*
+ * Demo on how to use /dev/crypto device through lib/libcryptodev.
+ *
+ * Placed under public domain.
+ *
+ */
+#include <pthread.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../lib/libcryptodev.h"
+
+#define	DATA_SIZE	4096
+#define	CHUNK_SIZE	64
+#define	NCHUNKS		(DATA_SIZE / CHUNK_SIZE)
+#define	BLOCK_SIZE	16
+#define	KEY_SIZE	16
+
+static int debug = 0;
+
+struct batch_result {
+	int ops;
+	int failed;
+};
+
+static void batch_done(void *data, const struct crypt_op *cop, int status)
+{
+	struct batch_result *r = data;
+
+	r->ops++;
+	if (status)
+		r->failed++;
+}
+
+/* encrypts plaintext in CBC chunks of their own, through a batch, and
+ * compares that with the same chunks through cryptodev_crypt() */
+static int
+test_batch(struct cryptodev_session *s, const char *plaintext,
+		const char *reference, int flags)
+{
+	struct cryptodev_batch b;
+	struct batch_result r;
+	char ivs[NCHUNKS][BLOCK_SIZE];
+	char *ciphertext;
+	int i;
+
+	ciphertext = cryptodev_alloc(s, DATA_SIZE);
+	if (!ciphertext) {
+		perror("cryptodev_alloc()");
+		return 1;
+	}
+
+	memset(&r, 0, sizeof(r));
+	memset(ivs, 0x03, sizeof(ivs));
+	cryptodev_batch_init(&b, flags, batch_done, &r);
+	for (i = 0; i < NCHUNKS; i++) {
+		if (cryptodev_batch_add(&b, s, COP_ENCRYPT,
+				plaintext + i * CHUNK_SIZE,
+				ciphertext + i * CHUNK_SIZE, CHUNK_SIZE,
+				ivs[i], NULL)) {
+			perror("cryptodev_batch_add()");
+			return 1;
+		}
+	}
+	if (cryptodev_batch_flush(&b)) {
+		perror("cryptodev_batch_flush()");
+		return 1;
+	}
+
+	if (r.ops != NCHUNKS || r.failed) {
+		fprintf(stderr, "batch (flags %d): %d operations, %d failed\n",
+			flags, r.ops, r.failed);
+		return 1;
+	}
+	if (memcmp(ciphertext, reference, DATA_SIZE)) {
+		fprintf(stderr, "batch (flags %d): ciphertext differs\n", flags);
+		return 1;
+	}
+
+	free(ciphertext);
+	return 0;
+}
+
+static void *thread_fd(void *p)
+{
+	*(int *)p = cryptodev_fd();
+	return NULL;
+}
+
+static int
+test_crypto_lib(void)
+{
+	struct cryptodev_session *s, *s2;
+	char *plaintext, *reference;
+	char iv[BLOCK_SIZE];
+	char key[KEY_SIZE];
+	pthread_t thread;
+	int i, other_fd;
+
+	memset(key, 0x33, sizeof(key));
+
+	s = cryptodev_session_get(CRYPTO_AES_CBC, key, KEY_SIZE, 0, NULL, 0);
+	if (!s) {
+		perror("cryptodev_session_get()");
+		return 1;
+	}
+
+	/* the same key is served from the cache, another is not */
+	s2 = cryptodev_session_get(CRYPTO_AES_CBC, key, KEY_SIZE, 0, NULL, 0);
+	if (s2 != s) {
+		fprintf(stderr, "the session was not cached\n");
+		return 1;
+	}
+	cryptodev_session_put(s2);
+
+	key[0] ^= 1;
+	s2 = cryptodev_session_get(CRYPTO_AES_CBC, key, KEY_SIZE, 0, NULL, 0);
+	if (!s2 || s2 == s || s2->ses == s->ses) {
+		fprintf(stderr, "another key got the same session\n");
+		return 1;
+	}
+	cryptodev_session_put(s2);
+
+	plaintext = cryptodev_alloc(s, DATA_SIZE);
+	reference = cryptodev_alloc(s, DATA_SIZE);
+	if (!plaintext || !reference) {
+		perror("cryptodev_alloc()");
+		return 1;
+	}
+	if ((unsigned long)plaintext & s->alignmask) {
+		fprintf(stderr, "the buffer is not aligned to %u\n",
+			s->alignmask + 1);
+		return 1;
+	}
+	memset(plaintext, 0x15, DATA_SIZE);
+
+	for (i = 0; i < NCHUNKS; i++) {
+		memset(iv, 0x03, sizeof(iv));
+		if (cryptodev_crypt(s, COP_ENCRYPT, plaintext + i * CHUNK_SIZE,
+				reference + i * CHUNK_SIZE, CHUNK_SIZE,
+				iv, NULL)) {
+			perror("cryptodev_crypt()");
+			return 1;
+		}
+	}
+
+	if (test_batch(s, plaintext, reference, 0))
+		return 1;
+	/* falls back to CIOCCRYPTMULTI without the async queue */
+	if (test_batch(s, plaintext, reference, CRYPTODEV_BATCH_ASYNC))
+		return 1;
+
+	/* each thread has a descriptor of its own */
+	if (pthread_create(&thread, NULL, thread_fd, &other_fd) ||
+	    pthread_join(thread, NULL)) {
+		fprintf(stderr, "cannot run a thread\n");
+		return 1;
+	}
+	if (other_fd < 0 || other_fd == cryptodev_fd()) {
+		fprintf(stderr, "the thread did not get a descriptor of its own\n");
+		return 1;
+	}
+
+	free(plaintext);
+	free(reference);
+	cryptodev_session_put(s);
+	cryptodev_thread_done();
+
+	if (debug)
+		printf("libcryptodev test passed\n");
+	return 0;
+}
+
+int
+main(int argc, char** argv)
+{
+	if (argc > 1) debug = 1;
+
+	return test_crypto_lib();
+}
@@ -0,0 +1,188 @@
+/*
+ * Demo on how to use /dev/crypto device for batched ciphering.
+ *
+ * Placed under public domain.
+ *
+ */
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+
+#include <sys/ioctl.h>
+#include <crypto/cryptodev.h>
+
+static int debug = 0;
+
+#define	DATA_SIZE	512
+#define	BLOCK_SIZE	16
+#define	KEY_SIZE	16
+#define	NOPS		8
+
+static int
+test_crypto_multi(int cfd)
+{
+	char plaintext_raw[NOPS][DATA_SIZE + 63], *plaintext[NOPS];
+	char ciphertext_raw[NOPS][DATA_SIZE + 63], *ciphertext[NOPS];
+	char iv[NOPS][BLOCK_SIZE];
+	char key[KEY_SIZE];
+	unsigned int alignmask = 0;
+	int i;
+
+	struct session_op sess;
+#ifdef CIOCGSESSINFO
+	struct session_info_op siop;
+#endif
+	struct crypt_op cryp[NOPS];
+	struct crypt_multi_op mop;
+	__s32 status[NOPS];
+
+	memset(&sess, 0, sizeof(sess));
+	memset(key, 0x33,  sizeof(key));
+
+	/* Get crypto session for AES128 */
+	sess.cipher = CRYPTO_AES_CBC;
+	sess.keylen = KEY_SIZE;
+	sess.key = key;
+	if (ioctl(cfd, CIOCGSESSION, &sess)) {
+		perror("ioctl(CIOCGSESSION)");
+		return 1;
+	}
+
+#ifdef CIOCGSESSINFO
+	siop.ses = sess.ses;
+	if (ioctl(cfd, CIOCGSESSINFO, &siop)) {
+		perror("ioctl(CIOCGSESSINFO)");
+		return 1;
+	}
+	if (debug)
+		printf("requested cipher CRYPTO_AES_CBC, got %s with driver %s\n",
+			siop.cipher_info.cra_name, siop.cipher_info.cra_driver_name);
+	alignmask = siop.alignmask;
+#endif
+
+	memset(cryp, 0, sizeof(cryp));
+	for (i = 0; i < NOPS; i++) {
+		plaintext[i] = (char *)(((unsigned long)plaintext_raw[i] + alignmask) & ~alignmask);
+		ciphertext[i] = (char *)(((unsigned long)ciphertext_raw[i] + alignmask) & ~alignmask);
+		memset(plaintext[i], 0x15 + i, DATA_SIZE);
+		memset(iv[i], 0x03 + i, BLOCK_SIZE);
+
+		cryp[i].ses = sess.ses;
+		cryp[i].len = DATA_SIZE;
+		cryp[i].src = plaintext[i];
+		cryp[i].dst = ciphertext[i];
+		cryp[i].iv = iv[i];
+		cryp[i].op = COP_ENCRYPT;
+	}
+	/* this one must fail without affecting the others */
+	cryp[NOPS / 2].ses = sess.ses + 1;
+
+	memset(&mop, 0, sizeof(mop));
+	mop.count = NOPS;
+	mop.ops = cryp;
+	mop.status = status;
+
+	/* Encrypt all buffers in a single call */
+	if (ioctl(cfd, CIOCCRYPTMULTI, &mop)) {
+		perror("ioctl(CIOCCRYPTMULTI)");
+		return 1;
+	}
+
+	for (i = 0; i < NOPS; i++) {
+		if (i == NOPS / 2) {
+			if (status[i] == 0) {
+				fprintf(stderr, "FAIL: operation with invalid session succeeded.\n");
+				return 1;
+			}
+			continue;
+		}
+		if (status[i] != 0) {
+			fprintf(stderr, "FAIL: operation %d returned %d.\n", i, status[i]);
+			return 1;
+		}
+	}
+
+	/* Decrypt each buffer separately and verify the result */
+	for (i = 0; i < NOPS; i++) {
+		struct crypt_op dcryp;
+
+		if (i == NOPS / 2)
+			continue;
+
+		memset(iv[i], 0x03 + i, BLOCK_SIZE);
+		memset(&dcryp, 0, sizeof(dcryp));
+		dcryp.ses = sess.ses;
+		dcryp.len = DATA_SIZE;
+		dcryp.src = ciphertext[i];
+		dcryp.dst = ciphertext[i];
+		dcryp.iv = iv[i];
+		dcryp.op = COP_DECRYPT;
+		if (ioctl(cfd, CIOCCRYPT, &dcryp)) {
+			perror("ioctl(CIOCCRYPT)");
+			return 1;
+		}
+
+		if (memcmp(plaintext[i], ciphertext[i], DATA_SIZE) != 0) {
+			fprintf(stderr,
+				"FAIL: Decrypted data of operation %d are different from the input data.\n", i);
+			return 1;
+		}
+	}
+
+	if (debug)
+		printf("Test passed\n");
+
+	/* Finish crypto session */
+	if (ioctl(cfd, CIOCFSESSION, &sess.ses)) {
+		perror("ioctl(CIOCFSESSION)");
+		return 1;
+	}
+
+	return 0;
+}
+
+int
+main(int argc, char** argv)
+{
+	int fd = -1, cfd = -1;
+
+	if (argc > 1) debug = 1;
+
+	/* Open the crypto device */
+	fd = open("/dev/crypto", O_RDWR, 0);
+	if (fd < 0) {
+		perror("open(/dev/crypto)");
+		return 1;
+	}
+
+	/* Clone file descriptor */
+	if (ioctl(fd, CRIOGET, &cfd)) {
+		perror("ioctl(CRIOGET)");
+		return 1;
+	}
+
+	/* Set close-on-exec (not really neede here) */
+	if (fcntl(cfd, F_SETFD, 1) == -1) {
+		perror("fcntl(F_SETFD)");
+		return 1;
+	}
+
+	/* Run the test itself */
+	if (test_crypto_multi(cfd))
+		return 1;
+
+	/* Close cloned descriptor */
+	if (close(cfd)) {
+		perror("close(cfd)");
+		return 1;
+	}
+
+	/* Close the original descriptor */
+	if (close(fd)) {
+		perror("close(fd)");
+		return 1;
+	}
+
+	return 0;
+}
@@ -0,0 +1,171 @@
+/*
+ * Demo on how to use /dev/crypto device for ciphering many buffers at once.
+ *
+ * Placed under public domain.
+ *
+ */
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <stdint.h>
+
+#include <sys/ioctl.h>
+#include <crypto/cryptodev.h>
+
+static int debug = 0;
+
+#define	NBUFS		40
+#define	MAX_SIZE	1024
+#define	BLOCK_SIZE	16
+#define	KEY_SIZE	16
+
+/* Runs NBUFS buffers of different sizes through CIOCCIPHERMULTI and then
+ * through CIOCCRYPT one at a time, and compares the outputs and the IVs
+ * that are written back */
+static int
+test_cipher_multi(int cfd, int cipher, int op, int in_place)
+{
+	static uint8_t data[NBUFS][MAX_SIZE], out[NBUFS][MAX_SIZE];
+	static uint8_t ref[MAX_SIZE];
+	uint8_t ivs[NBUFS][BLOCK_SIZE];
+	uint8_t iv[BLOCK_SIZE];
+	uint8_t key[KEY_SIZE];
+	struct crypt_iovec src[NBUFS], dst[NBUFS];
+	struct crypt_cipher_multi_op cmo;
+	struct session_op sess;
+	struct crypt_op cryp;
+	int i;
+
+	memset(key, 0x33, sizeof(key));
+	memset(&sess, 0, sizeof(sess));
+	sess.cipher = cipher;
+	sess.keylen = KEY_SIZE;
+	sess.key = key;
+	if (ioctl(cfd, CIOCGSESSION, &sess)) {
+		perror("ioctl(CIOCGSESSION)");
+		return 1;
+	}
+
+	for (i = 0; i < NBUFS; i++) {
+		memset(data[i], i, MAX_SIZE);
+		memset(ivs[i], i ^ 0x5a, BLOCK_SIZE);
+		src[i].base = data[i];
+		src[i].len = BLOCK_SIZE * (1 + (i * 7) % (MAX_SIZE / BLOCK_SIZE));
+		dst[i].base = in_place ? data[i] : out[i];
+		dst[i].len = src[i].len;
+	}
+
+	memset(&cmo, 0, sizeof(cmo));
+	cmo.ses = sess.ses;
+	cmo.op = op;
+	cmo.flags = COP_FLAG_WRITE_IV;
+	cmo.count = NBUFS;
+	cmo.src = src;
+	cmo.dst = in_place ? NULL : dst;
+	cmo.ivs = (uint8_t *)ivs;
+	if (ioctl(cfd, CIOCCIPHERMULTI, &cmo)) {
+		perror("ioctl(CIOCCIPHERMULTI)");
+		return 1;
+	}
+
+	/* each buffer must be what a separate operation makes of it */
+	for (i = 0; i < NBUFS; i++) {
+		memset(ref, i, MAX_SIZE);
+		memset(iv, i ^ 0x5a, BLOCK_SIZE);
+
+		memset(&cryp, 0, sizeof(cryp));
+		cryp.ses = sess.ses;
+		cryp.len = src[i].len;
+		cryp.src = ref;
+		cryp.dst = ref;
+		cryp.iv = iv;
+		cryp.op = op;
+		cryp.flags = COP_FLAG_WRITE_IV;
+		if (ioctl(cfd, CIOCCRYPT, &cryp)) {
+			perror("ioctl(CIOCCRYPT)");
+			return 1;
+		}
+
+		if (memcmp(ref, dst[i].base, src[i].len) != 0) {
+			fprintf(stderr, "FAIL: buffer %d of CIOCCIPHERMULTI is different.\n", i);
+			return 1;
+		}
+		if (memcmp(iv, ivs[i], BLOCK_SIZE) != 0) {
+			fprintf(stderr, "FAIL: IV %d of CIOCCIPHERMULTI is different.\n", i);
+			return 1;
+		}
+		if (!in_place && data[i][0] != i) {
+			fprintf(stderr, "FAIL: source %d of CIOCCIPHERMULTI was written.\n", i);
+			return 1;
+		}
+	}
+
+	/* a length that is not a multiple of the block is refused */
+	src[0].len = BLOCK_SIZE + 1;
+	dst[0].len = src[0].len;
+	if (ioctl(cfd, CIOCCIPHERMULTI, &cmo) == 0) {
+		fprintf(stderr, "FAIL: CIOCCIPHERMULTI took a partial block.\n");
+		return 1;
+	}
+
+	if (debug)
+		printf("Test passed (cipher %d, op %d, %s)\n", cipher, op,
+			in_place ? "in place" : "out of place");
+
+	/* Finish crypto session */
+	if (ioctl(cfd, CIOCFSESSION, &sess.ses)) {
+		perror("ioctl(CIOCFSESSION)");
+		return 1;
+	}
+
+	return 0;
+}
+
+int
+main(int argc, char** argv)
+{
+	int fd = -1, cfd = -1;
+
+	if (argc > 1) debug = 1;
+
+	/* Open the crypto device */
+	fd = open("/dev/crypto", O_RDWR, 0);
+	if (fd < 0) {
+		perror("open(/dev/crypto)");
+		return 1;
+	}
+
+	/* Clone file descriptor */
+	if (ioctl(fd, CRIOGET, &cfd)) {
+		perror("ioctl(CRIOGET)");
+		return 1;
+	}
+
+	/* Set close-on-exec (not really neede here) */
+	if (fcntl(cfd, F_SETFD, 1) == -1) {
+		perror("fcntl(F_SETFD)");
+		return 1;
+	}
+
+	/* Run the test itself: CBC decryption, CTR both ways */
+	if (test_cipher_multi(cfd, CRYPTO_AES_CBC, COP_DECRYPT, 0) ||
+	    test_cipher_multi(cfd, CRYPTO_AES_CBC, COP_DECRYPT, 1) ||
+	    test_cipher_multi(cfd, CRYPTO_AES_CTR, COP_ENCRYPT, 0) ||
+	    test_cipher_multi(cfd, CRYPTO_AES_CTR, COP_DECRYPT, 1))
+		return 1;
+
+	/* Close cloned descriptor */
+	if (close(cfd)) {
+		perror("close(cfd)");
+		return 1;
+	}
+
+	/* Close the original descriptor */
+	if (close(fd)) {
+		perror("close(fd)");
+		return 1;
+	}
+
+	return 0;
+}
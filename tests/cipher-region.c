@@ -0,0 +1,203 @@
+/*
+ * Demo on how to use /dev/crypto device for ciphering in registered
+ * (pinned) memory.
+ *
+ * Placed under public domain.
+ *
+ */
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+
+#include <sys/ioctl.h>
+#include <crypto/cryptodev.h>
+
+static int debug = 0;
+
+#define	DATA_SIZE	8192
+#define	BLOCK_SIZE	16
+#define	KEY_SIZE	16
+#define	PAGE		4096
+
+static char region[3 * DATA_SIZE + PAGE];
+
+static int
+test_crypto_region(int cfd)
+{
+	char *base, *plaintext, *ciphertext, *reference;
+	char iv[BLOCK_SIZE];
+	char key[KEY_SIZE];
+
+	struct session_op sess;
+	struct crypt_region_op rop;
+	struct crypt_op cryp;
+
+	memset(&sess, 0, sizeof(sess));
+	memset(key, 0x33,  sizeof(key));
+
+	/* Get crypto session for AES128 */
+	sess.cipher = CRYPTO_AES_CBC;
+	sess.keylen = KEY_SIZE;
+	sess.key = key;
+	if (ioctl(cfd, CIOCGSESSION, &sess)) {
+		perror("ioctl(CIOCGSESSION)");
+		return 1;
+	}
+
+	/* page aligned buffers, of which the first two are registered */
+	base = (char *)(((unsigned long)region + PAGE - 1) & ~(PAGE - 1UL));
+	plaintext = base;
+	ciphertext = base + DATA_SIZE;
+	reference = base + 2 * DATA_SIZE;
+	memset(plaintext, 0x15, DATA_SIZE);
+
+	memset(&rop, 0, sizeof(rop));
+	rop.addr = base;
+	rop.len = 2 * DATA_SIZE;
+	if (ioctl(cfd, CIOCREGBUF, &rop)) {
+		perror("ioctl(CIOCREGBUF)");
+		return 1;
+	}
+	if (debug)
+		printf("registered %u bytes as region %u\n", rop.len, rop.handle);
+
+	/* Encrypt within the region... */
+	memset(iv, 0x03, sizeof(iv));
+	memset(&cryp, 0, sizeof(cryp));
+	cryp.ses = sess.ses;
+	cryp.len = DATA_SIZE;
+	cryp.src = plaintext;
+	cryp.dst = ciphertext;
+	cryp.iv = iv;
+	cryp.op = COP_ENCRYPT;
+	if (ioctl(cfd, CIOCCRYPT, &cryp)) {
+		perror("ioctl(CIOCCRYPT)");
+		return 1;
+	}
+
+	/* ...and into memory outside of it, which must give the same */
+	memset(iv, 0x03, sizeof(iv));
+	cryp.dst = reference;
+	if (ioctl(cfd, CIOCCRYPT, &cryp)) {
+		perror("ioctl(CIOCCRYPT)");
+		return 1;
+	}
+
+	if (memcmp(ciphertext, reference, DATA_SIZE) != 0) {
+		fprintf(stderr, "FAIL: Encrypted data in the region are different.\n");
+		return 1;
+	}
+
+	/* Decrypt in place within the region */
+	memset(iv, 0x03, sizeof(iv));
+	cryp.src = ciphertext;
+	cryp.dst = ciphertext;
+	cryp.op = COP_DECRYPT;
+	if (ioctl(cfd, CIOCCRYPT, &cryp)) {
+		perror("ioctl(CIOCCRYPT)");
+		return 1;
+	}
+
+	if (memcmp(plaintext, ciphertext, DATA_SIZE) != 0) {
+		fprintf(stderr,
+			"FAIL: Decrypted data are different from the input data.\n");
+		return 1;
+	}
+
+	/* Encrypt again, naming the buffers by handle and offset */
+	memset(iv, 0x03, sizeof(iv));
+	cryp.src = CRYPTODEV_REGION_PTR(rop.handle, 0);
+	cryp.dst = CRYPTODEV_REGION_PTR(rop.handle, DATA_SIZE);
+	cryp.flags = COP_FLAG_REGION;
+	cryp.op = COP_ENCRYPT;
+	if (ioctl(cfd, CIOCCRYPT, &cryp)) {
+		perror("ioctl(CIOCCRYPT)");
+		return 1;
+	}
+
+	if (memcmp(ciphertext, reference, DATA_SIZE) != 0) {
+		fprintf(stderr, "FAIL: Encrypted data by handle are different.\n");
+		return 1;
+	}
+
+	if (cryp.src != CRYPTODEV_REGION_PTR(rop.handle, 0)) {
+		fprintf(stderr, "FAIL: src was not passed back as given.\n");
+		return 1;
+	}
+
+	/* past the end of the region */
+	cryp.dst = CRYPTODEV_REGION_PTR(rop.handle, DATA_SIZE + BLOCK_SIZE);
+	if (ioctl(cfd, CIOCCRYPT, &cryp) == 0 || errno != EINVAL) {
+		fprintf(stderr, "FAIL: data past the region were accepted.\n");
+		return 1;
+	}
+	cryp.flags = 0;
+
+	if (ioctl(cfd, CIOCUNREGBUF, &rop.handle)) {
+		perror("ioctl(CIOCUNREGBUF)");
+		return 1;
+	}
+
+	if (ioctl(cfd, CIOCUNREGBUF, &rop.handle) == 0 || errno != EINVAL) {
+		fprintf(stderr, "FAIL: region was unregistered twice.\n");
+		return 1;
+	}
+
+	if (debug)
+		printf("Test passed\n");
+
+	/* Finish crypto session */
+	if (ioctl(cfd, CIOCFSESSION, &sess.ses)) {
+		perror("ioctl(CIOCFSESSION)");
+		return 1;
+	}
+
+	return 0;
+}
+
+int
+main(int argc, char** argv)
+{
+	int fd = -1, cfd = -1;
+
+	if (argc > 1) debug = 1;
+
+	/* Open the crypto device */
+	fd = open("/dev/crypto", O_RDWR, 0);
+	if (fd < 0) {
+		perror("open(/dev/crypto)");
+		return 1;
+	}
+
+	/* Clone file descriptor */
+	if (ioctl(fd, CRIOGET, &cfd)) {
+		perror("ioctl(CRIOGET)");
+		return 1;
+	}
+
+	/* Set close-on-exec (not really neede here) */
+	if (fcntl(cfd, F_SETFD, 1) == -1) {
+		perror("fcntl(F_SETFD)");
+		return 1;
+	}
+
+	/* Run the test itself */
+	if (test_crypto_region(cfd))
+		return 1;
+
+	/* Close cloned descriptor */
+	if (close(cfd)) {
+		perror("close(cfd)");
+		return 1;
+	}
+
+	/* Close the original descriptor */
+	if (close(fd)) {
+		perror("close(fd)");
+		return 1;
+	}
+
+	return 0;
+}
@@ -0,0 +1,157 @@
+/*
+ * Demo on how to use /dev/crypto device for ciphering on a session from
+ * several processes at once, each with a transform of its own.
+ *
+ * Placed under public domain.
+ *
+ */
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <stdint.h>
+
+#include <sys/ioctl.h>
+#include <sys/wait.h>
+#include <crypto/cryptodev.h>
+
+static int debug = 0;
+
+#define	DATA_SIZE	4096
+#define	BLOCK_SIZE	16
+#define	KEY_SIZE	16
+#define	NPROCS		4
+#define	NOPS		256
+
+static int
+encrypt(int cfd, uint32_t ses, uint8_t *src, uint8_t *dst)
+{
+	uint8_t iv[BLOCK_SIZE];
+	struct crypt_op cryp;
+
+	memset(iv, 0x03, sizeof(iv));
+	memset(&cryp, 0, sizeof(cryp));
+	cryp.ses = ses;
+	cryp.len = DATA_SIZE;
+	cryp.src = src;
+	cryp.dst = dst;
+	cryp.iv = iv;
+	cryp.op = COP_ENCRYPT;
+	if (ioctl(cfd, CIOCCRYPT, &cryp)) {
+		perror("ioctl(CIOCCRYPT)");
+		return 1;
+	}
+	return 0;
+}
+
+static int
+test_crypto_shards(int cfd)
+{
+	static uint8_t plaintext[DATA_SIZE], ciphertext[DATA_SIZE];
+	static uint8_t reference[DATA_SIZE];
+	uint8_t key[KEY_SIZE];
+	struct session2_op sess;
+	int i, j, status, failed = 0;
+	pid_t pid;
+
+	memset(plaintext, 0x15, sizeof(plaintext));
+	memset(key, 0x33, sizeof(key));
+
+	memset(&sess, 0, sizeof(sess));
+	sess.sop.cipher = CRYPTO_AES_CBC;
+	sess.sop.keylen = KEY_SIZE;
+	sess.sop.key = key;
+	sess.flags = SOP_FLAG_TFM_SHARDS;
+	sess.shards = NPROCS - 1;
+	if (ioctl(cfd, CIOCGSESSION2, &sess)) {
+		perror("ioctl(CIOCGSESSION2)");
+		return 1;
+	}
+
+	if (encrypt(cfd, sess.sop.ses, plaintext, reference))
+		return 1;
+
+	/* Every transform has to be keyed as the one of the session */
+	for (i = 0; i < NPROCS; i++) {
+		pid = fork();
+		if (pid < 0) {
+			perror("fork()");
+			return 1;
+		}
+		if (pid)
+			continue;
+
+		for (j = 0; j < NOPS; j++) {
+			if (encrypt(cfd, sess.sop.ses, plaintext, ciphertext))
+				_exit(1);
+			if (memcmp(ciphertext, reference, DATA_SIZE) != 0) {
+				fprintf(stderr, "FAIL: Encrypted data of process %d are different.\n", i);
+				_exit(1);
+			}
+		}
+		_exit(0);
+	}
+
+	for (i = 0; i < NPROCS; i++) {
+		if (wait(&status) < 0 || !WIFEXITED(status) ||
+		    WEXITSTATUS(status) != 0)
+			failed = 1;
+	}
+	if (failed)
+		return 1;
+
+	if (debug)
+		printf("Test passed\n");
+
+	/* Finish crypto session */
+	if (ioctl(cfd, CIOCFSESSION, &sess.sop.ses)) {
+		perror("ioctl(CIOCFSESSION)");
+		return 1;
+	}
+
+	return 0;
+}
+int
+main(int argc, char** argv)
+{
+	int fd = -1, cfd = -1;
+
+	if (argc > 1) debug = 1;
+
+	/* Open the crypto device */
+	fd = open("/dev/crypto", O_RDWR, 0);
+	if (fd < 0) {
+		perror("open(/dev/crypto)");
+		return 1;
+	}
+
+	/* Clone file descriptor */
+	if (ioctl(fd, CRIOGET, &cfd)) {
+		perror("ioctl(CRIOGET)");
+		return 1;
+	}
+
+	/* Set close-on-exec (not really neede here) */
+	if (fcntl(cfd, F_SETFD, 1) == -1) {
+		perror("fcntl(F_SETFD)");
+		return 1;
+	}
+
+	/* Run the test itself */
+	if (test_crypto_shards(cfd))
+		return 1;
+
+	/* Close cloned descriptor */
+	if (close(cfd)) {
+		perror("close(cfd)");
+		return 1;
+	}
+
+	/* Close the original descriptor */
+	if (close(fd)) {
+		perror("close(fd)");
+		return 1;
+	}
+
+	return 0;
+}
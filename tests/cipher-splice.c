@@ -0,0 +1,290 @@
+/*
+ * Demo on how to use /dev/crypto device with read(), write() and
+ * sendfile() through a session.
+ *
+ * Placed under public domain.
+ *
+ */
+#define _GNU_SOURCE
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <errno.h>
+
+#include <sys/ioctl.h>
+#include <sys/sendfile.h>
+#include <crypto/cryptodev.h>
+
+static int debug = 0;
+
+#define	DATA_SIZE	(200 * 1024 + 5)
+#define	BLOCK_SIZE	16
+#define	KEY_SIZE	16
+
+static uint8_t plaintext[DATA_SIZE], reference[DATA_SIZE], output[DATA_SIZE];
+
+static int get_session(int cfd, int cipher, uint32_t *ses)
+{
+	struct session_op sess;
+	uint8_t key[KEY_SIZE];
+
+	memset(key, 0x33, sizeof(key));
+	memset(&sess, 0, sizeof(sess));
+	sess.cipher = cipher;
+	sess.keylen = KEY_SIZE;
+	sess.key = key;
+	if (ioctl(cfd, CIOCGSESSION, &sess)) {
+		perror("ioctl(CIOCGSESSION)");
+		return 1;
+	}
+	*ses = sess.ses;
+	return 0;
+}
+
+/* everything at once with CIOCCRYPT */
+static int crypt_reference(int cfd, uint32_t ses, int len)
+{
+	struct crypt_op cryp;
+	uint8_t iv[BLOCK_SIZE];
+
+	memset(iv, 0x03, sizeof(iv));
+	memset(&cryp, 0, sizeof(cryp));
+	cryp.ses = ses;
+	cryp.op = COP_ENCRYPT;
+	cryp.len = len;
+	cryp.src = plaintext;
+	cryp.dst = reference;
+	cryp.iv = iv;
+	if (ioctl(cfd, CIOCCRYPT, &cryp)) {
+		perror("ioctl(CIOCCRYPT)");
+		return 1;
+	}
+	return 0;
+}
+
+static int bind_stream(int cfd, uint32_t ses, uint8_t *iv)
+{
+	struct crypt_stream_op sop;
+
+	memset(&sop, 0, sizeof(sop));
+	sop.ses = ses;
+	sop.op = COP_ENCRYPT;
+	sop.iv = iv;
+	if (ioctl(cfd, CIOCSTREAM, &sop)) {
+		perror("ioctl(CIOCSTREAM)");
+		return 1;
+	}
+	return 0;
+}
+
+/* reads what the stream has ready to output + *done; EAGAIN is for
+ * nothing yet, and 0 for the end of the stream */
+static int drain(int cfd, int *done)
+{
+	ssize_t ret;
+
+	while ((ret = read(cfd, output + *done, DATA_SIZE - *done)) > 0)
+		*done += ret;
+	if (ret < 0 && errno != EAGAIN) {
+		perror("read()");
+		return 1;
+	}
+	return 0;
+}
+
+/* checks the poll() events of the stream */
+static int check_poll(int cfd, short expected)
+{
+	struct pollfd pfd;
+
+	pfd.fd = cfd;
+	pfd.events = POLLIN | POLLOUT;
+	if (poll(&pfd, 1, 0) < 0) {
+		perror("poll()");
+		return 1;
+	}
+	if (pfd.revents != expected) {
+		fprintf(stderr, "FAIL: poll() gave 0x%x instead of 0x%x.\n",
+			pfd.revents, expected);
+		return 1;
+	}
+	return 0;
+}
+
+/* writes in chunks that are not whole blocks, reading as it goes */
+static int test_write_read(int cfd, int cipher, int len)
+{
+	uint8_t iv[BLOCK_SIZE];
+	uint32_t ses;
+	int written = 0, done = 0, chunk;
+	ssize_t ret;
+
+	if (get_session(cfd, cipher, &ses) || crypt_reference(cfd, ses, len))
+		return 1;
+
+	memset(iv, 0x03, sizeof(iv));
+	if (bind_stream(cfd, ses, iv))
+		return 1;
+
+	/* nothing to read yet, which is not the end of the stream */
+	if (check_poll(cfd, POLLOUT))
+		return 1;
+	if (read(cfd, output, DATA_SIZE) >= 0 || errno != EAGAIN) {
+		fprintf(stderr, "FAIL: an empty stream did not give EAGAIN.\n");
+		return 1;
+	}
+
+	while (written < len) {
+		chunk = 1 + (written * 7 + 1001) % 9000;
+		if (chunk > len - written)
+			chunk = len - written;
+
+		ret = write(cfd, plaintext + written, chunk);
+		if (ret < 0 && errno == EAGAIN)
+			ret = 0;
+		else if (ret <= 0) {
+			perror("write()");
+			return 1;
+		}
+		written += ret;
+
+		if (drain(cfd, &done))
+			return 1;
+	}
+
+	/* the end of the stream releases the last partial block */
+	memset(iv, 0, sizeof(iv));
+	if (bind_stream(cfd, 0, iv) || drain(cfd, &done))
+		return 1;
+
+	if (done != len || memcmp(output, reference, len) != 0) {
+		fprintf(stderr, "FAIL: %d bytes out of %d, or they differ.\n",
+			done, len);
+		return 1;
+	}
+
+	if (write(cfd, plaintext, BLOCK_SIZE) >= 0 || errno != EINVAL) {
+		fprintf(stderr, "FAIL: a write after the end was taken.\n");
+		return 1;
+	}
+
+	if (ioctl(cfd, CIOCFSESSION, &ses)) {
+		perror("ioctl(CIOCFSESSION)");
+		return 1;
+	}
+	return 0;
+}
+
+/* sendfile() from a file into the stream */
+static int test_sendfile(int cfd)
+{
+	char name[] = "/tmp/cipher-spliceXXXXXX";
+	uint8_t iv[BLOCK_SIZE];
+	off_t off = 0;
+	uint32_t ses;
+	int fd, done = 0;
+	ssize_t ret;
+
+	if (get_session(cfd, CRYPTO_AES_CBC, &ses) ||
+	    crypt_reference(cfd, ses, DATA_SIZE - 5))
+		return 1;
+
+	fd = mkstemp(name);
+	if (fd < 0) {
+		perror("mkstemp()");
+		return 1;
+	}
+	unlink(name);
+	if (write(fd, plaintext, DATA_SIZE - 5) != DATA_SIZE - 5) {
+		perror("write(file)");
+		return 1;
+	}
+
+	memset(iv, 0x03, sizeof(iv));
+	if (bind_stream(cfd, ses, iv))
+		return 1;
+
+	while (off < DATA_SIZE - 5) {
+		ret = sendfile(cfd, fd, &off, DATA_SIZE - 5 - off);
+		if (ret < 0 && errno != EAGAIN) {
+			perror("sendfile()");
+			return 1;
+		}
+		if (drain(cfd, &done))
+			return 1;
+	}
+
+	if (bind_stream(cfd, 0, NULL) || drain(cfd, &done))
+		return 1;
+
+	if (done != DATA_SIZE - 5 ||
+	    memcmp(output, reference, DATA_SIZE - 5) != 0) {
+		fprintf(stderr, "FAIL: sendfile() into the stream gave %d bytes.\n",
+			done);
+		return 1;
+	}
+
+	close(fd);
+	if (ioctl(cfd, CIOCFSESSION, &ses)) {
+		perror("ioctl(CIOCFSESSION)");
+		return 1;
+	}
+	return 0;
+}
+
+int
+main(int argc, char** argv)
+{
+	int fd = -1, cfd = -1, i;
+
+	if (argc > 1) debug = 1;
+
+	for (i = 0; i < DATA_SIZE; i++)
+		plaintext[i] = i * 31;
+
+	/* Open the crypto device */
+	fd = open("/dev/crypto", O_RDWR, 0);
+	if (fd < 0) {
+		perror("open(/dev/crypto)");
+		return 1;
+	}
+
+	/* Clone file descriptor */
+	if (ioctl(fd, CRIOGET, &cfd)) {
+		perror("ioctl(CRIOGET)");
+		return 1;
+	}
+
+	/* Set close-on-exec (not really neede here) */
+	if (fcntl(cfd, F_SETFD, 1) == -1) {
+		perror("fcntl(F_SETFD)");
+		return 1;
+	}
+
+	/* Run the tests: CBC in whole blocks, CTR with a partial one */
+	if (test_write_read(cfd, CRYPTO_AES_CBC, DATA_SIZE - 5) ||
+	    test_write_read(cfd, CRYPTO_AES_CTR, DATA_SIZE) ||
+	    test_sendfile(cfd))
+		return 1;
+
+	if (debug)
+		printf("Test passed\n");
+
+	/* Close cloned descriptor */
+	if (close(cfd)) {
+		perror("close(cfd)");
+		return 1;
+	}
+
+	/* Close the original descriptor */
+	if (close(fd)) {
+		perror("close(fd)");
+		return 1;
+	}
+
+	return 0;
+}
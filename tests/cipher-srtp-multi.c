@@ -0,0 +1,274 @@
+/*
+ * Demo on how to use /dev/crypto device for SRTP packets in batches.
+ *
+ * Placed under public domain.
+ *
+ */
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+
+#include <sys/ioctl.h>
+#include <crypto/cryptodev.h>
+
+#define	NPACKETS	12
+#define	RTP_HEADER_SIZE	12
+#define	MAX_PAYLOAD	1200
+#define	ROC_SIZE	4
+#define	TAG_SIZE	10 /* HMAC-SHA1-80 */
+#define	PACKET_ROOM	(RTP_HEADER_SIZE + MAX_PAYLOAD + ROC_SIZE + TAG_SIZE)
+#define	BLOCK_SIZE	16
+#define	KEY_SIZE	16
+#define	SALT_SIZE	14
+
+#define	SSRC		0xdeadbeef
+/* the sequence numbers wrap in the middle of the packets */
+#define	FIRST_SEQ	0xfffa
+
+static int debug = 0;
+
+static const uint8_t key[KEY_SIZE] = {
+	0xe1, 0xf9, 0x7a, 0x0d, 0x3e, 0x01, 0x8b, 0xe0,
+	0xd6, 0x4f, 0xa3, 0x2c, 0x06, 0xde, 0x41, 0x39 };
+static const uint8_t mackey[20] = {
+	0x0b, 0x0b, 0x0b, 0x0b, 0x0b, 0x0b, 0x0b, 0x0b, 0x0b, 0x0b,
+	0x0b, 0x0b, 0x0b, 0x0b, 0x0b, 0x0b, 0x0b, 0x0b, 0x0b, 0x0b };
+static const uint8_t salt[BLOCK_SIZE] = {
+	0x0e, 0xc6, 0x75, 0xad, 0x49, 0x8a, 0xfe, 0xeb,
+	0xb6, 0x96, 0x0b, 0x3a, 0xab, 0xe6 };
+
+static int payload_len(int i)
+{
+	return 160 + (i * 97) % (MAX_PAYLOAD - 160);
+}
+
+static void put_be32(uint8_t *p, uint32_t v)
+{
+	p[0] = v >> 24;
+	p[1] = v >> 16;
+	p[2] = v >> 8;
+	p[3] = v;
+}
+
+static void rtp_packet(uint8_t *p, int i)
+{
+	uint16_t seq = FIRST_SEQ + i;
+
+	memset(p, i, PACKET_ROOM);
+	p[0] = 0x80;	/* version 2 */
+	p[1] = 0;	/* PCMU */
+	p[2] = seq >> 8;
+	p[3] = seq & 0xff;
+	put_be32(p + 4, 160 * i);
+	put_be32(p + 8, SSRC);
+}
+
+static int srtp_session(int cfd, uint32_t flags, uint32_t *ses)
+{
+	struct session2_op sess;
+
+	memset(&sess, 0, sizeof(sess));
+	sess.sop.cipher = CRYPTO_AES_CTR;
+	sess.sop.keylen = KEY_SIZE;
+	sess.sop.key = (uint8_t *)key;
+	sess.sop.mac = CRYPTO_SHA1_HMAC;
+	sess.sop.mackeylen = sizeof(mackey);
+	sess.sop.mackey = (uint8_t *)mackey;
+	sess.flags = flags;
+	sess.iv = (uint8_t *)salt;
+	if (ioctl(cfd, CIOCGSESSION2, &sess)) {
+		perror("ioctl(CIOCGSESSION2)");
+		return 1;
+	}
+	*ses = sess.sop.ses;
+	return 0;
+}
+
+/* Encrypts packet i with a plain session and the IV and the rollover
+ * counter of RFC 3711 worked out here, with the counter placed after
+ * the payload where the tag goes */
+static int
+srtp_reference(int cfd, uint32_t ses, uint8_t *p, int i, uint32_t roc)
+{
+	uint8_t iv[BLOCK_SIZE], tag[20];
+	struct crypt_auth_op cao;
+	int len = payload_len(i);
+	uint64_t index = ((uint64_t)roc << 16) | (uint16_t)(FIRST_SEQ + i);
+	int j;
+
+	memcpy(iv, salt, BLOCK_SIZE);
+	iv[4] ^= SSRC >> 24;
+	iv[5] ^= SSRC >> 16;
+	iv[6] ^= SSRC >> 8;
+	iv[7] ^= SSRC & 0xff;
+	for (j = 13; j >= 8; j--, index >>= 8)
+		iv[j] ^= index & 0xff;
+
+	put_be32(p + RTP_HEADER_SIZE + len, roc);
+
+	memset(&cao, 0, sizeof(cao));
+	cao.ses = ses;
+	cao.op = COP_ENCRYPT;
+	cao.flags = COP_FLAG_AEAD_SRTP_TYPE;
+	cao.len = len;
+	cao.auth_src = p;
+	cao.auth_len = RTP_HEADER_SIZE + len + ROC_SIZE;
+	cao.src = p + RTP_HEADER_SIZE;
+	cao.dst = cao.src;
+	cao.iv = iv;
+	cao.tag = tag;
+	cao.tag_len = TAG_SIZE;
+	if (ioctl(cfd, CIOCAUTHCRYPT, &cao)) {
+		perror("ioctl(CIOCAUTHCRYPT)");
+		return 1;
+	}
+
+	/* the tag replaces the counter */
+	memcpy(p + RTP_HEADER_SIZE + len, tag, TAG_SIZE);
+	return 0;
+}
+
+static int
+test_srtp_multi(int cfd)
+{
+	static uint8_t pkts[NPACKETS][PACKET_ROOM], ref[NPACKETS][PACKET_ROOM];
+	struct crypt_srtp_packet packets[NPACKETS];
+	struct crypt_srtp_multi_op smo;
+	uint32_t sender, receiver, plain;
+	int i, len;
+
+	if (srtp_session(cfd, SOP_FLAG_SRTP, &sender) ||
+	    srtp_session(cfd, SOP_FLAG_SRTP, &receiver) ||
+	    srtp_session(cfd, 0, &plain))
+		return 1;
+
+	for (i = 0; i < NPACKETS; i++) {
+		rtp_packet(pkts[i], i);
+		rtp_packet(ref[i], i);
+		packets[i].buf = pkts[i];
+		packets[i].len = RTP_HEADER_SIZE + payload_len(i);
+		packets[i].hdr_len = RTP_HEADER_SIZE;
+		packets[i].__reserved = 0;
+	}
+
+	memset(&smo, 0, sizeof(smo));
+	smo.ses = sender;
+	smo.op = COP_ENCRYPT;
+	smo.count = NPACKETS;
+	smo.tag_len = TAG_SIZE;
+	smo.packets = packets;
+	if (ioctl(cfd, CIOCSRTPMULTI, &smo)) {
+		perror("ioctl(CIOCSRTPMULTI)");
+		return 1;
+	}
+
+	for (i = 0; i < NPACKETS; i++) {
+		uint32_t roc = (uint16_t)(FIRST_SEQ + i) < FIRST_SEQ;
+
+		len = RTP_HEADER_SIZE + payload_len(i);
+		if (packets[i].status || packets[i].len != len + TAG_SIZE ||
+		    packets[i].roc != roc) {
+			fprintf(stderr, "FAIL: packet %d: status %d, length %u, roc %u.\n",
+				i, packets[i].status, packets[i].len, packets[i].roc);
+			return 1;
+		}
+
+		if (srtp_reference(cfd, plain, ref[i], i, roc))
+			return 1;
+		if (memcmp(pkts[i], ref[i], len + TAG_SIZE) != 0) {
+			fprintf(stderr, "FAIL: packet %d of CIOCSRTPMULTI is different.\n", i);
+			return 1;
+		}
+	}
+
+	/* the receiver gets them back, except one that is tampered with */
+	pkts[NPACKETS / 2][RTP_HEADER_SIZE] ^= 1;
+
+	smo.ses = receiver;
+	smo.op = COP_DECRYPT;
+	if (ioctl(cfd, CIOCSRTPMULTI, &smo)) {
+		perror("ioctl(CIOCSRTPMULTI)");
+		return 1;
+	}
+
+	for (i = 0; i < NPACKETS; i++) {
+		if (i == NPACKETS / 2) {
+			if (packets[i].status != -EBADMSG) {
+				fprintf(stderr, "FAIL: the tampered packet got %d.\n",
+					packets[i].status);
+				return 1;
+			}
+			continue;
+		}
+
+		len = RTP_HEADER_SIZE + payload_len(i);
+		rtp_packet(ref[i], i);
+		if (packets[i].status || packets[i].len != len ||
+		    memcmp(pkts[i], ref[i], len) != 0) {
+			fprintf(stderr, "FAIL: packet %d was not decrypted (status %d).\n",
+				i, packets[i].status);
+			return 1;
+		}
+	}
+
+	if (debug)
+		printf("Test passed\n");
+
+	/* Finish crypto sessions */
+	if (ioctl(cfd, CIOCFSESSION, &sender) ||
+	    ioctl(cfd, CIOCFSESSION, &receiver) ||
+	    ioctl(cfd, CIOCFSESSION, &plain)) {
+		perror("ioctl(CIOCFSESSION)");
+		return 1;
+	}
+
+	return 0;
+}
+
+int
+main(int argc, char** argv)
+{
+	int fd = -1, cfd = -1;
+
+	if (argc > 1) debug = 1;
+
+	/* Open the crypto device */
+	fd = open("/dev/crypto", O_RDWR, 0);
+	if (fd < 0) {
+		perror("open(/dev/crypto)");
+		return 1;
+	}
+
+	/* Clone file descriptor */
+	if (ioctl(fd, CRIOGET, &cfd)) {
+		perror("ioctl(CRIOGET)");
+		return 1;
+	}
+
+	/* Set close-on-exec (not really neede here) */
+	if (fcntl(cfd, F_SETFD, 1) == -1) {
+		perror("fcntl(F_SETFD)");
+		return 1;
+	}
+
+	/* Run the test itself */
+	if (test_srtp_multi(cfd))
+		return 1;
+
+	/* Close cloned descriptor */
+	if (close(cfd)) {
+		perror("close(cfd)");
+		return 1;
+	}
+
+	/* Close the original descriptor */
+	if (close(fd)) {
+		perror("close(fd)");
+		return 1;
+	}
+
+	return 0;
+}
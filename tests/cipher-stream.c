@@ -0,0 +1,178 @@
+/*
+ * Demo on how to use /dev/crypto device for ciphering and hashing data
+ * larger than a window of pinned pages.
+ *
+ * Placed under public domain.
+ *
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <stdint.h>
+
+#include <sys/ioctl.h>
+#include <crypto/cryptodev.h>
+
+static int debug = 0;
+
+/* a few windows and a part of one */
+#define	DATA_SIZE	(4 * 1024 * 1024 + 16384)
+#define	BLOCK_SIZE	16
+#define	KEY_SIZE	16
+#define SHA1_HASH_LEN   20
+
+/* run cryp once in zero-copy and once copying, with the same IV */
+static int
+run_both_ways(int cfd, struct crypt_op *cryp, uint8_t *dst, uint8_t *refdst,
+		uint8_t *mac, uint8_t *refmac)
+{
+	uint8_t iv[BLOCK_SIZE];
+
+	memset(iv, 0x03, sizeof(iv));
+	cryp->iv = iv;
+	cryp->dst = dst;
+	cryp->mac = mac;
+	cryp->flags = 0;
+	if (ioctl(cfd, CIOCCRYPT, cryp)) {
+		perror("ioctl(CIOCCRYPT)");
+		return 1;
+	}
+
+	memset(iv, 0x03, sizeof(iv));
+	cryp->dst = refdst;
+	cryp->mac = refmac;
+	cryp->flags = COP_FLAG_NO_ZC;
+	if (ioctl(cfd, CIOCCRYPT, cryp)) {
+		perror("ioctl(CIOCCRYPT)");
+		return 1;
+	}
+
+	return 0;
+}
+
+static int
+test_crypto_stream(int cfd)
+{
+	uint8_t *plaintext, *ciphertext, *reference;
+	uint8_t key[KEY_SIZE];
+	uint8_t mac[AALG_MAX_RESULT_LEN], refmac[AALG_MAX_RESULT_LEN];
+	struct session_op cipher_sess, hash_sess;
+	struct crypt_op cryp;
+
+	if (posix_memalign((void **)&plaintext, 4096, DATA_SIZE) ||
+	    posix_memalign((void **)&ciphertext, 4096, DATA_SIZE) ||
+	    posix_memalign((void **)&reference, 4096, DATA_SIZE)) {
+		perror("posix_memalign()");
+		return 1;
+	}
+	memset(plaintext, 0x15, DATA_SIZE);
+	memset(key, 0x33, sizeof(key));
+
+	memset(&cipher_sess, 0, sizeof(cipher_sess));
+	cipher_sess.cipher = CRYPTO_AES_CBC;
+	cipher_sess.keylen = KEY_SIZE;
+	cipher_sess.key = key;
+	if (ioctl(cfd, CIOCGSESSION, &cipher_sess)) {
+		perror("ioctl(CIOCGSESSION)");
+		return 1;
+	}
+
+	memset(&hash_sess, 0, sizeof(hash_sess));
+	hash_sess.mac = CRYPTO_SHA1;
+	if (ioctl(cfd, CIOCGSESSION, &hash_sess)) {
+		perror("ioctl(CIOCGSESSION)");
+		return 1;
+	}
+
+	/* The IV has to be carried from a window to the next */
+	memset(&cryp, 0, sizeof(cryp));
+	cryp.ses = cipher_sess.ses;
+	cryp.len = DATA_SIZE;
+	cryp.src = plaintext;
+	cryp.op = COP_ENCRYPT;
+	if (run_both_ways(cfd, &cryp, ciphertext, reference, NULL, NULL))
+		return 1;
+
+	if (memcmp(ciphertext, reference, DATA_SIZE) != 0) {
+		fprintf(stderr, "FAIL: Encrypted data are different from the copied ones.\n");
+		return 1;
+	}
+
+	/* The digest has to cover all the windows */
+	memset(&cryp, 0, sizeof(cryp));
+	cryp.ses = hash_sess.ses;
+	cryp.len = DATA_SIZE;
+	cryp.src = ciphertext;
+	cryp.op = COP_ENCRYPT;
+	if (run_both_ways(cfd, &cryp, NULL, NULL, mac, refmac))
+		return 1;
+
+	if (memcmp(mac, refmac, SHA1_HASH_LEN) != 0) {
+		fprintf(stderr, "FAIL: Digest is different from the one of the copied data.\n");
+		return 1;
+	}
+
+	if (debug)
+		printf("Test passed\n");
+
+	/* Finish crypto sessions */
+	if (ioctl(cfd, CIOCFSESSION, &cipher_sess.ses)) {
+		perror("ioctl(CIOCFSESSION)");
+		return 1;
+	}
+	if (ioctl(cfd, CIOCFSESSION, &hash_sess.ses)) {
+		perror("ioctl(CIOCFSESSION)");
+		return 1;
+	}
+
+	free(plaintext);
+	free(ciphertext);
+	free(reference);
+	return 0;
+}
+int
+main(int argc, char** argv)
+{
+	int fd = -1, cfd = -1;
+
+	if (argc > 1) debug = 1;
+
+	/* Open the crypto device */
+	fd = open("/dev/crypto", O_RDWR, 0);
+	if (fd < 0) {
+		perror("open(/dev/crypto)");
+		return 1;
+	}
+
+	/* Clone file descriptor */
+	if (ioctl(fd, CRIOGET, &cfd)) {
+		perror("ioctl(CRIOGET)");
+		return 1;
+	}
+
+	/* Set close-on-exec (not really neede here) */
+	if (fcntl(cfd, F_SETFD, 1) == -1) {
+		perror("fcntl(F_SETFD)");
+		return 1;
+	}
+
+	/* Run the test itself */
+	if (test_crypto_stream(cfd))
+		return 1;
+
+	/* Close cloned descriptor */
+	if (close(cfd)) {
+		perror("close(cfd)");
+		return 1;
+	}
+
+	/* Close the original descriptor */
+	if (close(fd)) {
+		perror("close(fd)");
+		return 1;
+	}
+
+	return 0;
+}
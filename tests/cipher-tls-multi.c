@@ -0,0 +1,217 @@
+/*
+ * Demo on how to use /dev/crypto device for TLS records in batches.
+ *
+ * Placed under public domain.
+ *
+ */
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+
+#include <sys/ioctl.h>
+#include <crypto/cryptodev.h>
+
+#define	NRECS		8
+#define	MAX_REC		1500
+/* room for the MAC and the padding */
+#define	REC_ROOM	(MAX_REC + 64)
+#define	BLOCK_SIZE	16
+#define	KEY_SIZE	16
+#define	TLS_AAD_SIZE	13
+
+#define	TLS_TYPE	23
+#define	TLS_VERSION	0x0303
+#define	TLS_SEQ		0x0102030405060708ULL
+
+static int debug = 0;
+
+static void tls_aad(uint8_t *aad, uint64_t seq, int len)
+{
+	int i;
+
+	for (i = 7; i >= 0; i--, seq >>= 8)
+		aad[i] = seq & 0xff;
+	aad[8] = TLS_TYPE;
+	aad[9] = TLS_VERSION >> 8;
+	aad[10] = TLS_VERSION & 0xff;
+	aad[11] = len >> 8;
+	aad[12] = len & 0xff;
+}
+
+static int rec_len(int i)
+{
+	return 1 + (i * 331) % MAX_REC;
+}
+
+static int
+test_tls_multi(int cfd)
+{
+	static uint8_t recs[NRECS][REC_ROOM], ref[NRECS][REC_ROOM];
+	uint8_t iv[BLOCK_SIZE], ref_iv[BLOCK_SIZE];
+	uint8_t key[KEY_SIZE], aad[TLS_AAD_SIZE];
+	struct crypt_tls_record records[NRECS];
+	struct crypt_tls_multi_op tmo;
+	struct crypt_auth_op cao;
+	struct session_op sess;
+	int i;
+
+	memset(key, 0x33, sizeof(key));
+	memset(&sess, 0, sizeof(sess));
+	sess.cipher = CRYPTO_AES_CBC;
+	sess.keylen = KEY_SIZE;
+	sess.key = key;
+	sess.mac = CRYPTO_SHA1_HMAC;
+	sess.mackeylen = 16;
+	sess.mackey = (uint8_t*)"\x0b\x0b\x0b\x0b\x0b\x0b\x0b\x0b\x0b\x0b\x0b\x0b\x0b\x0b\x0b\x0b";
+	if (ioctl(cfd, CIOCGSESSION, &sess)) {
+		perror("ioctl(CIOCGSESSION)");
+		return 1;
+	}
+
+	for (i = 0; i < NRECS; i++) {
+		memset(recs[i], i, REC_ROOM);
+		memset(ref[i], i, REC_ROOM);
+		records[i].buf = recs[i];
+		records[i].len = rec_len(i);
+	}
+
+	memset(iv, 0x03, sizeof(iv));
+	memset(&tmo, 0, sizeof(tmo));
+	tmo.ses = sess.ses;
+	tmo.op = COP_ENCRYPT;
+	tmo.flags = COP_FLAG_WRITE_IV;
+	tmo.count = NRECS;
+	tmo.type = TLS_TYPE;
+	tmo.version = TLS_VERSION;
+	tmo.seq = TLS_SEQ;
+	tmo.records = records;
+	tmo.iv = iv;
+	if (ioctl(cfd, CIOCTLSMULTI, &tmo)) {
+		perror("ioctl(CIOCTLSMULTI)");
+		return 1;
+	}
+
+	/* each record must be as a CIOCAUTHCRYPT with the same associated
+	 * data and the IV of the previous record makes it */
+	memset(ref_iv, 0x03, sizeof(ref_iv));
+	for (i = 0; i < NRECS; i++) {
+		tls_aad(aad, TLS_SEQ + i, rec_len(i));
+
+		memset(&cao, 0, sizeof(cao));
+		cao.ses = sess.ses;
+		cao.op = COP_ENCRYPT;
+		cao.flags = COP_FLAG_AEAD_TLS_TYPE | COP_FLAG_WRITE_IV;
+		cao.auth_src = aad;
+		cao.auth_len = sizeof(aad);
+		cao.len = rec_len(i);
+		cao.src = ref[i];
+		cao.dst = ref[i];
+		cao.iv = ref_iv;
+		if (ioctl(cfd, CIOCAUTHCRYPT, &cao)) {
+			perror("ioctl(CIOCAUTHCRYPT)");
+			return 1;
+		}
+
+		if (records[i].status != 0 || records[i].len != cao.len) {
+			fprintf(stderr, "FAIL: record %d: status %d, length %u instead of %u.\n",
+				i, records[i].status, records[i].len, cao.len);
+			return 1;
+		}
+		if (memcmp(recs[i], ref[i], cao.len) != 0) {
+			fprintf(stderr, "FAIL: record %d of CIOCTLSMULTI is different.\n", i);
+			return 1;
+		}
+	}
+	if (memcmp(iv, ref_iv, BLOCK_SIZE) != 0) {
+		fprintf(stderr, "FAIL: the IV of CIOCTLSMULTI is different.\n");
+		return 1;
+	}
+
+	/* a record that is tampered with fails alone */
+	recs[NRECS / 2][0] ^= 1;
+
+	memset(iv, 0x03, sizeof(iv));
+	tmo.op = COP_DECRYPT;
+	if (ioctl(cfd, CIOCTLSMULTI, &tmo)) {
+		perror("ioctl(CIOCTLSMULTI)");
+		return 1;
+	}
+
+	for (i = 0; i < NRECS; i++) {
+		if (i == NRECS / 2) {
+			if (records[i].status != -EBADMSG) {
+				fprintf(stderr, "FAIL: the tampered record got %d.\n",
+					records[i].status);
+				return 1;
+			}
+			continue;
+		}
+
+		memset(ref[i], i, REC_ROOM);
+		if (records[i].status != 0 || records[i].len != rec_len(i) ||
+		    memcmp(recs[i], ref[i], rec_len(i)) != 0) {
+			fprintf(stderr, "FAIL: record %d was not decrypted (status %d).\n",
+				i, records[i].status);
+			return 1;
+		}
+	}
+
+	if (debug)
+		printf("Test passed\n");
+
+	/* Finish crypto session */
+	if (ioctl(cfd, CIOCFSESSION, &sess.ses)) {
+		perror("ioctl(CIOCFSESSION)");
+		return 1;
+	}
+
+	return 0;
+}
+
+int
+main(int argc, char** argv)
+{
+	int fd = -1, cfd = -1;
+
+	if (argc > 1) debug = 1;
+
+	/* Open the crypto device */
+	fd = open("/dev/crypto", O_RDWR, 0);
+	if (fd < 0) {
+		perror("open(/dev/crypto)");
+		return 1;
+	}
+
+	/* Clone file descriptor */
+	if (ioctl(fd, CRIOGET, &cfd)) {
+		perror("ioctl(CRIOGET)");
+		return 1;
+	}
+
+	/* Set close-on-exec (not really neede here) */
+	if (fcntl(cfd, F_SETFD, 1) == -1) {
+		perror("fcntl(F_SETFD)");
+		return 1;
+	}
+
+	/* Run the test itself */
+	if (test_tls_multi(cfd))
+		return 1;
+
+	/* Close cloned descriptor */
+	if (close(cfd)) {
+		perror("close(cfd)");
+		return 1;
+	}
+
+	/* Close the original descriptor */
+	if (close(fd)) {
+		perror("close(fd)");
+		return 1;
+	}
+
+	return 0;
+}
@@ -0,0 +1,146 @@
+/*
+ * Demo on how to use /dev/crypto device for ciphering buffers that are
+ * not aligned as the driver wants.
+ *
+ * Placed under public domain.
+ *
+ */
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <stdint.h>
+
+#include <sys/ioctl.h>
+#include <crypto/cryptodev.h>
+
+static int debug = 0;
+
+#define	DATA_SIZE	(3 * 4096 + 512)
+#define	BLOCK_SIZE	16
+#define	KEY_SIZE	16
+
+/* encrypt DATA_SIZE bytes of src into dst, in zero-copy or copying them */
+static int
+encrypt(int cfd, uint32_t ses, uint8_t *src, uint8_t *dst, int flags)
+{
+	uint8_t iv[BLOCK_SIZE];
+	struct crypt_op cryp;
+
+	memset(iv, 0x03, sizeof(iv));
+	memset(&cryp, 0, sizeof(cryp));
+	cryp.ses = ses;
+	cryp.len = DATA_SIZE;
+	cryp.src = src;
+	cryp.dst = dst;
+	cryp.iv = iv;
+	cryp.op = COP_ENCRYPT;
+	cryp.flags = flags;
+	if (ioctl(cfd, CIOCCRYPT, &cryp)) {
+		perror("ioctl(CIOCCRYPT)");
+		return 1;
+	}
+	return 0;
+}
+
+static int
+test_crypto_unaligned(int cfd)
+{
+	static uint8_t plaintext_raw[DATA_SIZE + 4096];
+	static uint8_t ciphertext_raw[DATA_SIZE + 4096];
+	static uint8_t reference[DATA_SIZE];
+	uint8_t *plaintext, *ciphertext;
+	uint8_t key[KEY_SIZE];
+	struct session_op sess;
+
+	/* a byte and three bytes past a page boundary */
+	plaintext = (uint8_t *)((((unsigned long)plaintext_raw + 4095) & ~4095UL) + 1);
+	ciphertext = (uint8_t *)((((unsigned long)ciphertext_raw + 4095) & ~4095UL) + 3);
+	memset(plaintext, 0x15, DATA_SIZE);
+	memset(key, 0x33, sizeof(key));
+
+	memset(&sess, 0, sizeof(sess));
+	sess.cipher = CRYPTO_AES_CBC;
+	sess.keylen = KEY_SIZE;
+	sess.key = key;
+	if (ioctl(cfd, CIOCGSESSION, &sess)) {
+		perror("ioctl(CIOCGSESSION)");
+		return 1;
+	}
+
+	if (encrypt(cfd, sess.ses, plaintext, reference, COP_FLAG_NO_ZC))
+		return 1;
+
+	/* Separate buffers, unaligned differently */
+	if (encrypt(cfd, sess.ses, plaintext, ciphertext, 0))
+		return 1;
+
+	if (memcmp(ciphertext, reference, DATA_SIZE) != 0) {
+		fprintf(stderr, "FAIL: Encrypted data are different from the copied ones.\n");
+		return 1;
+	}
+
+	/* In place */
+	if (encrypt(cfd, sess.ses, plaintext, plaintext, 0))
+		return 1;
+
+	if (memcmp(plaintext, reference, DATA_SIZE) != 0) {
+		fprintf(stderr, "FAIL: Data encrypted in place are different from the copied ones.\n");
+		return 1;
+	}
+
+	if (debug)
+		printf("Test passed\n");
+
+	/* Finish crypto session */
+	if (ioctl(cfd, CIOCFSESSION, &sess.ses)) {
+		perror("ioctl(CIOCFSESSION)");
+		return 1;
+	}
+
+	return 0;
+}
+int
+main(int argc, char** argv)
+{
+	int fd = -1, cfd = -1;
+
+	if (argc > 1) debug = 1;
+
+	/* Open the crypto device */
+	fd = open("/dev/crypto", O_RDWR, 0);
+	if (fd < 0) {
+		perror("open(/dev/crypto)");
+		return 1;
+	}
+
+	/* Clone file descriptor */
+	if (ioctl(fd, CRIOGET, &cfd)) {
+		perror("ioctl(CRIOGET)");
+		return 1;
+	}
+
+	/* Set close-on-exec (not really neede here) */
+	if (fcntl(cfd, F_SETFD, 1) == -1) {
+		perror("fcntl(F_SETFD)");
+		return 1;
+	}
+
+	/* Run the test itself */
+	if (test_crypto_unaligned(cfd))
+		return 1;
+
+	/* Close cloned descriptor */
+	if (close(cfd)) {
+		perror("close(cfd)");
+		return 1;
+	}
+
+	/* Close the original descriptor */
+	if (close(fd)) {
+		perror("close(fd)");
+		return 1;
+	}
+
+	return 0;
+}
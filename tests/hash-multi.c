@@ -0,0 +1,131 @@
+/*
+ * Demo on how to use /dev/crypto device for hashing many buffers at once.
+ *
+ * Placed under public domain.
+ *
+ */
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <stdint.h>
+
+#include <sys/ioctl.h>
+#include <crypto/cryptodev.h>
+
+static int debug = 0;
+
+#define	NBUFS		40
+#define	MAX_SIZE	600
+#define SHA1_HASH_LEN   20
+
+static int
+test_hash_multi(int cfd)
+{
+	static uint8_t data[NBUFS][MAX_SIZE];
+	uint8_t digests[NBUFS][SHA1_HASH_LEN];
+	uint8_t mac[AALG_MAX_RESULT_LEN];
+	struct crypt_iovec bufs[NBUFS];
+	struct crypt_hash_multi_op hop;
+	struct session_op sess;
+	struct crypt_op cryp;
+	int i;
+
+	memset(&sess, 0, sizeof(sess));
+	sess.mac = CRYPTO_SHA1;
+	if (ioctl(cfd, CIOCGSESSION, &sess)) {
+		perror("ioctl(CIOCGSESSION)");
+		return 1;
+	}
+
+	/* buffers of different sizes, the first one empty */
+	for (i = 0; i < NBUFS; i++) {
+		memset(data[i], i, MAX_SIZE);
+		bufs[i].base = data[i];
+		bufs[i].len = (i * 97) % MAX_SIZE;
+	}
+
+	memset(&hop, 0, sizeof(hop));
+	hop.ses = sess.ses;
+	hop.count = NBUFS;
+	hop.bufs = bufs;
+	hop.digests = (uint8_t *)digests;
+	if (ioctl(cfd, CIOCHASHMULTI, &hop)) {
+		perror("ioctl(CIOCHASHMULTI)");
+		return 1;
+	}
+
+	/* each digest must be the one of a separate operation */
+	for (i = 0; i < NBUFS; i++) {
+		memset(&cryp, 0, sizeof(cryp));
+		cryp.ses = sess.ses;
+		cryp.len = bufs[i].len;
+		cryp.src = data[i];
+		cryp.mac = mac;
+		cryp.op = COP_ENCRYPT;
+		if (ioctl(cfd, CIOCCRYPT, &cryp)) {
+			perror("ioctl(CIOCCRYPT)");
+			return 1;
+		}
+
+		if (memcmp(mac, digests[i], SHA1_HASH_LEN) != 0) {
+			fprintf(stderr, "FAIL: digest %d of CIOCHASHMULTI is different.\n", i);
+			return 1;
+		}
+	}
+
+	if (debug)
+		printf("Test passed\n");
+
+	/* Finish crypto session */
+	if (ioctl(cfd, CIOCFSESSION, &sess.ses)) {
+		perror("ioctl(CIOCFSESSION)");
+		return 1;
+	}
+
+	return 0;
+}
+int
+main(int argc, char** argv)
+{
+	int fd = -1, cfd = -1;
+
+	if (argc > 1) debug = 1;
+
+	/* Open the crypto device */
+	fd = open("/dev/crypto", O_RDWR, 0);
+	if (fd < 0) {
+		perror("open(/dev/crypto)");
+		return 1;
+	}
+
+	/* Clone file descriptor */
+	if (ioctl(fd, CRIOGET, &cfd)) {
+		perror("ioctl(CRIOGET)");
+		return 1;
+	}
+
+	/* Set close-on-exec (not really neede here) */
+	if (fcntl(cfd, F_SETFD, 1) == -1) {
+		perror("fcntl(F_SETFD)");
+		return 1;
+	}
+
+	/* Run the test itself */
+	if (test_hash_multi(cfd))
+		return 1;
+
+	/* Close cloned descriptor */
+	if (close(cfd)) {
+		perror("close(cfd)");
+		return 1;
+	}
+
+	/* Close the original descriptor */
+	if (close(fd)) {
+		perror("close(fd)");
+		return 1;
+	}
+
+	return 0;
+}
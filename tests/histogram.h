@@ -0,0 +1,81 @@
+/*
+ * Latency histograms shared between the benchmark programs.
+ *
+ * Values are counted in buckets of 1/HIST_SUB of a power of two of
+ * nanoseconds, as in HDR histograms: any value is within 1/HIST_SUB
+ * (3%) of its bucket, from nanoseconds to minutes, with a fixed array.
+ */
+#ifndef _HISTOGRAM_H
+#define _HISTOGRAM_H
+
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+
+#define HIST_SUB_BITS	5
+#define HIST_SUB	(1 << HIST_SUB_BITS)
+#define HIST_BUCKETS	(64 * HIST_SUB)
+
+/* not slewed by NTP, so that short intervals are measured as they are */
+static inline uint64_t hist_now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC_RAW, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static inline unsigned int hist_bucket(uint64_t ns)
+{
+	int shift;
+
+	if (ns < HIST_SUB)
+		return ns;
+	shift = 63 - __builtin_clzll(ns) - HIST_SUB_BITS;
+	return (shift + 1) * HIST_SUB + ((ns >> shift) & (HIST_SUB - 1));
+}
+
+/* the lowest value of a bucket */
+static inline uint64_t hist_value(unsigned int bucket)
+{
+	unsigned int shift;
+
+	if (bucket < HIST_SUB)
+		return bucket;
+	shift = bucket / HIST_SUB - 1;
+	return (uint64_t)(HIST_SUB + bucket % HIST_SUB) << shift;
+}
+
+static inline void hist_add(uint64_t *hist, uint64_t ns)
+{
+	unsigned int b = hist_bucket(ns);
+
+	hist[b < HIST_BUCKETS ? b : HIST_BUCKETS - 1]++;
+}
+
+static inline void hist_merge(uint64_t *hist, const uint64_t *other)
+{
+	unsigned int i;
+
+	for (i = 0; i < HIST_BUCKETS; i++)
+		hist[i] += other[i];
+}
+
+/* the latency in microseconds that a fraction p of the values do not
+ * exceed; p = 1 gives the largest one */
+static inline double hist_percentile(const uint64_t *hist, double p)
+{
+	uint64_t total = 0, seen = 0;
+	unsigned int i;
+
+	for (i = 0; i < HIST_BUCKETS; i++)
+		total += hist[i];
+	for (i = 0; i < HIST_BUCKETS; i++) {
+		seen += hist[i];
+		if (total && seen >= p * total)
+			return hist_value(i) / 1000.0;
+	}
+	return 0;
+}
+
+#endif /* _HISTOGRAM_H */
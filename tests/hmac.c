@@ -9,6 +9,7 @@
 #include <unistd.h>
 #include <fcntl.h>
 #include <stdint.h>
+#include <errno.h>
 
 #include <sys/ioctl.h>
 #include <crypto/cryptodev.h>
@@ -288,6 +289,71 @@ test_extras(int cfd)
 	return 0;
 }
 
+/* COP_FLAG_VERIFY: the module checks the MAC (RFC 2202, test case 2) */
+static int
+test_verify(int cfd)
+{
+	struct session_op sess;
+	struct crypt_op cryp;
+	uint8_t mac[SHA1_HASH_LEN];
+	uint8_t sha1_hmac_out[] = "\xef\xfc\xdf\x6a\xe5\xeb\x2f\xa2\xd2\x74\x16\xd5\xf1\x84\xdf\x9c\x25\x9a\x7c\x79";
+	struct {
+		int len;
+		int flip;
+		int result;
+	} checks[] = {
+		{ 0, 0, 0 },		/* the whole digest */
+		{ 10, 0, 0 },		/* HMAC-SHA1-80 */
+		{ 10, 1, EBADMSG },
+		{ 0, 1, EBADMSG },
+		{ SHA1_HASH_LEN + 1, 0, EINVAL },
+	};
+	unsigned int i;
+
+	memset(&sess, 0, sizeof(sess));
+	sess.mac = CRYPTO_SHA1_HMAC;
+	sess.mackeylen = 4;
+	sess.mackey = (uint8_t *)"Jefe";
+	if (ioctl(cfd, CIOCGSESSION, &sess)) {
+		perror("ioctl(CIOCGSESSION)");
+		return 1;
+	}
+
+	for (i = 0; i < sizeof(checks) / sizeof(checks[0]); i++) {
+		memcpy(mac, sha1_hmac_out, SHA1_HASH_LEN);
+		if (checks[i].flip)
+			mac[checks[i].len ? checks[i].len - 1 : 0] ^= 1;
+
+		memset(&cryp, 0, sizeof(cryp));
+		cryp.ses = sess.ses;
+		cryp.len = sizeof("what do ya want for nothing?")-1;
+		cryp.src = "what do ya want for nothing?";
+		cryp.mac = mac;
+		cryp.op = COP_ENCRYPT;
+		cryp.flags = COP_FLAG_VERIFY | COP_VERIFY_LEN(checks[i].len);
+		if ((ioctl(cfd, CIOCCRYPT, &cryp) ? errno : 0) != checks[i].result) {
+			fprintf(stderr, "HMAC verify test %u: failed\n", i);
+			return 1;
+		}
+
+		/* the MAC is only read */
+		if (!checks[i].flip &&
+		    memcmp(mac, sha1_hmac_out, SHA1_HASH_LEN) != 0) {
+			fprintf(stderr, "HMAC verify test %u: mac written\n", i);
+			return 1;
+		}
+	}
+	if (debug)
+		fprintf(stderr, "HMAC verify test: passed\n");
+
+	/* Finish crypto session */
+	if (ioctl(cfd, CIOCFSESSION, &sess.ses)) {
+		perror("ioctl(CIOCFSESSION)");
+		return 1;
+	}
+
+	return 0;
+}
 
 int
 main(int argc, char** argv)
@@ -322,6 +388,9 @@ main(int argc, char** argv)
 	if (test_extras(cfd))
 		return 1;
 
+	if (test_verify(cfd))
+		return 1;
+
 	/* Close cloned descriptor */
 	if (close(cfd)) {
 		perror("close(cfd)");
@@ -0,0 +1,261 @@
+/*  latency - per-operation latency benchmark for cryptodev
+ *
+ *  Times each CIOCCRYPT and CIOCAUTHCRYPT call on its own, and prints
+ *  the latency percentiles of each algorithm, size and data path
+ *  (zero-copy, or copied with COP_FLAG_NO_ZC).
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+
+#include <crypto/cryptodev.h>
+#include "histogram.h"
+
+/* operations run before the timed ones, to fault in the buffers and
+ * warm up the caches and the transforms */
+#define WARMUP_OPS	100
+/* room for the tag and the padding of the AEAD modes */
+#define TAG_ROOM	64
+
+enum path { PATH_CRYPT, PATH_AEAD, PATH_TLS };
+
+static const struct latcase {
+	const char *name;
+	int cipher, mac, keylen, mackeylen;
+	enum path path;
+} cases[] = {
+	{ "aes-cbc", CRYPTO_AES_CBC, 0, 16, 0, PATH_CRYPT },
+	{ "aes-ctr", CRYPTO_AES_CTR, 0, 16, 0, PATH_CRYPT },
+	{ "sha1", 0, CRYPTO_SHA1, 0, 0, PATH_CRYPT },
+	{ "hmac-sha256", 0, CRYPTO_SHA2_256_HMAC, 0, 32, PATH_CRYPT },
+	{ "aes-gcm", CRYPTO_AES_GCM, 0, 16, 0, PATH_AEAD },
+	{ "tls-aes-cbc-hmac-sha1", CRYPTO_AES_CBC, CRYPTO_SHA1_HMAC, 16, 20,
+		PATH_TLS },
+	{ NULL }
+};
+
+static const int default_sizes[] = { 16, 64, 256, 1024, 4096, 16384, 0 };
+
+static int nops = 10000;
+static int csv = 0;
+
+static int open_session(int fd, const struct latcase *c, uint32_t *ses)
+{
+	static char key[64], mackey[64];
+	struct session_op sess;
+
+	memset(key, 0x33, sizeof(key));
+	memset(mackey, 0x44, sizeof(mackey));
+	memset(&sess, 0, sizeof(sess));
+	sess.cipher = c->cipher;
+	sess.keylen = c->keylen;
+	sess.key = (unsigned char *)key;
+	sess.mac = c->mac;
+	sess.mackeylen = c->mackeylen;
+	sess.mackey = (unsigned char *)mackey;
+	if (ioctl(fd, CIOCGSESSION, &sess)) {
+		perror("ioctl(CIOCGSESSION)");
+		return 1;
+	}
+	*ses = sess.ses;
+	return 0;
+}
+
+/* run a single operation of len bytes over buf */
+static int run_op(int fd, uint32_t ses, const struct latcase *c,
+		char *buf, int len, int flags)
+{
+	static char iv[32], mac[64], aad[16];
+	struct crypt_auth_op cao;
+	struct crypt_op cop;
+
+	if (c->path == PATH_CRYPT) {
+		memset(&cop, 0, sizeof(cop));
+		cop.ses = ses;
+		cop.len = len;
+		cop.op = COP_ENCRYPT;
+		cop.flags = flags;
+		cop.src = cop.dst = (unsigned char *)buf;
+		if (c->cipher)
+			cop.iv = (unsigned char *)iv;
+		else
+			cop.mac = (unsigned char *)mac;
+		if (ioctl(fd, CIOCCRYPT, &cop)) {
+			perror("ioctl(CIOCCRYPT)");
+			return 1;
+		}
+		return 0;
+	}
+
+	memset(&cao, 0, sizeof(cao));
+	cao.ses = ses;
+	cao.len = len;
+	cao.op = COP_ENCRYPT;
+	cao.auth_src = (unsigned char *)aad;
+	cao.auth_len = c->path == PATH_TLS ? 13 : sizeof(aad);
+	cao.src = cao.dst = (unsigned char *)buf;
+	cao.iv = (unsigned char *)iv;
+	cao.iv_len = c->path == PATH_TLS ? 16 : 12;
+	if (c->path == PATH_TLS)
+		cao.flags = COP_FLAG_AEAD_TLS_TYPE;
+	if (ioctl(fd, CIOCAUTHCRYPT, &cao)) {
+		perror("ioctl(CIOCAUTHCRYPT)");
+		return 1;
+	}
+	return 0;
+}
+
+static void print_header(void)
+{
+	if (csv)
+		printf("alg,size,path,ops,p50_us,p90_us,p99_us,p999_us,max_us\n");
+	else
+		printf("%-24s %6s %-5s %10s %10s %10s %10s %10s\n", "alg",
+		       "size", "path", "p50 us", "p90 us", "p99 us",
+		       "p99.9 us", "max us");
+}
+
+static void print_result(const struct latcase *c, int size, const char *path,
+		const uint64_t *hist)
+{
+	if (csv)
+		printf("%s,%d,%s,%d,%.3f,%.3f,%.3f,%.3f,%.3f\n", c->name, size,
+		       path, nops, hist_percentile(hist, 0.5),
+		       hist_percentile(hist, 0.9), hist_percentile(hist, 0.99),
+		       hist_percentile(hist, 0.999), hist_percentile(hist, 1));
+	else
+		printf("%-24s %6d %-5s %10.3f %10.3f %10.3f %10.3f %10.3f\n",
+		       c->name, size, path, hist_percentile(hist, 0.5),
+		       hist_percentile(hist, 0.9), hist_percentile(hist, 0.99),
+		       hist_percentile(hist, 0.999), hist_percentile(hist, 1));
+	fflush(stdout);
+}
+
+/* time nops operations of size bytes; AEAD operations are always
+ * zero-copy, the others also run with COP_FLAG_NO_ZC */
+static int run_case(int fd, const struct latcase *c, int size, char *buf)
+{
+	static uint64_t hist[HIST_BUCKETS];
+	int flags[] = { 0, COP_FLAG_NO_ZC };
+	const char *paths[] = { "zc", "nozc" };
+	uint64_t start;
+	uint32_t ses;
+	int i, f;
+
+	if (open_session(fd, c, &ses))
+		return 1;
+
+	for (f = 0; f < (c->path == PATH_CRYPT ? 2 : 1); f++) {
+		for (i = 0; i < WARMUP_OPS; i++)
+			if (run_op(fd, ses, c, buf, size, flags[f]))
+				return 1;
+
+		memset(hist, 0, sizeof(hist));
+		for (i = 0; i < nops; i++) {
+			start = hist_now_ns();
+			if (run_op(fd, ses, c, buf, size, flags[f]))
+				return 1;
+			hist_add(hist, hist_now_ns() - start);
+		}
+		print_result(c, size, paths[f], hist);
+	}
+
+	if (ioctl(fd, CIOCFSESSION, &ses)) {
+		perror("ioctl(CIOCFSESSION)");
+		return 1;
+	}
+	return 0;
+}
+
+static void usage(void)
+{
+	int i;
+
+	printf("Usage: latency [options]\n"
+	       "  -a ALG          only this algorithm:");
+	for (i = 0; cases[i].name; i++)
+		printf(" %s", cases[i].name);
+	printf("\n"
+	       "  -s S1,S2,...    the operation sizes (16 to 16384)\n"
+	       "  -n OPS          the operations timed per size (10000)\n"
+	       "  --csv           CSV instead of a table\n");
+}
+
+int main(int argc, char **argv)
+{
+	const char *only = NULL;
+	int sizes[32], i, j, fd, nsizes = 0, max = 0;
+	char *buf, *s;
+
+	for (i = 0; default_sizes[i]; i++)
+		sizes[i] = default_sizes[i];
+	sizes[i] = 0;
+
+	for (i = 1; i < argc; i++) {
+		if (strcmp(argv[i], "-a") == 0 && i + 1 < argc) {
+			only = argv[++i];
+		} else if (strcmp(argv[i], "-s") == 0 && i + 1 < argc) {
+			for (s = strtok(argv[++i], ","); s && nsizes < 31;
+			     s = strtok(NULL, ","))
+				sizes[nsizes++] = atoi(s);
+			sizes[nsizes] = 0;
+		} else if (strcmp(argv[i], "-n") == 0 && i + 1 < argc) {
+			nops = atoi(argv[++i]);
+		} else if (strcmp(argv[i], "--csv") == 0) {
+			csv = 1;
+		} else {
+			usage();
+			return strcmp(argv[i], "-h") && strcmp(argv[i], "--help");
+		}
+	}
+	if (nops < 1) {
+		usage();
+		return 1;
+	}
+
+	for (i = 0; sizes[i]; i++)
+		if (sizes[i] > max)
+			max = sizes[i];
+	if (posix_memalign((void **)&buf, 64, max + TAG_ROOM)) {
+		fprintf(stderr, "posix_memalign() failed (size %d)\n", max);
+		return 1;
+	}
+	memset(buf, 0x15, max + TAG_ROOM);
+
+	fd = open("/dev/crypto", O_RDWR, 0);
+	if (fd < 0) {
+		perror("open(/dev/crypto)");
+		return 1;
+	}
+
+	print_header();
+	for (j = 0; cases[j].name; j++) {
+		if (only && strcmp(only, cases[j].name))
+			continue;
+		for (i = 0; sizes[i]; i++)
+			if (run_case(fd, &cases[j], sizes[i], buf))
+				return 1;
+	}
+
+	close(fd);
+	free(buf);
+	return 0;
+}
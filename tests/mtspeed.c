@@ -0,0 +1,463 @@
+/*  mtspeed - multi-threaded benchmark tool for cryptodev
+ *
+ *  Runs the same operation from 1 up to N threads, on a file descriptor
+ *  and a session either shared by the threads or of their own, and
+ *  prints the throughput and the latency percentiles of each run as CSV
+ *  or JSON.
+ *
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+
+#include <crypto/cryptodev.h>
+#include "histogram.h"
+
+#define MAX_THREADS	256
+/* operations per CIOCCRYPTMULTI call */
+#define MULTI_OPS	16
+/* jobs of a thread in flight in the async mode */
+#define ASYNC_DEPTH	16
+
+enum mode { MODE_SYNC, MODE_ASYNC, MODE_MULTI };
+
+static const char *mode_names[] = { "sync", "async", "multi" };
+
+static const struct alg {
+	const char *name;
+	int cipher, mac, keylen;
+} algs[] = {
+	{ "aes-cbc", CRYPTO_AES_CBC, 0, 16 },
+	{ "aes-ctr", CRYPTO_AES_CTR, 0, 16 },
+	{ "null", CRYPTO_NULL, 0, 0 },
+	{ "sha1", 0, CRYPTO_SHA1, 0 },
+	{ "sha256", 0, CRYPTO_SHA2_256, 0 },
+	{ "hmac-sha1", 0, CRYPTO_SHA1_HMAC, 20 },
+	{ NULL }
+};
+
+static const int default_sizes[] = {
+	16, 64, 256, 1024, 4096, 16384, 65536, 0
+};
+
+/* the options */
+static const struct alg *alg = &algs[0];
+static enum mode mode = MODE_SYNC;
+static int max_threads = 4;
+static int shared_fd = 1, shared_session = 1;
+static int json = 0;
+static double seconds = 1.0;
+static int sizes[32];
+
+struct thread {
+	pthread_t id;
+	int fd;
+	uint32_t ses;
+	int size;
+	char *buf;
+	uint64_t ops, bytes;
+	uint64_t hist[HIST_BUCKETS];
+	int failed;
+};
+
+static struct thread threads[MAX_THREADS];
+static volatile int must_finish;
+static pthread_barrier_t start_barrier;
+
+static int open_fd(void)
+{
+	int fd = open("/dev/crypto", O_RDWR, 0);
+
+	if (fd < 0)
+		perror("open(/dev/crypto)");
+	return fd;
+}
+
+static int open_session(int fd, uint32_t *ses)
+{
+	static char key[64];
+	struct session_op sess;
+
+	memset(key, 0x33, sizeof(key));
+	memset(&sess, 0, sizeof(sess));
+	sess.cipher = alg->cipher;
+	sess.mac = alg->mac;
+	if (alg->cipher) {
+		sess.keylen = alg->keylen;
+		sess.key = (unsigned char *)key;
+	} else if (alg->keylen) {
+		sess.mackeylen = alg->keylen;
+		sess.mackey = (unsigned char *)key;
+	}
+	if (ioctl(fd, CIOCGSESSION, &sess)) {
+		perror("ioctl(CIOCGSESSION)");
+		return 1;
+	}
+	*ses = sess.ses;
+	return 0;
+}
+
+static void fill_cop(struct thread *t, struct crypt_op *cop, char *iv,
+		char *mac)
+{
+	memset(cop, 0, sizeof(*cop));
+	cop->ses = t->ses;
+	cop->len = t->size;
+	cop->op = COP_ENCRYPT;
+	cop->src = cop->dst = (unsigned char *)t->buf;
+	if (alg->cipher)
+		cop->iv = (unsigned char *)iv;
+	else
+		cop->mac = (unsigned char *)mac;
+}
+
+static int run_sync(struct thread *t)
+{
+	char iv[32], mac[64];
+	struct crypt_op cop;
+	uint64_t start;
+
+	memset(iv, 0x23, sizeof(iv));
+	while (!must_finish) {
+		fill_cop(t, &cop, iv, mac);
+		start = hist_now_ns();
+		if (ioctl(t->fd, CIOCCRYPT, &cop)) {
+			perror("ioctl(CIOCCRYPT)");
+			return 1;
+		}
+		hist_add(t->hist, hist_now_ns() - start);
+		t->ops++;
+	}
+	return 0;
+}
+
+static int run_multi(struct thread *t)
+{
+	char iv[MULTI_OPS][32], mac[MULTI_OPS][64];
+	struct crypt_op cop[MULTI_OPS];
+	struct crypt_multi_op mop;
+	__s32 status[MULTI_OPS];
+	uint64_t start;
+	int i;
+
+	memset(iv, 0x23, sizeof(iv));
+	while (!must_finish) {
+		for (i = 0; i < MULTI_OPS; i++)
+			fill_cop(t, &cop[i], iv[i], mac[i]);
+		memset(&mop, 0, sizeof(mop));
+		mop.count = MULTI_OPS;
+		mop.ops = cop;
+		mop.status = status;
+
+		start = hist_now_ns();
+		if (ioctl(t->fd, CIOCCRYPTMULTI, &mop)) {
+			perror("ioctl(CIOCCRYPTMULTI)");
+			return 1;
+		}
+		/* the latency of the call */
+		hist_add(t->hist, hist_now_ns() - start);
+		for (i = 0; i < MULTI_OPS; i++) {
+			if (status[i]) {
+				fprintf(stderr, "operation %d failed: %d\n",
+						i, status[i]);
+				return 1;
+			}
+		}
+		t->ops += MULTI_OPS;
+	}
+	return 0;
+}
+
+#ifdef ENABLE_ASYNC
+/* Jobs are fetched in the order they were submitted on the descriptor
+ * of the thread, so their start times are kept in that order too. */
+static int run_async(struct thread *t)
+{
+	char iv[ASYNC_DEPTH][32], mac[ASYNC_DEPTH][64];
+	uint64_t started[ASYNC_DEPTH];
+	unsigned int head = 0, tail = 0;
+	struct crypt_op cop;
+	struct pollfd pfd;
+
+	memset(iv, 0x23, sizeof(iv));
+	pfd.fd = t->fd;
+	pfd.events = POLLIN;
+	while (!must_finish || head != tail) {
+		while (!must_finish && head - tail < ASYNC_DEPTH) {
+			fill_cop(t, &cop, iv[head % ASYNC_DEPTH],
+					mac[head % ASYNC_DEPTH]);
+			started[head % ASYNC_DEPTH] = hist_now_ns();
+			if (ioctl(t->fd, CIOCASYNCCRYPT, &cop)) {
+				perror("ioctl(CIOCASYNCCRYPT)");
+				return 1;
+			}
+			head++;
+		}
+
+		if (poll(&pfd, 1, -1) < 1) {
+			perror("poll()");
+			return 1;
+		}
+		while (head != tail && ioctl(t->fd, CIOCASYNCFETCH, &cop) == 0) {
+			hist_add(t->hist, hist_now_ns() - started[tail % ASYNC_DEPTH]);
+			tail++;
+			t->ops++;
+		}
+	}
+	return 0;
+}
+#endif
+
+static void *thread_main(void *arg)
+{
+	struct thread *t = arg;
+
+	pthread_barrier_wait(&start_barrier);
+	switch (mode) {
+	case MODE_SYNC:
+		t->failed = run_sync(t);
+		break;
+	case MODE_MULTI:
+		t->failed = run_multi(t);
+		break;
+	case MODE_ASYNC:
+#ifdef ENABLE_ASYNC
+		t->failed = run_async(t);
+#endif
+		break;
+	}
+	t->bytes = t->ops * t->size;
+	return NULL;
+}
+
+static void print_header(void)
+{
+	if (json)
+		printf("[\n");
+	else
+		printf("mode,alg,size,threads,fd,session,ops,ops_per_sec,"
+		       "gbytes_per_sec,p50_us,p99_us,p999_us\n");
+}
+
+static void print_result(int size, int nthreads, uint64_t ops,
+		double secs, const uint64_t *hist, int first)
+{
+	const char *fd = shared_fd ? "shared" : "own";
+	const char *ses = shared_session ? "shared" : "own";
+	double ops_s = ops / secs, gb_s = ops * (double)size / secs / 1e9;
+	double p50 = hist_percentile(hist, 0.5);
+	double p99 = hist_percentile(hist, 0.99);
+	double p999 = hist_percentile(hist, 0.999);
+
+	if (json)
+		printf("%s  {\"mode\": \"%s\", \"alg\": \"%s\", \"size\": %d, "
+		       "\"threads\": %d, \"fd\": \"%s\", \"session\": \"%s\", "
+		       "\"ops\": %llu, \"ops_per_sec\": %.1f, "
+		       "\"gbytes_per_sec\": %.4f, \"p50_us\": %.3f, "
+		       "\"p99_us\": %.3f, \"p999_us\": %.3f}",
+		       first ? "" : ",\n", mode_names[mode], alg->name, size,
+		       nthreads, fd, ses, (unsigned long long)ops, ops_s, gb_s,
+		       p50, p99, p999);
+	else
+		printf("%s,%s,%d,%d,%s,%s,%llu,%.1f,%.4f,%.3f,%.3f,%.3f\n",
+		       mode_names[mode], alg->name, size, nthreads, fd, ses,
+		       (unsigned long long)ops, ops_s, gb_s, p50, p99, p999);
+	fflush(stdout);
+}
+
+/* one run of nthreads threads on operations of size bytes */
+static int run(int size, int nthreads, int first)
+{
+	static uint64_t hist[HIST_BUCKETS];
+	uint64_t ops = 0, start, end;
+	struct timespec ts;
+	int i, ret = 0;
+
+	for (i = 0; i < nthreads; i++) {
+		struct thread *t = &threads[i];
+
+		memset(t->hist, 0, sizeof(t->hist));
+		t->ops = t->bytes = 0;
+		t->failed = 0;
+		t->size = size;
+		t->fd = (shared_fd && i) ? threads[0].fd : open_fd();
+		if (t->fd < 0)
+			return 1;
+		if (shared_session && i)
+			t->ses = threads[0].ses;
+		else if (open_session(t->fd, &t->ses))
+			return 1;
+		if (posix_memalign((void **)&t->buf, 64, size)) {
+			fprintf(stderr, "posix_memalign() failed (size %d)\n", size);
+			return 1;
+		}
+		memset(t->buf, 0x15, size);
+	}
+
+	pthread_barrier_init(&start_barrier, NULL, nthreads + 1);
+	must_finish = 0;
+	for (i = 0; i < nthreads; i++) {
+		if (pthread_create(&threads[i].id, NULL, thread_main, &threads[i])) {
+			perror("pthread_create()");
+			exit(1);
+		}
+	}
+
+	pthread_barrier_wait(&start_barrier);
+	start = hist_now_ns();
+	ts.tv_sec = (time_t)seconds;
+	ts.tv_nsec = (long)((seconds - ts.tv_sec) * 1e9);
+	nanosleep(&ts, NULL);
+	must_finish = 1;
+
+	memset(hist, 0, sizeof(hist));
+	for (i = 0; i < nthreads; i++) {
+		pthread_join(threads[i].id, NULL);
+		ret |= threads[i].failed;
+		ops += threads[i].ops;
+		hist_merge(hist, threads[i].hist);
+	}
+	end = hist_now_ns();
+	pthread_barrier_destroy(&start_barrier);
+
+	if (!ret)
+		print_result(size, nthreads, ops, (end - start) / 1e9, hist, first);
+
+	for (i = nthreads - 1; i >= 0; i--) {
+		struct thread *t = &threads[i];
+
+		if (!(shared_session && i))
+			ioctl(t->fd, CIOCFSESSION, &t->ses);
+		if (!(shared_fd && i))
+			close(t->fd);
+		free(t->buf);
+	}
+	return ret;
+}
+
+static void usage(void)
+{
+	int i;
+
+	printf("Usage: mtspeed [options]\n"
+	       "  -t N            up to N threads, doubling from 1 (4)\n"
+	       "  -m MODE         sync, async or multi (sync)\n"
+	       "  -a ALG          the algorithm (aes-cbc):");
+	for (i = 0; algs[i].name; i++)
+		printf(" %s", algs[i].name);
+	printf("\n"
+	       "  -s S1,S2,...    the operation sizes (16 to 65536)\n"
+	       "  -d SECS         the duration of each run (1)\n"
+	       "  --own-fd        a file descriptor per thread\n"
+	       "  --own-session   a session per thread\n"
+	       "  --json          JSON instead of CSV\n");
+}
+
+int main(int argc, char **argv)
+{
+	int i, t, nsizes = 0, first = 1;
+	char *s;
+
+	for (i = 0; default_sizes[i]; i++)
+		sizes[i] = default_sizes[i];
+	sizes[i] = 0;
+
+	for (i = 1; i < argc; i++) {
+		if (strcmp(argv[i], "-t") == 0 && i + 1 < argc) {
+			max_threads = atoi(argv[++i]);
+		} else if (strcmp(argv[i], "-m") == 0 && i + 1 < argc) {
+			for (t = 0; t < 3; t++)
+				if (strcmp(argv[i + 1], mode_names[t]) == 0)
+					break;
+			if (t == 3) {
+				usage();
+				return 1;
+			}
+			mode = t;
+			i++;
+		} else if (strcmp(argv[i], "-a") == 0 && i + 1 < argc) {
+			for (alg = algs; alg->name; alg++)
+				if (strcmp(argv[i + 1], alg->name) == 0)
+					break;
+			if (!alg->name) {
+				usage();
+				return 1;
+			}
+			i++;
+		} else if (strcmp(argv[i], "-s") == 0 && i + 1 < argc) {
+			for (s = strtok(argv[++i], ","); s && nsizes < 31;
+			     s = strtok(NULL, ","))
+				sizes[nsizes++] = atoi(s);
+			sizes[nsizes] = 0;
+		} else if (strcmp(argv[i], "-d") == 0 && i + 1 < argc) {
+			seconds = atof(argv[++i]);
+		} else if (strcmp(argv[i], "--own-fd") == 0) {
+			shared_fd = 0;
+		} else if (strcmp(argv[i], "--own-session") == 0) {
+			shared_session = 0;
+		} else if (strcmp(argv[i], "--json") == 0) {
+			json = 1;
+		} else {
+			usage();
+			return strcmp(argv[i], "-h") && strcmp(argv[i], "--help");
+		}
+	}
+
+	if (max_threads < 1 || max_threads > MAX_THREADS || seconds <= 0) {
+		usage();
+		return 1;
+	}
+
+#ifdef ENABLE_ASYNC
+	/* the jobs of a descriptor are fetched in order, by any thread */
+	if (mode == MODE_ASYNC && shared_fd) {
+		fprintf(stderr, "the async mode needs --own-fd\n");
+		return 1;
+	}
+#else
+	if (mode == MODE_ASYNC) {
+		fprintf(stderr, "built without ENABLE_ASYNC\n");
+		return 1;
+	}
+#endif
+	/* a session belongs to the descriptor it was created on */
+	if (shared_session && !shared_fd) {
+		fprintf(stderr, "--own-fd needs --own-session\n");
+		return 1;
+	}
+
+	print_header();
+	for (i = 0; sizes[i]; i++) {
+		for (t = 1; ; t = t * 2 < max_threads ? t * 2 : max_threads) {
+			if (run(sizes[i], t, first))
+				return 1;
+			first = 0;
+			if (t == max_threads)
+				break;
+		}
+	}
+	if (json)
+		printf("\n]\n");
+
+	return 0;
+}
@@ -28,6 +28,10 @@
 #include <crypto/cryptodev.h>
 
 static int si = 1; /* SI by default */
+static int multi = 0; /* use CIOCCRYPTMULTI */
+
+/* operations per CIOCCRYPTMULTI call */
+#define MULTI_OPS 16
 
 static double udifftimeval(struct timeval start, struct timeval end)
 {
@@ -70,6 +74,42 @@ static void value2human(int si, double bytes, double time, double* data, double*
 
 #define MAX(x,y) ((x)>(y)?(x):(y))
 
+static int encrypt_multi(struct session_op *sess, int fdc, int chunksize,
+	char *buffer, char *iv)
+{
+	struct crypt_op cop[MULTI_OPS];
+	struct crypt_multi_op mop;
+	__s32 status[MULTI_OPS];
+	int i;
+
+	memset(cop, 0, sizeof(cop));
+	for (i = 0; i < MULTI_OPS; i++) {
+		cop[i].ses = sess->ses;
+		cop[i].len = chunksize;
+		cop[i].iv = (unsigned char *)iv;
+		cop[i].op = COP_ENCRYPT;
+		cop[i].src = cop[i].dst = (unsigned char *)buffer;
+	}
+
+	memset(&mop, 0, sizeof(mop));
+	mop.count = MULTI_OPS;
+	mop.ops = cop;
+	mop.status = status;
+
+	if (ioctl(fdc, CIOCCRYPTMULTI, &mop)) {
+		perror("ioctl(CIOCCRYPTMULTI)");
+		return 1;
+	}
+
+	for (i = 0; i < MULTI_OPS; i++) {
+		if (status[i]) {
+			fprintf(stderr, "operation %d failed: %d\n", i, status[i]);
+			return 1;
+		}
+	}
+	return 0;
+}
+
 int encrypt_data(struct session_op *sess, int fdc, int chunksize, int alignmask)
 {
 	struct crypt_op cop;
@@ -104,6 +144,13 @@ int encrypt_data(struct session_op *sess, int fdc, int chunksize, int alignmask)
 
 	gettimeofday(&start, NULL);
 	do {
+		if (multi) {
+			if (encrypt_multi(sess, fdc, chunksize, buffer, iv))
+				return 1;
+			total += chunksize * MULTI_OPS;
+			continue;
+		}
+
 		memset(&cop, 0, sizeof(cop));
 		cop.ses = sess->ses;
 		cop.len = chunksize;
@@ -140,14 +187,17 @@ int main(int argc, char** argv)
 
 	signal(SIGALRM, alarm_handler);
 	
-	if (argc > 1) {
-		if (strcmp(argv[1], "--help") == 0 || strcmp(argv[1], "-h") == 0) {
-			printf("Usage: speed [--kib]\n");
+	for (i = 1; i < argc; i++) {
+		if (strcmp(argv[i], "--help") == 0 || strcmp(argv[i], "-h") == 0) {
+			printf("Usage: speed [--kib] [--multi]\n");
 			exit(0);
 		}
-		if (strcmp(argv[1], "--kib") == 0) {
+		if (strcmp(argv[i], "--kib") == 0) {
 			si = 0;
 		}
+		if (strcmp(argv[i], "--multi") == 0) {
+			multi = 1;
+		}
 	}
 
 	if ((fd = open("/dev/crypto", O_RDWR, 0)) < 0) {
@@ -177,7 +227,7 @@ int main(int argc, char** argv)
 	alignmask = siop.alignmask;
 #endif
 
-	for (i = 512; i <= (64 * 1024); i *= 2) {
+	for (i = 64; i <= (64 * 1024); i *= 2) {
 		if (encrypt_data(&sess, fdc, i, alignmask))
 			break;
 	}
@@ -201,7 +251,7 @@ int main(int argc, char** argv)
 	alignmask = siop.alignmask;
 #endif
 
-	for (i = 512; i <= (64 * 1024); i *= 2) {
+	for (i = 64; i <= (64 * 1024); i *= 2) {
 		if (encrypt_data(&sess, fdc, i, alignmask))
 			break;
 	}
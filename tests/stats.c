@@ -0,0 +1,140 @@
+/*
+ * Demo on how to read the performance counters of a /dev/crypto
+ * file descriptor.
+ *
+ * Placed under public domain.
+ *
+ */
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+
+#include <sys/ioctl.h>
+#include <crypto/cryptodev.h>
+
+static int debug = 0;
+
+#define	DATA_SIZE	4096
+#define	BLOCK_SIZE	16
+#define	KEY_SIZE	16
+#define	NOPS		4
+
+static int
+test_stats(int cfd)
+{
+	char data[DATA_SIZE];
+	char iv[BLOCK_SIZE];
+	char key[KEY_SIZE];
+	int i;
+
+	struct session_op sess;
+	struct crypt_op cryp;
+	struct crypt_stats st;
+
+	memset(&sess, 0, sizeof(sess));
+	memset(key, 0x33,  sizeof(key));
+
+	/* Get crypto session for AES128 */
+	sess.cipher = CRYPTO_AES_CBC;
+	sess.keylen = KEY_SIZE;
+	sess.key = key;
+	if (ioctl(cfd, CIOCGSESSION, &sess)) {
+		perror("ioctl(CIOCGSESSION)");
+		return 1;
+	}
+
+	memset(data, 0x15, sizeof(data));
+	memset(iv, 0x03, sizeof(iv));
+	memset(&cryp, 0, sizeof(cryp));
+	cryp.ses = sess.ses;
+	cryp.len = DATA_SIZE;
+	cryp.src = data;
+	cryp.dst = data;
+	cryp.iv = iv;
+	cryp.op = COP_ENCRYPT;
+
+	for (i = 0; i < NOPS; i++) {
+		/* the last one copies the data */
+		if (i == NOPS - 1)
+			cryp.flags = COP_FLAG_NO_ZC;
+		if (ioctl(cfd, CIOCCRYPT, &cryp)) {
+			perror("ioctl(CIOCCRYPT)");
+			return 1;
+		}
+	}
+
+	if (ioctl(cfd, CIOCGSTATS, &st)) {
+		perror("ioctl(CIOCGSTATS)");
+		return 1;
+	}
+
+	if (debug)
+		printf("ops %llu bytes %llu zc %llu copy %llu unaligned %llu\n",
+			(unsigned long long)st.ops, (unsigned long long)st.bytes,
+			(unsigned long long)st.zc_ops,
+			(unsigned long long)st.copy_ops,
+			(unsigned long long)st.unaligned_ops);
+
+	if (st.ops != NOPS || st.bytes != NOPS * DATA_SIZE ||
+	    st.zc_ops + st.copy_ops != NOPS || st.copy_ops < 1) {
+		fprintf(stderr, "FAIL: unexpected counters.\n");
+		return 1;
+	}
+
+	if (debug)
+		printf("Test passed\n");
+
+	/* Finish crypto session */
+	if (ioctl(cfd, CIOCFSESSION, &sess.ses)) {
+		perror("ioctl(CIOCFSESSION)");
+		return 1;
+	}
+
+	return 0;
+}
+
+int
+main(int argc, char** argv)
+{
+	int fd = -1, cfd = -1;
+
+	if (argc > 1) debug = 1;
+
+	/* Open the crypto device */
+	fd = open("/dev/crypto", O_RDWR, 0);
+	if (fd < 0) {
+		perror("open(/dev/crypto)");
+		return 1;
+	}
+
+	/* Clone file descriptor */
+	if (ioctl(fd, CRIOGET, &cfd)) {
+		perror("ioctl(CRIOGET)");
+		return 1;
+	}
+
+	/* Set close-on-exec (not really neede here) */
+	if (fcntl(cfd, F_SETFD, 1) == -1) {
+		perror("fcntl(F_SETFD)");
+		return 1;
+	}
+
+	/* Run the test itself */
+	if (test_stats(cfd))
+		return 1;
+
+	/* Close cloned descriptor */
+	if (close(cfd)) {
+		perror("close(cfd)");
+		return 1;
+	}
+
+	/* Close the original descriptor */
+	if (close(fd)) {
+		perror("close(fd)");
+		return 1;
+	}
+
+	return 0;
+}
@@ -0,0 +1,179 @@
+/*
+ * Driver for /dev/crypto device (aka CryptoDev)
+ *
+ * This file is part of linux cryptodev.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+ * 02110-1301, USA.
+ */
+
+#include <linux/debugfs.h>
+
+#include <linux/crypto.h>
+#include <linux/list.h>
+#include <linux/slab.h>
+#include <linux/spinlock.h>
+#include <crypto/hash.h>
+#include "cryptodev_int.h"
+#include "tfm_pool.h"
+
+/* Transforms of ended sessions, kept for the next sessions of the same
+ * algorithm. Those only need to set their key, instead of having the
+ * algorithm looked up and its transform allocated and initialized.
+ * The key of the previous session is overwritten by the setkey of the
+ * next one, or destroyed along with the transform when it is dropped.
+ * Transforms are kept under their algorithm name (cra_name), and thus
+ * given to a session asking for it whatever their driver is. Sessions
+ * that choose their driver (type, mask or a cra_driver_name) neither
+ * take transforms from the pool nor give theirs back to it.
+ *
+ * AEAD transforms are not kept, as the tag size set on them would
+ * outlive the session.
+ */
+
+#define TFM_POOL_MAX 64
+
+enum tfm_pool_type {
+	TFM_BLKCIPHER,
+	TFM_AHASH,
+};
+
+struct tfm_pool_entry {
+	struct list_head list;
+	enum tfm_pool_type type;
+	char name[CRYPTO_MAX_ALG_NAME];
+	void *tfm;
+};
+
+static LIST_HEAD(tfm_pool);
+static unsigned int tfm_pool_count;
+static DEFINE_SPINLOCK(tfm_pool_lock);
+
+static void *tfm_pool_get(enum tfm_pool_type type, const char *name)
+{
+	struct tfm_pool_entry *e;
+	void *tfm = NULL;
+
+	spin_lock(&tfm_pool_lock);
+	list_for_each_entry(e, &tfm_pool, list) {
+		if (e->type == type && strcmp(e->name, name) == 0) {
+			list_del(&e->list);
+			tfm_pool_count--;
+			tfm = e->tfm;
+			break;
+		}
+	}
+	spin_unlock(&tfm_pool_lock);
+
+	if (tfm)
+		kfree(e);
+	return tfm;
+}
+
+/* Whether tfm was kept; it is to be freed otherwise */
+static int tfm_pool_put(enum tfm_pool_type type, const char *name, void *tfm)
+{
+	struct tfm_pool_entry *e;
+
+	if (ACCESS_ONCE(tfm_pool_count) >= TFM_POOL_MAX ||
+	    strlen(name) >= sizeof(e->name))
+		return 0;
+
+	e = kmalloc(sizeof(*e), GFP_KERNEL);
+	if (unlikely(!e))
+		return 0;
+	e->type = type;
+	strcpy(e->name, name);
+	e->tfm = tfm;
+
+	spin_lock(&tfm_pool_lock);
+	if (tfm_pool_count < TFM_POOL_MAX) {
+		/* most recently used first, those are still in the cache */
+		list_add(&e->list, &tfm_pool);
+		tfm_pool_count++;
+		e = NULL;
+	}
+	spin_unlock(&tfm_pool_lock);
+
+	if (e) {
+		kfree(e);
+		return 0;
+	}
+	return 1;
+}
+
+cryptodev_crypto_blkcipher_t *cryptodev_alloc_blkcipher(const char *alg_name,
+					u32 type, u32 mask)
+{
+	cryptodev_crypto_blkcipher_t *tfm;
+
+	if (type || mask)
+		return cryptodev_crypto_alloc_blkcipher(alg_name, type, mask);
+
+	tfm = tfm_pool_get(TFM_BLKCIPHER, alg_name);
+	if (tfm) {
+		cryptodev_crypto_blkcipher_clear_flags(tfm, CRYPTO_TFM_RES_MASK);
+		return tfm;
+	}
+	return cryptodev_crypto_alloc_blkcipher(alg_name, 0, 0);
+}
+
+void cryptodev_free_blkcipher(cryptodev_crypto_blkcipher_t *tfm)
+{
+	const char *name =
+		crypto_tfm_alg_name(cryptodev_crypto_blkcipher_tfm(tfm));
+
+	if (!tfm_pool_put(TFM_BLKCIPHER, name, tfm))
+		cryptodev_crypto_free_blkcipher(tfm);
+}
+
+struct crypto_ahash *cryptodev_alloc_ahash(const char *alg_name,
+					u32 type, u32 mask)
+{
+	struct crypto_ahash *tfm;
+
+	if (type || mask)
+		return crypto_alloc_ahash(alg_name, type, mask);
+
+	tfm = tfm_pool_get(TFM_AHASH, alg_name);
+	if (tfm) {
+		crypto_ahash_clear_flags(tfm, CRYPTO_TFM_RES_MASK);
+		return tfm;
+	}
+	return crypto_alloc_ahash(alg_name, 0, 0);
+}
+
+void cryptodev_free_ahash(struct crypto_ahash *tfm)
+{
+	const char *name = crypto_tfm_alg_name(crypto_ahash_tfm(tfm));
+
+	if (!tfm_pool_put(TFM_AHASH, name, tfm))
+		crypto_free_ahash(tfm);
+}
+
+void cryptodev_tfm_pool_exit(void)
+{
+	struct tfm_pool_entry *e, *tmp;
+
+	list_for_each_entry_safe(e, tmp, &tfm_pool, list) {
+		if (e->type == TFM_BLKCIPHER)
+			cryptodev_crypto_free_blkcipher(e->tfm);
+		else
+			crypto_free_ahash(e->tfm);
+		kfree(e);
+	}
+	INIT_LIST_HEAD(&tfm_pool);
+	tfm_pool_count = 0;
+}
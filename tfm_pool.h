@@ -0,0 +1,15 @@
+#ifndef TFM_POOL_H
+# define TFM_POOL_H
+
+/* Allocation of the transforms of sessions, reusing those of ended
+ * sessions of the same algorithm; see tfm_pool.c */
+cryptodev_crypto_blkcipher_t *cryptodev_alloc_blkcipher(const char *alg_name,
+							u32 type, u32 mask);
+void cryptodev_free_blkcipher(cryptodev_crypto_blkcipher_t *tfm);
+struct crypto_ahash *cryptodev_alloc_ahash(const char *alg_name,
+					   u32 type, u32 mask);
+void cryptodev_free_ahash(struct crypto_ahash *tfm);
+
+void cryptodev_tfm_pool_exit(void);
+
+#endif
@@ -32,26 +32,90 @@
 #include <linux/syscalls.h>
 #include <linux/pagemap.h>
 #include <linux/uaccess.h>
+#include <linux/capability.h>
 #include <crypto/scatterwalk.h>
 #include <linux/scatterlist.h>
 #include "cryptodev_int.h"
 #include "zc.h"
+#include "stats.h"
+#include "cryptodev_trace.h"
 #include "version.h"
 
-/* Helper functions to assist zero copy.
- * This needs to be redesigned and moved out of the session. --nmav
+/* Helper functions to assist zero copy. The pages of an operation are
+ * kept in a struct zc_pages; the one of the session is used by the
+ * blocking operations. Buffers within a registered region use its
+ * pages, which are pinned for as long as it is registered.
  */
 
 /* offset of buf in it's first page */
 #define PAGEOFFSET(buf) ((unsigned long)buf & ~PAGE_MASK)
 
+/* The longest sg entry that physically contiguous pages are merged into.
+ * Engines take an entry per descriptor, and some of them cannot describe
+ * more than 64KiB in one. */
+static unsigned int cryptodev_sg_max_len = 32768;
+module_param(cryptodev_sg_max_len, uint, 0644);
+MODULE_PARM_DESC(cryptodev_sg_max_len,
+	"the most bytes of physically contiguous user pages that make "
+	"a single scatterlist entry (0: an entry per page)");
+
+/* whether page follows prev in memory */
+static inline int pages_contiguous(struct page *prev, struct page *page)
+{
+	return page == prev + 1 &&
+		page_to_pfn(page) == page_to_pfn(prev) + 1;
+}
+
+/* Set the entries of sg to the pages pg that [addr, addr + len) resides
+ * in, and return how many there are. Runs of physically contiguous pages
+ * take a single entry, so that a buffer in a transparent or hugetlbfs
+ * huge page takes far fewer than a page each. */
+static unsigned int pages_to_sg(uint8_t __user *addr, uint32_t len,
+		struct page **pg, struct scatterlist *sg)
+{
+	unsigned int max_len = ACCESS_ONCE(cryptodev_sg_max_len);
+	unsigned int merged = 0;
+	int pglen, i = 0, n = 0;
+
+	pglen = min((ptrdiff_t)(PAGE_SIZE - PAGEOFFSET(addr)), (ptrdiff_t)len);
+	sg_set_page(&sg[n], pg[i], pglen, PAGEOFFSET(addr));
+	i++;
+
+	len -= pglen;
+	while (len) {
+		pglen = min((uint32_t)PAGE_SIZE, len);
+		if (pages_contiguous(pg[i - 1], pg[i]) &&
+		    sg[n].length + pglen <= max_len) {
+			sg[n].length += pglen;
+			merged++;
+		} else
+			sg_set_page(&sg[++n], pg[i], pglen, 0);
+		i++;
+		len -= pglen;
+	}
+
+	if (merged)
+		cryptodev_stat_add(NULL, CRYPTODEV_STAT_SG_MERGED, merged);
+	return n + 1;
+}
+
+/* initialise sg with the pgcount pages pg that addr resides in */
+static void pages_to_sg_table(uint8_t __user *addr, uint32_t len,
+		unsigned int pgcount, struct page **pg, struct scatterlist *sg)
+{
+	unsigned int nents;
+
+	sg_init_table(sg, pgcount);
+	nents = pages_to_sg(addr, len, pg, sg);
+	sg_mark_end(&sg[nents - 1]);
+}
+
 /* fetch the pages addr resides in into pg and initialise sg with them */
 int __get_userbuf(uint8_t __user *addr, uint32_t len, int write,
 		unsigned int pgcount, struct page **pg, struct scatterlist *sg,
 		struct task_struct *task, struct mm_struct *mm)
 {
-	int ret, pglen, i = 0;
-	struct scatterlist *sgp;
+	int ret;
 
 	if (unlikely(!pgcount || !len || !addr)) {
 		sg_mark_end(sg);
@@ -65,69 +129,520 @@ int __get_userbuf(uint8_t __user *addr, uint32_t len, int write,
 	if (ret != pgcount)
 		return -EINVAL;
 
-	sg_init_table(sg, pgcount);
+	trace_cryptodev_pin((unsigned long)addr, len, pgcount);
+	pages_to_sg_table(addr, len, pgcount, pg, sg);
+	return 0;
+}
 
-	pglen = min((ptrdiff_t)(PAGE_SIZE - PAGEOFFSET(addr)), (ptrdiff_t)len);
-	sg_set_page(sg, pg[i++], pglen, PAGEOFFSET(addr));
+int zc_pages_init(struct zc_pages *zc, unsigned int array_size)
+{
+	zc->used_pages = zc->readonly_pages = 0;
+	zc->region[0] = zc->region[1] = NULL;
+	zc->region_dst_pages = 0;
+	zc->bounce = NULL;
+	zc->bounce_pages = 0;
+	zc->pages = kzalloc(array_size * sizeof(struct page *), GFP_KERNEL);
+	zc->sg = kzalloc(array_size * sizeof(struct scatterlist), GFP_KERNEL);
+	if (unlikely(zc->pages == NULL || zc->sg == NULL)) {
+		zc_pages_deinit(zc);
+		return -ENOMEM;
+	}
+	zc->array_size = array_size;
+	return 0;
+}
 
-	len -= pglen;
-	for (sgp = sg_next(sg); len; sgp = sg_next(sgp)) {
-		pglen = min((uint32_t)PAGE_SIZE, len);
-		sg_set_page(sgp, pg[i++], pglen, 0);
-		len -= pglen;
+void zc_pages_deinit(struct zc_pages *zc)
+{
+	unsigned int i;
+
+	for (i = 0; i < zc->bounce_pages; i++)
+		__free_page(zc->bounce[i]);
+	kfree(zc->bounce);
+	zc->bounce = NULL;
+	zc->bounce_pages = 0;
+
+	kfree(zc->pages);
+	kfree(zc->sg);
+	zc->pages = NULL;
+	zc->sg = NULL;
+	zc->array_size = 0;
+}
+
+/* make sure that the bounce buffer has (at least) npages pages */
+int zc_bounce_alloc(struct zc_pages *zc, unsigned int npages)
+{
+	if (unlikely(npages > BOUNCE_PAGES))
+		return -EINVAL;
+
+	if (!zc->bounce) {
+		zc->bounce = kcalloc(BOUNCE_PAGES, sizeof(struct page *),
+				     GFP_KERNEL);
+		if (unlikely(!zc->bounce))
+			return -ENOMEM;
 	}
-	sg_mark_end(sg_last(sg, pgcount));
+
+	while (zc->bounce_pages < npages) {
+		zc->bounce[zc->bounce_pages] = alloc_page(GFP_KERNEL);
+		if (unlikely(!zc->bounce[zc->bounce_pages]))
+			return -ENOMEM;
+		zc->bounce_pages++;
+	}
+
 	return 0;
 }
 
-int adjust_sg_array(struct csession *ses, int pagecount)
+int adjust_sg_array(struct zc_pages *zc, int pagecount)
 {
 	struct scatterlist *sg;
 	struct page **pages;
 	int array_size;
 
-	for (array_size = ses->array_size; array_size < pagecount;
-	     array_size *= 2)
-		;
+	/* double the arrays up to the size they are kept at, and beyond
+	 * that allocate just what the operation needs */
+	array_size = zc->array_size;
+	while (array_size < pagecount && array_size < ZC_CACHED_PAGES)
+		array_size = min(array_size * 2, ZC_CACHED_PAGES);
+	if (array_size < pagecount)
+		array_size = pagecount;
 	ddebug(0, "reallocating from %d to %d pages",
-			ses->array_size, array_size);
-	pages = krealloc(ses->pages, array_size * sizeof(struct page *),
+			zc->array_size, array_size);
+	cryptodev_stat_inc(NULL, CRYPTODEV_STAT_SG_REALLOC);
+	pages = krealloc(zc->pages, array_size * sizeof(struct page *),
 			 GFP_KERNEL);
 	if (unlikely(!pages))
 		return -ENOMEM;
-	ses->pages = pages;
-	sg = krealloc(ses->sg, array_size * sizeof(struct scatterlist),
+	zc->pages = pages;
+	sg = krealloc(zc->sg, array_size * sizeof(struct scatterlist),
 		      GFP_KERNEL);
 	if (unlikely(!sg))
 		return -ENOMEM;
-	ses->sg = sg;
-	ses->array_size = array_size;
+	zc->sg = sg;
+	zc->array_size = array_size;
 
 	return 0;
 }
 
-void release_user_pages(struct csession *ses)
+/* The most struct zc_scratch a file descriptor keeps for its next
+ * operations. As many operations as there are threads on it may be
+ * running at once; more than that many arrays are freed after use. */
+#define MAX_SPARE_SCRATCH 8
+
+/* Lend scratch arrays to an operation. Sessions are held far longer than
+ * any operation on them, so it is the file descriptor that keeps the
+ * arrays, not each of its sessions. */
+struct zc_scratch *zc_get_scratch(struct fcrypt *fcr)
+{
+	struct zc_scratch *scratch = NULL;
+
+	spin_lock(&fcr->scratch_lock);
+	if (!list_empty(&fcr->spare_scratch)) {
+		scratch = list_first_entry(&fcr->spare_scratch,
+					struct zc_scratch, entry);
+		list_del(&scratch->entry);
+		fcr->nr_spare_scratch--;
+	}
+	spin_unlock(&fcr->scratch_lock);
+
+	if (scratch)
+		return scratch;
+
+	scratch = kzalloc(sizeof(*scratch), GFP_KERNEL);
+	if (unlikely(!scratch))
+		return NULL;
+
+	ddebug(2, "preallocating for %d user pages", DEFAULT_PREALLOC_PAGES);
+	if (unlikely(zc_pages_init(&scratch->zc, DEFAULT_PREALLOC_PAGES))) {
+		kfree(scratch);
+		return NULL;
+	}
+	return scratch;
+}
+
+static void zc_free_scratch(struct zc_scratch *scratch)
+{
+	ddebug(2, "freeing space for %d user pages", scratch->zc.array_size);
+	zc_pages_deinit(&scratch->zc);
+	zc_pages_deinit(&scratch->aad_zc);
+	kfree(scratch);
+}
+
+void zc_put_scratch(struct fcrypt *fcr, struct zc_scratch *scratch)
+{
+	spin_lock(&fcr->scratch_lock);
+	if (fcr->nr_spare_scratch < MAX_SPARE_SCRATCH) {
+		list_add(&scratch->entry, &fcr->spare_scratch);
+		fcr->nr_spare_scratch++;
+		scratch = NULL;
+	}
+	spin_unlock(&fcr->scratch_lock);
+
+	if (scratch)
+		zc_free_scratch(scratch);
+}
+
+void zc_free_all_scratch(struct fcrypt *fcr)
+{
+	struct zc_scratch *scratch, *tmp;
+
+	list_for_each_entry_safe(scratch, tmp, &fcr->spare_scratch, entry)
+		zc_free_scratch(scratch);
+	INIT_LIST_HEAD(&fcr->spare_scratch);
+	fcr->nr_spare_scratch = 0;
+}
+
+/* give back what adjust_sg_array() allocated beyond ZC_CACHED_PAGES. If
+ * krealloc() fails an array stays larger, which is harmless. */
+static void zc_pages_shrink(struct zc_pages *zc)
+{
+	struct scatterlist *sg;
+	struct page **pages;
+
+	pages = krealloc(zc->pages, ZC_CACHED_PAGES * sizeof(struct page *),
+			 GFP_KERNEL);
+	if (likely(pages))
+		zc->pages = pages;
+	sg = krealloc(zc->sg, ZC_CACHED_PAGES * sizeof(struct scatterlist),
+		      GFP_KERNEL);
+	if (likely(sg))
+		zc->sg = sg;
+	zc->array_size = ZC_CACHED_PAGES;
+}
+
+void release_user_pages(struct zc_pages *zc)
 {
 	unsigned int i;
 
-	for (i = 0; i < ses->used_pages; i++) {
-		if (!PageReserved(ses->pages[i]))
-			SetPageDirty(ses->pages[i]);
+	if (zc->used_pages)
+		trace_cryptodev_unpin(zc->used_pages);
+
+	for (i = 0; i < zc->used_pages; i++) {
+		if (!PageReserved(zc->pages[i]))
+			SetPageDirty(zc->pages[i]);
 
-		if (ses->readonly_pages == 0)
-			flush_dcache_page(ses->pages[i]);
+		if (zc->readonly_pages == 0)
+			flush_dcache_page(zc->pages[i]);
 		else
-			ses->readonly_pages--;
+			zc->readonly_pages--;
+
+		page_cache_release(zc->pages[i]);
+	}
+	zc->used_pages = 0;
+
+	for (i = 0; i < zc->region_dst_pages; i++)
+		flush_dcache_page(zc->region_dst[i]);
+	zc->region_dst_pages = 0;
+
+	for (i = 0; i < 2; i++) {
+		if (zc->region[i]) {
+			put_user_region(zc->region[i]);
+			zc->region[i] = NULL;
+		}
+	}
+
+	if (unlikely(zc->array_size > ZC_CACHED_PAGES))
+		zc_pages_shrink(zc);
+}
+
+/* Registered regions. Their pages are pinned once by CIOCREGBUF, and
+ * the operations on them only take a reference to the region.
+ */
+
+static void user_region_unpin(struct user_region *reg, unsigned int nr_pages)
+{
+	unsigned int i;
+
+	for (i = 0; i < nr_pages; i++) {
+		if (!PageReserved(reg->pages[i]))
+			SetPageDirty(reg->pages[i]);
+		page_cache_release(reg->pages[i]);
+	}
+}
+
+void put_user_region(struct user_region *reg)
+{
+	if (!atomic_dec_and_test(&reg->refcnt))
+		return;
+
+	trace_cryptodev_unpin(reg->nr_pages);
+	user_region_unpin(reg, reg->nr_pages);
+
+	down_write(&reg->mm->mmap_sem);
+	reg->mm->pinned_vm -= reg->nr_pages;
+	up_write(&reg->mm->mmap_sem);
+	mmdrop(reg->mm);
+
+	kfree_rcu(reg, rcu);
+}
+
+int crypto_register_region(struct fcrypt *fcr, struct crypt_region_op *rop,
+		struct task_struct *task, struct mm_struct *mm)
+{
+	struct user_region *reg;
+	unsigned long limit;
+	unsigned int nr_pages;
+	int ret;
+
+	if (unlikely(!rop->addr || !rop->len ||
+		     rop->len > CRYPTODEV_MAX_REGION_LEN))
+		return -EINVAL;
+
+	nr_pages = PAGECOUNT(rop->addr, rop->len);
+	reg = kzalloc(sizeof(*reg) + nr_pages * sizeof(struct page *),
+		      GFP_KERNEL);
+	if (unlikely(!reg))
+		return -ENOMEM;
+
+	limit = rlimit(RLIMIT_MEMLOCK) >> PAGE_SHIFT;
+
+	/* the pages are charged to the process, like those of RDMA memory
+	 * regions, before they are pinned */
+	down_write(&mm->mmap_sem);
+	if (!capable(CAP_IPC_LOCK) && mm->pinned_vm + nr_pages > limit) {
+		up_write(&mm->mmap_sem);
+		kfree(reg);
+		return -ENOMEM;
+	}
+	mm->pinned_vm += nr_pages;
+
+	ret = get_user_pages(task, mm, (unsigned long)rop->addr, nr_pages,
+			1, 0, reg->pages, NULL);
+	if (ret != nr_pages) {
+		mm->pinned_vm -= nr_pages;
+		up_write(&mm->mmap_sem);
+		derr(1, "failed to pin the pages of a region");
+		user_region_unpin(reg, ret > 0 ? ret : 0);
+		kfree(reg);
+		return -EFAULT;
+	}
+	up_write(&mm->mmap_sem);
+
+	trace_cryptodev_pin((unsigned long)rop->addr, rop->len, nr_pages);
+	reg->addr = (unsigned long)rop->addr;
+	reg->len = rop->len;
+	reg->nr_pages = nr_pages;
+	/* the charge is taken back from mm once the pages are unpinned */
+	reg->mm = mm;
+	atomic_inc(&mm->mm_count);
+	atomic_set(&reg->refcnt, 1);
+
+	idr_preload(GFP_KERNEL);
+	mutex_lock(&fcr->sem);
+	/* the handles fit in CRYPTODEV_REGION_PTR() */
+	ret = idr_alloc(&fcr->regions, reg, 1, CRYPTODEV_MAX_REGIONS + 1,
+			GFP_NOWAIT);
+	if (likely(ret >= 0))
+		fcr->region_pages += nr_pages;
+	mutex_unlock(&fcr->sem);
+	idr_preload_end();
+
+	if (unlikely(ret < 0)) {
+		put_user_region(reg);
+		return ret;
+	}
 
-		page_cache_release(ses->pages[i]);
+	rop->handle = ret;
+	ddebug(2, "registered region %u of %u pages", rop->handle, nr_pages);
+	return 0;
+}
+
+int crypto_unregister_region(struct fcrypt *fcr, uint32_t handle)
+{
+	struct user_region *reg;
+
+	mutex_lock(&fcr->sem);
+	reg = idr_find(&fcr->regions, handle);
+	if (likely(reg)) {
+		idr_remove(&fcr->regions, handle);
+		fcr->region_pages -= reg->nr_pages;
+	}
+	mutex_unlock(&fcr->sem);
+
+	if (unlikely(!reg)) {
+		derr(1, "invalid region handle %u", handle);
+		return -EINVAL;
+	}
+
+	/* operations still on it keep the pages until they are done */
+	put_user_region(reg);
+	return 0;
+}
+
+void crypto_unregister_all_regions(struct fcrypt *fcr)
+{
+	struct user_region *reg;
+	int id;
+
+	mutex_lock(&fcr->sem);
+	idr_for_each_entry(&fcr->regions, reg, id) {
+		idr_remove(&fcr->regions, id);
+		put_user_region(reg);
+	}
+	fcr->region_pages = 0;
+	mutex_unlock(&fcr->sem);
+	idr_destroy(&fcr->regions);
+}
+
+/* whether [start, start + len) of mm lies in reg */
+static inline int user_region_holds(const struct user_region *reg,
+		struct mm_struct *mm, unsigned long start, unsigned int len)
+{
+	return reg->mm == mm && start >= reg->addr && len <= reg->len &&
+		start - reg->addr <= reg->len - len;
+}
+
+/* Take a reference to the region of mm [addr, addr + len) lies in: the
+ * one of handle if not 0, and otherwise the first one that holds it */
+static struct user_region *
+find_user_region(struct fcrypt *fcr, struct mm_struct *mm, uint32_t handle,
+		void __user *addr, unsigned int len)
+{
+	unsigned long start = (unsigned long)addr;
+	struct user_region *reg, *found = NULL;
+	int id;
+
+	rcu_read_lock();
+	if (handle) {
+		reg = idr_find(&fcr->regions, handle);
+		if (reg && user_region_holds(reg, mm, start, len) &&
+		    atomic_inc_not_zero(&reg->refcnt))
+			found = reg;
+	} else {
+		idr_for_each_entry(&fcr->regions, reg, id) {
+			if (user_region_holds(reg, mm, start, len) &&
+			    atomic_inc_not_zero(&reg->refcnt)) {
+				found = reg;
+				break;
+			}
+		}
+	}
+	rcu_read_unlock();
+	return found;
+}
+
+/* Turn *addr, given with COP_FLAG_REGION as CRYPTODEV_REGION_PTR() makes
+ * it, into the address it names, and get the handle of its region in
+ * *handle. NULL is left as it is, with handle 0. */
+int crypto_region_resolve(struct fcrypt *fcr, struct mm_struct *mm,
+		uint8_t __user **addr, uint32_t len, uint32_t *handle)
+{
+	unsigned long ptr = (unsigned long)*addr;
+	unsigned long offset = ptr & ((1UL << CRYPTODEV_REGION_SHIFT) - 1);
+	struct user_region *reg;
+	int ret = -EINVAL;
+
+	*handle = 0;
+	if (!ptr)
+		return 0;
+
+	rcu_read_lock();
+	reg = idr_find(&fcr->regions, ptr >> CRYPTODEV_REGION_SHIFT);
+	if (likely(reg && reg->mm == mm && len <= reg->len &&
+		   offset <= reg->len - len)) {
+		*addr = (uint8_t __user *)(reg->addr + offset);
+		*handle = ptr >> CRYPTODEV_REGION_SHIFT;
+		ret = 0;
 	}
-	ses->used_pages = 0;
+	rcu_read_unlock();
+
+	if (unlikely(ret))
+		ddebug(1, "no region for %u bytes at offset %lu of handle %lu",
+				len, offset, ptr >> CRYPTODEV_REGION_SHIFT);
+	return ret;
+}
+
+/* the pages of reg that addr resides in */
+static inline struct page **
+user_region_pages(struct user_region *reg, void __user *addr)
+{
+	return reg->pages + (((unsigned long)addr >> PAGE_SHIFT) -
+			     (reg->addr >> PAGE_SHIFT));
+}
+
+/* Like get_userbuf(), for src and dst within registered regions.
+ * Returns -ENOENT if they are not, and their pages have to be looked
+ * up instead. */
+static int get_region_userbuf(struct zc_pages *zc, struct fcrypt *fcr,
+                const uint32_t *regions,
+                void *__user src, unsigned int src_len,
+                void *__user dst, unsigned int dst_len,
+                struct mm_struct *mm,
+                struct scatterlist **src_sg,
+                struct scatterlist **dst_sg)
+{
+	unsigned int src_pagecount, dst_pagecount;
+	int rc;
+
+	if (likely(!fcr || ACCESS_ONCE(fcr->region_pages) == 0))
+		return -ENOENT;
+
+	if (!src || !dst || !src_len || !dst_len)
+		return -ENOENT;
+
+	if (src == dst) {
+		/* inplace operation; authenc modes write more than they read */
+		if (src_len < dst_len)
+			src_len = dst_len;
+		dst_len = src_len;
+	}
+
+	zc->region[0] = find_user_region(fcr, mm, regions ? regions[0] : 0,
+					 src, src_len);
+	if (!zc->region[0])
+		return -ENOENT;
+
+	src_pagecount = PAGECOUNT(src, src_len);
+	dst_pagecount = PAGECOUNT(dst, dst_len);
+
+	if (src == dst) {
+		if (src_pagecount > zc->array_size) {
+			rc = adjust_sg_array(zc, src_pagecount);
+			if (rc)
+				goto fail;
+		}
+
+		zc->region_dst = user_region_pages(zc->region[0], src);
+		zc->region_dst_pages = src_pagecount;
+		pages_to_sg_table(src, src_len, src_pagecount,
+				  zc->region_dst, zc->sg);
+		(*src_sg) = (*dst_sg) = zc->sg;
+		return 0;
+	}
+
+	zc->region[1] = find_user_region(fcr, mm, regions ? regions[1] : 0,
+					 dst, dst_len);
+	if (!zc->region[1]) {
+		rc = -ENOENT;
+		goto fail;
+	}
+
+	if (src_pagecount + dst_pagecount > zc->array_size) {
+		rc = adjust_sg_array(zc, src_pagecount + dst_pagecount);
+		if (rc)
+			goto fail;
+	}
+
+	pages_to_sg_table(src, src_len, src_pagecount,
+			  user_region_pages(zc->region[0], src), zc->sg);
+	*src_sg = zc->sg;
+
+	zc->region_dst = user_region_pages(zc->region[1], dst);
+	zc->region_dst_pages = dst_pagecount;
+	*dst_sg = zc->sg + src_pagecount;
+	pages_to_sg_table(dst, dst_len, dst_pagecount, zc->region_dst,
+			  *dst_sg);
+	return 0;
+
+fail:
+	release_user_pages(zc);
+	return rc;
 }
 
 /* make src and dst available in scatterlists.
- * dst might be the same as src.
+ * dst might be the same as src. regions has the handles of the registered
+ * regions they are in, if known, or is NULL.
  */
-int get_userbuf(struct csession *ses,
+int get_userbuf(struct zc_pages *zc, struct fcrypt *fcr,
+                const uint32_t *regions,
                 void *__user src, unsigned int src_len,
                 void *__user dst, unsigned int dst_len,
                 struct task_struct *task, struct mm_struct *mm,
@@ -147,16 +662,21 @@ int get_userbuf(struct csession *ses,
 	if (!dst && dst_len)
 		dst_len = 0;
 
+	rc = get_region_userbuf(zc, fcr, regions, src, src_len, dst, dst_len,
+	                        mm, src_sg, dst_sg);
+	if (rc != -ENOENT)
+		return rc;
+
 	src_pagecount = PAGECOUNT(src, src_len);
 	dst_pagecount = PAGECOUNT(dst, dst_len);
 
-	ses->used_pages = (src == dst) ? max(src_pagecount, dst_pagecount)
+	zc->used_pages = (src == dst) ? max(src_pagecount, dst_pagecount)
 	                               : src_pagecount + dst_pagecount;
 
-	ses->readonly_pages = (src == dst) ? 0 : src_pagecount;
+	zc->readonly_pages = (src == dst) ? 0 : src_pagecount;
 
-	if (ses->used_pages > ses->array_size) {
-		rc = adjust_sg_array(ses, ses->used_pages);
+	if (zc->used_pages > zc->array_size) {
+		rc = adjust_sg_array(zc, zc->used_pages);
 		if (rc)
 			return rc;
 	}
@@ -166,13 +686,13 @@ int get_userbuf(struct csession *ses,
 		 * more data than the ones we read. */
 		if (src_len < dst_len)
 			src_len = dst_len;
-		rc = __get_userbuf(src, src_len, 1, ses->used_pages,
-			               ses->pages, ses->sg, task, mm);
+		rc = __get_userbuf(src, src_len, 1, zc->used_pages,
+			               zc->pages, zc->sg, task, mm);
 		if (unlikely(rc)) {
 			derr(1, "failed to get user pages for data IO");
 			return rc;
 		}
-		(*src_sg) = (*dst_sg) = ses->sg;
+		(*src_sg) = (*dst_sg) = zc->sg;
 		return 0;
 	}
 
@@ -180,29 +700,158 @@ int get_userbuf(struct csession *ses,
 	*dst_sg = NULL; /* default to ignore output */
 
 	if (likely(src)) {
-		rc = __get_userbuf(src, src_len, 0, ses->readonly_pages,
-					   ses->pages, ses->sg, task, mm);
+		rc = __get_userbuf(src, src_len, 0, zc->readonly_pages,
+					   zc->pages, zc->sg, task, mm);
 		if (unlikely(rc)) {
 			derr(1, "failed to get user pages for data input");
 			return rc;
 		}
-		*src_sg = ses->sg;
+		*src_sg = zc->sg;
 	}
 
 	if (likely(dst)) {
 		const unsigned int writable_pages =
-			ses->used_pages - ses->readonly_pages;
-		struct page **dst_pages = ses->pages + ses->readonly_pages;
-		*dst_sg = ses->sg + ses->readonly_pages;
+			zc->used_pages - zc->readonly_pages;
+		struct page **dst_pages = zc->pages + zc->readonly_pages;
+		*dst_sg = zc->sg + zc->readonly_pages;
 
 		rc = __get_userbuf(dst, dst_len, 1, writable_pages,
 					   dst_pages, *dst_sg, task, mm);
 		if (unlikely(rc)) {
 			derr(1, "failed to get user pages for data output");
-			release_user_pages(ses);  /* FIXME: use __release_userbuf(src, ...) */
+			release_user_pages(zc);  /* FIXME: use __release_userbuf(src, ...) */
 			return rc;
 		}
 	}
 	return 0;
 }
 
+
+/* The number of pages the first len bytes of the segments iov reside in,
+ * or -EINVAL if the segments are shorter. */
+static int iov_pagecount(const struct crypt_iovec *iov, unsigned int count,
+		uint32_t len)
+{
+	unsigned int i, pagecount = 0;
+	uint32_t seg_len;
+
+	for (i = 0; i < count && len; i++) {
+		seg_len = min(iov[i].len, len);
+		pagecount += PAGECOUNT(iov[i].base, seg_len);
+		len -= seg_len;
+	}
+
+	return len ? -EINVAL : pagecount;
+}
+
+/* fetch the pages of the first len bytes of the segments iov, following
+ * those already in zc, and initialise sg with them */
+static int __get_userbuf_iov(struct zc_pages *zc,
+		const struct crypt_iovec *iov, unsigned int count,
+		uint32_t len, int write, unsigned int pgcount,
+		struct scatterlist *sg,
+		struct task_struct *task, struct mm_struct *mm)
+{
+	struct scatterlist *sgp = sg;
+	unsigned int i, n;
+	uint32_t seg_len;
+	int ret;
+
+	if (unlikely(!pgcount))
+		return 0;
+
+	sg_init_table(sg, pgcount);
+
+	for (i = 0; i < count && len; i++) {
+		seg_len = min(iov[i].len, len);
+		n = PAGECOUNT(iov[i].base, seg_len);
+		if (!n)
+			continue;
+
+		down_read(&mm->mmap_sem);
+		ret = get_user_pages(task, mm, (unsigned long)iov[i].base, n,
+				write, 0, zc->pages + zc->used_pages, NULL);
+		up_read(&mm->mmap_sem);
+		if (ret > 0) {
+			zc->used_pages += ret;
+			if (!write)
+				zc->readonly_pages += ret;
+		}
+		if (ret != n)
+			return -EINVAL;
+
+		trace_cryptodev_pin((unsigned long)iov[i].base, seg_len, n);
+		sgp += pages_to_sg(iov[i].base, seg_len,
+				   zc->pages + zc->used_pages - n, sgp);
+		len -= seg_len;
+	}
+
+	if (sgp != sg)
+		sg_mark_end(sgp - 1);
+	return 0;
+}
+
+/* The get_userbuf() of operations given in segments: make the first
+ * src_len bytes of iov->src and the first dst_len bytes of iov->dst
+ * available in scatterlists. iov->dst might be the same as iov->src.
+ */
+int get_userbuf_iov(struct zc_pages *zc, const struct kernel_crypt_iov *iov,
+                    unsigned int src_len, unsigned int dst_len,
+                    struct task_struct *task, struct mm_struct *mm,
+                    struct scatterlist **src_sg,
+                    struct scatterlist **dst_sg)
+{
+	int src_pagecount, dst_pagecount = 0;
+	int rc;
+
+	if (iov->src == iov->dst && src_len < dst_len)
+		src_len = dst_len;
+
+	src_pagecount = iov_pagecount(iov->src, iov->src_count, src_len);
+	if (iov->src != iov->dst)
+		dst_pagecount = iov_pagecount(iov->dst, iov->dst_count, dst_len);
+	if (unlikely(src_pagecount < 0 || dst_pagecount < 0)) {
+		derr(1, "the segments are shorter than the data");
+		return -EINVAL;
+	}
+
+	if (src_pagecount + dst_pagecount > zc->array_size) {
+		rc = adjust_sg_array(zc, src_pagecount + dst_pagecount);
+		if (rc)
+			return rc;
+	}
+
+	zc->used_pages = zc->readonly_pages = 0;
+
+	if (iov->src == iov->dst) {	/* inplace operation */
+		rc = __get_userbuf_iov(zc, iov->src, iov->src_count, src_len, 1,
+				src_pagecount, zc->sg, task, mm);
+		if (unlikely(rc)) {
+			derr(1, "failed to get user pages for data IO");
+			goto fail;
+		}
+		(*src_sg) = (*dst_sg) = src_pagecount ? zc->sg : NULL;
+		return 0;
+	}
+
+	rc = __get_userbuf_iov(zc, iov->src, iov->src_count, src_len, 0,
+			src_pagecount, zc->sg, task, mm);
+	if (unlikely(rc)) {
+		derr(1, "failed to get user pages for data input");
+		goto fail;
+	}
+	*src_sg = src_pagecount ? zc->sg : NULL;
+
+	*dst_sg = dst_pagecount ? zc->sg + src_pagecount : NULL;
+	rc = __get_userbuf_iov(zc, iov->dst, iov->dst_count, dst_len, 1,
+			dst_pagecount, zc->sg + src_pagecount, task, mm);
+	if (unlikely(rc)) {
+		derr(1, "failed to get user pages for data output");
+		goto fail;
+	}
+	return 0;
+
+fail:
+	release_user_pages(zc);
+	return rc;
+}
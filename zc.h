@@ -7,15 +7,34 @@
 int __get_userbuf(uint8_t __user *addr, uint32_t len, int write,
 		unsigned int pgcount, struct page **pg, struct scatterlist *sg,
 		struct task_struct *task, struct mm_struct *mm);
-void release_user_pages(struct csession *ses);
+void release_user_pages(struct zc_pages *zc);
 
-int get_userbuf(struct csession *ses,
+int zc_pages_init(struct zc_pages *zc, unsigned int array_size);
+void zc_pages_deinit(struct zc_pages *zc);
+
+int get_userbuf(struct zc_pages *zc, struct fcrypt *fcr,
+                const uint32_t *regions,
                 void *__user src, unsigned int src_len,
                 void *__user dst, unsigned int dst_len,
                 struct task_struct *task, struct mm_struct *mm,
                 struct scatterlist **src_sg,
                 struct scatterlist **dst_sg);
 
+int get_userbuf_iov(struct zc_pages *zc, const struct kernel_crypt_iov *iov,
+                    unsigned int src_len, unsigned int dst_len,
+                    struct task_struct *task, struct mm_struct *mm,
+                    struct scatterlist **src_sg,
+                    struct scatterlist **dst_sg);
+
+/* registered regions, see CIOCREGBUF */
+int crypto_register_region(struct fcrypt *fcr, struct crypt_region_op *rop,
+		struct task_struct *task, struct mm_struct *mm);
+int crypto_unregister_region(struct fcrypt *fcr, uint32_t handle);
+void crypto_unregister_all_regions(struct fcrypt *fcr);
+int crypto_region_resolve(struct fcrypt *fcr, struct mm_struct *mm,
+		uint8_t __user **addr, uint32_t len, uint32_t *handle);
+void put_user_region(struct user_region *reg);
+
 /* buflen ? (last page - first page + 1) : 0 */
 #define PAGECOUNT(buf, buflen) ((buflen) \
 	? ((((unsigned long)(buf + buflen - 1)) >> PAGE_SHIFT) - \
@@ -24,4 +43,21 @@ int get_userbuf(struct csession *ses,
 
 #define DEFAULT_PREALLOC_PAGES 32
 
+/* operations over more than this many pages are pinned a window at a time */
+#define STREAM_WINDOW_PAGES 128
+
+/* the most pages the arrays of a struct zc_pages are kept for; beyond that
+ * they are grown for a single operation and shrunk on release */
+#define ZC_CACHED_PAGES (2 * (STREAM_WINDOW_PAGES + 1))
+
+/* the most the bounce buffer of a struct zc_pages grows to */
+#define BOUNCE_PAGES 16
+
+int zc_bounce_alloc(struct zc_pages *zc, unsigned int npages);
+
+/* the arrays lent to the operations of a file descriptor */
+struct zc_scratch *zc_get_scratch(struct fcrypt *fcr);
+void zc_put_scratch(struct fcrypt *fcr, struct zc_scratch *scratch);
+void zc_free_all_scratch(struct fcrypt *fcr);
+
 #endif